@@ -0,0 +1,375 @@
+#!/usr/bin/env ruby
+#
+# Builds indexes over deterministic synthetic corpora with several yatof
+# token filter chains and records wall time, peak RSS, lexicon key count
+# and index file sizes as JSON.
+#
+#   % test/run-benchmark.sh --output result.json
+#   % test/run-benchmark.sh --corpus html --configuration remove_word
+
+require "fileutils"
+require "json"
+require "optparse"
+require "tmpdir"
+
+class Corpus
+  attr_reader :name
+
+  def initialize(name, seed)
+    @name = name
+    @random = Random.new(seed)
+  end
+
+  def each_record(n_records)
+    n_records.times do |i|
+      yield(generate(i))
+    end
+  end
+
+  private
+  def pick(words, n)
+    Array.new(n) { words[@random.rand(words.size)] }
+  end
+end
+
+class JapaneseCorpus < Corpus
+  WORDS = %w(
+    東京 大阪 検索 全文 索引 転置 語彙 文書 情報 処理 日本語 形態素
+    解析 システム データベース サーバー インデックス トークン フィルター
+    グルンガ 高速 構築 更新 削除 追加 設定 性能 評価 結果 比較
+    です ます した する される こと もの ため による について として
+  )
+  PUNCTUATIONS = %w(、 。 「 」)
+
+  private
+  def generate(i)
+    sentences = Array.new(3 + @random.rand(8)) do
+      pick(WORDS, 5 + @random.rand(15)).join + PUNCTUATIONS[@random.rand(2)]
+    end
+    "#{sentences.join}第#{i}版"
+  end
+end
+
+class EnglishCorpus < Corpus
+  WORDS = %w(
+    the of and to in is that for it as was with be by on not he this are or
+    his from at which but have an they you were her she there been one all
+    search index token filter lexicon posting document query groonga server
+    performance memory latency throughput benchmark configuration release
+  )
+
+  private
+  def generate(i)
+    sentences = Array.new(3 + @random.rand(8)) do
+      words = pick(WORDS, 5 + @random.rand(15))
+      words[0] = words[0].capitalize
+      "#{words.join(" ")}."
+    end
+    "#{sentences.join(" ")} Revision #{i}."
+  end
+end
+
+class HTMLCorpus < EnglishCorpus
+  TAGS = %w(p div span a li td)
+
+  private
+  def generate(i)
+    body = super(i).split(". ").collect do |sentence|
+      tag = TAGS[@random.rand(TAGS.size)]
+      "<#{tag} class=\"c#{@random.rand(10)}\">#{sentence}</#{tag}>"
+    end
+    script = "<script>var x#{i} = document.getElementById('n');</script>"
+    "<html><head>#{script}</head><body>#{body.join}</body></html>"
+  end
+end
+
+class LogCorpus < Corpus
+  LEVELS = %w(INFO INFO INFO WARN ERROR DEBUG)
+  MESSAGES = [
+    "request completed",
+    "connection accepted from",
+    "cache miss for key",
+    "retrying upload of",
+    "slow query detected on",
+  ]
+
+  private
+  def generate(i)
+    lines = Array.new(10 + @random.rand(30)) do |j|
+      time = Time.at(1_400_000_000 + i * 60 + j).utc.strftime("%Y-%m-%dT%H:%M:%S")
+      id = "%016x" % @random.rand(2 ** 64)
+      "#{time} #{LEVELS[@random.rand(LEVELS.size)]} " +
+        "#{MESSAGES[@random.rand(MESSAGES.size)]} #{id}"
+    end
+    lines.join("\n")
+  end
+end
+
+CORPORA = {
+  "japanese" => JapaneseCorpus,
+  "english" => EnglishCorpus,
+  "html" => HTMLCorpus,
+  "log" => LogCorpus,
+}
+
+CONFIGURATIONS = {
+  "none" => {
+    :token_filters => [],
+  },
+  "symbol_digit" => {
+    :token_filters => ["TokenFilterSymbol", "TokenFilterDigit"],
+  },
+  "length" => {
+    :token_filters => ["TokenFilterMaxLength", "TokenFilterUnmaturedOne"],
+  },
+  "limit" => {
+    :token_filters => ["TokenFilterTFLimit", "TokenFilterPhraseLimit"],
+  },
+  "remove_word" => {
+    :token_filters => ["TokenFilterRemoveWord"],
+    :words => {
+      "remove_words" => ["<remove_html>", "the", "of", "and", "です", "ます"],
+    },
+  },
+  "word_chain" => {
+    :token_filters => [
+      "TokenFilterSymbol",
+      "TokenFilterDigit",
+      "TokenFilterRemoveWord",
+      "TokenFilterHighEntropy",
+    ],
+    :words => {
+      "remove_words" => ["the", "of", "and", "です", "ます"],
+    },
+  },
+  "word_chain_cached" => {
+    :token_filters => [
+      "TokenFilterSymbol",
+      "TokenFilterDigit",
+      "TokenFilterRemoveWord",
+      "TokenFilterHighEntropy",
+    ],
+    :words => {
+      "remove_words" => ["the", "of", "and", "です", "ます"],
+    },
+    :config => {
+      "tokenfilter-yatof.verdict-cache-size" => 65536,
+    },
+  },
+}
+
+class YatofBenchmark
+  def initialize(options)
+    @options = options
+  end
+
+  def run
+    results = []
+    @options[:corpora].each do |corpus_name|
+      @options[:configurations].each do |configuration_name|
+        results << run_one(corpus_name, configuration_name)
+      end
+    end
+    {
+      "groonga_version" => groonga_version,
+      "n_records" => @options[:n_records],
+      "seed" => @options[:seed],
+      "results" => results,
+    }
+  end
+
+  private
+  def run_one(corpus_name, configuration_name)
+    configuration = CONFIGURATIONS[configuration_name]
+    Dir.mktmpdir("yatof-benchmark") do |dir|
+      database = File.join(dir, "db")
+
+      load_commands = File.join(dir, "load.grn")
+      corpus_size = write_load_commands(load_commands, corpus_name,
+                                        configuration)
+      load_time, = run_groonga(["-n", database], load_commands)
+      files_before_index = file_sizes(dir)
+
+      index_commands = File.join(dir, "index.grn")
+      write_index_commands(index_commands, configuration)
+      index_time, peak_rss_kb = run_groonga([database], index_commands)
+
+      index_files = {}
+      file_sizes(dir).each do |path, size|
+        next if files_before_index[path] == size
+        index_files[File.basename(path)] = size
+      end
+
+      result = {
+        "corpus" => corpus_name,
+        "configuration" => configuration_name,
+        "token_filters" => configuration[:token_filters],
+        "config" => configuration[:config] || {},
+        "corpus_size" => corpus_size,
+        "load_time" => load_time,
+        "index_time" => index_time,
+        "peak_rss_kb" => peak_rss_kb,
+        "n_lexicon_keys" => count_lexicon_keys(database),
+        "index_size" => index_files.values.inject(0, :+),
+        "index_files" => index_files,
+      }
+      $stderr.puts("#{corpus_name}/#{configuration_name}: " +
+                   "#{result["index_time"].round(3)}s " +
+                   "#{result["n_lexicon_keys"]} keys " +
+                   "#{result["index_size"]} bytes")
+      result
+    end
+  end
+
+  def write_load_commands(path, corpus_name, configuration)
+    corpus = CORPORA[corpus_name].new(corpus_name, @options[:seed])
+    corpus_size = 0
+    File.open(path, "w") do |output|
+      output.puts("register token_filters/yatof")
+      (configuration[:words] || {}).each do |table, words|
+        output.puts("table_create #{table} TABLE_HASH_KEY ShortText")
+        output.puts("load --table #{table}")
+        output.puts(JSON.generate(words.collect { |word| {"_key" => word} }))
+      end
+      output.puts("table_create Docs TABLE_NO_KEY")
+      output.puts("column_create Docs body COLUMN_SCALAR LongText")
+      output.puts("load --table Docs")
+      output.puts("[")
+      separator = ""
+      corpus.each_record(@options[:n_records]) do |body|
+        corpus_size += body.bytesize
+        output.print(separator)
+        output.print(JSON.generate({"body" => body}))
+        separator = ",\n"
+      end
+      output.puts
+      output.puts("]")
+    end
+    corpus_size
+  end
+
+  def write_index_commands(path, configuration)
+    File.open(path, "w") do |output|
+      (configuration[:config] || {}).each do |key, value|
+        output.puts("config_set #{key} #{value}")
+      end
+      command = "table_create Terms TABLE_PAT_KEY ShortText"
+      command << " --default_tokenizer #{@options[:tokenizer]}"
+      command << " --normalizer NormalizerAuto"
+      unless configuration[:token_filters].empty?
+        command << " --token_filters #{configuration[:token_filters].join(",")}"
+      end
+      output.puts(command)
+      output.puts("column_create Terms docs_body COLUMN_INDEX|WITH_POSITION " +
+                  "Docs body")
+    end
+  end
+
+  def run_groonga(arguments, input)
+    time_command = "/usr/bin/time"
+    use_time = File.executable?(time_command)
+    command = [@options[:groonga], *arguments]
+    output_path = "#{input}.out"
+    rss_path = "#{input}.rss"
+    command = [time_command, "-f", "%M", "-o", rss_path, *command] if use_time
+
+    start = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+    pid = spawn(*command, :in => input, :out => output_path)
+    peak_rss_kb = 0
+    unless use_time
+      status_path = "/proc/#{pid}/status"
+      watcher = Thread.new do
+        loop do
+          break unless File.exist?(status_path)
+          status = File.read(status_path) rescue break
+          if /^VmHWM:\s+(\d+)/ =~ status
+            peak_rss_kb = [peak_rss_kb, $1.to_i].max
+          end
+          sleep(0.01)
+        end
+      end
+    end
+    Process.wait(pid)
+    elapsed = Process.clock_gettime(Process::CLOCK_MONOTONIC) - start
+    watcher.join if watcher
+    unless $?.success?
+      raise "groonga failed: #{command.join(" ")}"
+    end
+    check_errors(output_path)
+    peak_rss_kb = File.read(rss_path).lines.last.to_i if use_time
+    [elapsed, peak_rss_kb]
+  end
+
+  def check_errors(output_path)
+    File.foreach(output_path) do |line|
+      next unless /\A\[\[(-\d+),/ =~ line
+      raise "groonga returned an error: #{line.strip}"
+    end
+  end
+
+  def count_lexicon_keys(database)
+    output = IO.popen([@options[:groonga], database,
+                       "select", "Terms", "--limit", "0",
+                       "--output_columns", "_id"], &:read)
+    JSON.parse(output)[1][0][0][0]
+  end
+
+  def file_sizes(dir)
+    sizes = {}
+    Dir.glob(File.join(dir, "db*")).each do |path|
+      sizes[path] = File.size(path)
+    end
+    sizes
+  end
+
+  def groonga_version
+    IO.popen([@options[:groonga], "--version"], &:read).lines.first.to_s.strip
+  end
+end
+
+options = {
+  :groonga => ENV["GROONGA"] || "groonga",
+  :output => nil,
+  :n_records => 1000,
+  :seed => 29,
+  :tokenizer => "TokenBigram",
+  :corpora => CORPORA.keys,
+  :configurations => CONFIGURATIONS.keys,
+}
+parser = OptionParser.new
+parser.on("--groonga=PATH", "groonga command") do |path|
+  options[:groonga] = path
+end
+parser.on("--output=PATH", "write JSON to PATH instead of stdout") do |path|
+  options[:output] = path
+end
+parser.on("--n-records=N", Integer,
+          "records per corpus (#{options[:n_records]})") do |n|
+  options[:n_records] = n
+end
+parser.on("--seed=N", Integer, "random seed (#{options[:seed]})") do |seed|
+  options[:seed] = seed
+end
+parser.on("--tokenizer=NAME", "tokenizer (#{options[:tokenizer]})") do |name|
+  options[:tokenizer] = name
+end
+parser.on("--corpus=NAME", CORPORA.keys,
+          "run only NAME (#{CORPORA.keys.join(", ")})") do |name|
+  (options[:selected_corpora] ||= []) << name
+end
+parser.on("--configuration=NAME", CONFIGURATIONS.keys,
+          "run only NAME (#{CONFIGURATIONS.keys.join(", ")})") do |name|
+  (options[:selected_configurations] ||= []) << name
+end
+parser.parse!(ARGV)
+options[:corpora] = options[:selected_corpora] if options[:selected_corpora]
+if options[:selected_configurations]
+  options[:configurations] = options[:selected_configurations]
+end
+
+report = JSON.pretty_generate(YatofBenchmark.new(options).run)
+if options[:output]
+  File.write(options[:output], report + "\n")
+else
+  puts(report)
+end
@@ -0,0 +1,53 @@
+#!/bin/bash
+
+export BASE_DIR="`dirname $0`"
+if test -z "$BUILD_DIR"; then
+    BUILD_DIR="$BASE_DIR"
+fi
+export BUILD_DIR
+
+top_dir="$BUILD_DIR/.."
+top_dir=$(cd -P "$top_dir" 2>/dev/null || cd "$top_dir"; pwd)
+
+n_processors=1
+case `uname` in
+    Linux)
+	n_processors="$(grep '^processor' /proc/cpuinfo | wc -l)"
+	;;
+    Darwin)
+	n_processors="$(/usr/sbin/sysctl -n hw.ncpu)"
+	;;
+    *)
+	:
+	;;
+esac
+
+if test x"$NO_MAKE" != x"yes"; then
+    MAKE_ARGS=
+    if test $n_processors -gt 1; then
+	MAKE_ARGS="${MAKE_ARGS} -j${n_processors}"
+    fi
+    make -C $top_dir ${MAKE_ARGS} > /dev/null || exit 1
+fi
+
+if test -z "$GROONGA"; then
+    GROONGA="`make -s -C $top_dir echo-groonga`"
+fi
+export GROONGA
+
+GRN_PLUGINS_DIR="$top_dir"
+export GRN_PLUGINS_DIR
+
+case `uname` in
+    Darwin)
+	DYLD_LIBRARY_PATH="$top_dir/lib/.libs:$DYLD_LIBRARY_PATH"
+	export DYLD_LIBRARY_PATH
+	;;
+    *)
+	:
+	;;
+esac
+
+ruby "${BASE_DIR}/benchmark/run-benchmark.rb" \
+    --groonga "$GROONGA" \
+    "$@"
@@ -19,1410 +19,8852 @@
 #include <groonga/nfkc.h>
 
 #include <string.h>
+#include <strings.h>
 #include <stdlib.h>
+#include <stddef.h>
 
 #include <stdio.h>
 #include <ctype.h>
 #include <math.h>
 #include <locale.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #ifdef __GNUC__
 #  define GNUC_UNUSED __attribute__((__unused__))
+#  define YATOF_THREAD_LOCAL __thread
 #else
 #  define GNUC_UNUSED
+#  define YATOF_THREAD_LOCAL __declspec(thread)
+#endif
+
+/* USDT probes enabled by configure --enable-dtrace, e.g.
+   usdt:.../token_filters/yatof.so:yatof:filter_done for bpftrace. A
+   probe is a nop until it is attached and its arguments are computed
+   only while its semaphore is set. Without the switch they are empty. */
+#ifdef YATOF_ENABLE_DTRACE
+#  define _SDT_HAS_SEMAPHORES 1
+#  include <sys/sdt.h>
+#  define YATOF_PROBE_SEMAPHORE(name)                                   \
+  __extension__ unsigned short yatof_ ## name ## _semaphore             \
+  __attribute__((unused)) __attribute__((section(".probes")))
+YATOF_PROBE_SEMAPHORE(filter_init);
+YATOF_PROBE_SEMAPHORE(filter_fin);
+YATOF_PROBE_SEMAPHORE(filter_start);
+YATOF_PROBE_SEMAPHORE(filter_done);
+YATOF_PROBE_SEMAPHORE(tf_limit_reached);
+YATOF_PROBE_SEMAPHORE(phrase_limit_reached);
+YATOF_PROBE_SEMAPHORE(dictionary_reload);
+#  define YATOF_PROBE_ENABLED(name) (yatof_ ## name ## _semaphore != 0)
+#  define YATOF_PROBE1(name, a1) DTRACE_PROBE1(yatof, name, a1)
+#  define YATOF_PROBE2(name, a1, a2) DTRACE_PROBE2(yatof, name, a1, a2)
+#  define YATOF_PROBE3(name, a1, a2, a3) DTRACE_PROBE3(yatof, name, a1, a2, a3)
+#else
+#  define YATOF_PROBE_ENABLED(name) 0
+/* Arguments are still evaluated as void so that variables only read by
+   probes are not reported as unused. */
+#  define YATOF_PROBE1(name, a1) ((void)(a1))
+#  define YATOF_PROBE2(name, a1, a2) ((void)(a1), (void)(a2))
+#  define YATOF_PROBE3(name, a1, a2, a3) ((void)(a1), (void)(a2), (void)(a3))
 #endif
 
 typedef struct {
-  grn_obj *table;
-  grn_token_mode mode;
-  grn_tokenizer_token token;
-} grn_yatof_token_filter;
+  const char *name;
+  unsigned int name_size;
+  const char *alternative_name;
+  unsigned int alternative_name_size;
+} grn_yatof_table_override;
 
-static void *
-yatof_init(grn_ctx *ctx, grn_obj *table, grn_token_mode mode)
+/* Set by yatof_reindex while it deletes postings with the rules of the
+   recorded generation. Only affects the current thread. */
+static YATOF_THREAD_LOCAL grn_yatof_table_override *yatof_table_override = NULL;
+
+/* Digest of the options, tables and dictionaries read by the filter being
+   initialized. The verdict cache keys verdicts on it. */
+static YATOF_THREAD_LOCAL uint64_t yatof_option_digest;
+
+static void
+yatof_option_digest_add(const void *data, uint32_t size)
 {
-  grn_yatof_token_filter *token_filter;
+  const unsigned char *bytes = data;
+  uint32_t i;
 
-  token_filter = GRN_PLUGIN_MALLOC(ctx, sizeof(grn_yatof_token_filter));
-  if (!token_filter) {
-    GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
-                     "[token-filter][yatof] "
-                     "failed to allocate grn_yatof_token_filter");
-    return NULL;
+  for (i = 0; i < size; i++) {
+    yatof_option_digest ^= bytes[i];
+    yatof_option_digest *= 1099511628211ULL;
   }
-  token_filter->table = table;
-  token_filter->mode = mode;
-  grn_tokenizer_token_init(ctx, &(token_filter->token));
-
-  return token_filter;
+  yatof_option_digest ^= size;
+  yatof_option_digest *= 1099511628211ULL;
 }
 
+/* Set when the filter being initialized reads a table or a column
+   modified in the current second. Its last-modified time may not change
+   on the next modification in the same second, so the verdict cache
+   doesn't cache the filter. */
+static YATOF_THREAD_LOCAL grn_bool yatof_option_volatile;
+
+/* Folds the last-modified time of a table or column that a filter reads
+   on every token, and the number of records of a table, into the
+   digest. */
 static void
-yatof_fin(grn_ctx *ctx, void *user_data)
+yatof_option_digest_add_object(grn_ctx *ctx, grn_obj *object)
 {
-  grn_yatof_token_filter *token_filter = user_data;
-  if (!token_filter) {
+  uint32_t last_modified;
+  unsigned int n_records;
+
+  if (!object) {
     return;
   }
-  grn_tokenizer_token_fin(ctx, &(token_filter->token));
-  GRN_PLUGIN_FREE(ctx, token_filter);
+  last_modified = grn_obj_get_last_modified(ctx, object);
+  if (last_modified >= (uint32_t)time(NULL)) {
+    yatof_option_volatile = GRN_TRUE;
+  }
+  yatof_option_digest_add(&last_modified, sizeof(last_modified));
+  if (grn_obj_is_table(ctx, object)) {
+    n_records = grn_table_size(ctx, object);
+    yatof_option_digest_add(&n_records, sizeof(n_records));
+  }
 }
 
-typedef struct {
-  grn_obj *table;
-  grn_token_mode mode;
-  grn_tokenizer_token token;
-  int max_length_in_bytes;
-} grn_max_length_token_filter;
-
-static void *
-max_length_init(grn_ctx *ctx, grn_obj *table, grn_token_mode mode)
+static grn_obj *
+yatof_table_open(grn_ctx *ctx, const char *name, int name_size)
 {
-#define DEFAULT_MAX_LENGTH 64
-  grn_max_length_token_filter *token_filter;
-  const char *max_length_env;
+  grn_yatof_table_override *override = yatof_table_override;
+  grn_obj *table;
 
-  token_filter = GRN_PLUGIN_MALLOC(ctx, sizeof(grn_max_length_token_filter));
-  if (!token_filter) {
-    GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
-                     "[token-filter][max-length] "
-                     "failed to allocate grn_max_length_token_filter");
-    return NULL;
+  if (name_size < 0) {
+    name_size = strlen(name);
   }
-  max_length_env = getenv("GRN_YATOF_MAX_TOKEN_LENGTH");
-  if (max_length_env) {
-    token_filter->max_length_in_bytes = atoi(max_length_env);
+  if (override &&
+      override->name_size == (unsigned int)name_size &&
+      !memcmp(override->name, name, name_size)) {
+    table = grn_ctx_get(ctx,
+                        override->alternative_name,
+                        override->alternative_name_size);
   } else {
-    token_filter->max_length_in_bytes = DEFAULT_MAX_LENGTH;
+    table = grn_ctx_get(ctx, name, name_size);
   }
-  token_filter->table = table;
-  token_filter->mode = mode;
-  grn_tokenizer_token_init(ctx, &(token_filter->token));
-
-  return token_filter;
-#undef DEFAULT_MAX_LENGTH
+  yatof_option_digest_add_object(ctx, table);
+  return table;
 }
 
-static void
-max_length_filter(grn_ctx *ctx,
-                  grn_token *current_token,
-                  grn_token *next_token,
-                  void *user_data)
+
+/* Reads an option from the database config first and then from the
+   environment, e.g. tokenfilter-yatof.memory-limit or
+   GRN_YATOF_MEMORY_LIMIT. */
+static const char *
+yatof_option_get(grn_ctx *ctx, const char *config_key, const char *env_name,
+                 uint32_t *value_size)
 {
-  grn_obj *data;
-  grn_max_length_token_filter *token_filter = user_data;
-  grn_tokenizer_status status;
-  data = grn_token_get_data(ctx, current_token);
+  const char *value = NULL;
+  uint32_t size = 0;
 
-  if (GRN_TEXT_LEN(data) > token_filter->max_length_in_bytes) {
-    status = grn_token_get_status(ctx, current_token);
-    status |= GRN_TOKEN_SKIP_WITH_POSITION;
-    grn_token_set_status(ctx, next_token, status);
+  if (config_key && grn_ctx_db(ctx)) {
+    grn_config_get(ctx, config_key, -1, &value, &size);
+  }
+  if (!value && env_name) {
+    value = getenv(env_name);
+    if (value) {
+      size = strlen(value);
+    }
+  }
+  if (config_key) {
+    yatof_option_digest_add(config_key, strlen(config_key));
   }
+  yatof_option_digest_add(value, size);
+  if (value_size) {
+    *value_size = size;
+  }
+  return value;
 }
 
-static void
-max_length_fin(grn_ctx *ctx, void *user_data)
+static uint64_t
+yatof_option_get_uint64(grn_ctx *ctx, const char *config_key,
+                        const char *env_name, uint64_t default_value)
 {
-  grn_max_length_token_filter *token_filter = user_data;
-  if (!token_filter) {
-    return;
+  const char *value;
+  uint32_t value_size;
+
+  value = yatof_option_get(ctx, config_key, env_name, &value_size);
+  if (!value || value_size == 0) {
+    return default_value;
   }
-  grn_tokenizer_token_fin(ctx, &(token_filter->token));
-  GRN_PLUGIN_FREE(ctx, token_filter);
+  return grn_atoll(value, value + value_size, NULL);
 }
 
-typedef struct {
-  grn_obj *table;
-  grn_token_mode mode;
-  grn_tokenizer_token token;
-  int min_length_in_bytes;
-} grn_min_length_token_filter;
+/* Looks up prefix.LEXICON.name first so that thresholds can differ per
+   lexicon, then falls back to prefix.name and env_name. */
+static const char *
+yatof_lexicon_option_get(grn_ctx *ctx, grn_obj *lexicon,
+                         const char *prefix, const char *name,
+                         const char *env_name, uint32_t *value_size)
+{
+  char key[GRN_TABLE_MAX_KEY_SIZE];
+  const char *value;
+
+  if (lexicon) {
+    char lexicon_name[GRN_TABLE_MAX_KEY_SIZE];
+    int lexicon_name_size;
+    lexicon_name_size = grn_obj_name(ctx, lexicon,
+                                     lexicon_name, GRN_TABLE_MAX_KEY_SIZE);
+    if (lexicon_name_size > 0) {
+      snprintf(key, GRN_TABLE_MAX_KEY_SIZE, "%s.%.*s.%s",
+               prefix, lexicon_name_size, lexicon_name, name);
+      value = yatof_option_get(ctx, key, NULL, value_size);
+      if (value) {
+        return value;
+      }
+    }
+  }
+  snprintf(key, GRN_TABLE_MAX_KEY_SIZE, "%s.%s", prefix, name);
+  return yatof_option_get(ctx, key, env_name, value_size);
+}
 
-static void *
-min_length_init(grn_ctx *ctx, grn_obj *table, grn_token_mode mode)
+static uint64_t
+yatof_lexicon_option_get_uint64(grn_ctx *ctx, grn_obj *lexicon,
+                                const char *prefix, const char *name,
+                                const char *env_name, uint64_t default_value)
 {
-#define DEFAULT_MIN_LENGTH 3
-  grn_min_length_token_filter *token_filter;
-  const char *min_length_env;
+  const char *value;
+  uint32_t value_size;
 
-  token_filter = GRN_PLUGIN_MALLOC(ctx, sizeof(grn_min_length_token_filter));
-  if (!token_filter) {
-    GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
-                     "[token-filter][min-length] "
-                     "failed to allocate grn_min_length_token_filter");
-    return NULL;
-  }
-  min_length_env = getenv("GRN_YATOF_MIN_TOKEN_LENGTH");
-  if (min_length_env) {
-    token_filter->min_length_in_bytes = atoi(min_length_env);
-  } else {
-    token_filter->min_length_in_bytes = DEFAULT_MIN_LENGTH;
+  value = yatof_lexicon_option_get(ctx, lexicon, prefix, name, env_name,
+                                   &value_size);
+  if (!value || value_size == 0) {
+    return default_value;
   }
-  token_filter->table = table;
-  token_filter->mode = mode;
-  grn_tokenizer_token_init(ctx, &(token_filter->token));
+  return grn_atoll(value, value + value_size, NULL);
+}
 
-  return token_filter;
-#undef DEFAULT_MIN_LENGTH
+static double
+yatof_lexicon_option_get_double(grn_ctx *ctx, grn_obj *lexicon,
+                                const char *prefix, const char *name,
+                                const char *env_name, double default_value)
+{
+  const char *value;
+  uint32_t value_size;
+  char buffer[64];
+
+  value = yatof_lexicon_option_get(ctx, lexicon, prefix, name, env_name,
+                                   &value_size);
+  if (!value || value_size == 0 || value_size >= sizeof(buffer)) {
+    return default_value;
+  }
+  memcpy(buffer, value, value_size);
+  buffer[value_size] = '\0';
+  return strtod(buffer, NULL);
 }
 
-static void
-min_length_filter(grn_ctx *ctx,
-                  grn_token *current_token,
-                  grn_token *next_token,
-                  void *user_data)
+/* Reads tokenfilter-NAME.modes such as "add", "get" or "add,get". DEL
+   follows ADD so that postings added by a filter are deleted with the
+   same tokens. Filters are enabled in every mode by default. */
+static grn_bool
+yatof_mode_is_enabled(grn_ctx *ctx, grn_obj *lexicon, const char *name,
+                      grn_token_mode mode)
 {
-  grn_obj *data;
-  grn_min_length_token_filter *token_filter = user_data;
-  grn_tokenizer_status status;
-  data = grn_token_get_data(ctx, current_token);
+  char prefix[GRN_TABLE_MAX_KEY_SIZE];
+  char env_name[GRN_TABLE_MAX_KEY_SIZE];
+  const char *modes;
+  const char *modes_end;
+  uint32_t modes_size;
+  const char *mode_name;
+  int i;
+
+  snprintf(prefix, GRN_TABLE_MAX_KEY_SIZE, "tokenfilter-%s", name);
+  snprintf(env_name, GRN_TABLE_MAX_KEY_SIZE, "GRN_YATOF_%s_MODES", name);
+  for (i = 0; env_name[i]; i++) {
+    env_name[i] = env_name[i] == '-' ? '_' : toupper((unsigned char)env_name[i]);
+  }
+  modes = yatof_lexicon_option_get(ctx, lexicon, prefix, "modes", env_name,
+                                   &modes_size);
+  if (!modes || modes_size == 0) {
+    return GRN_TRUE;
+  }
 
-  if (GRN_TEXT_LEN(data) < token_filter->min_length_in_bytes) {
-    status = grn_token_get_status(ctx, current_token);
-    status |= GRN_TOKEN_SKIP_WITH_POSITION;
-    grn_token_set_status(ctx, next_token, status);
+  mode_name = mode == GRN_TOKEN_GET ? "get" : "add";
+  modes_end = modes + modes_size;
+  while (modes < modes_end) {
+    const char *next = modes;
+    while (next < modes_end && *next != ',' && *next != '|') {
+      next++;
+    }
+    if ((size_t)(next - modes) == strlen(mode_name) &&
+        memcmp(modes, mode_name, next - modes) == 0) {
+      return GRN_TRUE;
+    }
+    if (next - modes == 3 && memcmp(modes, "all", 3) == 0) {
+      return GRN_TRUE;
+    }
+    modes = next + 1;
   }
+  return GRN_FALSE;
 }
 
+typedef enum {
+  YATOF_MEMORY_TF_LIMIT,
+  YATOF_MEMORY_PHRASE_LIMIT,
+  YATOF_MEMORY_REMOVE_WORD,
+  YATOF_MEMORY_SYNONYM,
+  YATOF_MEMORY_REPEATED_SHINGLE,
+  YATOF_MEMORY_UNIQUE,
+  YATOF_MEMORY_N_FILTERS
+} grn_yatof_memory_filter;
+
+static const char *yatof_memory_filter_names[YATOF_MEMORY_N_FILTERS] = {
+  "TokenFilterTFLimit",
+  "TokenFilterPhraseLimit",
+  "TokenFilterRemoveWord",
+  "TokenFilterSynonym",
+  "TokenFilterRepeatedShingle",
+  "TokenFilterUnique"
+};
+
+#define YATOF_MEMORY_ENTRY_SIZE 32
+#define YATOF_MEMORY_REPORT_UNIT 65536
+
+typedef struct {
+  grn_yatof_memory_filter filter;
+  uint64_t bytes;
+  uint64_t peak_bytes;
+  uint64_t reported_bytes;
+  uint64_t limit;
+  grn_bool capped;
+} grn_yatof_memory;
+
+typedef struct {
+  uint64_t peak_bytes;
+  uint64_t n_capped;
+} grn_yatof_memory_filter_stat;
+
+/* Memory in use by all filter instances of the process. Contexts are
+   not tracked one by one: a grn_ctx pointer can't be told from a later
+   context allocated at the same address. */
+typedef struct {
+  uint64_t bytes;
+  uint64_t peak_bytes;
+} grn_yatof_memory_total_stat;
+
+static grn_plugin_mutex *yatof_memory_mutex = NULL;
+static grn_yatof_memory_filter_stat yatof_memory_filter_stats[YATOF_MEMORY_N_FILTERS];
+static grn_yatof_memory_total_stat yatof_memory_total_stat;
+
 static void
-min_length_fin(grn_ctx *ctx, void *user_data)
+yatof_memory_report(grn_ctx *ctx, grn_yatof_memory *memory, uint64_t bytes)
 {
-  grn_min_length_token_filter *token_filter = user_data;
-  if (!token_filter) {
+  grn_yatof_memory_total_stat *stat = &yatof_memory_total_stat;
+
+  if (!yatof_memory_mutex) {
     return;
   }
-  grn_tokenizer_token_fin(ctx, &(token_filter->token));
-  GRN_PLUGIN_FREE(ctx, token_filter);
+  grn_plugin_mutex_lock(ctx, yatof_memory_mutex);
+  stat->bytes -= memory->reported_bytes;
+  stat->bytes += bytes;
+  if (stat->bytes > stat->peak_bytes) {
+    stat->peak_bytes = stat->bytes;
+  }
+  grn_plugin_mutex_unlock(ctx, yatof_memory_mutex);
+  memory->reported_bytes = bytes;
 }
 
 static void
-prolong_filter(grn_ctx *ctx,
-               grn_token *current_token,
-               grn_token *next_token,
-               GNUC_UNUSED void *user_data)
+yatof_memory_init(grn_ctx *ctx, grn_yatof_memory *memory,
+                  grn_yatof_memory_filter filter)
 {
-#define CUT_PROLONG_LENGTH 4
-
-  grn_obj *data;
-  int token_size = 0;
-  grn_bool is_katakana = GRN_TRUE;
-
-  data = grn_token_get_data(ctx, current_token);
-
-  {
-    int char_length;
-    int rest_length = GRN_TEXT_LEN(data);
-    const char *rest = GRN_TEXT_VALUE(data);
+  memory->filter = filter;
+  memory->bytes = 0;
+  memory->peak_bytes = 0;
+  memory->reported_bytes = 0;
+  memory->capped = GRN_FALSE;
+  memory->limit = yatof_option_get_uint64(ctx,
+                                          "tokenfilter-yatof.memory-limit",
+                                          "GRN_YATOF_MEMORY_LIMIT",
+                                          0);
+}
 
-    while (rest_length > 0) {
-      grn_char_type type;
-      grn_encoding encoding = GRN_CTX_GET_ENCODING(ctx);
-      char_length = grn_plugin_charlen(ctx, rest, rest_length, encoding);
-      if (char_length == 0) {
-        break;
-      }
-      type = grn_nfkc_char_type((unsigned char *)rest);
-      if (type != GRN_CHAR_KATAKANA) {
-        is_katakana = GRN_FALSE;
-        break;
-      }
-      token_size++;
-      rest += char_length;
-      rest_length -= char_length;
+/* Returns GRN_FALSE without accounting when the instance would go over
+   its limit. The caller must fall back to a mode that doesn't grow. */
+static grn_bool
+yatof_memory_reserve(grn_ctx *ctx, grn_yatof_memory *memory, uint64_t bytes)
+{
+  if (memory->limit > 0 && memory->bytes + bytes > memory->limit) {
+    if (!memory->capped) {
+      memory->capped = GRN_TRUE;
+      GRN_PLUGIN_LOG(ctx, GRN_LOG_NOTICE,
+                     "[token-filter][memory] "
+                     "%s reached memory limit %" PRIu64 " bytes: "
+                     "falling back to a cheaper mode",
+                     yatof_memory_filter_names[memory->filter],
+                     memory->limit);
     }
+    return GRN_FALSE;
   }
-  if (is_katakana && token_size >= CUT_PROLONG_LENGTH) {
-    const char *last = GRN_TEXT_VALUE(data);
-    last += GRN_TEXT_LEN(data) - 3;
-    if (!memcmp("ー", last, 3)) {
-      grn_token_set_data(ctx, next_token,
-                         GRN_TEXT_VALUE(data),
-                         GRN_TEXT_LEN(data) - 3);
-    }
+  memory->bytes += bytes;
+  if (memory->bytes > memory->peak_bytes) {
+    memory->peak_bytes = memory->bytes;
   }
-#undef CUT_PROLONG_LENGTH
+  if (memory->bytes >= memory->reported_bytes + YATOF_MEMORY_REPORT_UNIT) {
+    yatof_memory_report(ctx, memory, memory->bytes);
+  }
+  return GRN_TRUE;
 }
 
-static void
-symbol_filter(grn_ctx *ctx,
-              grn_token *current_token,
-              grn_token *next_token,
-              GNUC_UNUSED void *user_data)
+/* For buffers that are rewritten in place: accounts their current
+   capacity instead of accumulating. */
+static grn_bool
+yatof_memory_resize(grn_ctx *ctx, grn_yatof_memory *memory,
+                    uint64_t old_bytes, uint64_t new_bytes)
 {
-  grn_obj *data;
-  grn_tokenizer_status status;
-  int token_size = 0;
-  grn_bool is_symbol = GRN_TRUE;
-
-  data = grn_token_get_data(ctx, current_token);
+  if (new_bytes <= old_bytes) {
+    return GRN_TRUE;
+  }
+  return yatof_memory_reserve(ctx, memory, new_bytes - old_bytes);
+}
 
-  {
-    int char_length;
-    int rest_length = GRN_TEXT_LEN(data);
-    const char *rest = GRN_TEXT_VALUE(data);
+/* added is optional and is set to 1 only when the key is new. */
+static grn_id
+yatof_memory_table_add(grn_ctx *ctx, grn_yatof_memory *memory,
+                       grn_obj *table, const char *key, unsigned int key_size,
+                       int *added)
+{
+  grn_id id;
 
-    while (rest_length > 0) {
-      grn_char_type type;
-      grn_encoding encoding = GRN_CTX_GET_ENCODING(ctx);
-      char_length = grn_plugin_charlen(ctx, rest, rest_length, encoding);
-      if (char_length == 0) {
-        break;
-      }
-      type = grn_nfkc_char_type((unsigned char *)rest);
-      if (type != GRN_CHAR_SYMBOL && type != GRN_CHAR_OTHERS) {
-        is_symbol = GRN_FALSE;
-        break;
-      }
-      token_size++;
-      rest += char_length;
-      rest_length -= char_length;
+  if (memory->limit == 0) {
+    int table_added = 0;
+    id = grn_table_add(ctx, table, key, key_size, &table_added);
+    if (table_added) {
+      yatof_memory_reserve(ctx, memory, key_size + YATOF_MEMORY_ENTRY_SIZE);
+    }
+    if (added) {
+      *added = table_added;
     }
+    return id;
   }
-  if (is_symbol) {
-    status = grn_token_get_status(ctx, current_token);
-    status |= GRN_TOKEN_SKIP_WITH_POSITION;
-    grn_token_set_status(ctx, next_token, status);
+
+  id = grn_table_get(ctx, table, key, key_size);
+  if (id == GRN_ID_NIL &&
+      yatof_memory_reserve(ctx, memory, key_size + YATOF_MEMORY_ENTRY_SIZE)) {
+    id = grn_table_add(ctx, table, key, key_size, added);
   }
+  return id;
 }
 
 static void
-digit_filter(grn_ctx *ctx,
-             grn_token *current_token,
-             grn_token *next_token,
-             GNUC_UNUSED void *user_data)
+yatof_memory_fin(grn_ctx *ctx, grn_yatof_memory *memory)
 {
-  grn_obj *data;
-  grn_tokenizer_status status;
-  int token_size = 0;
-  grn_bool is_digit = GRN_TRUE;
+  grn_yatof_memory_filter_stat *stat;
 
-  data = grn_token_get_data(ctx, current_token);
+  if (memory->bytes != memory->reported_bytes) {
+    yatof_memory_report(ctx, memory, memory->bytes);
+  }
+  if (memory->reported_bytes > 0) {
+    yatof_memory_report(ctx, memory, 0);
+  }
+  if (!yatof_memory_mutex) {
+    return;
+  }
+  grn_plugin_mutex_lock(ctx, yatof_memory_mutex);
+  stat = &(yatof_memory_filter_stats[memory->filter]);
+  if (memory->peak_bytes > stat->peak_bytes) {
+    stat->peak_bytes = memory->peak_bytes;
+  }
+  if (memory->capped) {
+    stat->n_capped++;
+  }
+  grn_plugin_mutex_unlock(ctx, yatof_memory_mutex);
+}
 
-  {
-    int char_length;
-    int rest_length = GRN_TEXT_LEN(data);
-    const char *rest = GRN_TEXT_VALUE(data);
+#define YATOF_DICTIONARY_MAGIC "YATOFDIC"
+#define YATOF_DICTIONARY_VERSION 1
+#define YATOF_DICTIONARY_ALIGNMENT 8
 
-    while (rest_length > 0) {
-      grn_char_type type;
-      grn_encoding encoding = GRN_CTX_GET_ENCODING(ctx);
-      char_length = grn_plugin_charlen(ctx, rest, rest_length, encoding);
-      if (char_length == 0) {
-        break;
-      }
-      type = grn_nfkc_char_type((unsigned char *)rest);
-      if (type != GRN_CHAR_DIGIT) {
-        is_digit = GRN_FALSE;
-        break;
-      }
-      token_size++;
-      rest += char_length;
-      rest_length -= char_length;
-    }
-  }
-  if (is_digit) {
-    status = grn_token_get_status(ctx, current_token);
-    status |= GRN_TOKEN_SKIP_WITH_POSITION;
-    grn_token_set_status(ctx, next_token, status);
+/* Layout of a file written by yatof_dictionary_compile:
+
+     header | buckets (uint32_t x n_buckets) | entries | key/value pool
+
+   buckets is an open addressing hash table with linear probing. 0 is
+   an empty bucket and others are entry index + 1. The checksum covers
+   everything after the header. Integers are in host byte order. */
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t n_keys;
+  uint32_t n_buckets;
+  uint32_t reserved;
+  uint64_t buckets_offset;
+  uint64_t entries_offset;
+  uint64_t pool_offset;
+  uint64_t pool_size;
+  uint64_t checksum;
+} grn_yatof_dictionary_header;
+
+typedef struct {
+  uint32_t key_offset;
+  uint32_t key_size;
+  uint32_t value_offset;
+  uint32_t value_size;
+} grn_yatof_dictionary_entry;
+
+typedef struct _grn_yatof_dictionary grn_yatof_dictionary;
+struct _grn_yatof_dictionary {
+  char *path;
+  dev_t device;
+  ino_t inode;
+  time_t mtime;
+  off_t size;
+  void *address;
+  const grn_yatof_dictionary_header *header;
+  const uint32_t *buckets;
+  const grn_yatof_dictionary_entry *entries;
+  const char *pool;
+  unsigned int n_references;
+  grn_bool is_stale;
+  grn_yatof_dictionary *next;
+};
+
+/* Mapped dictionaries are shared by all contexts in the process and are
+   kept mapped while they are current, so that opening a dictionary for
+   each document costs only a stat(). */
+static grn_plugin_mutex *yatof_dictionary_mutex = NULL;
+static grn_yatof_dictionary *yatof_dictionaries = NULL;
+
+static uint32_t
+yatof_dictionary_hash(const char *key, unsigned int key_size)
+{
+  uint32_t hash = 2166136261U;
+  unsigned int i;
+
+  for (i = 0; i < key_size; i++) {
+    hash ^= (unsigned char)key[i];
+    hash *= 16777619U;
   }
+  return hash;
 }
 
-static void
-unmatured_one_filter(grn_ctx *ctx,
-             grn_token *current_token,
-             grn_token *next_token,
-             GNUC_UNUSED void *user_data)
+static uint64_t
+yatof_dictionary_checksum(const char *data, uint64_t size)
 {
-  grn_obj *data;
-  grn_tokenizer_status status;
-  int token_size = 0;
+  uint64_t hash = 14695981039346656037ULL;
+  uint64_t i;
 
-  data = grn_token_get_data(ctx, current_token);
+  for (i = 0; i < size; i++) {
+    hash ^= (unsigned char)data[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
 
-  {
-    int char_length;
-    int rest_length = GRN_TEXT_LEN(data);
-    const char *rest = GRN_TEXT_VALUE(data);
+static grn_bool
+yatof_dictionary_validate(grn_ctx *ctx, grn_yatof_dictionary *dictionary)
+{
+  const grn_yatof_dictionary_header *header;
+  const char *address = dictionary->address;
+  uint64_t size = dictionary->size;
+  uint32_t i;
+
+  if (size < sizeof(grn_yatof_dictionary_header)) {
+    GRN_PLUGIN_ERROR(ctx, GRN_FILE_CORRUPT,
+                     "[yatof][dictionary] too small: <%s>",
+                     dictionary->path);
+    return GRN_FALSE;
+  }
+  header = dictionary->address;
+  if (memcmp(header->magic, YATOF_DICTIONARY_MAGIC,
+             sizeof(header->magic)) != 0) {
+    GRN_PLUGIN_ERROR(ctx, GRN_FILE_CORRUPT,
+                     "[yatof][dictionary] not a dictionary: <%s>",
+                     dictionary->path);
+    return GRN_FALSE;
+  }
+  if (header->version != YATOF_DICTIONARY_VERSION) {
+    GRN_PLUGIN_ERROR(ctx, GRN_FILE_CORRUPT,
+                     "[yatof][dictionary] unsupported version %u: <%s>",
+                     header->version, dictionary->path);
+    return GRN_FALSE;
+  }
+  /* Buckets and entries are read in place, so their sections must keep
+     the alignment that yatof_dictionary_compile writes them with. */
+  if (header->buckets_offset < sizeof(grn_yatof_dictionary_header) ||
+      header->entries_offset < sizeof(grn_yatof_dictionary_header) ||
+      header->pool_offset < sizeof(grn_yatof_dictionary_header) ||
+      header->buckets_offset % YATOF_DICTIONARY_ALIGNMENT != 0 ||
+      header->entries_offset % YATOF_DICTIONARY_ALIGNMENT != 0 ||
+      header->pool_offset % YATOF_DICTIONARY_ALIGNMENT != 0) {
+    GRN_PLUGIN_ERROR(ctx, GRN_FILE_CORRUPT,
+                     "[yatof][dictionary] misaligned section: <%s>",
+                     dictionary->path);
+    return GRN_FALSE;
+  }
+  if (header->n_buckets == 0 ||
+      (header->n_buckets & (header->n_buckets - 1)) != 0 ||
+      header->n_keys >= header->n_buckets ||
+      header->buckets_offset > size ||
+      (uint64_t)header->n_buckets * sizeof(uint32_t) >
+        size - header->buckets_offset ||
+      header->entries_offset > size ||
+      (uint64_t)header->n_keys * sizeof(grn_yatof_dictionary_entry) >
+        size - header->entries_offset ||
+      header->pool_offset > size ||
+      header->pool_size > size - header->pool_offset) {
+    GRN_PLUGIN_ERROR(ctx, GRN_FILE_CORRUPT,
+                     "[yatof][dictionary] broken header: <%s>",
+                     dictionary->path);
+    return GRN_FALSE;
+  }
+  if (yatof_dictionary_checksum(address + sizeof(grn_yatof_dictionary_header),
+                                size - sizeof(grn_yatof_dictionary_header)) !=
+      header->checksum) {
+    GRN_PLUGIN_ERROR(ctx, GRN_FILE_CORRUPT,
+                     "[yatof][dictionary] checksum mismatch: <%s>",
+                     dictionary->path);
+    return GRN_FALSE;
+  }
 
-    while (rest_length > 0) {
-      grn_encoding encoding = GRN_CTX_GET_ENCODING(ctx);
-      char_length = grn_plugin_charlen(ctx, rest, rest_length, encoding);
-      if (char_length == 0) {
-        break;
-      }
-      token_size++;
-      rest += char_length;
-      rest_length -= char_length;
+  dictionary->header = header;
+  dictionary->buckets = (const uint32_t *)(address + header->buckets_offset);
+  dictionary->entries =
+    (const grn_yatof_dictionary_entry *)(address + header->entries_offset);
+  dictionary->pool = address + header->pool_offset;
+  for (i = 0; i < header->n_buckets; i++) {
+    if (dictionary->buckets[i] > header->n_keys) {
+      GRN_PLUGIN_ERROR(ctx, GRN_FILE_CORRUPT,
+                       "[yatof][dictionary] broken bucket: <%s>",
+                       dictionary->path);
+      return GRN_FALSE;
     }
   }
-  if (token_size == 1) {
-    status = grn_token_get_status(ctx, current_token);
-    if (status & GRN_TOKEN_UNMATURED) {
-      status |= GRN_TOKEN_SKIP_WITH_POSITION;
-      grn_token_set_status(ctx, next_token, status);
+  for (i = 0; i < header->n_keys; i++) {
+    const grn_yatof_dictionary_entry *entry = &(dictionary->entries[i]);
+    if (entry->key_size > header->pool_size ||
+        entry->key_offset > header->pool_size - entry->key_size ||
+        entry->value_size > header->pool_size ||
+        entry->value_offset > header->pool_size - entry->value_size) {
+      GRN_PLUGIN_ERROR(ctx, GRN_FILE_CORRUPT,
+                       "[yatof][dictionary] broken entry: <%s>",
+                       dictionary->path);
+      return GRN_FALSE;
     }
   }
+  return GRN_TRUE;
 }
 
-#define ATGC_LIMIT 9
-
 static void
-atgc_filter(grn_ctx *ctx,
-             grn_token *current_token,
-             grn_token *next_token,
-             GNUC_UNUSED void *user_data)
+yatof_dictionary_unmap(grn_yatof_dictionary *dictionary)
 {
-  grn_obj *data;
-  grn_tokenizer_status status;
-  int token_size = 0;
-  int n_atgc = 0;
-
-  data = grn_token_get_data(ctx, current_token);
-
-  {
-    int char_length;
-    int rest_length = GRN_TEXT_LEN(data);
-    const char *rest = GRN_TEXT_VALUE(data);
+  grn_yatof_dictionary **previous;
 
-    while (rest_length > 0) {
-      grn_encoding encoding = GRN_CTX_GET_ENCODING(ctx);
-      char_length = grn_plugin_charlen(ctx, rest, rest_length, encoding);
-      if (char_length == 0) {
-        break;
-      }
-      if (rest[0] == 'A' || rest[0] == 'T' || rest[0] == 'G' || rest[0] == 'C' || rest[0] == 'U' ||
-          rest[0] == 'a' || rest[0] == 't' || rest[0] == 'g' || rest[0] == 'c' || rest[0] == 'u') {
-        n_atgc++;
-      } else {
-        n_atgc = 0;
-      }
-      token_size++;
-      rest += char_length;
-      rest_length -= char_length;
+  for (previous = &yatof_dictionaries; *previous;
+       previous = &((*previous)->next)) {
+    if (*previous == dictionary) {
+      *previous = dictionary->next;
+      break;
     }
   }
-  if (n_atgc >= ATGC_LIMIT) {
-    status = grn_token_get_status(ctx, current_token);
-    status |= GRN_TOKEN_SKIP_WITH_POSITION;
-    grn_token_set_status(ctx, next_token, status);
-  }
+  munmap(dictionary->address, dictionary->size);
+  free(dictionary->path);
+  free(dictionary);
 }
 
-#define TF_LIMIT_WORD_TABLE_NAME "tf_limits"
-#define TF_LIMIT_COLUMN_NAME "tf_limit"
+static grn_yatof_dictionary *
+yatof_dictionary_open(grn_ctx *ctx, const char *path)
+{
+  grn_yatof_dictionary *dictionary, *next;
+  struct stat status;
+  int fd;
+  grn_bool replaced = GRN_FALSE;
 
-typedef struct {
-  grn_tokenizer_token token;
-  grn_obj *table;
-  grn_obj value;
-  unsigned int tf_limit;
-  grn_obj *word_table;
-  grn_obj *column;
-  grn_obj word_tf_limit;
-} grn_tf_limit_token_filter;
+  if (!yatof_dictionary_mutex) {
+    return NULL;
+  }
+  grn_plugin_mutex_lock(ctx, yatof_dictionary_mutex);
 
-static void *
-tf_limit_init(grn_ctx *ctx, GNUC_UNUSED grn_obj *table, GNUC_UNUSED grn_token_mode mode)
-{
-#define DEFAULT_TF_LIMIT 131071
-  grn_tf_limit_token_filter *token_filter;
-  const char *tf_limit_env;
-  const char *tf_limit_word_table_name_env;
+  if (stat(path, &status) != 0) {
+    GRN_PLUGIN_ERROR(ctx, GRN_NO_SUCH_FILE_OR_DIRECTORY,
+                     "[yatof][dictionary] couldn't stat: <%s>: %s",
+                     path, strerror(errno));
+    grn_plugin_mutex_unlock(ctx, yatof_dictionary_mutex);
+    return NULL;
+  }
 
-  token_filter = GRN_PLUGIN_MALLOC(ctx, sizeof(grn_tf_limit_token_filter));
-  if (!token_filter) {
+  /* A dictionary is replaced by renaming a new file over the old one.
+     Old mappings are released when the last user closes them. */
+  for (dictionary = yatof_dictionaries; dictionary; dictionary = next) {
+    next = dictionary->next;
+    if (dictionary->is_stale || strcmp(dictionary->path, path) != 0) {
+      continue;
+    }
+    if (dictionary->device == status.st_dev &&
+        dictionary->inode == status.st_ino &&
+        dictionary->mtime == status.st_mtime &&
+        dictionary->size == status.st_size) {
+      dictionary->n_references++;
+      grn_plugin_mutex_unlock(ctx, yatof_dictionary_mutex);
+      return dictionary;
+    }
+    dictionary->is_stale = GRN_TRUE;
+    replaced = GRN_TRUE;
+    if (dictionary->n_references == 0) {
+      yatof_dictionary_unmap(dictionary);
+    }
+  }
+
+  dictionary = calloc(1, sizeof(grn_yatof_dictionary));
+  if (dictionary) {
+    dictionary->path = strdup(path);
+  }
+  if (!dictionary || !dictionary->path) {
     GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
-                     "[token-filter][tf-limit] "
-                     "failed to allocate grn_tf_limit_token_filter");
+                     "[yatof][dictionary] "
+                     "failed to allocate grn_yatof_dictionary");
+    free(dictionary);
+    grn_plugin_mutex_unlock(ctx, yatof_dictionary_mutex);
     return NULL;
   }
-  token_filter->table = grn_table_create(ctx, NULL, 0, NULL,
-                                         GRN_OBJ_TABLE_HASH_KEY,
-                                         grn_ctx_at(ctx, GRN_DB_SHORT_TEXT),
-                                         grn_ctx_at(ctx, GRN_DB_UINT32));
-  if (!token_filter->table) {
-    GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
-                     "[token-filter][tf-limit] "
-                     "couldn't create a table");
-    GRN_PLUGIN_FREE(ctx, token_filter);
+  dictionary->device = status.st_dev;
+  dictionary->inode = status.st_ino;
+  dictionary->mtime = status.st_mtime;
+  dictionary->size = status.st_size;
+
+  fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    GRN_PLUGIN_ERROR(ctx, GRN_NO_SUCH_FILE_OR_DIRECTORY,
+                     "[yatof][dictionary] couldn't open: <%s>: %s",
+                     path, strerror(errno));
+    free(dictionary->path);
+    free(dictionary);
+    grn_plugin_mutex_unlock(ctx, yatof_dictionary_mutex);
     return NULL;
   }
-  tf_limit_env = getenv("GRN_YATOF_TF_LIMIT");
-  if (tf_limit_env) {
-    token_filter->tf_limit = atoi(tf_limit_env);
-  } else {
-    token_filter->tf_limit = DEFAULT_TF_LIMIT;
+  dictionary->address = MAP_FAILED;
+  if (dictionary->size > 0) {
+    dictionary->address = mmap(NULL, dictionary->size, PROT_READ, MAP_SHARED,
+                               fd, 0);
   }
-  token_filter->word_table = NULL;
-  token_filter->column = NULL;
-
-  tf_limit_word_table_name_env = getenv("GRN_YATOF_TF_LIMIT_WORD_TABLE_NAME");
-  if (tf_limit_word_table_name_env) {
-    token_filter->word_table = grn_ctx_get(ctx,
-                                           tf_limit_word_table_name_env,
-                                           strlen(tf_limit_word_table_name_env));
-  } else {
-    token_filter->word_table = grn_ctx_get(ctx,
-                                           TF_LIMIT_WORD_TABLE_NAME,
-                                           strlen(TF_LIMIT_WORD_TABLE_NAME));
+  close(fd);
+  if (dictionary->address == MAP_FAILED) {
+    GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
+                     "[yatof][dictionary] couldn't map: <%s>",
+                     path);
+    free(dictionary->path);
+    free(dictionary);
+    grn_plugin_mutex_unlock(ctx, yatof_dictionary_mutex);
+    return NULL;
   }
-
-  if (token_filter->word_table) {
-     token_filter->column = grn_obj_column(ctx,
-                                           token_filter->word_table,
-                                           TF_LIMIT_COLUMN_NAME,
-                                           strlen(TF_LIMIT_COLUMN_NAME));
+  if (!yatof_dictionary_validate(ctx, dictionary)) {
+    munmap(dictionary->address, dictionary->size);
+    free(dictionary->path);
+    free(dictionary);
+    grn_plugin_mutex_unlock(ctx, yatof_dictionary_mutex);
+    return NULL;
   }
 
-  GRN_UINT32_INIT(&(token_filter->value), 0);
-  GRN_UINT32_INIT(&(token_filter->word_tf_limit), 0);
-  grn_tokenizer_token_init(ctx, &(token_filter->token));
-
-  return token_filter;
-#undef DEFAULT_TF_LIMIT
+  GRN_PLUGIN_LOG(ctx, GRN_LOG_INFO,
+                 "[yatof][dictionary] mapped <%s>: %u keys",
+                 path, dictionary->header->n_keys);
+  YATOF_PROBE3(dictionary_reload, path, dictionary->header->n_keys, replaced);
+  dictionary->n_references = 1;
+  dictionary->next = yatof_dictionaries;
+  yatof_dictionaries = dictionary;
+  grn_plugin_mutex_unlock(ctx, yatof_dictionary_mutex);
+  return dictionary;
 }
 
 static void
-tf_limit_filter(grn_ctx *ctx,
-                grn_token *current_token,
-                grn_token *next_token,
-                void *user_data)
+yatof_dictionary_close(grn_ctx *ctx, grn_yatof_dictionary *dictionary)
 {
-  grn_tf_limit_token_filter *token_filter = user_data;
-  grn_obj *data;
-  grn_tokenizer_status status;
-  data = grn_token_get_data(ctx, current_token);
-  unsigned int tf_limit = token_filter->tf_limit;
+  if (!dictionary || !yatof_dictionary_mutex) {
+    return;
+  }
+  grn_plugin_mutex_lock(ctx, yatof_dictionary_mutex);
+  dictionary->n_references--;
+  if (dictionary->n_references == 0 && dictionary->is_stale) {
+    yatof_dictionary_unmap(dictionary);
+  }
+  grn_plugin_mutex_unlock(ctx, yatof_dictionary_mutex);
+}
 
-  {
-    grn_id id;
-    id = grn_table_add(ctx, token_filter->table,
-                       GRN_TEXT_VALUE(data), GRN_TEXT_LEN(data), NULL);
-    if (id) {
-      GRN_BULK_REWIND(&(token_filter->value));
-      grn_obj_get_value(ctx, token_filter->table, id, &(token_filter->value));
-      GRN_UINT32_SET(ctx, &(token_filter->value), GRN_UINT32_VALUE(&(token_filter->value)) + 1);
-      grn_obj_set_value(ctx, token_filter->table, id, &(token_filter->value), GRN_OBJ_SET);
+static const grn_yatof_dictionary_entry *
+yatof_dictionary_lookup(grn_yatof_dictionary *dictionary,
+                        const char *key, unsigned int key_size)
+{
+  uint32_t mask = dictionary->header->n_buckets - 1;
+  uint32_t i = yatof_dictionary_hash(key, key_size) & mask;
+
+  while (dictionary->buckets[i] != 0) {
+    const grn_yatof_dictionary_entry *entry;
+    entry = &(dictionary->entries[dictionary->buckets[i] - 1]);
+    if (entry->key_size == key_size &&
+        memcmp(dictionary->pool + entry->key_offset, key, key_size) == 0) {
+      return entry;
     }
+    i = (i + 1) & mask;
   }
+  return NULL;
+}
 
-  if (token_filter->word_table) {
-    grn_id id;
-    id = grn_table_get(ctx, token_filter->word_table,
-                       GRN_TEXT_VALUE(data), GRN_TEXT_LEN(data));
-    if (id != GRN_ID_NIL) {
-      GRN_BULK_REWIND(&(token_filter->word_tf_limit));
-      grn_obj_get_value(ctx, token_filter->column, id, &(token_filter->word_tf_limit));
-      tf_limit = GRN_UINT32_VALUE(&(token_filter->word_tf_limit));
+/* Resolves a dictionary name in GRN_YATOF_DICTIONARY_DIR or, by
+   default, in the directory of the database. Names come from clients
+   through yatof_dictionary_compile and config_set, so absolute paths and
+   ".." are rejected and the directory is only taken from the
+   environment of the server. */
+static grn_bool
+yatof_dictionary_path(grn_ctx *ctx, const char *tag,
+                      const char *name, unsigned int name_size,
+                      char *path)
+{
+  const char *directory;
+  int directory_size;
+  unsigned int i, start;
+
+  if (name_size == 0 || name[0] == '/' || memchr(name, '\0', name_size)) {
+    GRN_PLUGIN_ERROR(ctx, GRN_INVALID_ARGUMENT,
+                     "%s invalid path: <%.*s>", tag, (int)name_size, name);
+    return GRN_FALSE;
+  }
+  for (start = 0, i = 0; i <= name_size; i++) {
+    if (i < name_size && name[i] != '/' && name[i] != '\\') {
+      continue;
     }
+    if (i - start == 2 && name[start] == '.' && name[start + 1] == '.') {
+      GRN_PLUGIN_ERROR(ctx, GRN_INVALID_ARGUMENT,
+                       "%s path must not contain \"..\": <%.*s>",
+                       tag, (int)name_size, name);
+      return GRN_FALSE;
+    }
+    start = i + 1;
   }
 
-  if (GRN_UINT32_VALUE(&(token_filter->value)) > tf_limit) {
-    status = grn_token_get_status(ctx, current_token);
-    status |= GRN_TOKEN_SKIP_WITH_POSITION;
-    grn_token_set_status(ctx, next_token, status);
+  directory = getenv("GRN_YATOF_DICTIONARY_DIR");
+  if (directory && directory[0]) {
+    directory_size = strlen(directory);
+  } else {
+    const char *db_path = NULL;
+    const char *slash;
+    if (grn_ctx_db(ctx)) {
+      db_path = grn_obj_path(ctx, grn_ctx_db(ctx));
+    }
+    if (!db_path) {
+      GRN_PLUGIN_ERROR(ctx, GRN_INVALID_ARGUMENT,
+                       "%s no dictionary directory: "
+                       "set GRN_YATOF_DICTIONARY_DIR or use a persistent "
+                       "database: <%.*s>",
+                       tag, (int)name_size, name);
+      return GRN_FALSE;
+    }
+    directory = db_path;
+    slash = strrchr(db_path, '/');
+    directory_size = slash ? slash - db_path : 0;
+    if (directory_size == 0) {
+      directory = slash ? "/" : ".";
+      directory_size = 1;
+    }
+  }
+  if (snprintf(path, PATH_MAX, "%.*s/%.*s",
+               directory_size, directory, (int)name_size, name) >= PATH_MAX) {
+    GRN_PLUGIN_ERROR(ctx, GRN_INVALID_ARGUMENT,
+                     "%s too long path: <%.*s>", tag, (int)name_size, name);
+    return GRN_FALSE;
+  }
+  return GRN_TRUE;
+}
 
-    GRN_PLUGIN_LOG(ctx, GRN_LOG_INFO,
-                   "[token-filter][tf-limit] "
-                   "<%.*s> is reached on tf limit %u",
-                   (int)GRN_TEXT_LEN(data), GRN_TEXT_VALUE(data),
-                   tf_limit);
+/* Opens the dictionary file set by "PREFIX.dictionary" or ENV_NAME. It
+   returns NULL without error when no dictionary is configured. */
+static grn_yatof_dictionary *
+yatof_dictionary_open_option(grn_ctx *ctx, grn_obj *lexicon,
+                             const char *prefix, const char *env_name)
+{
+  grn_yatof_dictionary *dictionary;
+  char path[PATH_MAX];
+  const char *value;
+  uint32_t value_size;
+
+  value = yatof_lexicon_option_get(ctx, lexicon, prefix, "dictionary",
+                                   env_name, &value_size);
+  if (!value || value_size == 0) {
+    return NULL;
   }
+  if (!yatof_dictionary_path(ctx, "[yatof][dictionary]",
+                             value, value_size, path)) {
+    return NULL;
+  }
+  dictionary = yatof_dictionary_open(ctx, path);
+  if (dictionary) {
+    /* A dictionary renamed over the old one has another checksum. */
+    yatof_option_digest_add(&(dictionary->header->checksum),
+                            sizeof(dictionary->header->checksum));
+  }
+  return dictionary;
 }
 
-static void
-tf_limit_fin(grn_ctx *ctx, void *user_data)
+static grn_bool
+yatof_words_contain(grn_ctx *ctx, grn_obj *table,
+                    grn_yatof_dictionary *dictionary,
+                    const char *key, unsigned int key_size)
 {
-  grn_tf_limit_token_filter *token_filter = user_data;
-  if (!token_filter) {
-    return;
+  if (dictionary) {
+    return yatof_dictionary_lookup(dictionary, key, key_size) != NULL;
   }
-  if (token_filter->table) {
-    grn_obj_unlink(ctx, token_filter->table);
+  if (!table) {
+    return GRN_FALSE;
   }
-  if (token_filter->word_table) {
-    grn_obj_unlink(ctx, token_filter->word_table);
+  return grn_table_get(ctx, table, key, key_size) != GRN_ID_NIL;
+}
+
+#define YATOF_LEXICON_CACHE_KEY_SIZE 256
+
+/* The last token resolved on a lexicon by this thread. Filters in a
+   chain see the same token one after another, so remove, ignore and
+   white in flag column mode share one lexicon lookup. Only found IDs
+   are cached: a new token is added to the lexicon after the chain. */
+typedef struct {
+  grn_obj *lexicon;
+  grn_id id;
+  unsigned int key_size;
+  char key[YATOF_LEXICON_CACHE_KEY_SIZE];
+} grn_yatof_lexicon_cache;
+
+static YATOF_THREAD_LOCAL grn_yatof_lexicon_cache yatof_lexicon_cache;
+
+static grn_id
+yatof_lexicon_get(grn_ctx *ctx, grn_obj *lexicon,
+                  const char *key, unsigned int key_size)
+{
+  grn_yatof_lexicon_cache *cache = &yatof_lexicon_cache;
+  grn_id id;
+
+  if (cache->lexicon == lexicon &&
+      cache->key_size == key_size &&
+      memcmp(cache->key, key, key_size) == 0) {
+    return cache->id;
   }
-  if (token_filter->column) {
-    grn_obj_unlink(ctx, token_filter->column);
+  id = grn_table_get(ctx, lexicon, key, key_size);
+  if (id != GRN_ID_NIL && key_size <= YATOF_LEXICON_CACHE_KEY_SIZE) {
+    cache->lexicon = lexicon;
+    cache->id = id;
+    cache->key_size = key_size;
+    memcpy(cache->key, key, key_size);
   }
-  grn_obj_unlink(ctx, &(token_filter->value));
-  grn_obj_unlink(ctx, &(token_filter->word_tf_limit));
-  grn_tokenizer_token_fin(ctx, &(token_filter->token));
-  GRN_PLUGIN_FREE(ctx, token_filter);
+  return id;
 }
 
+/* tokenfilter-NAME.flag-column names a Bool or UInt8-64 column on the
+   lexicon itself, e.g. Terms.is_stop_word or Terms.flags. An integer
+   column is flagged when it has one of the bits in
+   tokenfilter-NAME.flag-mask, so one column can serve several filters. */
 typedef struct {
-  grn_tokenizer_token token;
-  grn_obj *table;
+  grn_obj *lexicon;
+  grn_obj *column;
+  grn_id range;
+  uint64_t mask;
   grn_obj value;
-  grn_obj previous_token;
-  unsigned int phrase_limit;
-} grn_phrase_limit_token_filter;
+} grn_yatof_flags;
 
-static void *
-phrase_limit_init(grn_ctx *ctx, GNUC_UNUSED grn_obj *table, GNUC_UNUSED grn_token_mode mode)
+static grn_bool
+yatof_flags_open(grn_ctx *ctx, grn_yatof_flags *flags, grn_obj *lexicon,
+                 const char *name)
 {
-#define DEFAULT_PHRASE_LIMIT 4096
-  grn_phrase_limit_token_filter *token_filter;
-  const char *phrase_limit_env;
+  char prefix[GRN_TABLE_MAX_KEY_SIZE];
+  char env_name[GRN_TABLE_MAX_KEY_SIZE];
+  int env_name_size;
+  const char *column_name;
+  uint32_t column_name_size;
+  int i;
+
+  flags->lexicon = lexicon;
+  flags->column = NULL;
+  flags->range = GRN_ID_NIL;
+  flags->mask = UINT64_MAX;
+
+  snprintf(prefix, GRN_TABLE_MAX_KEY_SIZE, "tokenfilter-%s", name);
+  env_name_size = snprintf(env_name, GRN_TABLE_MAX_KEY_SIZE,
+                           "GRN_YATOF_%s_FLAG_COLUMN", name);
+  for (i = 0; env_name[i]; i++) {
+    env_name[i] = env_name[i] == '-' ? '_' : toupper((unsigned char)env_name[i]);
+  }
+  column_name = yatof_lexicon_option_get(ctx, lexicon, prefix, "flag-column",
+                                         env_name, &column_name_size);
+  if (!column_name || column_name_size == 0 || !lexicon) {
+    return GRN_TRUE;
+  }
 
-  token_filter = GRN_PLUGIN_MALLOC(ctx, sizeof(grn_phrase_limit_token_filter));
-  if (!token_filter) {
-    GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
-                     "[token-filter][phrase-limit] "
-                     "failed to allocate grn_phrase_limit_token_filter");
-    return NULL;
+  flags->column = grn_obj_column(ctx, lexicon, column_name, column_name_size);
+  if (!flags->column) {
+    GRN_PLUGIN_ERROR(ctx, GRN_INVALID_ARGUMENT,
+                     "[token-filter][%s] flag column not found: <%.*s>",
+                     name, (int)column_name_size, column_name);
+    return GRN_FALSE;
   }
-  token_filter->table = grn_table_create(ctx, NULL, 0, NULL,
-                                         GRN_OBJ_TABLE_HASH_KEY,
-                                         grn_ctx_at(ctx, GRN_DB_SHORT_TEXT),
-                                         grn_ctx_at(ctx, GRN_DB_UINT32));
-  if (!token_filter->table) {
-    GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
-                     "[token-filter][phrase-limit] "
-                     "couldn't create a table");
-    GRN_PLUGIN_FREE(ctx, token_filter);
-    return NULL;
-  }
-  phrase_limit_env = getenv("GRN_YATOF_PHRASE_LIMIT");
-  if (phrase_limit_env) {
-    token_filter->phrase_limit = atoi(phrase_limit_env);
-  } else {
-    token_filter->phrase_limit = DEFAULT_PHRASE_LIMIT;
+  /* Tokens already in the lexicon are answered by the column. */
+  yatof_option_digest_add_object(ctx, lexicon);
+  yatof_option_digest_add_object(ctx, flags->column);
+  flags->range = grn_obj_get_range(ctx, flags->column);
+  switch (flags->range) {
+  case GRN_DB_BOOL :
+  case GRN_DB_UINT8 :
+  case GRN_DB_UINT16 :
+  case GRN_DB_UINT32 :
+  case GRN_DB_UINT64 :
+    break;
+  default :
+    GRN_PLUGIN_ERROR(ctx, GRN_INVALID_ARGUMENT,
+                     "[token-filter][%s] flag column must be "
+                     "Bool or UInt8-64: <%.*s>",
+                     name, (int)column_name_size, column_name);
+    grn_obj_unlink(ctx, flags->column);
+    flags->column = NULL;
+    return GRN_FALSE;
   }
 
-  GRN_UINT32_INIT(&(token_filter->value), 0);
-  GRN_TEXT_INIT(&(token_filter->previous_token), 0);
-  grn_tokenizer_token_init(ctx, &(token_filter->token));
+  memcpy(env_name + env_name_size - strlen("COLUMN"), "MASK", strlen("MASK") + 1);
+  flags->mask = yatof_lexicon_option_get_uint64(ctx, lexicon, prefix,
+                                                "flag-mask", env_name,
+                                                UINT64_MAX);
+  GRN_VALUE_FIX_SIZE_INIT(&(flags->value), 0, flags->range);
+  return GRN_TRUE;
+}
 
-  return token_filter;
-#undef DEFAULT_PHRASE_LIMIT
+/* Returns GRN_TRUE and sets *flagged when the token is in the lexicon.
+   New tokens are left to the word table or the dictionary. */
+static grn_bool
+yatof_flags_get(grn_ctx *ctx, grn_yatof_flags *flags,
+                const char *key, unsigned int key_size, grn_bool *flagged)
+{
+  grn_id id;
+  uint64_t bits;
+
+  if (!flags->column) {
+    return GRN_FALSE;
+  }
+  id = yatof_lexicon_get(ctx, flags->lexicon, key, key_size);
+  if (id == GRN_ID_NIL) {
+    return GRN_FALSE;
+  }
+  GRN_BULK_REWIND(&(flags->value));
+  grn_obj_get_value(ctx, flags->column, id, &(flags->value));
+  if (GRN_BULK_VSIZE(&(flags->value)) == 0) {
+    *flagged = GRN_FALSE;
+    return GRN_TRUE;
+  }
+  switch (flags->range) {
+  case GRN_DB_BOOL :
+    *flagged = GRN_BOOL_VALUE(&(flags->value)) ? GRN_TRUE : GRN_FALSE;
+    return GRN_TRUE;
+  case GRN_DB_UINT8 :
+    bits = GRN_UINT8_VALUE(&(flags->value));
+    break;
+  case GRN_DB_UINT16 :
+    bits = GRN_UINT16_VALUE(&(flags->value));
+    break;
+  case GRN_DB_UINT32 :
+    bits = GRN_UINT32_VALUE(&(flags->value));
+    break;
+  default :
+    bits = GRN_UINT64_VALUE(&(flags->value));
+    break;
+  }
+  *flagged = (bits & flags->mask) ? GRN_TRUE : GRN_FALSE;
+  return GRN_TRUE;
 }
 
 static void
-phrase_limit_filter(grn_ctx *ctx,
-                grn_token *current_token,
-                grn_token *next_token,
-                void *user_data)
+yatof_flags_fin(grn_ctx *ctx, grn_yatof_flags *flags)
 {
-  grn_phrase_limit_token_filter *token_filter = user_data;
-  grn_obj *data;
-  grn_tokenizer_status status;
-  data = grn_token_get_data(ctx, current_token);
-  unsigned int phrase_limit = token_filter->phrase_limit;
+  if (!flags->column) {
+    return;
+  }
+  if (yatof_lexicon_cache.lexicon == flags->lexicon) {
+    yatof_lexicon_cache.lexicon = NULL;
+  }
+  GRN_OBJ_FIN(ctx, &(flags->value));
+  grn_obj_unlink(ctx, flags->column);
+}
 
-  if (GRN_TEXT_LEN(&(token_filter->previous_token)) != 0) {
-    grn_id id;
-    GRN_TEXT_PUT(ctx, &(token_filter->previous_token),
-                 GRN_TEXT_VALUE(data), GRN_TEXT_LEN(data));
+/* A flag column answers for tokens already in the lexicon. Others are
+   looked up by string in the word table or the dictionary, if any. */
+static grn_bool
+yatof_words_flagged(grn_ctx *ctx, grn_yatof_flags *flags, grn_obj *table,
+                    grn_yatof_dictionary *dictionary,
+                    const char *key, unsigned int key_size)
+{
+  grn_bool flagged;
 
-    id = grn_table_add(ctx, token_filter->table,
-                       GRN_TEXT_VALUE(&(token_filter->previous_token)),
-                       GRN_TEXT_LEN(&(token_filter->previous_token)), NULL);
-    if (id) {
-      GRN_BULK_REWIND(&(token_filter->value));
-      grn_obj_get_value(ctx, token_filter->table, id, &(token_filter->value));
-      GRN_UINT32_SET(ctx, &(token_filter->value), GRN_UINT32_VALUE(&(token_filter->value)) + 1);
-      grn_obj_set_value(ctx, token_filter->table, id, &(token_filter->value), GRN_OBJ_SET);
-    }
+  if (yatof_flags_get(ctx, flags, key, key_size, &flagged)) {
+    return flagged;
   }
-  GRN_BULK_REWIND(&(token_filter->previous_token));
-  GRN_TEXT_SET(ctx, &(token_filter->previous_token),
-               GRN_TEXT_VALUE(data), GRN_TEXT_LEN(data));
+  return yatof_words_contain(ctx, table, dictionary, key, key_size);
+}
 
-  if (GRN_UINT32_VALUE(&(token_filter->value)) > phrase_limit) {
-    status = grn_token_get_status(ctx, current_token);
-    status |= GRN_TOKEN_SKIP_WITH_POSITION;
-    grn_token_set_status(ctx, next_token, status);
+static void
+yatof_dictionary_close_all(void)
+{
+  while (yatof_dictionaries) {
+    yatof_dictionary_unmap(yatof_dictionaries);
+  }
+}
 
-    GRN_PLUGIN_LOG(ctx, GRN_LOG_NOTICE,
-                   "[token-filter][phrase-limit] "
-                   "<%.*s> is reached on phrase limit %u",
-                   (int)GRN_TEXT_LEN(data), GRN_TEXT_VALUE(data),
-                   phrase_limit);
+typedef struct {
+  grn_obj *table;
+  grn_token_mode mode;
+  grn_tokenizer_token token;
+  grn_bool enabled;
+} grn_yatof_token_filter;
+
+static void *
+yatof_init(grn_ctx *ctx, grn_obj *table, grn_token_mode mode,
+           const char *name)
+{
+  grn_yatof_token_filter *token_filter;
+
+  token_filter = GRN_PLUGIN_MALLOC(ctx, sizeof(grn_yatof_token_filter));
+  if (!token_filter) {
+    GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
+                     "[token-filter][yatof] "
+                     "failed to allocate grn_yatof_token_filter");
+    return NULL;
   }
+  token_filter->table = table;
+  token_filter->mode = mode;
+  token_filter->enabled = yatof_mode_is_enabled(ctx, table, name, mode);
+  grn_tokenizer_token_init(ctx, &(token_filter->token));
+
+  return token_filter;
 }
 
 static void
-phrase_limit_fin(grn_ctx *ctx, void *user_data)
+yatof_fin(grn_ctx *ctx, void *user_data)
 {
-  grn_phrase_limit_token_filter *token_filter = user_data;
+  grn_yatof_token_filter *token_filter = user_data;
   if (!token_filter) {
     return;
   }
-  if (token_filter->table) {
-    grn_obj_unlink(ctx, token_filter->table);
-  }
-  grn_obj_unlink(ctx, &(token_filter->value));
-  grn_obj_unlink(ctx, &(token_filter->previous_token));
   grn_tokenizer_token_fin(ctx, &(token_filter->token));
   GRN_PLUGIN_FREE(ctx, token_filter);
 }
 
-#define IGNORE_WORD_TABLE_NAME "ignore_words"
+#define MAX_LENGTH_OPTION_PREFIX "tokenfilter-max-length"
+#define MAX_LENGTH_MARKER_SIZE 16
+#define MAX_LENGTH_HASH_SIZE 16
+
+typedef enum {
+  MAX_LENGTH_MODE_SKIP,
+  MAX_LENGTH_MODE_HASH,
+  MAX_LENGTH_MODE_TRUNCATE
+} grn_max_length_mode;
 
 typedef struct {
-  grn_tokenizer_token token;
   grn_obj *table;
-  grn_obj value;
-} grn_ignore_word_token_filter;
+  grn_token_mode mode;
+  grn_tokenizer_token token;
+  int max_length_in_bytes;
+  grn_bool enabled;
+  grn_max_length_mode long_token_mode;
+  char marker[MAX_LENGTH_MARKER_SIZE];
+  unsigned int marker_size;
+} grn_max_length_token_filter;
 
 static void *
-ignore_word_init(grn_ctx *ctx, GNUC_UNUSED grn_obj *table, GNUC_UNUSED grn_token_mode mode)
+max_length_init(grn_ctx *ctx, grn_obj *table, grn_token_mode mode)
 {
-  grn_ignore_word_token_filter *token_filter;
-  const char *ignore_word_table_name_env;
+#define DEFAULT_MAX_LENGTH 64
+  grn_max_length_token_filter *token_filter;
+  const char *max_length_env;
+  const char *value;
+  uint32_t value_size;
 
-  token_filter = GRN_PLUGIN_MALLOC(ctx, sizeof(grn_ignore_word_token_filter));
+  token_filter = GRN_PLUGIN_MALLOC(ctx, sizeof(grn_max_length_token_filter));
   if (!token_filter) {
     GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
-                     "[token-filter][ignore-word] "
-                     "failed to allocate grn_ignore_word_token_filter");
+                     "[token-filter][max-length] "
+                     "failed to allocate grn_max_length_token_filter");
     return NULL;
   }
-  ignore_word_table_name_env = getenv("GRN_YATOF_IGNORE_WORD_TABLE_NAME");
-  if (ignore_word_table_name_env) {
-    token_filter->table = grn_ctx_get(ctx,
-                                      ignore_word_table_name_env,
-                                      strlen(ignore_word_table_name_env));
+  token_filter->enabled = yatof_mode_is_enabled(ctx, table, "max-length", mode);
+  max_length_env = getenv("GRN_YATOF_MAX_TOKEN_LENGTH");
+  if (max_length_env) {
+    token_filter->max_length_in_bytes = atoi(max_length_env);
   } else {
-    token_filter->table = grn_ctx_get(ctx,
-                                      IGNORE_WORD_TABLE_NAME,
-                                      strlen(IGNORE_WORD_TABLE_NAME));
+    token_filter->max_length_in_bytes = DEFAULT_MAX_LENGTH;
   }
-  if (!token_filter->table) {
-    GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
-                     "[token-filter][ignore-word] "
-                     "couldn't open a table");
-    GRN_PLUGIN_FREE(ctx, token_filter);
-    return NULL;
+  token_filter->long_token_mode = MAX_LENGTH_MODE_SKIP;
+  value = yatof_lexicon_option_get(ctx, table, MAX_LENGTH_OPTION_PREFIX,
+                                   "mode", "GRN_YATOF_MAX_LENGTH_MODE",
+                                   &value_size);
+  if (value) {
+    if (value_size == strlen("hash") &&
+        memcmp(value, "hash", value_size) == 0) {
+      token_filter->long_token_mode = MAX_LENGTH_MODE_HASH;
+    } else if (value_size == strlen("truncate") &&
+               memcmp(value, "truncate", value_size) == 0) {
+      token_filter->long_token_mode = MAX_LENGTH_MODE_TRUNCATE;
+    }
   }
-
+  token_filter->marker[0] = '#';
+  token_filter->marker_size = 1;
+  value = yatof_lexicon_option_get(ctx, table, MAX_LENGTH_OPTION_PREFIX,
+                                   "marker", "GRN_YATOF_MAX_LENGTH_MARKER",
+                                   &value_size);
+  if (value && value_size < MAX_LENGTH_MARKER_SIZE) {
+    memcpy(token_filter->marker, value, value_size);
+    token_filter->marker_size = value_size;
+  }
+  token_filter->table = table;
+  token_filter->mode = mode;
   grn_tokenizer_token_init(ctx, &(token_filter->token));
 
   return token_filter;
+#undef DEFAULT_MAX_LENGTH
+}
+
+/* The marker followed by the FNV-1a 64 hash of the whole token in fixed
+   width hex. Add and get produce the same key, so exact match search on a
+   long token still works. */
+static unsigned int
+max_length_hash(grn_max_length_token_filter *token_filter,
+                const char *value, unsigned int value_length,
+                char *replaced)
+{
+  uint64_t hash = 14695981039346656037ULL;
+  unsigned int i;
+
+  for (i = 0; i < value_length; i++) {
+    hash ^= (unsigned char)value[i];
+    hash *= 1099511628211ULL;
+  }
+  memcpy(replaced, token_filter->marker, token_filter->marker_size);
+  snprintf(replaced + token_filter->marker_size, MAX_LENGTH_HASH_SIZE + 1,
+           "%016" PRIx64, hash);
+  return token_filter->marker_size + MAX_LENGTH_HASH_SIZE;
+}
+
+/* The longest prefix on a character boundary that fits in the limit
+   together with the marker. Returns 0 when not even one character fits. */
+static unsigned int
+max_length_truncate(grn_ctx *ctx,
+                    grn_max_length_token_filter *token_filter,
+                    const char *value, unsigned int value_length,
+                    char *replaced, unsigned int replaced_size)
+{
+  grn_encoding encoding = GRN_CTX_GET_ENCODING(ctx);
+  unsigned int limit;
+  unsigned int kept = 0;
+
+  if (token_filter->max_length_in_bytes <= (int)token_filter->marker_size) {
+    return 0;
+  }
+  limit = token_filter->max_length_in_bytes - token_filter->marker_size;
+  if (limit > replaced_size - token_filter->marker_size) {
+    limit = replaced_size - token_filter->marker_size;
+  }
+  while (kept < value_length) {
+    int char_length = grn_plugin_charlen(ctx, value + kept,
+                                         value_length - kept, encoding);
+    if (char_length == 0 || kept + char_length > limit) {
+      break;
+    }
+    kept += char_length;
+  }
+  if (kept == 0) {
+    return 0;
+  }
+  memcpy(replaced, value, kept);
+  memcpy(replaced + kept, token_filter->marker, token_filter->marker_size);
+  return kept + token_filter->marker_size;
 }
 
 static void
-ignore_word_filter(grn_ctx *ctx,
-                   grn_token *current_token,
-                   grn_token *next_token,
-                   void *user_data)
+max_length_filter(grn_ctx *ctx,
+                  grn_token *current_token,
+                  grn_token *next_token,
+                  void *user_data)
 {
-  grn_ignore_word_token_filter *token_filter = user_data;
   grn_obj *data;
+  grn_max_length_token_filter *token_filter = user_data;
   grn_tokenizer_status status;
+  if (!token_filter->enabled) {
+    return;
+  }
   data = grn_token_get_data(ctx, current_token);
 
-  {
-    grn_id id;
-    id = grn_table_get(ctx, token_filter->table,
-                       GRN_TEXT_VALUE(data), GRN_TEXT_LEN(data));
-    if (id != GRN_ID_NIL) {
-      status = grn_token_get_status(ctx, current_token);
-      status |= GRN_TOKEN_SKIP_WITH_POSITION;
-      grn_token_set_status(ctx, next_token, status);
+  if (GRN_TEXT_LEN(data) > token_filter->max_length_in_bytes) {
+    char replaced[GRN_TABLE_MAX_KEY_SIZE];
+    unsigned int replaced_length = 0;
+
+    switch (token_filter->long_token_mode) {
+    case MAX_LENGTH_MODE_HASH :
+      replaced_length = max_length_hash(token_filter,
+                                        GRN_TEXT_VALUE(data),
+                                        GRN_TEXT_LEN(data),
+                                        replaced);
+      break;
+    case MAX_LENGTH_MODE_TRUNCATE :
+      replaced_length = max_length_truncate(ctx, token_filter,
+                                            GRN_TEXT_VALUE(data),
+                                            GRN_TEXT_LEN(data),
+                                            replaced,
+                                            GRN_TABLE_MAX_KEY_SIZE);
+      break;
+    default :
+      break;
     }
+    if (replaced_length > 0) {
+      grn_token_set_data(ctx, next_token, replaced, replaced_length);
+      return;
+    }
+    status = grn_token_get_status(ctx, current_token);
+    status |= GRN_TOKEN_SKIP_WITH_POSITION;
+    grn_token_set_status(ctx, next_token, status);
   }
 }
 
 static void
-ignore_word_fin(grn_ctx *ctx, void *user_data)
+max_length_fin(grn_ctx *ctx, void *user_data)
 {
-  grn_ignore_word_token_filter *token_filter = user_data;
+  grn_max_length_token_filter *token_filter = user_data;
   if (!token_filter) {
     return;
   }
-  if (token_filter->table) {
-    grn_obj_unlink(ctx, token_filter->table);
-  }
   grn_tokenizer_token_fin(ctx, &(token_filter->token));
   GRN_PLUGIN_FREE(ctx, token_filter);
 }
 
-#define REMOVE_WORD_TABLE_NAME "remove_words"
-#define REMOVE_WORD_HTML_TAG "<remove_html>"
-#define REMOVE_WORD_EOS_TAG "<remove_eos>"
-#define REMOVE_WORD_NON_ENGLISH_TAG "<remove_non_en>"
+typedef struct {
+  grn_obj *table;
+  grn_token_mode mode;
+  grn_tokenizer_token token;
+  int min_length_in_bytes;
+  grn_bool enabled;
+} grn_min_length_token_filter;
 
+static void *
+min_length_init(grn_ctx *ctx, grn_obj *table, grn_token_mode mode)
+{
+#define DEFAULT_MIN_LENGTH 3
+  grn_min_length_token_filter *token_filter;
+  const char *min_length_env;
 
-// 文字列がアルファベットとスペースのみで構成されているか判定する関数
-static int
-is_alpha_only(const char *str) {
-  if (str == NULL) {
-    return 0;
+  token_filter = GRN_PLUGIN_MALLOC(ctx, sizeof(grn_min_length_token_filter));
+  if (!token_filter) {
+    GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
+                     "[token-filter][min-length] "
+                     "failed to allocate grn_min_length_token_filter");
+    return NULL;
   }
-
-  while (*str) {
-    if (!isalpha((unsigned char)*str) && !isspace((unsigned char)*str)) {
-      return 0;
-    }
-    str++;
+  token_filter->enabled = yatof_mode_is_enabled(ctx, table, "min-length", mode);
+  min_length_env = getenv("GRN_YATOF_MIN_TOKEN_LENGTH");
+  if (min_length_env) {
+    token_filter->min_length_in_bytes = atoi(min_length_env);
+  } else {
+    token_filter->min_length_in_bytes = DEFAULT_MIN_LENGTH;
   }
-  return 1;
+  token_filter->table = table;
+  token_filter->mode = mode;
+  grn_tokenizer_token_init(ctx, &(token_filter->token));
+
+  return token_filter;
+#undef DEFAULT_MIN_LENGTH
 }
 
-// 文字列が化学式らしいかどうかを判定する関数
-static int
-is_chemical_formula(const char *str) {
-  if (str == NULL || strlen(str) == 0) {
-    return 0;
+static void
+min_length_filter(grn_ctx *ctx,
+                  grn_token *current_token,
+                  grn_token *next_token,
+                  void *user_data)
+{
+  grn_obj *data;
+  grn_min_length_token_filter *token_filter = user_data;
+  grn_tokenizer_status status;
+  if (!token_filter->enabled) {
+    return;
   }
+  data = grn_token_get_data(ctx, current_token);
 
-  // 化学式の特徴的なパターンを定義
-  // 1. 数字を含む場合
-  int has_digit = 0;
-  for (int i = 0; str[i]; i++) {
-    if (isdigit((unsigned char)str[i])) {
-      has_digit = 1;
-      break;
-    }
+  if (GRN_TEXT_LEN(data) < token_filter->min_length_in_bytes) {
+    status = grn_token_get_status(ctx, current_token);
+    status |= GRN_TOKEN_SKIP_WITH_POSITION;
+    grn_token_set_status(ctx, next_token, status);
   }
+}
 
-  if (has_digit) {
+static void
+min_length_fin(grn_ctx *ctx, void *user_data)
+{
+  grn_min_length_token_filter *token_filter = user_data;
+  if (!token_filter) {
+    return;
+  }
+  grn_tokenizer_token_fin(ctx, &(token_filter->token));
+  GRN_PLUGIN_FREE(ctx, token_filter);
+}
+
+static void *
+prolong_init(grn_ctx *ctx, grn_obj *table, grn_token_mode mode)
+{
+  return yatof_init(ctx, table, mode, "prolong");
+}
+
+static void
+prolong_filter(grn_ctx *ctx,
+               grn_token *current_token,
+               grn_token *next_token,
+               void *user_data)
+{
+#define CUT_PROLONG_LENGTH 4
+
+  grn_yatof_token_filter *token_filter = user_data;
+  grn_obj *data;
+  int token_size = 0;
+  grn_bool is_katakana = GRN_TRUE;
+
+  if (!token_filter->enabled) {
+    return;
+  }
+  data = grn_token_get_data(ctx, current_token);
+
+  {
+    int char_length;
+    int rest_length = GRN_TEXT_LEN(data);
+    const char *rest = GRN_TEXT_VALUE(data);
+
+    while (rest_length > 0) {
+      grn_char_type type;
+      grn_encoding encoding = GRN_CTX_GET_ENCODING(ctx);
+      char_length = grn_plugin_charlen(ctx, rest, rest_length, encoding);
+      if (char_length == 0) {
+        break;
+      }
+      type = grn_nfkc_char_type((unsigned char *)rest);
+      if (type != GRN_CHAR_KATAKANA) {
+        is_katakana = GRN_FALSE;
+        break;
+      }
+      token_size++;
+      rest += char_length;
+      rest_length -= char_length;
+    }
+  }
+  if (is_katakana && token_size >= CUT_PROLONG_LENGTH) {
+    const char *last = GRN_TEXT_VALUE(data);
+    last += GRN_TEXT_LEN(data) - 3;
+    if (!memcmp("ー", last, 3)) {
+      grn_token_set_data(ctx, next_token,
+                         GRN_TEXT_VALUE(data),
+                         GRN_TEXT_LEN(data) - 3);
+    }
+  }
+#undef CUT_PROLONG_LENGTH
+}
+
+static void *
+symbol_init(grn_ctx *ctx, grn_obj *table, grn_token_mode mode)
+{
+  return yatof_init(ctx, table, mode, "symbol");
+}
+
+static grn_bool
+is_symbol_only(grn_ctx *ctx, const char *value, int value_length)
+{
+  int char_length;
+  int rest_length = value_length;
+  const char *rest = value;
+
+  while (rest_length > 0) {
+    grn_char_type type;
+    grn_encoding encoding = GRN_CTX_GET_ENCODING(ctx);
+    char_length = grn_plugin_charlen(ctx, rest, rest_length, encoding);
+    if (char_length == 0) {
+      break;
+    }
+    type = grn_nfkc_char_type((unsigned char *)rest);
+    if (type != GRN_CHAR_SYMBOL && type != GRN_CHAR_OTHERS) {
+      return GRN_FALSE;
+    }
+    rest += char_length;
+    rest_length -= char_length;
+  }
+  return GRN_TRUE;
+}
+
+static void
+symbol_filter(grn_ctx *ctx,
+              grn_token *current_token,
+              grn_token *next_token,
+              void *user_data)
+{
+  grn_yatof_token_filter *token_filter = user_data;
+  grn_obj *data;
+  grn_tokenizer_status status;
+
+  if (!token_filter->enabled) {
+    return;
+  }
+  data = grn_token_get_data(ctx, current_token);
+
+  if (is_symbol_only(ctx, GRN_TEXT_VALUE(data), GRN_TEXT_LEN(data))) {
+    status = grn_token_get_status(ctx, current_token);
+    status |= GRN_TOKEN_SKIP_WITH_POSITION;
+    grn_token_set_status(ctx, next_token, status);
+  }
+}
+
+static void *
+digit_init(grn_ctx *ctx, grn_obj *table, grn_token_mode mode)
+{
+  return yatof_init(ctx, table, mode, "digit");
+}
+
+static void
+digit_filter(grn_ctx *ctx,
+             grn_token *current_token,
+             grn_token *next_token,
+             void *user_data)
+{
+  grn_yatof_token_filter *token_filter = user_data;
+  grn_obj *data;
+  grn_tokenizer_status status;
+  int token_size = 0;
+  grn_bool is_digit = GRN_TRUE;
+
+  if (!token_filter->enabled) {
+    return;
+  }
+  data = grn_token_get_data(ctx, current_token);
+
+  {
+    int char_length;
+    int rest_length = GRN_TEXT_LEN(data);
+    const char *rest = GRN_TEXT_VALUE(data);
+
+    while (rest_length > 0) {
+      grn_char_type type;
+      grn_encoding encoding = GRN_CTX_GET_ENCODING(ctx);
+      char_length = grn_plugin_charlen(ctx, rest, rest_length, encoding);
+      if (char_length == 0) {
+        break;
+      }
+      type = grn_nfkc_char_type((unsigned char *)rest);
+      if (type != GRN_CHAR_DIGIT) {
+        is_digit = GRN_FALSE;
+        break;
+      }
+      token_size++;
+      rest += char_length;
+      rest_length -= char_length;
+    }
+  }
+  if (is_digit) {
+    status = grn_token_get_status(ctx, current_token);
+    status |= GRN_TOKEN_SKIP_WITH_POSITION;
+    grn_token_set_status(ctx, next_token, status);
+  }
+}
+
+static void *
+unmatured_one_init(grn_ctx *ctx, grn_obj *table, grn_token_mode mode)
+{
+  return yatof_init(ctx, table, mode, "unmatured-one");
+}
+
+static void
+unmatured_one_filter(grn_ctx *ctx,
+             grn_token *current_token,
+             grn_token *next_token,
+             void *user_data)
+{
+  grn_yatof_token_filter *token_filter = user_data;
+  grn_obj *data;
+  grn_tokenizer_status status;
+  int token_size = 0;
+
+  if (!token_filter->enabled) {
+    return;
+  }
+  data = grn_token_get_data(ctx, current_token);
+
+  {
+    int char_length;
+    int rest_length = GRN_TEXT_LEN(data);
+    const char *rest = GRN_TEXT_VALUE(data);
+
+    while (rest_length > 0) {
+      grn_encoding encoding = GRN_CTX_GET_ENCODING(ctx);
+      char_length = grn_plugin_charlen(ctx, rest, rest_length, encoding);
+      if (char_length == 0) {
+        break;
+      }
+      token_size++;
+      rest += char_length;
+      rest_length -= char_length;
+    }
+  }
+  if (token_size == 1) {
+    status = grn_token_get_status(ctx, current_token);
+    if (status & GRN_TOKEN_UNMATURED) {
+      status |= GRN_TOKEN_SKIP_WITH_POSITION;
+      grn_token_set_status(ctx, next_token, status);
+    }
+  }
+}
+
+#define ATGC_LIMIT 9
+
+static void *
+atgc_init(grn_ctx *ctx, grn_obj *table, grn_token_mode mode)
+{
+  return yatof_init(ctx, table, mode, "atgc");
+}
+
+static void
+atgc_filter(grn_ctx *ctx,
+             grn_token *current_token,
+             grn_token *next_token,
+             void *user_data)
+{
+  grn_yatof_token_filter *token_filter = user_data;
+  grn_obj *data;
+  grn_tokenizer_status status;
+  int token_size = 0;
+  int n_atgc = 0;
+
+  if (!token_filter->enabled) {
+    return;
+  }
+  data = grn_token_get_data(ctx, current_token);
+
+  {
+    int char_length;
+    int rest_length = GRN_TEXT_LEN(data);
+    const char *rest = GRN_TEXT_VALUE(data);
+
+    while (rest_length > 0) {
+      grn_encoding encoding = GRN_CTX_GET_ENCODING(ctx);
+      char_length = grn_plugin_charlen(ctx, rest, rest_length, encoding);
+      if (char_length == 0) {
+        break;
+      }
+      if (rest[0] == 'A' || rest[0] == 'T' || rest[0] == 'G' || rest[0] == 'C' || rest[0] == 'U' ||
+          rest[0] == 'a' || rest[0] == 't' || rest[0] == 'g' || rest[0] == 'c' || rest[0] == 'u') {
+        n_atgc++;
+      } else {
+        n_atgc = 0;
+      }
+      token_size++;
+      rest += char_length;
+      rest_length -= char_length;
+    }
+  }
+  if (n_atgc >= ATGC_LIMIT) {
+    status = grn_token_get_status(ctx, current_token);
+    status |= GRN_TOKEN_SKIP_WITH_POSITION;
+    grn_token_set_status(ctx, next_token, status);
+  }
+}
+
+#define TF_LIMIT_WORD_TABLE_NAME "tf_limits"
+#define TF_LIMIT_COLUMN_NAME "tf_limit"
+#define TF_LIMIT_OPTION_PREFIX "tokenfilter-tf-limit"
+
+typedef struct {
+  grn_tokenizer_token token;
+  grn_obj *table;
+  grn_obj value;
+  unsigned int tf_limit;
+  double ratio;
+  unsigned int floor;
+  unsigned int ceiling;
+  unsigned int stride;
+  uint64_t n_tokens;
+  grn_obj *word_table;
+  grn_obj *column;
+  grn_obj word_tf_limit;
+  grn_yatof_memory memory;
+  grn_bool enabled;
+} grn_tf_limit_token_filter;
+
+static void *
+tf_limit_init(grn_ctx *ctx, grn_obj *table, grn_token_mode mode)
+{
+#define DEFAULT_TF_LIMIT 131071
+#define DEFAULT_TF_LIMIT_FLOOR 16
+  grn_tf_limit_token_filter *token_filter;
+  const char *tf_limit_env;
+  const char *tf_limit_word_table_name_env;
+
+  token_filter = GRN_PLUGIN_MALLOC(ctx, sizeof(grn_tf_limit_token_filter));
+  if (!token_filter) {
+    GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
+                     "[token-filter][tf-limit] "
+                     "failed to allocate grn_tf_limit_token_filter");
+    return NULL;
+  }
+  token_filter->enabled = yatof_mode_is_enabled(ctx, table, "tf-limit", mode);
+  token_filter->table = NULL;
+  if (token_filter->enabled) {
+    token_filter->table = grn_table_create(ctx, NULL, 0, NULL,
+                                           GRN_OBJ_TABLE_HASH_KEY,
+                                           grn_ctx_at(ctx, GRN_DB_SHORT_TEXT),
+                                           grn_ctx_at(ctx, GRN_DB_UINT32));
+  }
+  if (token_filter->enabled && !token_filter->table) {
+    GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
+                     "[token-filter][tf-limit] "
+                     "couldn't create a table");
+    GRN_PLUGIN_FREE(ctx, token_filter);
+    return NULL;
+  }
+  tf_limit_env = getenv("GRN_YATOF_TF_LIMIT");
+  if (tf_limit_env) {
+    token_filter->tf_limit = atoi(tf_limit_env);
+  } else {
+    token_filter->tf_limit = DEFAULT_TF_LIMIT;
+  }
+  token_filter->ratio =
+    yatof_lexicon_option_get_double(ctx, table, TF_LIMIT_OPTION_PREFIX,
+                                    "ratio", "GRN_YATOF_TF_LIMIT_RATIO",
+                                    0.0);
+  token_filter->floor =
+    yatof_lexicon_option_get_uint64(ctx, table, TF_LIMIT_OPTION_PREFIX,
+                                    "floor", "GRN_YATOF_TF_LIMIT_FLOOR",
+                                    DEFAULT_TF_LIMIT_FLOOR);
+  token_filter->ceiling =
+    yatof_lexicon_option_get_uint64(ctx, table, TF_LIMIT_OPTION_PREFIX,
+                                    "ceiling", "GRN_YATOF_TF_LIMIT_CEILING",
+                                    token_filter->tf_limit);
+  token_filter->stride =
+    yatof_lexicon_option_get_uint64(ctx, table, TF_LIMIT_OPTION_PREFIX,
+                                    "stride", "GRN_YATOF_TF_LIMIT_STRIDE",
+                                    0);
+  token_filter->n_tokens = 0;
+  token_filter->word_table = NULL;
+  token_filter->column = NULL;
+
+  tf_limit_word_table_name_env = getenv("GRN_YATOF_TF_LIMIT_WORD_TABLE_NAME");
+  if (tf_limit_word_table_name_env) {
+    token_filter->word_table = yatof_table_open(ctx,
+                                                tf_limit_word_table_name_env,
+                                                strlen(tf_limit_word_table_name_env));
+  } else {
+    token_filter->word_table = yatof_table_open(ctx,
+                                                TF_LIMIT_WORD_TABLE_NAME,
+                                                strlen(TF_LIMIT_WORD_TABLE_NAME));
+  }
+
+  if (token_filter->word_table) {
+     token_filter->column = grn_obj_column(ctx,
+                                           token_filter->word_table,
+                                           TF_LIMIT_COLUMN_NAME,
+                                           strlen(TF_LIMIT_COLUMN_NAME));
+  }
+
+  GRN_UINT32_INIT(&(token_filter->value), 0);
+  GRN_UINT32_INIT(&(token_filter->word_tf_limit), 0);
+  yatof_memory_init(ctx, &(token_filter->memory), YATOF_MEMORY_TF_LIMIT);
+  grn_tokenizer_token_init(ctx, &(token_filter->token));
+
+  return token_filter;
+#undef DEFAULT_TF_LIMIT
+#undef DEFAULT_TF_LIMIT_FLOOR
+}
+
+static void
+tf_limit_filter(grn_ctx *ctx,
+                grn_token *current_token,
+                grn_token *next_token,
+                void *user_data)
+{
+  grn_tf_limit_token_filter *token_filter = user_data;
+  grn_obj *data;
+  grn_tokenizer_status status;
+  if (!token_filter->enabled) {
+    return;
+  }
+  data = grn_token_get_data(ctx, current_token);
+  unsigned int tf_limit = token_filter->tf_limit;
+  unsigned int tf;
+
+  token_filter->n_tokens++;
+  if (token_filter->ratio > 0.0) {
+    double proportional_limit = token_filter->ratio * token_filter->n_tokens;
+    if (proportional_limit < token_filter->floor) {
+      tf_limit = token_filter->floor;
+    } else if (proportional_limit > token_filter->ceiling) {
+      tf_limit = token_filter->ceiling;
+    } else {
+      tf_limit = (unsigned int)proportional_limit;
+    }
+  }
+
+  {
+    grn_id id;
+    id = yatof_memory_table_add(ctx, &(token_filter->memory),
+                                token_filter->table,
+                                GRN_TEXT_VALUE(data), GRN_TEXT_LEN(data),
+                                NULL);
+    if (id) {
+      GRN_BULK_REWIND(&(token_filter->value));
+      grn_obj_get_value(ctx, token_filter->table, id, &(token_filter->value));
+      GRN_UINT32_SET(ctx, &(token_filter->value), GRN_UINT32_VALUE(&(token_filter->value)) + 1);
+      grn_obj_set_value(ctx, token_filter->table, id, &(token_filter->value), GRN_OBJ_SET);
+    } else {
+      GRN_UINT32_SET(ctx, &(token_filter->value), 0);
+    }
+  }
+
+  if (token_filter->word_table) {
+    grn_id id;
+    id = grn_table_get(ctx, token_filter->word_table,
+                       GRN_TEXT_VALUE(data), GRN_TEXT_LEN(data));
+    if (id != GRN_ID_NIL) {
+      GRN_BULK_REWIND(&(token_filter->word_tf_limit));
+      grn_obj_get_value(ctx, token_filter->column, id, &(token_filter->word_tf_limit));
+      tf_limit = GRN_UINT32_VALUE(&(token_filter->word_tf_limit));
+    }
+  }
+
+  tf = GRN_UINT32_VALUE(&(token_filter->value));
+  if (tf > tf_limit) {
+    if (token_filter->stride > 0 &&
+        (tf - tf_limit) % token_filter->stride == 0) {
+      return;
+    }
+    status = grn_token_get_status(ctx, current_token);
+    status |= GRN_TOKEN_SKIP_WITH_POSITION;
+    grn_token_set_status(ctx, next_token, status);
+
+    YATOF_PROBE3(tf_limit_reached,
+                 GRN_TEXT_VALUE(data), GRN_TEXT_LEN(data), tf_limit);
+    GRN_PLUGIN_LOG(ctx, GRN_LOG_INFO,
+                   "[token-filter][tf-limit] "
+                   "<%.*s> is reached on tf limit %u",
+                   (int)GRN_TEXT_LEN(data), GRN_TEXT_VALUE(data),
+                   tf_limit);
+  }
+}
+
+static void
+tf_limit_fin(grn_ctx *ctx, void *user_data)
+{
+  grn_tf_limit_token_filter *token_filter = user_data;
+  if (!token_filter) {
+    return;
+  }
+  if (token_filter->table) {
+    grn_obj_unlink(ctx, token_filter->table);
+  }
+  if (token_filter->word_table) {
+    grn_obj_unlink(ctx, token_filter->word_table);
+  }
+  if (token_filter->column) {
+    grn_obj_unlink(ctx, token_filter->column);
+  }
+  grn_obj_unlink(ctx, &(token_filter->value));
+  grn_obj_unlink(ctx, &(token_filter->word_tf_limit));
+  yatof_memory_fin(ctx, &(token_filter->memory));
+  grn_tokenizer_token_fin(ctx, &(token_filter->token));
+  GRN_PLUGIN_FREE(ctx, token_filter);
+}
+
+typedef struct {
+  grn_tokenizer_token token;
+  grn_obj *table;
+  grn_obj value;
+  grn_obj previous_token;
+  unsigned int phrase_limit;
+  grn_yatof_memory memory;
+  grn_bool enabled;
+} grn_phrase_limit_token_filter;
+
+static void *
+phrase_limit_init(grn_ctx *ctx, grn_obj *table, grn_token_mode mode)
+{
+#define DEFAULT_PHRASE_LIMIT 4096
+  grn_phrase_limit_token_filter *token_filter;
+  const char *phrase_limit_env;
+
+  token_filter = GRN_PLUGIN_MALLOC(ctx, sizeof(grn_phrase_limit_token_filter));
+  if (!token_filter) {
+    GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
+                     "[token-filter][phrase-limit] "
+                     "failed to allocate grn_phrase_limit_token_filter");
+    return NULL;
+  }
+  token_filter->enabled = yatof_mode_is_enabled(ctx, table, "phrase-limit", mode);
+  token_filter->table = NULL;
+  if (token_filter->enabled) {
+    token_filter->table = grn_table_create(ctx, NULL, 0, NULL,
+                                           GRN_OBJ_TABLE_HASH_KEY,
+                                           grn_ctx_at(ctx, GRN_DB_SHORT_TEXT),
+                                           grn_ctx_at(ctx, GRN_DB_UINT32));
+  }
+  if (token_filter->enabled && !token_filter->table) {
+    GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
+                     "[token-filter][phrase-limit] "
+                     "couldn't create a table");
+    GRN_PLUGIN_FREE(ctx, token_filter);
+    return NULL;
+  }
+  phrase_limit_env = getenv("GRN_YATOF_PHRASE_LIMIT");
+  if (phrase_limit_env) {
+    token_filter->phrase_limit = atoi(phrase_limit_env);
+  } else {
+    token_filter->phrase_limit = DEFAULT_PHRASE_LIMIT;
+  }
+
+  GRN_UINT32_INIT(&(token_filter->value), 0);
+  GRN_TEXT_INIT(&(token_filter->previous_token), 0);
+  yatof_memory_init(ctx, &(token_filter->memory), YATOF_MEMORY_PHRASE_LIMIT);
+  grn_tokenizer_token_init(ctx, &(token_filter->token));
+
+  return token_filter;
+#undef DEFAULT_PHRASE_LIMIT
+}
+
+static void
+phrase_limit_filter(grn_ctx *ctx,
+                grn_token *current_token,
+                grn_token *next_token,
+                void *user_data)
+{
+  grn_phrase_limit_token_filter *token_filter = user_data;
+  grn_obj *data;
+  grn_tokenizer_status status;
+  if (!token_filter->enabled) {
+    return;
+  }
+  data = grn_token_get_data(ctx, current_token);
+  unsigned int phrase_limit = token_filter->phrase_limit;
+
+  if (GRN_TEXT_LEN(&(token_filter->previous_token)) != 0) {
+    grn_id id;
+    GRN_TEXT_PUT(ctx, &(token_filter->previous_token),
+                 GRN_TEXT_VALUE(data), GRN_TEXT_LEN(data));
+
+    id = yatof_memory_table_add(ctx, &(token_filter->memory),
+                                token_filter->table,
+                                GRN_TEXT_VALUE(&(token_filter->previous_token)),
+                                GRN_TEXT_LEN(&(token_filter->previous_token)),
+                                NULL);
+    if (id) {
+      GRN_BULK_REWIND(&(token_filter->value));
+      grn_obj_get_value(ctx, token_filter->table, id, &(token_filter->value));
+      GRN_UINT32_SET(ctx, &(token_filter->value), GRN_UINT32_VALUE(&(token_filter->value)) + 1);
+      grn_obj_set_value(ctx, token_filter->table, id, &(token_filter->value), GRN_OBJ_SET);
+    } else {
+      GRN_UINT32_SET(ctx, &(token_filter->value), 0);
+    }
+  }
+  GRN_BULK_REWIND(&(token_filter->previous_token));
+  GRN_TEXT_SET(ctx, &(token_filter->previous_token),
+               GRN_TEXT_VALUE(data), GRN_TEXT_LEN(data));
+
+  if (GRN_UINT32_VALUE(&(token_filter->value)) > phrase_limit) {
+    status = grn_token_get_status(ctx, current_token);
+    status |= GRN_TOKEN_SKIP_WITH_POSITION;
+    grn_token_set_status(ctx, next_token, status);
+
+    YATOF_PROBE3(phrase_limit_reached,
+                 GRN_TEXT_VALUE(data), GRN_TEXT_LEN(data), phrase_limit);
+    GRN_PLUGIN_LOG(ctx, GRN_LOG_NOTICE,
+                   "[token-filter][phrase-limit] "
+                   "<%.*s> is reached on phrase limit %u",
+                   (int)GRN_TEXT_LEN(data), GRN_TEXT_VALUE(data),
+                   phrase_limit);
+  }
+}
+
+static void
+phrase_limit_fin(grn_ctx *ctx, void *user_data)
+{
+  grn_phrase_limit_token_filter *token_filter = user_data;
+  if (!token_filter) {
+    return;
+  }
+  if (token_filter->table) {
+    grn_obj_unlink(ctx, token_filter->table);
+  }
+  grn_obj_unlink(ctx, &(token_filter->value));
+  grn_obj_unlink(ctx, &(token_filter->previous_token));
+  yatof_memory_fin(ctx, &(token_filter->memory));
+  grn_tokenizer_token_fin(ctx, &(token_filter->token));
+  GRN_PLUGIN_FREE(ctx, token_filter);
+}
+
+#define IGNORE_WORD_TABLE_NAME "ignore_words"
+
+typedef struct {
+  grn_tokenizer_token token;
+  grn_obj *table;
+  grn_obj value;
+  grn_yatof_dictionary *dictionary;
+  grn_yatof_flags flags;
+  grn_bool enabled;
+} grn_ignore_word_token_filter;
+
+static void *
+ignore_word_init(grn_ctx *ctx, grn_obj *table, grn_token_mode mode)
+{
+  grn_ignore_word_token_filter *token_filter;
+  const char *ignore_word_table_name_env;
+
+  token_filter = GRN_PLUGIN_MALLOC(ctx, sizeof(grn_ignore_word_token_filter));
+  if (!token_filter) {
+    GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
+                     "[token-filter][ignore-word] "
+                     "failed to allocate grn_ignore_word_token_filter");
+    return NULL;
+  }
+  token_filter->enabled = yatof_mode_is_enabled(ctx, table, "ignore-word", mode);
+  if (!yatof_flags_open(ctx, &(token_filter->flags), table, "ignore-word")) {
+    GRN_PLUGIN_FREE(ctx, token_filter);
+    return NULL;
+  }
+  token_filter->dictionary =
+    yatof_dictionary_open_option(ctx, table, "tokenfilter-ignore-word",
+                                 "GRN_YATOF_IGNORE_WORD_DICTIONARY");
+  if (ctx->rc != GRN_SUCCESS) {
+    yatof_flags_fin(ctx, &(token_filter->flags));
+    GRN_PLUGIN_FREE(ctx, token_filter);
+    return NULL;
+  }
+  ignore_word_table_name_env = getenv("GRN_YATOF_IGNORE_WORD_TABLE_NAME");
+  if (token_filter->dictionary) {
+    token_filter->table = NULL;
+  } else if (ignore_word_table_name_env) {
+    token_filter->table = yatof_table_open(ctx,
+                                           ignore_word_table_name_env,
+                                           strlen(ignore_word_table_name_env));
+  } else {
+    token_filter->table = yatof_table_open(ctx,
+                                           IGNORE_WORD_TABLE_NAME,
+                                           strlen(IGNORE_WORD_TABLE_NAME));
+  }
+  if (!token_filter->dictionary && !token_filter->table &&
+      !token_filter->flags.column) {
+    GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
+                     "[token-filter][ignore-word] "
+                     "couldn't open a table");
+    GRN_PLUGIN_FREE(ctx, token_filter);
+    return NULL;
+  }
+
+  grn_tokenizer_token_init(ctx, &(token_filter->token));
+
+  return token_filter;
+}
+
+static void
+ignore_word_filter(grn_ctx *ctx,
+                   grn_token *current_token,
+                   grn_token *next_token,
+                   void *user_data)
+{
+  grn_ignore_word_token_filter *token_filter = user_data;
+  grn_obj *data;
+  grn_tokenizer_status status;
+  if (!token_filter->enabled) {
+    return;
+  }
+  data = grn_token_get_data(ctx, current_token);
+
+  {
+    if (yatof_words_flagged(ctx, &(token_filter->flags),
+                            token_filter->table,
+                            token_filter->dictionary,
+                            GRN_TEXT_VALUE(data), GRN_TEXT_LEN(data))) {
+      status = grn_token_get_status(ctx, current_token);
+      status |= GRN_TOKEN_SKIP_WITH_POSITION;
+      grn_token_set_status(ctx, next_token, status);
+    }
+  }
+}
+
+static void
+ignore_word_fin(grn_ctx *ctx, void *user_data)
+{
+  grn_ignore_word_token_filter *token_filter = user_data;
+  if (!token_filter) {
+    return;
+  }
+  yatof_flags_fin(ctx, &(token_filter->flags));
+  yatof_dictionary_close(ctx, token_filter->dictionary);
+  if (token_filter->table) {
+    grn_obj_unlink(ctx, token_filter->table);
+  }
+  grn_tokenizer_token_fin(ctx, &(token_filter->token));
+  GRN_PLUGIN_FREE(ctx, token_filter);
+}
+
+#define REMOVE_WORD_TABLE_NAME "remove_words"
+#define REMOVE_WORD_HTML_TAG "<remove_html>"
+#define REMOVE_WORD_EOS_TAG "<remove_eos>"
+#define REMOVE_WORD_NON_ENGLISH_TAG "<remove_non_en>"
+#define REMOVE_WORD_HTML_BLOCK_TAG "<remove_html_block>"
+
+
+// 文字列がアルファベットとスペースのみで構成されているか判定する関数
+static int
+is_alpha_only(const char *str) {
+  if (str == NULL) {
+    return 0;
+  }
+
+  while (*str) {
+    if (!isalpha((unsigned char)*str) && !isspace((unsigned char)*str)) {
+      return 0;
+    }
+    str++;
+  }
+  return 1;
+}
+
+// 文字列が化学式らしいかどうかを判定する関数
+static int
+is_chemical_formula(const char *str) {
+  if (str == NULL || strlen(str) == 0) {
+    return 0;
+  }
+
+  // 化学式の特徴的なパターンを定義
+  // 1. 数字を含む場合
+  int has_digit = 0;
+  for (int i = 0; str[i]; i++) {
+    if (isdigit((unsigned char)str[i])) {
+      has_digit = 1;
+      break;
+    }
+  }
+
+  if (has_digit) {
     return 1; // 数字を含む場合は化学式の可能性が高い
   }
 
-  // 2. 代表的な化学式パターンにマッチするか確認
-  const char *specific_formulas[] = {
-    "NaCl", "CuSO", "FeO", "ZnCl", "AgNO", "KOH", "MgO", "CaO",
-    "HCl", "NH"
-  };
-  int formula_count = sizeof(specific_formulas) / sizeof(specific_formulas[0]);
+  // 2. 代表的な化学式パターンにマッチするか確認
+  const char *specific_formulas[] = {
+    "NaCl", "CuSO", "FeO", "ZnCl", "AgNO", "KOH", "MgO", "CaO",
+    "HCl", "NH"
+  };
+  int formula_count = sizeof(specific_formulas) / sizeof(specific_formulas[0]);
+
+  for (int i = 0; i < formula_count; i++) {
+    if (strstr(str, specific_formulas[i]) != NULL) {
+      return 1;
+    }
+  }
+
+  // 3. 他の判定条件は使用しない
+  return 0;
+}
+
+// 英単語らしくないかどうかを判定する関数
+static int
+is_non_english_word(const char *word) {
+  if (word == NULL || strlen(word) == 0) {
+    return 0; // 空文字列は判定不能
+  }
+
+  // 化学式らしい場合は非英単語として検出しない
+  if (is_chemical_formula(word)) {
+    // printf("DEBUG: %s - 化学式と判定\n", word);
+    return 0;
+  }
+
+  // 英語文字の一般的な頻度（小文字）
+  const double eng_freq[26] = {
+    0.08167, 0.01492, 0.02802, 0.04271, 0.12702, // a-e
+    0.02228, 0.02015, 0.06094, 0.06966, 0.00153, // f-j
+    0.00772, 0.04025, 0.02406, 0.06749, 0.07507, // k-o
+    0.01929, 0.00095, 0.05987, 0.06327, 0.09056, // p-t
+    0.02758, 0.00978, 0.02360, 0.00150, 0.01974, // u-y
+    0.00074  // z
+  };
+
+  int len = strlen(word);
+  if (len < 8) {
+    return 0; // 7文字以下は判定保留（より保守的に）
+  }
+
+  // 文字数カウント
+  int char_count[26] = {0};
+  int valid_chars = 0;
+  int vowel_count = 0;
+  int consecutive_consonants = 0;
+  int max_consecutive_consonants = 0;
+
+  // 文字頻度と母音/子音の集計
+  for (int i = 0; i < len; i++) {
+    char c = tolower(word[i]);
+    if (c >= 'a' && c <= 'z') {
+      char_count[c - 'a']++;
+      valid_chars++;
+
+      // 母音判定
+      if (c == 'a' || c == 'e' || c == 'i' || c == 'o' || c == 'u') {
+        vowel_count++;
+        consecutive_consonants = 0;
+      } else {
+        consecutive_consonants++;
+        if (consecutive_consonants > max_consecutive_consonants) {
+          max_consecutive_consonants = consecutive_consonants;
+        }
+      }
+    }
+  }
+
+  // 有効な文字がなければ判定不能
+  if (valid_chars == 0) {
+    return 0;
+  }
+
+  // 判定条件を調整
+  double vowel_ratio = (double)vowel_count / valid_chars;
+  double freq_score = 0.0;
+
+  for (int i = 0; i < 26; i++) {
+    double observed_freq = (double)char_count[i] / valid_chars;
+    double expected_freq = eng_freq[i];
+    freq_score += (observed_freq - expected_freq) * (observed_freq - expected_freq);
+  }
+
+  // デバッグ情報
+  // printf("DEBUG: %s - 母音比率: %.2f, 最大連続子音: %d, 頻度スコア: %.2f\n",
+          // word, vowel_ratio, max_consecutive_consonants, freq_score);
+
+  // スペースを含む場合は複数の英単語として扱い、非英単語とは判定しない
+  if (strchr(word, ' ') != NULL) {
+    return 0;
+  }
+
+  // 判定条件（より保守的なOR条件）
+  // 1. 子音の連続が非常に多い（7以上）
+  if (max_consecutive_consonants >= 7) {
+    return 1;
+  }
+
+  // 2. 母音比率が低く（15%未満）、子音の連続がやや多い（5以上）
+  if (vowel_ratio < 0.15 && max_consecutive_consonants >= 5) {
+    return 1;
+  }
+
+  // 3. 母音比率が非常に低い（5%未満）
+  if (vowel_ratio < 0.05) {
+    return 1;
+  }
+
+  // 4. 文字頻度が英語と大きく異なる（0.4以上）
+  if (freq_score > 0.40) {
+    return 1;
+  }
+
+  // いずれの条件も満たさない場合は英単語の可能性あり
+  return 0;
+}
+
+
+typedef enum {
+  REMOVE_WORD_HTML_TEXT,
+  REMOVE_WORD_HTML_TAG_OPEN,
+  REMOVE_WORD_HTML_IN_TAG,
+  REMOVE_WORD_HTML_IN_SCRIPT,
+  REMOVE_WORD_HTML_IN_STYLE,
+  REMOVE_WORD_HTML_IN_COMMENT,
+  REMOVE_WORD_HTML_IN_ENTITY
+} grn_remove_word_html_state;
+
+#define REMOVE_WORD_HTML_NAME_SIZE 16
+#define REMOVE_WORD_HTML_ENTITY_SIZE 12
+
+/* HTML state kept across the tokens of one document. Tokenizers split
+   "<script>" or "&amp;" into several tokens, so a tag name, the end of a
+   script/style/comment block and an entity are matched incrementally. */
+typedef struct {
+  grn_remove_word_html_state state;
+  char name[REMOVE_WORD_HTML_NAME_SIZE];
+  int name_length;
+  grn_bool name_done;
+  char quote;
+  int n_matched;
+  char entity[REMOVE_WORD_HTML_ENTITY_SIZE];
+  int entity_length;
+} grn_remove_word_html;
+
+static void
+remove_word_html_init(grn_remove_word_html *html)
+{
+  html->state = REMOVE_WORD_HTML_TEXT;
+  html->name_length = 0;
+  html->name_done = GRN_FALSE;
+  html->quote = '\0';
+  html->n_matched = 0;
+  html->entity_length = 0;
+}
+
+static grn_bool
+remove_word_html_name_equal(grn_remove_word_html *html, const char *name)
+{
+  int length = strlen(name);
+  return html->name_length == length &&
+    memcmp(html->name, name, length) == 0;
+}
+
+static int
+remove_word_html_encode_utf8(unsigned long code_point, char *buffer)
+{
+  if (code_point < 0x80) {
+    buffer[0] = code_point;
+    return 1;
+  } else if (code_point < 0x800) {
+    buffer[0] = 0xc0 | (code_point >> 6);
+    buffer[1] = 0x80 | (code_point & 0x3f);
+    return 2;
+  } else if (code_point < 0x10000) {
+    if (code_point >= 0xd800 && code_point <= 0xdfff) {
+      return 0;
+    }
+    buffer[0] = 0xe0 | (code_point >> 12);
+    buffer[1] = 0x80 | ((code_point >> 6) & 0x3f);
+    buffer[2] = 0x80 | (code_point & 0x3f);
+    return 3;
+  } else if (code_point <= 0x10ffff) {
+    buffer[0] = 0xf0 | (code_point >> 18);
+    buffer[1] = 0x80 | ((code_point >> 12) & 0x3f);
+    buffer[2] = 0x80 | ((code_point >> 6) & 0x3f);
+    buffer[3] = 0x80 | (code_point & 0x3f);
+    return 4;
+  }
+  return 0;
+}
+
+static void
+remove_word_html_put_entity(grn_ctx *ctx, grn_remove_word_html *html,
+                            grn_obj *value, grn_bool terminated)
+{
+  static const struct {
+    const char *name;
+    const char *text;
+  } named_entities[] = {
+    {"amp", "&"},
+    {"lt", "<"},
+    {"gt", ">"},
+    {"quot", "\""},
+    {"apos", "'"},
+    {"nbsp", " "}
+  };
+  const char *entity = html->entity;
+  int entity_length = html->entity_length;
+  char decoded[4];
+  int decoded_length = 0;
+  unsigned int i;
+
+  if (terminated && entity_length > 1 && entity[0] == '#') {
+    unsigned long code_point = 0;
+    int base = 10;
+    int start = 1;
+    int j;
+    if (entity[1] == 'x' || entity[1] == 'X') {
+      base = 16;
+      start = 2;
+    }
+    for (j = start; j < entity_length; j++) {
+      int digit;
+      if (isdigit((unsigned char)entity[j])) {
+        digit = entity[j] - '0';
+      } else if (base == 16 && isxdigit((unsigned char)entity[j])) {
+        digit = tolower((unsigned char)entity[j]) - 'a' + 10;
+      } else {
+        break;
+      }
+      code_point = code_point * base + digit;
+      if (code_point > 0x10ffff) {
+        break;
+      }
+    }
+    if (j == entity_length && j > start && code_point > 0) {
+      if (GRN_CTX_GET_ENCODING(ctx) == GRN_ENC_UTF8) {
+        decoded_length = remove_word_html_encode_utf8(code_point, decoded);
+      } else if (code_point < 0x80) {
+        decoded[0] = code_point;
+        decoded_length = 1;
+      }
+    }
+  } else if (terminated) {
+    for (i = 0; i < sizeof(named_entities) / sizeof(named_entities[0]); i++) {
+      if (strlen(named_entities[i].name) == (size_t)entity_length &&
+          strncasecmp(named_entities[i].name, entity, entity_length) == 0) {
+        decoded_length = strlen(named_entities[i].text);
+        memcpy(decoded, named_entities[i].text, decoded_length);
+        break;
+      }
+    }
+  }
+
+  if (decoded_length > 0) {
+    GRN_TEXT_PUT(ctx, value, decoded, decoded_length);
+  } else {
+    GRN_TEXT_PUTC(ctx, value, '&');
+    GRN_TEXT_PUT(ctx, value, entity, entity_length);
+    if (terminated) {
+      GRN_TEXT_PUTC(ctx, value, ';');
+    }
+  }
+}
+
+/* Appends the text of the token that is outside of tags, script/style
+   blocks and comments to value, decoding entities on the way. */
+static void
+remove_word_html_strip(grn_ctx *ctx, grn_remove_word_html *html,
+                       const char *text, int text_length, grn_bool is_last,
+                       grn_obj *value)
+{
+  grn_encoding encoding = GRN_CTX_GET_ENCODING(ctx);
+  const char *rest = text;
+  int rest_length = text_length;
+
+  /* Tokenizers drop the white-space between tokens, so a tag name never
+     continues into the next token. */
+  if (html->state == REMOVE_WORD_HTML_IN_TAG && html->name_length > 0) {
+    html->name_done = GRN_TRUE;
+  }
+
+  while (rest_length > 0) {
+    int char_length;
+    char c;
+
+    char_length = grn_plugin_charlen(ctx, rest, rest_length, encoding);
+    if (char_length == 0) {
+      break;
+    }
+    c = char_length == 1 ? *rest : '\0';
+
+    switch (html->state) {
+    case REMOVE_WORD_HTML_TEXT :
+      if (c == '<') {
+        html->state = REMOVE_WORD_HTML_TAG_OPEN;
+      } else if (c == '&') {
+        html->state = REMOVE_WORD_HTML_IN_ENTITY;
+        html->entity_length = 0;
+      } else {
+        GRN_TEXT_PUT(ctx, value, rest, char_length);
+      }
+      break;
+    case REMOVE_WORD_HTML_TAG_OPEN :
+      if (!(isalpha((unsigned char)c) || c == '/' || c == '!' || c == '?')) {
+        /* "<5" or "a < b" isn't a tag. */
+        GRN_TEXT_PUTC(ctx, value, '<');
+        html->state = REMOVE_WORD_HTML_TEXT;
+        continue;
+      }
+      html->state = REMOVE_WORD_HTML_IN_TAG;
+      html->name[0] = tolower((unsigned char)c);
+      html->name_length = 1;
+      html->name_done = GRN_FALSE;
+      html->quote = '\0';
+      break;
+    case REMOVE_WORD_HTML_IN_TAG :
+      if (html->quote) {
+        if (c == html->quote) {
+          html->quote = '\0';
+        }
+      } else if (c == '>') {
+        if (remove_word_html_name_equal(html, "script")) {
+          html->state = REMOVE_WORD_HTML_IN_SCRIPT;
+        } else if (remove_word_html_name_equal(html, "style")) {
+          html->state = REMOVE_WORD_HTML_IN_STYLE;
+        } else {
+          html->state = REMOVE_WORD_HTML_TEXT;
+        }
+        html->n_matched = 0;
+      } else if (html->name_done) {
+        if (c == '"' || c == '\'') {
+          html->quote = c;
+        }
+      } else if (isspace((unsigned char)c) || c == '/') {
+        html->name_done = GRN_TRUE;
+      } else if (html->name_length < REMOVE_WORD_HTML_NAME_SIZE) {
+        html->name[html->name_length++] = tolower((unsigned char)c);
+        if (remove_word_html_name_equal(html, "!--")) {
+          html->state = REMOVE_WORD_HTML_IN_COMMENT;
+          html->n_matched = 0;
+        }
+      } else {
+        html->name_done = GRN_TRUE;
+      }
+      break;
+    case REMOVE_WORD_HTML_IN_SCRIPT :
+    case REMOVE_WORD_HTML_IN_STYLE :
+      {
+        const char *end_tag;
+        end_tag = html->state == REMOVE_WORD_HTML_IN_SCRIPT ?
+          "</script" : "</style";
+        if (tolower((unsigned char)c) == end_tag[html->n_matched]) {
+          html->n_matched++;
+        } else {
+          html->n_matched = c == '<' ? 1 : 0;
+        }
+        if (end_tag[html->n_matched] == '\0') {
+          html->state = REMOVE_WORD_HTML_IN_TAG;
+          html->name_length = 0;
+          html->name_done = GRN_TRUE;
+          html->quote = '\0';
+        }
+      }
+      break;
+    case REMOVE_WORD_HTML_IN_COMMENT :
+      if (c == '-') {
+        if (html->n_matched < 2) {
+          html->n_matched++;
+        }
+      } else if (c == '>' && html->n_matched == 2) {
+        html->state = REMOVE_WORD_HTML_TEXT;
+      } else {
+        html->n_matched = 0;
+      }
+      break;
+    case REMOVE_WORD_HTML_IN_ENTITY :
+      if (c == ';') {
+        remove_word_html_put_entity(ctx, html, value, GRN_TRUE);
+        html->state = REMOVE_WORD_HTML_TEXT;
+      } else if ((isalnum((unsigned char)c) || c == '#') &&
+                 html->entity_length < REMOVE_WORD_HTML_ENTITY_SIZE) {
+        html->entity[html->entity_length++] = c;
+      } else {
+        remove_word_html_put_entity(ctx, html, value, GRN_FALSE);
+        html->state = REMOVE_WORD_HTML_TEXT;
+        continue;
+      }
+      break;
+    }
+
+    rest += char_length;
+    rest_length -= char_length;
+  }
+
+  if (is_last) {
+    if (html->state == REMOVE_WORD_HTML_TAG_OPEN) {
+      GRN_TEXT_PUTC(ctx, value, '<');
+    } else if (html->state == REMOVE_WORD_HTML_IN_ENTITY) {
+      remove_word_html_put_entity(ctx, html, value, GRN_FALSE);
+    }
+    html->state = REMOVE_WORD_HTML_TEXT;
+  }
+}
+
+typedef struct {
+  grn_tokenizer_token token;
+  grn_obj *table;
+  grn_obj value;
+  grn_bool remove_html;
+  grn_bool remove_html_block;
+  grn_remove_word_html html;
+  grn_bool remove_eos;
+  grn_bool remove_non_en;
+  grn_yatof_memory memory;
+  unsigned int reserved_value_size;
+  grn_yatof_dictionary *dictionary;
+  grn_yatof_flags flags;
+  grn_bool enabled;
+} grn_remove_word_token_filter;
+
+static void *
+remove_word_init(grn_ctx *ctx, grn_obj *table, grn_token_mode mode)
+{
+  grn_remove_word_token_filter *token_filter;
+  const char *remove_word_table_name_env;
+
+  token_filter = GRN_PLUGIN_MALLOC(ctx, sizeof(grn_remove_word_token_filter));
+  if (!token_filter) {
+    GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
+                     "[token-filter][remove-word] "
+                     "failed to allocate grn_remove_word_token_filter");
+    return NULL;
+  }
+  token_filter->enabled = yatof_mode_is_enabled(ctx, table, "remove-word", mode);
+  if (!yatof_flags_open(ctx, &(token_filter->flags), table, "remove-word")) {
+    GRN_PLUGIN_FREE(ctx, token_filter);
+    return NULL;
+  }
+  token_filter->dictionary =
+    yatof_dictionary_open_option(ctx, table, "tokenfilter-remove-word",
+                                 "GRN_YATOF_REMOVE_WORD_DICTIONARY");
+  if (ctx->rc != GRN_SUCCESS) {
+    yatof_flags_fin(ctx, &(token_filter->flags));
+    GRN_PLUGIN_FREE(ctx, token_filter);
+    return NULL;
+  }
+  remove_word_table_name_env = getenv("GRN_YATOF_REMOVE_WORD_TABLE_NAME");
+  if (token_filter->dictionary) {
+    token_filter->table = NULL;
+  } else if (remove_word_table_name_env) {
+    token_filter->table = yatof_table_open(ctx,
+                                           remove_word_table_name_env,
+                                           strlen(remove_word_table_name_env));
+  } else {
+    token_filter->table = yatof_table_open(ctx,
+                                           REMOVE_WORD_TABLE_NAME,
+                                           strlen(REMOVE_WORD_TABLE_NAME));
+  }
+  if (!token_filter->dictionary && !token_filter->table &&
+      !token_filter->flags.column) {
+    GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
+                     "[token-filter][remove-word] "
+                     "couldn't open a table");
+    GRN_PLUGIN_FREE(ctx, token_filter);
+    return NULL;
+  }
+
+  token_filter->remove_html = GRN_FALSE;
+  {
+    if (yatof_words_contain(ctx, token_filter->table,
+                            token_filter->dictionary,
+                            REMOVE_WORD_HTML_TAG, strlen(REMOVE_WORD_HTML_TAG))) {
+      token_filter->remove_html = GRN_TRUE;
+    }
+  }
+  token_filter->remove_html_block = GRN_FALSE;
+  {
+    if (yatof_words_contain(ctx, token_filter->table,
+                            token_filter->dictionary,
+                            REMOVE_WORD_HTML_BLOCK_TAG, strlen(REMOVE_WORD_HTML_BLOCK_TAG))) {
+      token_filter->remove_html_block = GRN_TRUE;
+    }
+  }
+  remove_word_html_init(&(token_filter->html));
+  token_filter->remove_eos = GRN_FALSE;
+  {
+    if (yatof_words_contain(ctx, token_filter->table,
+                            token_filter->dictionary,
+                            REMOVE_WORD_EOS_TAG, strlen(REMOVE_WORD_EOS_TAG))) {
+      token_filter->remove_eos = GRN_TRUE;
+    }
+  }
+  token_filter->remove_non_en = GRN_FALSE;
+  {
+    if (yatof_words_contain(ctx, token_filter->table,
+                            token_filter->dictionary,
+                            REMOVE_WORD_NON_ENGLISH_TAG, strlen(REMOVE_WORD_NON_ENGLISH_TAG))) {
+      token_filter->remove_non_en = GRN_TRUE;
+    }
+  }
+  GRN_TEXT_INIT(&(token_filter->value), 0);
+  yatof_memory_init(ctx, &(token_filter->memory), YATOF_MEMORY_REMOVE_WORD);
+  token_filter->reserved_value_size = 0;
+
+  grn_tokenizer_token_init(ctx, &(token_filter->token));
+
+  return token_filter;
+}
+
+static void
+remove_word_filter(grn_ctx *ctx,
+                   grn_token *current_token,
+                   grn_token *next_token,
+                   void *user_data)
+{
+  grn_remove_word_token_filter *token_filter = user_data;
+  grn_obj *data;
+  grn_tokenizer_status status;
+  if (!token_filter->enabled) {
+    return;
+  }
+  data = grn_token_get_data(ctx, current_token);
+
+  status = grn_token_get_status(ctx, current_token);
+
+  if (token_filter->remove_html_block &&
+      yatof_memory_resize(ctx, &(token_filter->memory),
+                          token_filter->reserved_value_size,
+                          GRN_TEXT_LEN(data))) {
+    const char *value;
+    int value_length;
+
+    if (GRN_TEXT_LEN(data) > token_filter->reserved_value_size) {
+      token_filter->reserved_value_size = GRN_TEXT_LEN(data);
+    }
+
+    GRN_BULK_REWIND(&(token_filter->value));
+    remove_word_html_strip(ctx, &(token_filter->html),
+                           GRN_TEXT_VALUE(data), GRN_TEXT_LEN(data),
+                           (status & GRN_TOKEN_LAST) ? GRN_TRUE : GRN_FALSE,
+                           &(token_filter->value));
+    value = GRN_TEXT_VALUE(&(token_filter->value));
+    value_length = GRN_TEXT_LEN(&(token_filter->value));
+    while (value_length > 0 && value[value_length - 1] == ' ') {
+      value_length--;
+    }
+    grn_token_set_data(ctx, next_token, value, value_length);
+    if (value_length == 0 ||
+        yatof_words_flagged(ctx, &(token_filter->flags),
+                            token_filter->table,
+                            token_filter->dictionary,
+                            value, value_length)) {
+      status |= GRN_TOKEN_SKIP;
+    }
+  } else if (token_filter->remove_html &&
+      yatof_memory_resize(ctx, &(token_filter->memory),
+                          token_filter->reserved_value_size,
+                          GRN_TEXT_LEN(data))) {
+    if (GRN_TEXT_LEN(data) > token_filter->reserved_value_size) {
+      token_filter->reserved_value_size = GRN_TEXT_LEN(data);
+    }
+
+    int char_length;
+    int rest_length = GRN_TEXT_LEN(data);
+    const char *rest = GRN_TEXT_VALUE(data);
+
+    GRN_BULK_REWIND(&(token_filter->value));
+
+    grn_bool in_tag = GRN_FALSE;
+    const char *tag_start = NULL;
+    int tag_length = 0;
+    grn_encoding encoding = GRN_CTX_GET_ENCODING(ctx);
+
+    while (rest_length > 0) {
+      grn_char_type type;
+      char_length = grn_plugin_charlen(ctx, rest, rest_length, encoding);
+      if (char_length == 0) {
+        break;
+      }
+
+      if (!in_tag) {
+        if (*rest == '<') {
+          in_tag = GRN_TRUE;
+          tag_start = rest;
+          tag_length = 0;
+        } else {
+          GRN_TEXT_PUT(ctx, &(token_filter->value), rest, char_length);
+        }
+      } else {
+        if (*rest == '>') {
+          in_tag = GRN_FALSE;
+          tag_length = 0;
+        } else {
+          tag_length += char_length;
+        }
+      }
+
+      rest += char_length;
+      rest_length -= char_length;
+    }
+
+    // Handle case where document ends with an unclosed tag
+    if (in_tag) {
+      const char *p = tag_start;
+      rest_length = GRN_TEXT_LEN(data) - (p - GRN_TEXT_VALUE(data));
+      while (rest_length > 0) {
+        char_length = grn_plugin_charlen(ctx, p, rest_length, encoding);
+        GRN_TEXT_PUT(ctx, &(token_filter->value), p, char_length);
+        p += char_length;
+        rest_length -= char_length;
+      }
+    }
+
+    grn_token_set_data(ctx, next_token,
+                       GRN_TEXT_VALUE(&(token_filter->value)),
+                       GRN_TEXT_LEN(&(token_filter->value)));
+
+    if (yatof_words_flagged(ctx, &(token_filter->flags),
+                            token_filter->table,
+                            token_filter->dictionary,
+                            GRN_TEXT_VALUE(&(token_filter->value)),
+                            GRN_TEXT_LEN(&(token_filter->value)))) {
+      status |= GRN_TOKEN_SKIP;
+    }
+  }
+
+  if (token_filter->remove_eos) {
+    int char_length;
+    int rest_length = GRN_TEXT_LEN(data);
+    const char *rest = GRN_TEXT_VALUE(data);
+
+    if (rest_length >= 4 && (strncmp(rest, "EOS ", 4) == 0 || strncmp(rest, "eos ", 4) == 0)) {
+      status |= GRN_TOKEN_SKIP;
+    }
+  }
+
+  if (token_filter->remove_non_en) {
+    int char_length;
+    int rest_length = GRN_TEXT_LEN(data);
+    const char *rest = GRN_TEXT_VALUE(data);
+    char buf[256];
+    int copy_len = rest_length < 255 ? rest_length : 255;
+    memcpy(buf, rest, copy_len);
+    buf[copy_len] = '\0';
+    if (is_alpha_only(buf) && is_non_english_word(buf)) {
+      status |= GRN_TOKEN_SKIP;
+    }
+  }
+
+  if (yatof_words_flagged(ctx, &(token_filter->flags),
+                          token_filter->table,
+                          token_filter->dictionary,
+                          GRN_TEXT_VALUE(data), GRN_TEXT_LEN(data))) {
+    status |= GRN_TOKEN_SKIP;
+  }
+  grn_token_set_status(ctx, next_token, status);
+}
+
+static void
+remove_word_fin(grn_ctx *ctx, void *user_data)
+{
+  grn_remove_word_token_filter *token_filter = user_data;
+  if (!token_filter) {
+    return;
+  }
+  yatof_flags_fin(ctx, &(token_filter->flags));
+  yatof_dictionary_close(ctx, token_filter->dictionary);
+  if (token_filter->table) {
+    grn_obj_unlink(ctx, token_filter->table);
+  }
+  grn_obj_close(ctx, &(token_filter->value));
+  yatof_memory_fin(ctx, &(token_filter->memory));
+  grn_tokenizer_token_fin(ctx, &(token_filter->token));
+  GRN_PLUGIN_FREE(ctx, token_filter);
+}
+
+typedef struct {
+  grn_tokenizer_token token;
+  grn_obj value;
+  grn_bool enabled;
+} grn_remove_non_english_token_filter;
+
+static void *
+remove_non_english_init(grn_ctx *ctx, grn_obj *table, grn_token_mode mode)
+{
+  grn_remove_non_english_token_filter *token_filter;
+  const char *remove_word_table_name_env;
+
+  token_filter = GRN_PLUGIN_MALLOC(ctx, sizeof(grn_remove_non_english_token_filter));
+  if (!token_filter) {
+    GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
+                     "[token-filter][remove-non-english] "
+                     "failed to allocate grn_remove_non_english_token_filter");
+    return NULL;
+  }
+  token_filter->enabled = yatof_mode_is_enabled(ctx, table, "skip-non-english-alpha", mode);
+  GRN_TEXT_INIT(&(token_filter->value), 0);
+
+  grn_tokenizer_token_init(ctx, &(token_filter->token));
+
+  return token_filter;
+}
+
+static void
+remove_non_english_filter(grn_ctx *ctx,
+                          grn_token *current_token,
+                          grn_token *next_token,
+                          void *user_data)
+{
+  grn_remove_non_english_token_filter *token_filter = user_data;
+  grn_obj *data;
+  grn_tokenizer_status status;
+  if (!token_filter->enabled) {
+    return;
+  }
+  data = grn_token_get_data(ctx, current_token);
+
+  status = grn_token_get_status(ctx, current_token);
+
+  {
+    GRN_BULK_REWIND(&(token_filter->value));
+    GRN_TEXT_SET(ctx, &(token_filter->value), GRN_TEXT_VALUE(data), GRN_TEXT_LEN(data));
+    GRN_TEXT_PUTC(ctx, &(token_filter->value), '\0');
+    if (is_alpha_only(GRN_TEXT_VALUE(&(token_filter->value))) && is_non_english_word(GRN_TEXT_VALUE(&(token_filter->value)))) {
+      status |= GRN_TOKEN_SKIP_WITH_POSITION;
+    }
+  }
+
+  grn_token_set_status(ctx, next_token, status);
+}
+
+static void
+remove_non_english_fin(grn_ctx *ctx, void *user_data)
+{
+  grn_remove_non_english_token_filter *token_filter = user_data;
+  if (!token_filter) {
+    return;
+  }
+  grn_obj_close(ctx, &(token_filter->value));
+  grn_tokenizer_token_fin(ctx, &(token_filter->token));
+  GRN_PLUGIN_FREE(ctx, token_filter);
+}
+
+#define THROUGH_WORD_TABLE_NAME "through_words"
+
+typedef struct {
+  grn_tokenizer_token token;
+  grn_obj *table;
+  grn_obj value;
+  grn_yatof_dictionary *dictionary;
+  grn_bool enabled;
+} grn_through_word_token_filter;
+
+static void *
+through_word_init(grn_ctx *ctx, grn_obj *table, grn_token_mode mode)
+{
+  grn_through_word_token_filter *token_filter;
+  const char *through_word_table_name_env;
+
+  token_filter = GRN_PLUGIN_MALLOC(ctx, sizeof(grn_through_word_token_filter));
+  if (!token_filter) {
+    GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
+                     "[token-filter][through-word] "
+                     "failed to allocate grn_through_word_token_filter");
+    return NULL;
+  }
+  token_filter->enabled = yatof_mode_is_enabled(ctx, table, "through-word", mode);
+  token_filter->dictionary =
+    yatof_dictionary_open_option(ctx, table, "tokenfilter-through-word",
+                                 "GRN_YATOF_THROUGH_WORD_DICTIONARY");
+  if (ctx->rc != GRN_SUCCESS) {
+    GRN_PLUGIN_FREE(ctx, token_filter);
+    return NULL;
+  }
+  through_word_table_name_env = getenv("GRN_YATOF_THROUGH_WORD_TABLE_NAME");
+  if (token_filter->dictionary) {
+    token_filter->table = NULL;
+  } else if (through_word_table_name_env) {
+    token_filter->table = yatof_table_open(ctx,
+                                           through_word_table_name_env,
+                                           strlen(through_word_table_name_env));
+  } else {
+    token_filter->table = yatof_table_open(ctx,
+                                           THROUGH_WORD_TABLE_NAME,
+                                           strlen(THROUGH_WORD_TABLE_NAME));
+  }
+  if (!token_filter->dictionary && !token_filter->table) {
+    GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
+                     "[token-filter][through-word] "
+                     "couldn't open a table");
+    GRN_PLUGIN_FREE(ctx, token_filter);
+    return NULL;
+  }
+
+  grn_tokenizer_token_init(ctx, &(token_filter->token));
+
+  return token_filter;
+}
+
+static void
+through_word_filter(grn_ctx *ctx,
+                   grn_token *current_token,
+                   grn_token *next_token,
+                   void *user_data)
+{
+  grn_through_word_token_filter *token_filter = user_data;
+  grn_obj *data;
+  grn_tokenizer_status status;
+  if (!token_filter->enabled) {
+    return;
+  }
+  data = grn_token_get_data(ctx, current_token);
+
+  {
+    if (!yatof_words_contain(ctx, token_filter->table,
+                             token_filter->dictionary,
+                             GRN_TEXT_VALUE(data), GRN_TEXT_LEN(data))) {
+      status = grn_token_get_status(ctx, current_token);
+      status |= GRN_TOKEN_SKIP_WITH_POSITION;
+      grn_token_set_status(ctx, next_token, status);
+    }
+  }
+}
+
+static void
+through_word_fin(grn_ctx *ctx, void *user_data)
+{
+  grn_through_word_token_filter *token_filter = user_data;
+  if (!token_filter) {
+    return;
+  }
+  yatof_dictionary_close(ctx, token_filter->dictionary);
+  if (token_filter->table) {
+    grn_obj_unlink(ctx, token_filter->table);
+  }
+  grn_tokenizer_token_fin(ctx, &(token_filter->token));
+  GRN_PLUGIN_FREE(ctx, token_filter);
+}
+
+#define SYNONYM_TABLE_NAME "synonyms"
+#define SYNONYM_COLUMN_NAME "synonym"
+
+typedef struct {
+  grn_tokenizer_token token;
+  grn_obj *table;
+  grn_obj *column;
+  grn_obj value;
+  grn_yatof_memory memory;
+  unsigned int reserved_value_size;
+  grn_yatof_dictionary *dictionary;
+  grn_bool enabled;
+} grn_synonym_token_filter;
+
+static void *
+synonym_init(grn_ctx *ctx, grn_obj *table, grn_token_mode mode)
+{
+  grn_synonym_token_filter *token_filter;
+  const char *synonym_table_name_env;
+
+  token_filter = GRN_PLUGIN_MALLOC(ctx, sizeof(grn_synonym_token_filter));
+  if (!token_filter) {
+    GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
+                     "[token-filter][synonym] "
+                     "failed to allocate grn_synonym_token_filter");
+    return NULL;
+  }
+  token_filter->enabled = yatof_mode_is_enabled(ctx, table, "synonym", mode);
+  token_filter->dictionary =
+    yatof_dictionary_open_option(ctx, table, "tokenfilter-synonym",
+                                 "GRN_YATOF_SYNONYM_DICTIONARY");
+  if (ctx->rc != GRN_SUCCESS) {
+    GRN_PLUGIN_FREE(ctx, token_filter);
+    return NULL;
+  }
+  synonym_table_name_env = getenv("GRN_YATOF_SYNONYM_TABLE_NAME");
+  if (token_filter->dictionary) {
+    token_filter->table = NULL;
+  } else if (synonym_table_name_env) {
+    token_filter->table = yatof_table_open(ctx,
+                                           synonym_table_name_env,
+                                           strlen(synonym_table_name_env));
+  } else {
+    token_filter->table = yatof_table_open(ctx,
+                                           SYNONYM_TABLE_NAME,
+                                           strlen(SYNONYM_TABLE_NAME));
+  }
+  if (!token_filter->dictionary && !token_filter->table) {
+    GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
+                     "[token-filter][synonym] "
+                     "couldn't open a table");
+    GRN_PLUGIN_FREE(ctx, token_filter);
+    return NULL;
+  }
+  token_filter->column = NULL;
+  if (token_filter->table) {
+    token_filter->column = grn_obj_column(ctx,
+                                          token_filter->table,
+                                          SYNONYM_COLUMN_NAME,
+                                          strlen(SYNONYM_COLUMN_NAME));
+    yatof_option_digest_add_object(ctx, token_filter->column);
+    if (!token_filter->column) {
+      GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
+                       "[token-filter][synonym] "
+                       "couldn't open synonym column");
+      GRN_PLUGIN_FREE(ctx, token_filter);
+      return NULL;
+    }
+  }
+
+  GRN_TEXT_INIT(&(token_filter->value), 0);
+  yatof_memory_init(ctx, &(token_filter->memory), YATOF_MEMORY_SYNONYM);
+  token_filter->reserved_value_size = 0;
+  grn_tokenizer_token_init(ctx, &(token_filter->token));
+
+  return token_filter;
+}
+
+static void
+synonym_filter(grn_ctx *ctx,
+               grn_token *current_token,
+               grn_token *next_token,
+               void *user_data)
+{
+  grn_synonym_token_filter *token_filter = user_data;
+  grn_obj *data;
+  if (!token_filter->enabled) {
+    return;
+  }
+  data = grn_token_get_data(ctx, current_token);
+
+  if (token_filter->dictionary) {
+    const grn_yatof_dictionary_entry *entry;
+    entry = yatof_dictionary_lookup(token_filter->dictionary,
+                                    GRN_TEXT_VALUE(data), GRN_TEXT_LEN(data));
+    if (entry) {
+      grn_token_set_data(ctx, next_token,
+                         token_filter->dictionary->pool + entry->value_offset,
+                         entry->value_size);
+    }
+    return;
+  }
+
+  {
+    grn_id id;
+    id = grn_table_get(ctx, token_filter->table,
+                       GRN_TEXT_VALUE(data), GRN_TEXT_LEN(data));
+    if (id != GRN_ID_NIL) {
+      GRN_BULK_REWIND(&(token_filter->value));
+      grn_obj_get_value(ctx, token_filter->column, id, &(token_filter->value));
+      if (!yatof_memory_resize(ctx, &(token_filter->memory),
+                               token_filter->reserved_value_size,
+                               GRN_TEXT_LEN(&(token_filter->value)))) {
+        GRN_OBJ_FIN(ctx, &(token_filter->value));
+        GRN_TEXT_INIT(&(token_filter->value), 0);
+        return;
+      }
+      if (GRN_TEXT_LEN(&(token_filter->value)) >
+          token_filter->reserved_value_size) {
+        token_filter->reserved_value_size = GRN_TEXT_LEN(&(token_filter->value));
+      }
+      grn_token_set_data(ctx, next_token,
+                         GRN_TEXT_VALUE(&(token_filter->value)),
+                         GRN_TEXT_LEN(&(token_filter->value)));
+    }
+  }
+}
+
+static void
+synonym_fin(grn_ctx *ctx, void *user_data)
+{
+  grn_synonym_token_filter *token_filter = user_data;
+  if (!token_filter) {
+    return;
+  }
+  yatof_dictionary_close(ctx, token_filter->dictionary);
+  if (token_filter->table) {
+    grn_obj_unlink(ctx, token_filter->table);
+  }
+  if (token_filter->column) {
+    grn_obj_unlink(ctx, token_filter->column);
+  }
+  grn_obj_unlink(ctx, &(token_filter->value));
+  yatof_memory_fin(ctx, &(token_filter->memory));
+  grn_tokenizer_token_fin(ctx, &(token_filter->token));
+  GRN_PLUGIN_FREE(ctx, token_filter);
+}
+
+
+const char *white_table_name = "white_terms";
+uint32_t white_table_name_size = 11;
+
+typedef struct {
+  grn_tokenizer_token token;
+  grn_obj *table;
+  grn_token_mode mode;
+  grn_yatof_dictionary *dictionary;
+  grn_yatof_flags flags;
+  grn_bool enabled;
+} grn_white_token_filter;
+
+static void *
+white_init(grn_ctx *ctx, grn_obj *table, grn_token_mode mode)
+{
+  grn_white_token_filter *token_filter;
+
+  token_filter = GRN_PLUGIN_MALLOC(ctx, sizeof(grn_white_token_filter));
+  if (!token_filter) {
+    GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
+                     "[token-filter][white] "
+                     "failed to allocate grn_white_token_filter");
+    return NULL;
+  }
+  token_filter->enabled = yatof_mode_is_enabled(ctx, table, "white", mode);
+  if (!yatof_flags_open(ctx, &(token_filter->flags), table, "white")) {
+    GRN_PLUGIN_FREE(ctx, token_filter);
+    return NULL;
+  }
+  token_filter->dictionary =
+    yatof_dictionary_open_option(ctx, table, "tokenfilter-white",
+                                 "GRN_YATOF_WHITE_DICTIONARY");
+  if (ctx->rc != GRN_SUCCESS) {
+    yatof_flags_fin(ctx, &(token_filter->flags));
+    GRN_PLUGIN_FREE(ctx, token_filter);
+    return NULL;
+  }
+  token_filter->table = NULL;
+  if (!token_filter->dictionary) {
+    token_filter->table = yatof_table_open(ctx,
+                                           white_table_name,
+                                           white_table_name_size);
+  }
+  if (!token_filter->dictionary && !token_filter->table &&
+      !token_filter->flags.column) {
+    GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
+                     "[token-filter][white] "
+                     "couldn't open a table");
+    GRN_PLUGIN_FREE(ctx, token_filter);
+    return NULL;
+  }
+  token_filter->mode = mode;
+
+  grn_tokenizer_token_init(ctx, &(token_filter->token));
+
+  return token_filter;
+}
+
+static void
+white_filter(grn_ctx *ctx,
+             grn_token *current_token,
+             grn_token *next_token,
+             void *user_data)
+{
+  grn_white_token_filter *token_filter = user_data;
+  grn_obj *data;
+  if (!token_filter->enabled) {
+    return;
+  }
+  data = grn_token_get_data(ctx, current_token);
+
+  {
+    if (!yatof_words_flagged(ctx, &(token_filter->flags),
+                             token_filter->table,
+                             token_filter->dictionary,
+                             GRN_TEXT_VALUE(data), GRN_TEXT_LEN(data))) {
+      grn_tokenizer_status status;
+      status = grn_token_get_status(ctx, current_token);
+      status |= GRN_TOKEN_SKIP;
+      grn_token_set_status(ctx, next_token, status);
+    }
+  }
+}
+
+static void
+white_fin(grn_ctx *ctx, void *user_data)
+{
+  grn_white_token_filter *token_filter = user_data;
+  if (!token_filter) {
+    return;
+  }
+  yatof_flags_fin(ctx, &(token_filter->flags));
+  yatof_dictionary_close(ctx, token_filter->dictionary);
+  if (token_filter->table) {
+    grn_obj_unlink(ctx, token_filter->table);
+  }
+  grn_tokenizer_token_fin(ctx, &(token_filter->token));
+  GRN_PLUGIN_FREE(ctx, token_filter);
+}
+
+#define HIGH_ENTROPY_OPTION_PREFIX "tokenfilter-high-entropy"
+
+typedef enum {
+  HIGH_ENTROPY_NONE,
+  HIGH_ENTROPY_HEX,
+  HIGH_ENTROPY_UUID,
+  HIGH_ENTROPY_BASE64,
+  HIGH_ENTROPY_JWT
+} grn_high_entropy_class;
+
+#define HIGH_ENTROPY_CHAR_DIGIT     (1 << 0)
+#define HIGH_ENTROPY_CHAR_ALPHA     (1 << 1)
+#define HIGH_ENTROPY_CHAR_HEX       (1 << 2)
+#define HIGH_ENTROPY_CHAR_BASE64    (1 << 3)
+#define HIGH_ENTROPY_CHAR_BASE64URL (1 << 4)
+#define HIGH_ENTROPY_CHAR_DOT       (1 << 5)
+#define HIGH_ENTROPY_CHAR_DASH      (1 << 6)
+
+typedef struct {
+  grn_tokenizer_token token;
+  grn_bool fingerprint;
+  unsigned int min_length;
+  unsigned int min_hex_length;
+  unsigned int fingerprint_length;
+  double min_entropy;
+  double min_alternation;
+  grn_bool enabled;
+} grn_high_entropy_token_filter;
+
+static unsigned char high_entropy_char_classes[256];
+
+static void
+high_entropy_char_classes_init(void)
+{
+  int c;
+
+  for (c = 0; c < 256; c++) {
+    unsigned char classes = 0;
+    if (c >= '0' && c <= '9') {
+      classes |= HIGH_ENTROPY_CHAR_DIGIT | HIGH_ENTROPY_CHAR_HEX;
+    } else if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')) {
+      classes |= HIGH_ENTROPY_CHAR_ALPHA;
+      if ((c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F')) {
+        classes |= HIGH_ENTROPY_CHAR_HEX;
+      }
+    }
+    if (classes || c == '+' || c == '/' || c == '=') {
+      classes |= HIGH_ENTROPY_CHAR_BASE64;
+    }
+    if ((classes & (HIGH_ENTROPY_CHAR_DIGIT | HIGH_ENTROPY_CHAR_ALPHA)) ||
+        c == '-' || c == '_' || c == '=') {
+      classes |= HIGH_ENTROPY_CHAR_BASE64URL;
+    }
+    if (c == '.') {
+      classes |= HIGH_ENTROPY_CHAR_DOT;
+    }
+    if (c == '-') {
+      classes |= HIGH_ENTROPY_CHAR_DASH;
+    }
+    high_entropy_char_classes[c] = classes;
+  }
+}
+
+static void *
+high_entropy_init(grn_ctx *ctx, grn_obj *table, grn_token_mode mode)
+{
+#define DEFAULT_MIN_LENGTH 20
+#define DEFAULT_MIN_HEX_LENGTH 12
+#define DEFAULT_FINGERPRINT_LENGTH 6
+#define DEFAULT_MIN_ENTROPY 3.0
+#define DEFAULT_MIN_ALTERNATION 0.1
+  grn_high_entropy_token_filter *token_filter;
+  const char *mode_name;
+  uint32_t mode_name_size;
+
+  token_filter = GRN_PLUGIN_MALLOC(ctx, sizeof(grn_high_entropy_token_filter));
+  if (!token_filter) {
+    GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
+                     "[token-filter][high-entropy] "
+                     "failed to allocate grn_high_entropy_token_filter");
+    return NULL;
+  }
+  token_filter->enabled = yatof_mode_is_enabled(ctx, table, "high-entropy", mode);
+
+  mode_name = yatof_lexicon_option_get(ctx, table,
+                                       HIGH_ENTROPY_OPTION_PREFIX, "mode",
+                                       "GRN_YATOF_HIGH_ENTROPY_MODE",
+                                       &mode_name_size);
+  token_filter->fingerprint =
+    mode_name &&
+    mode_name_size == strlen("fingerprint") &&
+    memcmp(mode_name, "fingerprint", mode_name_size) == 0;
+  token_filter->min_length =
+    yatof_lexicon_option_get_uint64(ctx, table,
+                                    HIGH_ENTROPY_OPTION_PREFIX, "min-length",
+                                    "GRN_YATOF_HIGH_ENTROPY_MIN_LENGTH",
+                                    DEFAULT_MIN_LENGTH);
+  token_filter->min_hex_length =
+    yatof_lexicon_option_get_uint64(ctx, table,
+                                    HIGH_ENTROPY_OPTION_PREFIX, "min-hex-length",
+                                    "GRN_YATOF_HIGH_ENTROPY_MIN_HEX_LENGTH",
+                                    DEFAULT_MIN_HEX_LENGTH);
+  token_filter->fingerprint_length =
+    yatof_lexicon_option_get_uint64(ctx, table,
+                                    HIGH_ENTROPY_OPTION_PREFIX, "fingerprint-length",
+                                    "GRN_YATOF_HIGH_ENTROPY_FINGERPRINT_LENGTH",
+                                    DEFAULT_FINGERPRINT_LENGTH);
+  token_filter->min_entropy =
+    yatof_lexicon_option_get_double(ctx, table,
+                                    HIGH_ENTROPY_OPTION_PREFIX, "min-entropy",
+                                    "GRN_YATOF_HIGH_ENTROPY_MIN_ENTROPY",
+                                    DEFAULT_MIN_ENTROPY);
+  token_filter->min_alternation =
+    yatof_lexicon_option_get_double(ctx, table,
+                                    HIGH_ENTROPY_OPTION_PREFIX, "min-alternation",
+                                    "GRN_YATOF_HIGH_ENTROPY_MIN_ALTERNATION",
+                                    DEFAULT_MIN_ALTERNATION);
+
+  grn_tokenizer_token_init(ctx, &(token_filter->token));
+
+  return token_filter;
+#undef DEFAULT_MIN_LENGTH
+#undef DEFAULT_MIN_HEX_LENGTH
+#undef DEFAULT_FINGERPRINT_LENGTH
+#undef DEFAULT_MIN_ENTROPY
+#undef DEFAULT_MIN_ALTERNATION
+}
+
+/* Classifies the token in one pass: the intersection of the character
+   classes decides the alphabet, the byte histogram gives the Shannon
+   entropy and digit/letter switches give the alternation ratio. */
+static grn_high_entropy_class
+high_entropy_classify(grn_high_entropy_token_filter *token_filter,
+                      const unsigned char *value, unsigned int value_length)
+{
+  unsigned int counts[128];
+  unsigned char all_classes = 0xff;
+  unsigned char any_classes = 0;
+  unsigned char previous_classes = 0;
+  unsigned int n_alternations = 0;
+  unsigned int n_dots = 0;
+  unsigned int i;
+  double entropy = 0.0;
+
+  if (value_length < token_filter->min_hex_length &&
+      value_length < token_filter->min_length) {
+    return HIGH_ENTROPY_NONE;
+  }
+
+  memset(counts, 0, sizeof(counts));
+  for (i = 0; i < value_length; i++) {
+    unsigned char c = value[i];
+    unsigned char classes;
+    if (c >= 128) {
+      return HIGH_ENTROPY_NONE;
+    }
+    classes = high_entropy_char_classes[c];
+    counts[c]++;
+    any_classes |= classes;
+    if (classes & HIGH_ENTROPY_CHAR_DOT) {
+      n_dots++;
+    } else {
+      all_classes &= classes;
+    }
+    if (((classes ^ previous_classes) &
+         (HIGH_ENTROPY_CHAR_DIGIT | HIGH_ENTROPY_CHAR_ALPHA)) ==
+        (HIGH_ENTROPY_CHAR_DIGIT | HIGH_ENTROPY_CHAR_ALPHA)) {
+      n_alternations++;
+    }
+    previous_classes = classes;
+  }
+
+  if (!(any_classes & HIGH_ENTROPY_CHAR_DIGIT) ||
+      !(any_classes & HIGH_ENTROPY_CHAR_ALPHA)) {
+    return HIGH_ENTROPY_NONE;
+  }
+
+  if (value_length == 36 && !(any_classes & HIGH_ENTROPY_CHAR_DOT) &&
+      value[8] == '-' && value[13] == '-' &&
+      value[18] == '-' && value[23] == '-') {
+    for (i = 0; i < value_length; i++) {
+      if (i == 8 || i == 13 || i == 18 || i == 23) {
+        continue;
+      }
+      if (!(high_entropy_char_classes[value[i]] & HIGH_ENTROPY_CHAR_HEX)) {
+        break;
+      }
+    }
+    if (i == value_length) {
+      return HIGH_ENTROPY_UUID;
+    }
+  }
+
+  if ((all_classes & HIGH_ENTROPY_CHAR_HEX) &&
+      !(any_classes & (HIGH_ENTROPY_CHAR_DOT | HIGH_ENTROPY_CHAR_DASH))) {
+    if (value_length >= token_filter->min_hex_length) {
+      return HIGH_ENTROPY_HEX;
+    }
+    return HIGH_ENTROPY_NONE;
+  }
+
+  if (value_length < token_filter->min_length) {
+    return HIGH_ENTROPY_NONE;
+  }
+
+  if (n_dots == 2 && (all_classes & HIGH_ENTROPY_CHAR_BASE64URL) &&
+      value[0] == 'e' && (value[1] == 'y' || value[1] == 'Y') &&
+      value[value_length - 1] != '.') {
+    return HIGH_ENTROPY_JWT;
+  }
+  if (n_dots > 0) {
+    return HIGH_ENTROPY_NONE;
+  }
+  if (!(all_classes & (HIGH_ENTROPY_CHAR_BASE64 | HIGH_ENTROPY_CHAR_BASE64URL))) {
+    return HIGH_ENTROPY_NONE;
+  }
+
+  if ((double)n_alternations / value_length < token_filter->min_alternation) {
+    return HIGH_ENTROPY_NONE;
+  }
+  for (i = 0; i < 128; i++) {
+    if (counts[i] > 0) {
+      double p = (double)counts[i] / value_length;
+      entropy -= p * log2(p);
+    }
+  }
+  if (entropy < token_filter->min_entropy) {
+    return HIGH_ENTROPY_NONE;
+  }
+  return HIGH_ENTROPY_BASE64;
+}
+
+static void
+high_entropy_filter(grn_ctx *ctx,
+                    grn_token *current_token,
+                    grn_token *next_token,
+                    void *user_data)
+{
+  grn_high_entropy_token_filter *token_filter = user_data;
+  grn_obj *data;
+  grn_tokenizer_status status;
+  const char *value;
+  unsigned int value_length;
+
+  if (!token_filter->enabled) {
+    return;
+  }
+  data = grn_token_get_data(ctx, current_token);
+  value = GRN_TEXT_VALUE(data);
+  value_length = GRN_TEXT_LEN(data);
+
+  if (high_entropy_classify(token_filter,
+                            (const unsigned char *)value,
+                            value_length) == HIGH_ENTROPY_NONE) {
+    return;
+  }
+
+  if (token_filter->fingerprint && token_filter->fingerprint_length > 0) {
+    if (value_length > token_filter->fingerprint_length) {
+      grn_token_set_data(ctx, next_token,
+                         value, token_filter->fingerprint_length);
+    }
+    return;
+  }
+
+  status = grn_token_get_status(ctx, current_token);
+  status |= GRN_TOKEN_SKIP_WITH_POSITION;
+  grn_token_set_status(ctx, next_token, status);
+}
+
+static void
+high_entropy_fin(grn_ctx *ctx, void *user_data)
+{
+  grn_high_entropy_token_filter *token_filter = user_data;
+  if (!token_filter) {
+    return;
+  }
+  grn_tokenizer_token_fin(ctx, &(token_filter->token));
+  GRN_PLUGIN_FREE(ctx, token_filter);
+}
+
+#define NUMBER_OPTION_PREFIX "tokenfilter-number"
+#define NUMBER_MAX_N_CHARS 128
+#define NUMBER_MAX_N_RANGES 32
+#define NUMBER_RANGE_NAME_SIZE 32
+
+typedef enum {
+  NUMBER_BUCKET_NONE,
+  NUMBER_BUCKET_MAGNITUDE,
+  NUMBER_BUCKET_RANGES
+} grn_number_bucket;
+
+typedef enum {
+  DATE_BUCKET_DAY,
+  DATE_BUCKET_MONTH,
+  DATE_BUCKET_YEAR
+} grn_date_bucket;
+
+typedef struct {
+  grn_tokenizer_token token;
+  grn_obj value;
+  grn_number_bucket number_bucket;
+  double ranges[NUMBER_MAX_N_RANGES];
+  char range_names[NUMBER_MAX_N_RANGES][NUMBER_RANGE_NAME_SIZE];
+  int n_ranges;
+  grn_date_bucket date_bucket;
+  grn_bool enabled;
+} grn_number_token_filter;
+
+static void
+number_parse_ranges(grn_ctx *ctx, grn_number_token_filter *token_filter,
+                    const char *ranges, uint32_t ranges_size)
+{
+  const char *current = ranges;
+  const char *end = ranges + ranges_size;
+
+  token_filter->n_ranges = 0;
+  while (current < end && token_filter->n_ranges < NUMBER_MAX_N_RANGES) {
+    const char *next = memchr(current, ',', end - current);
+    int length;
+    if (!next) {
+      next = end;
+    }
+    length = next - current;
+    if (length > 0 && length < NUMBER_RANGE_NAME_SIZE) {
+      char *name = token_filter->range_names[token_filter->n_ranges];
+      double boundary;
+      memcpy(name, current, length);
+      name[length] = '\0';
+      boundary = strtod(name, NULL);
+      if (token_filter->n_ranges > 0 &&
+          boundary <= token_filter->ranges[token_filter->n_ranges - 1]) {
+        GRN_PLUGIN_LOG(ctx, GRN_LOG_WARNING,
+                       "[token-filter][number] "
+                       "ignored a range boundary that isn't ascending: <%s>",
+                       name);
+      } else {
+        token_filter->ranges[token_filter->n_ranges++] = boundary;
+      }
+    }
+    current = next + 1;
+  }
+}
+
+static void *
+number_init(grn_ctx *ctx, grn_obj *table, grn_token_mode mode)
+{
+  grn_number_token_filter *token_filter;
+  const char *bucket;
+  uint32_t bucket_size;
+
+  token_filter = GRN_PLUGIN_MALLOC(ctx, sizeof(grn_number_token_filter));
+  if (!token_filter) {
+    GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
+                     "[token-filter][number] "
+                     "failed to allocate grn_number_token_filter");
+    return NULL;
+  }
+  token_filter->enabled = yatof_mode_is_enabled(ctx, table, "number", mode);
+
+  token_filter->number_bucket = NUMBER_BUCKET_NONE;
+  token_filter->n_ranges = 0;
+  bucket = yatof_lexicon_option_get(ctx, table,
+                                    NUMBER_OPTION_PREFIX, "number-bucket",
+                                    "GRN_YATOF_NUMBER_BUCKET",
+                                    &bucket_size);
+  if (bucket && bucket_size > 0) {
+    if (bucket_size == strlen("magnitude") &&
+        memcmp(bucket, "magnitude", bucket_size) == 0) {
+      token_filter->number_bucket = NUMBER_BUCKET_MAGNITUDE;
+    } else if (!(bucket_size == strlen("none") &&
+                 memcmp(bucket, "none", bucket_size) == 0)) {
+      number_parse_ranges(ctx, token_filter, bucket, bucket_size);
+      if (token_filter->n_ranges > 0) {
+        token_filter->number_bucket = NUMBER_BUCKET_RANGES;
+      }
+    }
+  }
+
+  token_filter->date_bucket = DATE_BUCKET_DAY;
+  bucket = yatof_lexicon_option_get(ctx, table,
+                                    NUMBER_OPTION_PREFIX, "date-bucket",
+                                    "GRN_YATOF_DATE_BUCKET",
+                                    &bucket_size);
+  if (bucket) {
+    if (bucket_size == strlen("month") &&
+        memcmp(bucket, "month", bucket_size) == 0) {
+      token_filter->date_bucket = DATE_BUCKET_MONTH;
+    } else if (bucket_size == strlen("year") &&
+               memcmp(bucket, "year", bucket_size) == 0) {
+      token_filter->date_bucket = DATE_BUCKET_YEAR;
+    }
+  }
+
+  GRN_TEXT_INIT(&(token_filter->value), 0);
+  grn_tokenizer_token_init(ctx, &(token_filter->token));
+
+  return token_filter;
+}
+
+/* Returns the value of an ASCII or full-width digit, -1 otherwise. */
+static int
+number_char_digit(uint32_t code_point)
+{
+  if (code_point >= '0' && code_point <= '9') {
+    return code_point - '0';
+  }
+  if (code_point >= 0xff10 && code_point <= 0xff19) {
+    return code_point - 0xff10;
+  }
+  return -1;
+}
+
+/* Returns the value of a kanji numeral, -1 otherwise. */
+static int
+number_char_kanji_digit(uint32_t code_point)
+{
+  switch (code_point) {
+  case 0x3007 : return 0; /* 〇 */
+  case 0x96f6 : return 0; /* 零 */
+  case 0x4e00 : return 1; /* 一 */
+  case 0x4e8c : return 2; /* 二 */
+  case 0x4e09 : return 3; /* 三 */
+  case 0x56db : return 4; /* 四 */
+  case 0x4e94 : return 5; /* 五 */
+  case 0x516d : return 6; /* 六 */
+  case 0x4e03 : return 7; /* 七 */
+  case 0x516b : return 8; /* 八 */
+  case 0x4e5d : return 9; /* 九 */
+  default : return -1;
+  }
+}
+
+static uint64_t
+number_char_kanji_unit(uint32_t code_point)
+{
+  switch (code_point) {
+  case 0x5341 : return 10; /* 十 */
+  case 0x767e : return 100; /* 百 */
+  case 0x5343 : return 1000; /* 千 */
+  case 0x4e07 : return UINT64_C(10000); /* 万 */
+  case 0x5104 : return UINT64_C(100000000); /* 億 */
+  case 0x5146 : return UINT64_C(1000000000000); /* 兆 */
+  default : return 0;
+  }
+}
+
+static int
+number_decode(grn_ctx *ctx, const char *value, int value_length,
+              uint32_t *code_points)
+{
+  grn_encoding encoding = GRN_CTX_GET_ENCODING(ctx);
+  int n_chars = 0;
+
+  while (value_length > 0) {
+    const unsigned char *c = (const unsigned char *)value;
+    int char_length;
+    uint32_t code_point;
+
+    if (n_chars == NUMBER_MAX_N_CHARS) {
+      return -1;
+    }
+    char_length = grn_plugin_charlen(ctx, value, value_length, encoding);
+    if (char_length == 0) {
+      return -1;
+    }
+    if (char_length == 1) {
+      code_point = c[0];
+    } else if (encoding != GRN_ENC_UTF8) {
+      code_point = 0xffffffff;
+    } else if (char_length == 2) {
+      code_point = ((c[0] & 0x1f) << 6) | (c[1] & 0x3f);
+    } else if (char_length == 3) {
+      code_point = ((c[0] & 0x0f) << 12) | ((c[1] & 0x3f) << 6) | (c[2] & 0x3f);
+    } else {
+      code_point = 0xffffffff;
+    }
+    code_points[n_chars++] = code_point;
+    value += char_length;
+    value_length -= char_length;
+  }
+  return n_chars;
+}
+
+/* Reads 1-4 digits at code_points[*i]. */
+static int
+number_read_digits(uint32_t *code_points, int n_chars, int *i, int *n_digits)
+{
+  int value = 0;
+
+  *n_digits = 0;
+  while (*i < n_chars && *n_digits < 4) {
+    int digit = number_char_digit(code_points[*i]);
+    if (digit < 0) {
+      break;
+    }
+    value = value * 10 + digit;
+    (*n_digits)++;
+    (*i)++;
+  }
+  return value;
+}
+
+/* Accepts 2014-01-05, 2014/1/5, 2014.01.05, 2014-01, 2014年1月5日,
+   2014年1月 and 2014年. */
+static grn_bool
+number_put_date(grn_ctx *ctx, grn_number_token_filter *token_filter,
+                uint32_t *code_points, int n_chars, grn_obj *value)
+{
+  int i = 0;
+  int n_digits;
+  int year, month = 0, day = 0;
+  uint32_t separator;
+
+  year = number_read_digits(code_points, n_chars, &i, &n_digits);
+  if (n_digits != 4 || i == n_chars) {
+    return GRN_FALSE;
+  }
+  separator = code_points[i++];
+  if (separator == 0x5e74) { /* 年 */
+    if (i < n_chars) {
+      month = number_read_digits(code_points, n_chars, &i, &n_digits);
+      if (n_digits < 1 || n_digits > 2 ||
+          i == n_chars || code_points[i++] != 0x6708) { /* 月 */
+        return GRN_FALSE;
+      }
+    }
+    if (i < n_chars) {
+      day = number_read_digits(code_points, n_chars, &i, &n_digits);
+      if (n_digits < 1 || n_digits > 2 ||
+          i == n_chars || code_points[i++] != 0x65e5) { /* 日 */
+        return GRN_FALSE;
+      }
+    }
+  } else if (separator == '-' || separator == '/' || separator == '.') {
+    month = number_read_digits(code_points, n_chars, &i, &n_digits);
+    if (n_digits < 1 || n_digits > 2) {
+      return GRN_FALSE;
+    }
+    if (i < n_chars) {
+      if (code_points[i++] != separator) {
+        return GRN_FALSE;
+      }
+      day = number_read_digits(code_points, n_chars, &i, &n_digits);
+      if (n_digits < 1 || n_digits > 2) {
+        return GRN_FALSE;
+      }
+    } else if (separator == '.') {
+      /* 2014.05 is a decimal. */
+      return GRN_FALSE;
+    }
+  } else {
+    return GRN_FALSE;
+  }
+  if (i != n_chars || month > 12 || day > 31 ||
+      (month == 0 && day > 0) ||
+      (month == 0 && separator != 0x5e74)) {
+    return GRN_FALSE;
+  }
+
+  if (month == 0 || token_filter->date_bucket == DATE_BUCKET_YEAR) {
+    grn_text_printf(ctx, value, "%04d", year);
+  } else if (day == 0 || token_filter->date_bucket == DATE_BUCKET_MONTH) {
+    grn_text_printf(ctx, value, "%04d-%02d", year, month);
+  } else {
+    grn_text_printf(ctx, value, "%04d-%02d-%02d", year, month, day);
+  }
+  return GRN_TRUE;
+}
+
+/* Accepts 1234, 1,234, 12.50 and their full-width forms. Leading zeros
+   of the integer part and trailing zeros of the fraction are dropped. */
+static grn_bool
+number_put_arabic(grn_ctx *ctx, uint32_t *code_points, int n_chars,
+                  grn_obj *value)
+{
+  int i;
+  int n_group_digits = 0;
+  grn_bool have_comma = GRN_FALSE;
+  grn_bool in_fraction = GRN_FALSE;
+  unsigned int start = GRN_TEXT_LEN(value);
+  unsigned int fraction_start = 0;
+
+  for (i = 0; i < n_chars; i++) {
+    uint32_t code_point = code_points[i];
+    int digit = number_char_digit(code_point);
+    if (digit >= 0) {
+      if (!in_fraction && GRN_TEXT_LEN(value) == start && digit == 0) {
+        n_group_digits++;
+        continue;
+      }
+      GRN_TEXT_PUTC(ctx, value, '0' + digit);
+      n_group_digits++;
+    } else if ((code_point == ',' || code_point == 0xff0c) && !in_fraction) {
+      if (n_group_digits == 0 || n_group_digits > 3 ||
+          (have_comma && n_group_digits != 3)) {
+        return GRN_FALSE;
+      }
+      have_comma = GRN_TRUE;
+      n_group_digits = 0;
+    } else if ((code_point == '.' || code_point == 0xff0e) && !in_fraction) {
+      if (n_group_digits == 0 || (have_comma && n_group_digits != 3)) {
+        return GRN_FALSE;
+      }
+      if (GRN_TEXT_LEN(value) == start) {
+        GRN_TEXT_PUTC(ctx, value, '0');
+      }
+      in_fraction = GRN_TRUE;
+      fraction_start = GRN_TEXT_LEN(value);
+      GRN_TEXT_PUTC(ctx, value, '.');
+      n_group_digits = 0;
+    } else {
+      return GRN_FALSE;
+    }
+  }
+  if (n_group_digits == 0 || (have_comma && !in_fraction && n_group_digits != 3)) {
+    return GRN_FALSE;
+  }
+
+  if (GRN_TEXT_LEN(value) == start) {
+    GRN_TEXT_PUTC(ctx, value, '0');
+  }
+  if (in_fraction) {
+    const char *text = GRN_TEXT_VALUE(value);
+    unsigned int length = GRN_TEXT_LEN(value);
+    while (length > fraction_start + 1 && text[length - 1] == '0') {
+      length--;
+    }
+    if (length == fraction_start + 1) {
+      length--;
+    }
+    grn_bulk_truncate(ctx, value, length);
+  }
+  return GRN_TRUE;
+}
+
+/* Accepts 三千五百, 二〇一四, 3万 and 1億2000万. */
+static grn_bool
+number_put_kanji(grn_ctx *ctx, uint32_t *code_points, int n_chars,
+                 grn_obj *value)
+{
+  uint64_t total = 0;
+  uint64_t section = 0;
+  uint64_t pending = 0;
+  grn_bool have_pending = GRN_FALSE;
+  grn_bool have_kanji_digit = GRN_FALSE;
+  grn_bool have_unit = GRN_FALSE;
+  uint64_t last_large_unit = 0;
+  int i;
+
+  for (i = 0; i < n_chars; i++) {
+    uint32_t code_point = code_points[i];
+    int digit;
+    uint64_t unit;
+
+    digit = number_char_digit(code_point);
+    if (digit < 0) {
+      digit = number_char_kanji_digit(code_point);
+      if (digit >= 0) {
+        have_kanji_digit = GRN_TRUE;
+      }
+    }
+    if (digit >= 0) {
+      if (pending > UINT64_C(100000000000000000)) {
+        return GRN_FALSE;
+      }
+      pending = pending * 10 + digit;
+      have_pending = GRN_TRUE;
+      continue;
+    }
+
+    unit = number_char_kanji_unit(code_point);
+    if (unit == 0) {
+      return GRN_FALSE;
+    }
+    have_unit = GRN_TRUE;
+    if (unit < 10000) {
+      section += (have_pending ? pending : 1) * unit;
+    } else {
+      if (last_large_unit && unit >= last_large_unit) {
+        return GRN_FALSE;
+      }
+      section += pending;
+      if (section == 0) {
+        /* 万 alone isn't a number. */
+        return GRN_FALSE;
+      }
+      total += section * unit;
+      section = 0;
+      last_large_unit = unit;
+    }
+    pending = 0;
+    have_pending = GRN_FALSE;
+  }
+  if (!have_kanji_digit && !have_unit) {
+    return GRN_FALSE;
+  }
+  total += section + pending;
+  grn_text_printf(ctx, value, "%" PRIu64, total);
+  return GRN_TRUE;
+}
+
+static void
+number_put_bucket(grn_ctx *ctx, grn_number_token_filter *token_filter,
+                  const char *number, unsigned int number_length,
+                  grn_obj *value)
+{
+  if (token_filter->number_bucket == NUMBER_BUCKET_MAGNITUDE) {
+    const char *dot = memchr(number, '.', number_length);
+    unsigned int integer_length = dot ? dot - number : number_length;
+    if (integer_length > 1 || number[0] != '0') {
+      grn_text_printf(ctx, value, "1e%u", integer_length - 1);
+    } else if (dot) {
+      unsigned int n_zeros = 0;
+      while (dot + 1 + n_zeros < number + number_length &&
+             dot[1 + n_zeros] == '0') {
+        n_zeros++;
+      }
+      grn_text_printf(ctx, value, "1e-%u", n_zeros + 1);
+    } else {
+      GRN_TEXT_PUTC(ctx, value, '0');
+    }
+  } else {
+    char buffer[NUMBER_MAX_N_CHARS * 2];
+    double number_value;
+    int i;
+    if (number_length >= sizeof(buffer)) {
+      number_length = sizeof(buffer) - 1;
+    }
+    memcpy(buffer, number, number_length);
+    buffer[number_length] = '\0';
+    number_value = strtod(buffer, NULL);
+    for (i = 0; i < token_filter->n_ranges; i++) {
+      if (number_value < token_filter->ranges[i]) {
+        break;
+      }
+    }
+    if (i > 0) {
+      GRN_TEXT_PUTS(ctx, value, token_filter->range_names[i - 1]);
+    }
+    GRN_TEXT_PUTC(ctx, value, '-');
+    if (i < token_filter->n_ranges) {
+      GRN_TEXT_PUTS(ctx, value, token_filter->range_names[i]);
+    }
+  }
+}
+
+static void
+number_filter(grn_ctx *ctx,
+              grn_token *current_token,
+              grn_token *next_token,
+              void *user_data)
+{
+  grn_number_token_filter *token_filter = user_data;
+  grn_obj *data;
+  grn_obj *value = &(token_filter->value);
+  uint32_t code_points[NUMBER_MAX_N_CHARS];
+  int n_chars;
+
+  if (!token_filter->enabled) {
+    return;
+  }
+  data = grn_token_get_data(ctx, current_token);
+  n_chars = number_decode(ctx, GRN_TEXT_VALUE(data), GRN_TEXT_LEN(data),
+                          code_points);
+  if (n_chars <= 0) {
+    return;
+  }
+
+  GRN_BULK_REWIND(value);
+  if (number_put_date(ctx, token_filter, code_points, n_chars, value)) {
+    grn_token_set_data(ctx, next_token,
+                       GRN_TEXT_VALUE(value), GRN_TEXT_LEN(value));
+    return;
+  }
+
+  GRN_BULK_REWIND(value);
+  if (!number_put_arabic(ctx, code_points, n_chars, value)) {
+    GRN_BULK_REWIND(value);
+    if (!number_put_kanji(ctx, code_points, n_chars, value)) {
+      return;
+    }
+  }
+
+  if (token_filter->number_bucket != NUMBER_BUCKET_NONE) {
+    unsigned int number_length = GRN_TEXT_LEN(value);
+    number_put_bucket(ctx, token_filter,
+                      GRN_TEXT_VALUE(value), number_length, value);
+    grn_token_set_data(ctx, next_token,
+                       GRN_TEXT_VALUE(value) + number_length,
+                       GRN_TEXT_LEN(value) - number_length);
+    return;
+  }
+  grn_token_set_data(ctx, next_token,
+                     GRN_TEXT_VALUE(value), GRN_TEXT_LEN(value));
+}
+
+static void
+number_fin(grn_ctx *ctx, void *user_data)
+{
+  grn_number_token_filter *token_filter = user_data;
+  if (!token_filter) {
+    return;
+  }
+  grn_obj_close(ctx, &(token_filter->value));
+  grn_tokenizer_token_fin(ctx, &(token_filter->token));
+  GRN_PLUGIN_FREE(ctx, token_filter);
+}
+
+#define LEXICON_LIMIT_OPTION_PREFIX "tokenfilter-lexicon-limit"
+
+typedef struct {
+  grn_tokenizer_token token;
+  grn_obj *lexicon;
+  grn_token_mode mode;
+  uint64_t max_n_keys;
+  uint64_t sample_rate;
+  grn_bool reached;
+  unsigned int n_rejected;
+  grn_bool enabled;
+} grn_lexicon_limit_token_filter;
+
+static void *
+lexicon_limit_init(grn_ctx *ctx, grn_obj *table, grn_token_mode mode)
+{
+#define DEFAULT_MAX_N_KEYS 1000000
+  grn_lexicon_limit_token_filter *token_filter;
+
+  token_filter = GRN_PLUGIN_MALLOC(ctx, sizeof(grn_lexicon_limit_token_filter));
+  if (!token_filter) {
+    GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
+                     "[token-filter][lexicon-limit] "
+                     "failed to allocate grn_lexicon_limit_token_filter");
+    return NULL;
+  }
+  token_filter->enabled = yatof_mode_is_enabled(ctx, table, "lexicon-limit", mode);
+  token_filter->lexicon = table;
+  token_filter->mode = mode;
+  token_filter->max_n_keys =
+    yatof_lexicon_option_get_uint64(ctx, table,
+                                    LEXICON_LIMIT_OPTION_PREFIX, "max-keys",
+                                    "GRN_YATOF_LEXICON_LIMIT_MAX_KEYS",
+                                    DEFAULT_MAX_N_KEYS);
+  token_filter->sample_rate =
+    yatof_lexicon_option_get_uint64(ctx, table,
+                                    LEXICON_LIMIT_OPTION_PREFIX, "sample-rate",
+                                    "GRN_YATOF_LEXICON_LIMIT_SAMPLE_RATE",
+                                    0);
+  token_filter->reached = GRN_FALSE;
+  token_filter->n_rejected = 0;
+
+  grn_tokenizer_token_init(ctx, &(token_filter->token));
+
+  return token_filter;
+#undef DEFAULT_MAX_N_KEYS
+}
+
+/* FNV-1a. The same key is always admitted or always rejected, so sampled
+   keys get all of their postings. */
+static grn_bool
+lexicon_limit_is_sampled(grn_lexicon_limit_token_filter *token_filter,
+                         const char *key, unsigned int key_size)
+{
+  uint32_t hash = 2166136261U;
+  unsigned int i;
+
+  if (token_filter->sample_rate == 0) {
+    return GRN_FALSE;
+  }
+  for (i = 0; i < key_size; i++) {
+    hash ^= (unsigned char)key[i];
+    hash *= 16777619U;
+  }
+  return hash % token_filter->sample_rate == 0;
+}
+
+static void
+lexicon_limit_filter(grn_ctx *ctx,
+                     grn_token *current_token,
+                     grn_token *next_token,
+                     void *user_data)
+{
+  grn_lexicon_limit_token_filter *token_filter = user_data;
+  grn_obj *data;
+  grn_tokenizer_status status;
+
+  if (!token_filter->enabled ||
+      token_filter->mode != GRN_TOKEN_ADD ||
+      token_filter->max_n_keys == 0 ||
+      !token_filter->lexicon) {
+    return;
+  }
+  if (!token_filter->reached) {
+    if (grn_table_size(ctx, token_filter->lexicon) <
+        token_filter->max_n_keys) {
+      return;
+    }
+    token_filter->reached = GRN_TRUE;
+  }
+
+  data = grn_token_get_data(ctx, current_token);
+  if (grn_table_get(ctx, token_filter->lexicon,
+                    GRN_TEXT_VALUE(data), GRN_TEXT_LEN(data)) != GRN_ID_NIL) {
+    return;
+  }
+  if (lexicon_limit_is_sampled(token_filter,
+                               GRN_TEXT_VALUE(data), GRN_TEXT_LEN(data))) {
+    return;
+  }
+
+  token_filter->n_rejected++;
+  status = grn_token_get_status(ctx, current_token);
+  status |= GRN_TOKEN_SKIP;
+  grn_token_set_status(ctx, next_token, status);
+}
+
+static void
+lexicon_limit_fin(grn_ctx *ctx, void *user_data)
+{
+  grn_lexicon_limit_token_filter *token_filter = user_data;
+  if (!token_filter) {
+    return;
+  }
+  if (token_filter->n_rejected > 0) {
+    char name[GRN_TABLE_MAX_KEY_SIZE];
+    int name_size;
+    name_size = grn_obj_name(ctx, token_filter->lexicon,
+                             name, GRN_TABLE_MAX_KEY_SIZE);
+    GRN_PLUGIN_LOG(ctx, GRN_LOG_NOTICE,
+                   "[token-filter][lexicon-limit] "
+                   "<%.*s> rejected %u new tokens: "
+                   "reached %" PRIu64 " keys",
+                   name_size, name,
+                   token_filter->n_rejected,
+                   token_filter->max_n_keys);
+  }
+  grn_tokenizer_token_fin(ctx, &(token_filter->token));
+  GRN_PLUGIN_FREE(ctx, token_filter);
+}
+
+#define DOCUMENT_LIMIT_OPTION_PREFIX "tokenfilter-document-limit"
+
+typedef struct {
+  grn_tokenizer_token token;
+  grn_obj *lexicon;
+  grn_token_mode mode;
+  uint64_t max_n_tokens;
+  uint64_t max_n_bytes;
+  uint64_t max_n_positions;
+  uint64_t tail_sample_rate;
+  uint64_t n_tokens;
+  uint64_t n_bytes;
+  uint64_t n_positions;
+  grn_bool reached;
+  uint64_t n_tail_tokens;
+  uint64_t n_tail_kept;
+  grn_bool enabled;
+} grn_document_limit_token_filter;
+
+static void *
+document_limit_init(grn_ctx *ctx, grn_obj *table, grn_token_mode mode)
+{
+#define DEFAULT_MAX_N_TOKENS 1000000
+  grn_document_limit_token_filter *token_filter;
+
+  token_filter = GRN_PLUGIN_MALLOC(ctx, sizeof(grn_document_limit_token_filter));
+  if (!token_filter) {
+    GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
+                     "[token-filter][document-limit] "
+                     "failed to allocate grn_document_limit_token_filter");
+    return NULL;
+  }
+  token_filter->enabled =
+    mode != GRN_TOKEN_GET &&
+    yatof_mode_is_enabled(ctx, table, "document-limit", mode);
+  token_filter->lexicon = table;
+  token_filter->mode = mode;
+  token_filter->max_n_tokens =
+    yatof_lexicon_option_get_uint64(ctx, table,
+                                    DOCUMENT_LIMIT_OPTION_PREFIX, "max-tokens",
+                                    "GRN_YATOF_DOCUMENT_LIMIT_MAX_TOKENS",
+                                    DEFAULT_MAX_N_TOKENS);
+  token_filter->max_n_bytes =
+    yatof_lexicon_option_get_uint64(ctx, table,
+                                    DOCUMENT_LIMIT_OPTION_PREFIX, "max-bytes",
+                                    "GRN_YATOF_DOCUMENT_LIMIT_MAX_BYTES",
+                                    0);
+  token_filter->max_n_positions =
+    yatof_lexicon_option_get_uint64(ctx, table,
+                                    DOCUMENT_LIMIT_OPTION_PREFIX, "max-positions",
+                                    "GRN_YATOF_DOCUMENT_LIMIT_MAX_POSITIONS",
+                                    0);
+  token_filter->tail_sample_rate =
+    yatof_lexicon_option_get_uint64(ctx, table,
+                                    DOCUMENT_LIMIT_OPTION_PREFIX, "tail-sample-rate",
+                                    "GRN_YATOF_DOCUMENT_LIMIT_TAIL_SAMPLE_RATE",
+                                    0);
+  token_filter->n_tokens = 0;
+  token_filter->n_bytes = 0;
+  token_filter->n_positions = 0;
+  token_filter->reached = GRN_FALSE;
+  token_filter->n_tail_tokens = 0;
+  token_filter->n_tail_kept = 0;
+
+  grn_tokenizer_token_init(ctx, &(token_filter->token));
+
+  return token_filter;
+#undef DEFAULT_MAX_N_TOKENS
+}
+
+static void
+document_limit_filter(grn_ctx *ctx,
+                      grn_token *current_token,
+                      grn_token *next_token,
+                      void *user_data)
+{
+  grn_document_limit_token_filter *token_filter = user_data;
+  grn_obj *data;
+  grn_tokenizer_status status;
+
+  if (!token_filter->enabled) {
+    return;
+  }
+  status = grn_token_get_status(ctx, current_token);
+
+  if (!token_filter->reached) {
+    uint64_t n_tokens = token_filter->n_tokens;
+    uint64_t n_bytes = token_filter->n_bytes;
+    uint64_t n_positions = token_filter->n_positions + 1;
+
+    if (status & GRN_TOKEN_SKIP_WITH_POSITION) {
+      return;
+    }
+    if (!(status & GRN_TOKEN_SKIP)) {
+      data = grn_token_get_data(ctx, current_token);
+      n_tokens++;
+      n_bytes += GRN_TEXT_LEN(data);
+    }
+    if ((token_filter->max_n_tokens == 0 ||
+         n_tokens <= token_filter->max_n_tokens) &&
+        (token_filter->max_n_bytes == 0 ||
+         n_bytes <= token_filter->max_n_bytes) &&
+        (token_filter->max_n_positions == 0 ||
+         n_positions <= token_filter->max_n_positions)) {
+      token_filter->n_tokens = n_tokens;
+      token_filter->n_bytes = n_bytes;
+      token_filter->n_positions = n_positions;
+      return;
+    }
+    token_filter->reached = GRN_TRUE;
+  }
+
+  if (token_filter->tail_sample_rate == 0) {
+    status |= GRN_TOKEN_SKIP | GRN_TOKEN_LAST;
+    grn_token_set_status(ctx, next_token, status);
+    return;
+  }
+
+  /* Keeps every Nth token of the rest. The position still advances for
+     the dropped ones so that sampled tokens never look adjacent. */
+  if (token_filter->n_tail_tokens++ % token_filter->tail_sample_rate == 0) {
+    token_filter->n_tail_kept++;
+    return;
+  }
+  status |= GRN_TOKEN_SKIP;
+  grn_token_set_status(ctx, next_token, status);
+}
+
+static void
+document_limit_fin(grn_ctx *ctx, void *user_data)
+{
+  grn_document_limit_token_filter *token_filter = user_data;
+  if (!token_filter) {
+    return;
+  }
+  if (token_filter->reached) {
+    char name[GRN_TABLE_MAX_KEY_SIZE];
+    int name_size;
+    name_size = grn_obj_name(ctx, token_filter->lexicon,
+                             name, GRN_TABLE_MAX_KEY_SIZE);
+    if (token_filter->tail_sample_rate == 0) {
+      GRN_PLUGIN_LOG(ctx, GRN_LOG_NOTICE,
+                     "[token-filter][document-limit] "
+                     "<%.*s> stopped a document at "
+                     "%" PRIu64 " tokens, %" PRIu64 " bytes, "
+                     "%" PRIu64 " positions",
+                     name_size, name,
+                     token_filter->n_tokens,
+                     token_filter->n_bytes,
+                     token_filter->n_positions);
+    } else {
+      GRN_PLUGIN_LOG(ctx, GRN_LOG_NOTICE,
+                     "[token-filter][document-limit] "
+                     "<%.*s> sampled a document after "
+                     "%" PRIu64 " tokens, %" PRIu64 " bytes, "
+                     "%" PRIu64 " positions: "
+                     "kept %" PRIu64 "/%" PRIu64 " tail tokens",
+                     name_size, name,
+                     token_filter->n_tokens,
+                     token_filter->n_bytes,
+                     token_filter->n_positions,
+                     token_filter->n_tail_kept,
+                     token_filter->n_tail_tokens);
+    }
+  }
+  grn_tokenizer_token_fin(ctx, &(token_filter->token));
+  GRN_PLUGIN_FREE(ctx, token_filter);
+}
+
+#define KATAKANA_FOLD_OPTION_PREFIX "tokenfilter-katakana-fold"
+#define KATAKANA_FOLD_BUFFER_SIZE 1024
+#define KATAKANA_FOLD_MIN_LONG_VOWEL_LENGTH 4
+#define KATAKANA_FOLD_BLOCK_START 0x30a0
+#define KATAKANA_FOLD_BLOCK_END 0x3100
+
+typedef enum {
+  KATAKANA_FOLD_LONG_VOWEL_NONE,
+  KATAKANA_FOLD_LONG_VOWEL_TAIL,
+  KATAKANA_FOLD_LONG_VOWEL_ALL
+} grn_katakana_fold_long_vowel;
+
+typedef struct {
+  grn_tokenizer_token token;
+  grn_katakana_fold_long_vowel long_vowel;
+  grn_bool enabled;
+} grn_katakana_fold_token_filter;
+
+/* Canonical forms for U+30A0-U+30FF. NULL keeps the character and ""
+   drops it. Small kana become large ones so that ティ/テイ and
+   キャノン/キヤノン fold together. ッ is kept because it is rarely a
+   variant. */
+static const char *katakana_fold_table[KATAKANA_FOLD_BLOCK_END -
+                                       KATAKANA_FOLD_BLOCK_START] = {
+  /* U+30A0 */ NULL, "ア", NULL, "イ", NULL, "ウ", NULL, "エ",
+  /* U+30A8 */ NULL, "オ", NULL, NULL, NULL, NULL, NULL, NULL,
+  /* U+30B0 */ NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+  /* U+30B8 */ NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+  /* U+30C0 */ NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+  /* U+30C8 */ NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+  /* U+30D0 */ NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+  /* U+30D8 */ NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+  /* U+30E0 */ NULL, NULL, NULL, "ヤ", NULL, "ユ", NULL, "ヨ",
+  /* U+30E8 */ NULL, NULL, NULL, NULL, NULL, NULL, "ワ", NULL,
+  /* U+30F0 */ NULL, NULL, NULL, NULL, "ブ", "カ", "ケ", "バ",
+  /* U+30F8 */ "ビ", "ベ", "ボ", "", NULL, NULL, NULL, NULL
+};
+
+/* ヴ followed by a small vowel. */
+static const struct {
+  uint32_t next;
+  const char *folded;
+} katakana_fold_vu_table[] = {
+  {0x30a1, "バ"}, /* ヴァ */
+  {0x30a3, "ビ"}, /* ヴィ */
+  {0x30a5, "ブ"}, /* ヴゥ */
+  {0x30a7, "ベ"}, /* ヴェ */
+  {0x30a9, "ボ"}, /* ヴォ */
+  {0x30e5, "ビュ"} /* ヴュ */
+};
+
+static void *
+katakana_fold_init(grn_ctx *ctx, grn_obj *table, grn_token_mode mode)
+{
+  grn_katakana_fold_token_filter *token_filter;
+  const char *long_vowel;
+  uint32_t long_vowel_size;
+
+  token_filter = GRN_PLUGIN_MALLOC(ctx, sizeof(grn_katakana_fold_token_filter));
+  if (!token_filter) {
+    GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
+                     "[token-filter][katakana-fold] "
+                     "failed to allocate grn_katakana_fold_token_filter");
+    return NULL;
+  }
+  token_filter->enabled = yatof_mode_is_enabled(ctx, table, "katakana-fold", mode);
+  token_filter->long_vowel = KATAKANA_FOLD_LONG_VOWEL_TAIL;
+  long_vowel = yatof_lexicon_option_get(ctx, table,
+                                        KATAKANA_FOLD_OPTION_PREFIX,
+                                        "long-vowel",
+                                        "GRN_YATOF_KATAKANA_FOLD_LONG_VOWEL",
+                                        &long_vowel_size);
+  if (long_vowel) {
+    if (long_vowel_size == strlen("none") &&
+        memcmp(long_vowel, "none", long_vowel_size) == 0) {
+      token_filter->long_vowel = KATAKANA_FOLD_LONG_VOWEL_NONE;
+    } else if (long_vowel_size == strlen("all") &&
+               memcmp(long_vowel, "all", long_vowel_size) == 0) {
+      token_filter->long_vowel = KATAKANA_FOLD_LONG_VOWEL_ALL;
+    }
+  }
+
+  grn_tokenizer_token_init(ctx, &(token_filter->token));
+
+  return token_filter;
+}
+
+static uint32_t
+katakana_fold_code_point(const unsigned char *c)
+{
+  return ((c[0] & 0x0f) << 12) | ((c[1] & 0x3f) << 6) | (c[2] & 0x3f);
+}
+
+static void
+katakana_fold_filter(grn_ctx *ctx,
+                     grn_token *current_token,
+                     grn_token *next_token,
+                     void *user_data)
+{
+  grn_katakana_fold_token_filter *token_filter = user_data;
+  grn_obj *data;
+  const unsigned char *value;
+  unsigned int value_length;
+  char folded[KATAKANA_FOLD_BUFFER_SIZE];
+  unsigned int folded_length = 0;
+  unsigned int n_chars;
+  unsigned int i;
+
+  if (!token_filter->enabled) {
+    return;
+  }
+  if (GRN_CTX_GET_ENCODING(ctx) != GRN_ENC_UTF8) {
+    return;
+  }
+  data = grn_token_get_data(ctx, current_token);
+  value = (const unsigned char *)GRN_TEXT_VALUE(data);
+  value_length = GRN_TEXT_LEN(data);
+  if (value_length == 0 ||
+      value_length % 3 != 0 ||
+      value_length > KATAKANA_FOLD_BUFFER_SIZE) {
+    return;
+  }
+
+  n_chars = value_length / 3;
+  for (i = 0; i < value_length; i += 3) {
+    uint32_t code_point;
+    if (value[i] != 0xe3 || (value[i + 1] != 0x82 && value[i + 1] != 0x83)) {
+      return;
+    }
+    code_point = katakana_fold_code_point(value + i);
+    if (code_point < 0x30a1 || code_point > 0x30fc) {
+      return;
+    }
+  }
+
+  for (i = 0; i < value_length; i += 3) {
+    uint32_t code_point = katakana_fold_code_point(value + i);
+    const char *replacement;
+
+    if (code_point == 0x30fc) { /* ー */
+      if (token_filter->long_vowel == KATAKANA_FOLD_LONG_VOWEL_ALL ||
+          (token_filter->long_vowel == KATAKANA_FOLD_LONG_VOWEL_TAIL &&
+           i + 3 == value_length &&
+           n_chars >= KATAKANA_FOLD_MIN_LONG_VOWEL_LENGTH)) {
+        continue;
+      }
+    } else if (code_point == 0x30f4 && i + 3 < value_length) { /* ヴ */
+      uint32_t next = katakana_fold_code_point(value + i + 3);
+      unsigned int j;
+      for (j = 0;
+           j < sizeof(katakana_fold_vu_table) / sizeof(katakana_fold_vu_table[0]);
+           j++) {
+        if (katakana_fold_vu_table[j].next == next) {
+          break;
+        }
+      }
+      if (j < sizeof(katakana_fold_vu_table) / sizeof(katakana_fold_vu_table[0])) {
+        replacement = katakana_fold_vu_table[j].folded;
+        memcpy(folded + folded_length, replacement, strlen(replacement));
+        folded_length += strlen(replacement);
+        i += 3;
+        continue;
+      }
+    }
+
+    replacement = katakana_fold_table[code_point - KATAKANA_FOLD_BLOCK_START];
+    if (replacement) {
+      memcpy(folded + folded_length, replacement, strlen(replacement));
+      folded_length += strlen(replacement);
+    } else {
+      memcpy(folded + folded_length, value + i, 3);
+      folded_length += 3;
+    }
+  }
+
+  if (folded_length == 0) {
+    return;
+  }
+  if (folded_length != value_length ||
+      memcmp(folded, value, value_length) != 0) {
+    grn_token_set_data(ctx, next_token, folded, folded_length);
+  }
+}
+
+static void
+katakana_fold_fin(grn_ctx *ctx, void *user_data)
+{
+  grn_katakana_fold_token_filter *token_filter = user_data;
+  if (!token_filter) {
+    return;
+  }
+  grn_tokenizer_token_fin(ctx, &(token_filter->token));
+  GRN_PLUGIN_FREE(ctx, token_filter);
+}
+
+#define YATOF_SHINGLE_MAX_SIZE 64
+#define YATOF_SHINGLE_BASE 1099511628211ULL
+
+/* A polynomial rolling hash over the last size token hashes, so a token
+   is added and dropped in O(1). TokenFilterRepeatedShingle,
+   TokenFilterBoilerplate and yatof_boilerplate_learn must hash tokens
+   the same way. */
+typedef struct {
+  unsigned int size;
+  uint64_t token_hashes[YATOF_SHINGLE_MAX_SIZE];
+  uint64_t hash;
+  uint64_t base_power;
+  uint64_t n_tokens;
+} grn_yatof_shingle;
+
+static void
+yatof_shingle_init(grn_yatof_shingle *shingle, unsigned int size)
+{
+  unsigned int i;
+
+  if (size == 0) {
+    size = 1;
+  } else if (size > YATOF_SHINGLE_MAX_SIZE) {
+    size = YATOF_SHINGLE_MAX_SIZE;
+  }
+  shingle->size = size;
+  shingle->base_power = 1;
+  for (i = 1; i < size; i++) {
+    shingle->base_power *= YATOF_SHINGLE_BASE;
+  }
+  shingle->hash = 0;
+  shingle->n_tokens = 0;
+}
+
+/* Returns GRN_TRUE when shingle->hash covers size tokens. */
+static grn_bool
+yatof_shingle_push(grn_yatof_shingle *shingle,
+                   const char *value, unsigned int value_length)
+{
+  uint64_t token_hash = 14695981039346656037ULL;
+  unsigned int i, slot;
+
+  for (i = 0; i < value_length; i++) {
+    token_hash ^= (unsigned char)value[i];
+    token_hash *= 1099511628211ULL;
+  }
+
+  slot = shingle->n_tokens % shingle->size;
+  if (shingle->n_tokens >= shingle->size) {
+    shingle->hash -= shingle->token_hashes[slot] * shingle->base_power;
+  }
+  shingle->hash = shingle->hash * YATOF_SHINGLE_BASE + token_hash;
+  shingle->token_hashes[slot] = token_hash;
+  shingle->n_tokens++;
+  return shingle->n_tokens >= shingle->size;
+}
+
+#define REPEATED_SHINGLE_OPTION_PREFIX "tokenfilter-repeated-shingle"
+
+typedef struct {
+  grn_tokenizer_token token;
+  grn_obj *table;
+  grn_yatof_memory memory;
+  grn_yatof_shingle shingle;
+  unsigned int n_skipped;
+  grn_bool enabled;
+} grn_repeated_shingle_token_filter;
+
+static void *
+repeated_shingle_init(grn_ctx *ctx, grn_obj *table, grn_token_mode mode)
+{
+#define DEFAULT_SHINGLE_SIZE 8
+  grn_repeated_shingle_token_filter *token_filter;
+  uint64_t shingle_size;
+
+  token_filter = GRN_PLUGIN_MALLOC(ctx, sizeof(grn_repeated_shingle_token_filter));
+  if (!token_filter) {
+    GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
+                     "[token-filter][repeated-shingle] "
+                     "failed to allocate grn_repeated_shingle_token_filter");
+    return NULL;
+  }
+  token_filter->enabled =
+    mode != GRN_TOKEN_GET &&
+    yatof_mode_is_enabled(ctx, table, "repeated-shingle", mode);
+  token_filter->table = NULL;
+  if (token_filter->enabled) {
+    token_filter->table = grn_table_create(ctx, NULL, 0, NULL,
+                                           GRN_OBJ_TABLE_HASH_KEY,
+                                           grn_ctx_at(ctx, GRN_DB_UINT64),
+                                           NULL);
+  }
+  if (token_filter->enabled && !token_filter->table) {
+    GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
+                     "[token-filter][repeated-shingle] "
+                     "couldn't create a table");
+    GRN_PLUGIN_FREE(ctx, token_filter);
+    return NULL;
+  }
+  shingle_size =
+    yatof_lexicon_option_get_uint64(ctx, table,
+                                    REPEATED_SHINGLE_OPTION_PREFIX, "size",
+                                    "GRN_YATOF_REPEATED_SHINGLE_SIZE",
+                                    DEFAULT_SHINGLE_SIZE);
+  yatof_shingle_init(&(token_filter->shingle), shingle_size);
+  token_filter->n_skipped = 0;
+  yatof_memory_init(ctx, &(token_filter->memory), YATOF_MEMORY_REPEATED_SHINGLE);
+  grn_tokenizer_token_init(ctx, &(token_filter->token));
+
+  return token_filter;
+#undef DEFAULT_SHINGLE_SIZE
+}
+
+/* A repeat is found when its shingle ends, so the first size - 1 tokens
+   of each repeated run are still indexed. */
+static void
+repeated_shingle_filter(grn_ctx *ctx,
+                        grn_token *current_token,
+                        grn_token *next_token,
+                        void *user_data)
+{
+  grn_repeated_shingle_token_filter *token_filter = user_data;
+  grn_obj *data;
+  grn_tokenizer_status status;
+
+  if (!token_filter->enabled) {
+    return;
+  }
+  status = grn_token_get_status(ctx, current_token);
+  if (status & (GRN_TOKEN_SKIP | GRN_TOKEN_SKIP_WITH_POSITION)) {
+    return;
+  }
+  data = grn_token_get_data(ctx, current_token);
+  if (!yatof_shingle_push(&(token_filter->shingle),
+                          GRN_TEXT_VALUE(data), GRN_TEXT_LEN(data))) {
+    return;
+  }
+
+  if (grn_table_get(ctx, token_filter->table,
+                    &(token_filter->shingle.hash),
+                    sizeof(uint64_t)) != GRN_ID_NIL) {
+    status |= GRN_TOKEN_SKIP;
+    grn_token_set_status(ctx, next_token, status);
+    token_filter->n_skipped++;
+  } else {
+    yatof_memory_table_add(ctx, &(token_filter->memory),
+                           token_filter->table,
+                           (const char *)&(token_filter->shingle.hash),
+                           sizeof(uint64_t), NULL);
+  }
+}
+
+static void
+repeated_shingle_fin(grn_ctx *ctx, void *user_data)
+{
+  grn_repeated_shingle_token_filter *token_filter = user_data;
+  if (!token_filter) {
+    return;
+  }
+  if (token_filter->n_skipped > 0) {
+    GRN_PLUGIN_LOG(ctx, GRN_LOG_INFO,
+                   "[token-filter][repeated-shingle] "
+                   "skipped %u of %" PRIu64 " tokens in repeated %u-token runs",
+                   token_filter->n_skipped, token_filter->shingle.n_tokens,
+                   token_filter->shingle.size);
+  }
+  if (token_filter->table) {
+    grn_obj_unlink(ctx, token_filter->table);
+  }
+  yatof_memory_fin(ctx, &(token_filter->memory));
+  grn_tokenizer_token_fin(ctx, &(token_filter->token));
+  GRN_PLUGIN_FREE(ctx, token_filter);
+}
+
+#define BOILERPLATE_OPTION_PREFIX "tokenfilter-boilerplate"
+#define BOILERPLATE_TABLE_NAME "boilerplate_shingles"
+#define BOILERPLATE_TEXT_COLUMN_NAME "text"
+#define BOILERPLATE_N_DOCUMENTS_COLUMN_NAME "n_documents"
+#define BOILERPLATE_DEFAULT_SIZE 8
+
+typedef struct {
+  grn_tokenizer_token token;
+  grn_obj *table;
+  grn_yatof_shingle shingle;
+  unsigned int n_skipped;
+  grn_bool enabled;
+} grn_boilerplate_token_filter;
+
+static void *
+boilerplate_init(grn_ctx *ctx, grn_obj *table, grn_token_mode mode)
+{
+  grn_boilerplate_token_filter *token_filter;
+  const char *table_name;
+  uint32_t table_name_size;
+  uint64_t shingle_size;
+
+  token_filter = GRN_PLUGIN_MALLOC(ctx, sizeof(grn_boilerplate_token_filter));
+  if (!token_filter) {
+    GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
+                     "[token-filter][boilerplate] "
+                     "failed to allocate grn_boilerplate_token_filter");
+    return NULL;
+  }
+  token_filter->enabled =
+    mode != GRN_TOKEN_GET &&
+    yatof_mode_is_enabled(ctx, table, "boilerplate", mode);
+  table_name = yatof_lexicon_option_get(ctx, table, BOILERPLATE_OPTION_PREFIX,
+                                        "table",
+                                        "GRN_YATOF_BOILERPLATE_TABLE_NAME",
+                                        &table_name_size);
+  if (table_name) {
+    token_filter->table = yatof_table_open(ctx, table_name, table_name_size);
+  } else {
+    token_filter->table = yatof_table_open(ctx,
+                                           BOILERPLATE_TABLE_NAME,
+                                           strlen(BOILERPLATE_TABLE_NAME));
+  }
+  if (!token_filter->table) {
+    GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
+                     "[token-filter][boilerplate] "
+                     "couldn't open a table");
+    GRN_PLUGIN_FREE(ctx, token_filter);
+    return NULL;
+  }
+  shingle_size =
+    yatof_lexicon_option_get_uint64(ctx, table,
+                                    BOILERPLATE_OPTION_PREFIX, "size",
+                                    "GRN_YATOF_BOILERPLATE_SIZE",
+                                    BOILERPLATE_DEFAULT_SIZE);
+  yatof_shingle_init(&(token_filter->shingle), shingle_size);
+  token_filter->n_skipped = 0;
+  grn_tokenizer_token_init(ctx, &(token_filter->token));
+
+  return token_filter;
+}
+
+/* Tokens already skipped by earlier filters are not part of shingles, as
+   in yatof_boilerplate_learn. */
+static void
+boilerplate_filter(grn_ctx *ctx,
+                   grn_token *current_token,
+                   grn_token *next_token,
+                   void *user_data)
+{
+  grn_boilerplate_token_filter *token_filter = user_data;
+  grn_obj *data;
+  grn_tokenizer_status status;
+
+  if (!token_filter->enabled) {
+    return;
+  }
+  status = grn_token_get_status(ctx, current_token);
+  if (status & (GRN_TOKEN_SKIP | GRN_TOKEN_SKIP_WITH_POSITION)) {
+    return;
+  }
+  data = grn_token_get_data(ctx, current_token);
+  if (!yatof_shingle_push(&(token_filter->shingle),
+                          GRN_TEXT_VALUE(data), GRN_TEXT_LEN(data))) {
+    return;
+  }
+
+  if (grn_table_get(ctx, token_filter->table,
+                    &(token_filter->shingle.hash),
+                    sizeof(uint64_t)) != GRN_ID_NIL) {
+    status |= GRN_TOKEN_SKIP;
+    grn_token_set_status(ctx, next_token, status);
+    token_filter->n_skipped++;
+  }
+}
+
+static void
+boilerplate_fin(grn_ctx *ctx, void *user_data)
+{
+  grn_boilerplate_token_filter *token_filter = user_data;
+  if (!token_filter) {
+    return;
+  }
+  if (token_filter->n_skipped > 0) {
+    GRN_PLUGIN_LOG(ctx, GRN_LOG_INFO,
+                   "[token-filter][boilerplate] "
+                   "skipped %u of %" PRIu64 " tokens in boilerplate runs",
+                   token_filter->n_skipped, token_filter->shingle.n_tokens);
+  }
+  if (token_filter->table) {
+    grn_obj_unlink(ctx, token_filter->table);
+  }
+  grn_tokenizer_token_fin(ctx, &(token_filter->token));
+  GRN_PLUGIN_FREE(ctx, token_filter);
+}
+
+#define SCRIPT_OPTION_PREFIX "tokenfilter-script"
+
+typedef enum {
+  YATOF_SCRIPT_COMMON,
+  YATOF_SCRIPT_LATIN,
+  YATOF_SCRIPT_GREEK,
+  YATOF_SCRIPT_CYRILLIC,
+  YATOF_SCRIPT_ARMENIAN,
+  YATOF_SCRIPT_HEBREW,
+  YATOF_SCRIPT_ARABIC,
+  YATOF_SCRIPT_DEVANAGARI,
+  YATOF_SCRIPT_THAI,
+  YATOF_SCRIPT_GEORGIAN,
+  YATOF_SCRIPT_HANGUL,
+  YATOF_SCRIPT_HIRAGANA,
+  YATOF_SCRIPT_KATAKANA,
+  YATOF_SCRIPT_HAN,
+  YATOF_SCRIPT_MATH,
+  YATOF_SCRIPT_OTHER,
+  YATOF_SCRIPT_N_SCRIPTS
+} grn_yatof_script;
+
+static const char *yatof_script_names[YATOF_SCRIPT_N_SCRIPTS] = {
+  "common",
+  "latin",
+  "greek",
+  "cyrillic",
+  "armenian",
+  "hebrew",
+  "arabic",
+  "devanagari",
+  "thai",
+  "georgian",
+  "hangul",
+  "hiragana",
+  "katakana",
+  "han",
+  "math",
+  "other"
+};
+
+/* Sorted and non-overlapping. Code points not listed here are common:
+   digits, punctuation, spaces and symbols never decide a script. */
+static const struct {
+  uint32_t start;
+  uint32_t end;
+  grn_yatof_script script;
+} yatof_script_ranges[] = {
+  { 0x00041, 0x0005a, YATOF_SCRIPT_LATIN },
+  { 0x00061, 0x0007a, YATOF_SCRIPT_LATIN },
+  { 0x000c0, 0x000d6, YATOF_SCRIPT_LATIN },
+  { 0x000d8, 0x000f6, YATOF_SCRIPT_LATIN },
+  { 0x000f8, 0x002af, YATOF_SCRIPT_LATIN },
+  { 0x00370, 0x003ff, YATOF_SCRIPT_GREEK },
+  { 0x00400, 0x0052f, YATOF_SCRIPT_CYRILLIC },
+  { 0x00530, 0x0058f, YATOF_SCRIPT_ARMENIAN },
+  { 0x00590, 0x005ff, YATOF_SCRIPT_HEBREW },
+  { 0x00600, 0x006ff, YATOF_SCRIPT_ARABIC },
+  { 0x00700, 0x0074f, YATOF_SCRIPT_OTHER },
+  { 0x00750, 0x0077f, YATOF_SCRIPT_ARABIC },
+  { 0x00780, 0x008ff, YATOF_SCRIPT_OTHER },
+  { 0x00900, 0x0097f, YATOF_SCRIPT_DEVANAGARI },
+  { 0x00980, 0x00dff, YATOF_SCRIPT_OTHER },
+  { 0x00e00, 0x00e7f, YATOF_SCRIPT_THAI },
+  { 0x00e80, 0x0109f, YATOF_SCRIPT_OTHER },
+  { 0x010a0, 0x010ff, YATOF_SCRIPT_GEORGIAN },
+  { 0x01100, 0x011ff, YATOF_SCRIPT_HANGUL },
+  { 0x01200, 0x01cff, YATOF_SCRIPT_OTHER },
+  { 0x01d00, 0x01dbf, YATOF_SCRIPT_LATIN },
+  { 0x01e00, 0x01eff, YATOF_SCRIPT_LATIN },
+  { 0x01f00, 0x01fff, YATOF_SCRIPT_GREEK },
+  { 0x02200, 0x022ff, YATOF_SCRIPT_MATH },
+  { 0x027c0, 0x027ef, YATOF_SCRIPT_MATH },
+  { 0x02980, 0x02aff, YATOF_SCRIPT_MATH },
+  { 0x02c60, 0x02c7f, YATOF_SCRIPT_LATIN },
+  { 0x02d00, 0x02d2f, YATOF_SCRIPT_GEORGIAN },
+  { 0x02de0, 0x02dff, YATOF_SCRIPT_CYRILLIC },
+  { 0x02e80, 0x02fdf, YATOF_SCRIPT_HAN },
+  { 0x03005, 0x03005, YATOF_SCRIPT_HAN },
+  { 0x03007, 0x03007, YATOF_SCRIPT_HAN },
+  { 0x03041, 0x0309f, YATOF_SCRIPT_HIRAGANA },
+  { 0x030a1, 0x030fa, YATOF_SCRIPT_KATAKANA },
+  { 0x030fd, 0x030ff, YATOF_SCRIPT_KATAKANA },
+  { 0x03130, 0x0318f, YATOF_SCRIPT_HANGUL },
+  { 0x031f0, 0x031ff, YATOF_SCRIPT_KATAKANA },
+  { 0x03400, 0x04dbf, YATOF_SCRIPT_HAN },
+  { 0x04e00, 0x09fff, YATOF_SCRIPT_HAN },
+  { 0x0a000, 0x0a4ff, YATOF_SCRIPT_OTHER },
+  { 0x0a640, 0x0a69f, YATOF_SCRIPT_CYRILLIC },
+  { 0x0a720, 0x0a7ff, YATOF_SCRIPT_LATIN },
+  { 0x0ac00, 0x0d7af, YATOF_SCRIPT_HANGUL },
+  { 0x0f900, 0x0faff, YATOF_SCRIPT_HAN },
+  { 0x0fb1d, 0x0fb4f, YATOF_SCRIPT_HEBREW },
+  { 0x0fb50, 0x0fdff, YATOF_SCRIPT_ARABIC },
+  { 0x0fe70, 0x0feff, YATOF_SCRIPT_ARABIC },
+  { 0x0ff21, 0x0ff3a, YATOF_SCRIPT_LATIN },
+  { 0x0ff41, 0x0ff5a, YATOF_SCRIPT_LATIN },
+  { 0x0ff66, 0x0ff6f, YATOF_SCRIPT_KATAKANA },
+  { 0x0ff71, 0x0ff9d, YATOF_SCRIPT_KATAKANA },
+  { 0x0ffa0, 0x0ffdc, YATOF_SCRIPT_HANGUL },
+  { 0x10000, 0x1d3ff, YATOF_SCRIPT_OTHER },
+  { 0x1d400, 0x1d7ff, YATOF_SCRIPT_MATH },
+  { 0x20000, 0x3134f, YATOF_SCRIPT_HAN }
+};
+
+typedef enum {
+  SCRIPT_CLASSIFY_MAJORITY,
+  SCRIPT_CLASSIFY_FIRST
+} grn_script_classify;
+
+typedef struct {
+  grn_tokenizer_token token;
+  grn_bool enabled;
+  uint32_t allowed;
+  uint32_t denied;
+  grn_script_classify classify;
+} grn_script_token_filter;
+
+static uint32_t
+script_parse_names(const char *names, uint32_t names_size)
+{
+  const char *names_end = names + names_size;
+  uint32_t scripts = 0;
+
+  while (names < names_end) {
+    const char *next = names;
+    int i;
+    while (next < names_end && *next != ',' && *next != '|') {
+      next++;
+    }
+    for (i = 0; i < YATOF_SCRIPT_N_SCRIPTS; i++) {
+      if ((size_t)(next - names) == strlen(yatof_script_names[i]) &&
+          memcmp(names, yatof_script_names[i], next - names) == 0) {
+        scripts |= 1U << i;
+        break;
+      }
+    }
+    names = next + 1;
+  }
+  return scripts;
+}
+
+static void *
+script_init(grn_ctx *ctx, grn_obj *table, grn_token_mode mode)
+{
+  grn_script_token_filter *token_filter;
+  const char *value;
+  uint32_t value_size;
+
+  token_filter = GRN_PLUGIN_MALLOC(ctx, sizeof(grn_script_token_filter));
+  if (!token_filter) {
+    GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
+                     "[token-filter][script] "
+                     "failed to allocate grn_script_token_filter");
+    return NULL;
+  }
+  token_filter->enabled = yatof_mode_is_enabled(ctx, table, "script", mode);
+  token_filter->allowed = 0;
+  token_filter->denied = 0;
+  token_filter->classify = SCRIPT_CLASSIFY_MAJORITY;
+
+  value = yatof_lexicon_option_get(ctx, table, SCRIPT_OPTION_PREFIX, "allow",
+                                   "GRN_YATOF_SCRIPT_ALLOW", &value_size);
+  if (value) {
+    token_filter->allowed = script_parse_names(value, value_size);
+  }
+  value = yatof_lexicon_option_get(ctx, table, SCRIPT_OPTION_PREFIX, "deny",
+                                   "GRN_YATOF_SCRIPT_DENY", &value_size);
+  if (value) {
+    token_filter->denied = script_parse_names(value, value_size);
+  }
+  value = yatof_lexicon_option_get(ctx, table, SCRIPT_OPTION_PREFIX,
+                                   "classify", "GRN_YATOF_SCRIPT_CLASSIFY",
+                                   &value_size);
+  if (value && value_size == strlen("first") &&
+      memcmp(value, "first", value_size) == 0) {
+    token_filter->classify = SCRIPT_CLASSIFY_FIRST;
+  }
+  if (!token_filter->allowed && !token_filter->denied) {
+    token_filter->enabled = GRN_FALSE;
+  }
+
+  grn_tokenizer_token_init(ctx, &(token_filter->token));
+
+  return token_filter;
+}
+
+static grn_yatof_script
+script_lookup(uint32_t code_point)
+{
+  int low = 0;
+  int high = sizeof(yatof_script_ranges) / sizeof(yatof_script_ranges[0]) - 1;
+
+  while (low <= high) {
+    int middle = (low + high) / 2;
+    if (code_point < yatof_script_ranges[middle].start) {
+      high = middle - 1;
+    } else if (code_point > yatof_script_ranges[middle].end) {
+      low = middle + 1;
+    } else {
+      return yatof_script_ranges[middle].script;
+    }
+  }
+  return YATOF_SCRIPT_COMMON;
+}
+
+static uint32_t
+script_code_point(const unsigned char *c, int char_length)
+{
+  switch (char_length) {
+  case 1 :
+    return c[0];
+  case 2 :
+    return ((c[0] & 0x1f) << 6) | (c[1] & 0x3f);
+  case 3 :
+    return ((c[0] & 0x0f) << 12) | ((c[1] & 0x3f) << 6) | (c[2] & 0x3f);
+  case 4 :
+    return ((c[0] & 0x07) << 18) | ((c[1] & 0x3f) << 12) |
+      ((c[2] & 0x3f) << 6) | (c[3] & 0x3f);
+  default :
+    return 0;
+  }
+}
+
+static void
+script_filter(grn_ctx *ctx,
+              grn_token *current_token,
+              grn_token *next_token,
+              void *user_data)
+{
+  grn_script_token_filter *token_filter = user_data;
+  grn_obj *data;
+  grn_tokenizer_status status;
+  unsigned int counts[YATOF_SCRIPT_N_SCRIPTS];
+  unsigned int max_count = 0;
+  grn_yatof_script script = YATOF_SCRIPT_COMMON;
+  int char_length;
+  int rest_length;
+  const char *rest;
+
+  if (!token_filter->enabled) {
+    return;
+  }
+  if (GRN_CTX_GET_ENCODING(ctx) != GRN_ENC_UTF8) {
+    return;
+  }
+  data = grn_token_get_data(ctx, current_token);
+  rest = GRN_TEXT_VALUE(data);
+  rest_length = GRN_TEXT_LEN(data);
+
+  memset(counts, 0, sizeof(counts));
+  while (rest_length > 0) {
+    grn_yatof_script char_script;
+    char_length = grn_plugin_charlen(ctx, rest, rest_length, GRN_ENC_UTF8);
+    if (char_length == 0) {
+      break;
+    }
+    char_script =
+      script_lookup(script_code_point((const unsigned char *)rest,
+                                      char_length));
+    rest += char_length;
+    rest_length -= char_length;
+    if (char_script == YATOF_SCRIPT_COMMON) {
+      continue;
+    }
+    if (token_filter->classify == SCRIPT_CLASSIFY_FIRST) {
+      script = char_script;
+      break;
+    }
+    /* On a tie the script that reached the count first wins. */
+    counts[char_script]++;
+    if (counts[char_script] > max_count) {
+      max_count = counts[char_script];
+      script = char_script;
+    }
+  }
+  if (script == YATOF_SCRIPT_COMMON) {
+    return;
+  }
+
+  if ((token_filter->denied & (1U << script)) ||
+      (token_filter->allowed && !(token_filter->allowed & (1U << script)))) {
+    status = grn_token_get_status(ctx, current_token);
+    status |= GRN_TOKEN_SKIP_WITH_POSITION;
+    grn_token_set_status(ctx, next_token, status);
+  }
+}
+
+static void
+script_fin(grn_ctx *ctx, void *user_data)
+{
+  grn_script_token_filter *token_filter = user_data;
+  if (!token_filter) {
+    return;
+  }
+  grn_tokenizer_token_fin(ctx, &(token_filter->token));
+  GRN_PLUGIN_FREE(ctx, token_filter);
+}
+
+#define URL_OPTION_PREFIX "tokenfilter-url"
+#define URL_KEEP_DOMAINS_TABLE_NAME "url_keep_domains"
+#define URL_DEFAULT_MAX_SPAN 32
+#define URL_HOST_SIZE 256
+
+typedef enum {
+  URL_TOKEN_ALPHA,
+  URL_TOKEN_DIGIT,
+  URL_TOKEN_ALNUM,
+  URL_TOKEN_SYMBOL,
+  URL_TOKEN_OTHER
+} grn_url_token_kind;
+
+typedef enum {
+  URL_STATE_NONE,
+  URL_STATE_SCHEME,
+  URL_STATE_LABEL,
+  URL_STATE_HOST,
+  URL_STATE_PATH
+} grn_url_state;
+
+typedef struct {
+  grn_tokenizer_token token;
+  grn_obj *keep_domains;
+  unsigned int max_span;
+  grn_url_state state;
+  grn_url_token_kind previous_kind;
+  unsigned int n_span_tokens;
+  grn_bool keep;
+  char host[URL_HOST_SIZE];
+  unsigned int host_size;
+  unsigned int n_dots;
+  grn_bool enabled;
+} grn_url_token_filter;
+
+/* Labels that appear in most host names and select nothing. */
+static const char *url_generic_labels[] = {
+  "www", "com", "net", "org", "edu", "gov", "mil", "int", "info", "biz",
+  "io", "co", "ne", "or", "ac", "go", "ed", "lg", "gr", "ad",
+  "jp", "uk", "us", "de", "fr", "cn", "kr", "tw", "ru", "au", "ca",
+  NULL
+};
+
+static const char *url_generic_path_words[] = {
+  "index", "html", "htm", "php", "asp", "aspx", "jsp", "cgi",
+  NULL
+};
+
+static const char *url_schemes[] = {
+  "http", "https", "ftp", "mailto",
+  NULL
+};
+
+static void *
+url_init(grn_ctx *ctx, grn_obj *table, grn_token_mode mode)
+{
+  grn_url_token_filter *token_filter;
+  const char *table_name;
+  uint32_t table_name_size;
+
+  token_filter = GRN_PLUGIN_MALLOC(ctx, sizeof(grn_url_token_filter));
+  if (!token_filter) {
+    GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
+                     "[token-filter][url] "
+                     "failed to allocate grn_url_token_filter");
+    return NULL;
+  }
+  token_filter->enabled = yatof_mode_is_enabled(ctx, table, "url", mode);
+  table_name = yatof_lexicon_option_get(ctx, table, URL_OPTION_PREFIX,
+                                        "keep-domains-table",
+                                        "GRN_YATOF_URL_KEEP_DOMAINS_TABLE_NAME",
+                                        &table_name_size);
+  if (table_name) {
+    token_filter->keep_domains = yatof_table_open(ctx, table_name,
+                                                  table_name_size);
+  } else {
+    token_filter->keep_domains =
+      yatof_table_open(ctx,
+                       URL_KEEP_DOMAINS_TABLE_NAME,
+                       strlen(URL_KEEP_DOMAINS_TABLE_NAME));
+  }
+  token_filter->max_span =
+    yatof_lexicon_option_get_uint64(ctx, table, URL_OPTION_PREFIX,
+                                    "max-span", "GRN_YATOF_URL_MAX_SPAN",
+                                    URL_DEFAULT_MAX_SPAN);
+  token_filter->state = URL_STATE_NONE;
+  token_filter->previous_kind = URL_TOKEN_OTHER;
+  token_filter->n_span_tokens = 0;
+  token_filter->keep = GRN_FALSE;
+  token_filter->host_size = 0;
+  token_filter->n_dots = 0;
+
+  grn_tokenizer_token_init(ctx, &(token_filter->token));
+
+  return token_filter;
+}
+
+static grn_url_token_kind
+url_token_kind(const char *value, unsigned int value_length)
+{
+  unsigned int n_alphas = 0;
+  unsigned int n_digits = 0;
+  unsigned int i;
+
+  if (value_length == 0) {
+    return URL_TOKEN_OTHER;
+  }
+  for (i = 0; i < value_length; i++) {
+    unsigned char c = value[i];
+    if (c >= 0x80 || c <= ' ') {
+      return URL_TOKEN_OTHER;
+    }
+    if (isalpha(c)) {
+      n_alphas++;
+    } else if (isdigit(c)) {
+      n_digits++;
+    }
+  }
+  if (n_alphas + n_digits == 0) {
+    return URL_TOKEN_SYMBOL;
+  }
+  if (n_alphas + n_digits < value_length) {
+    return URL_TOKEN_OTHER;
+  }
+  if (n_digits == 0) {
+    return URL_TOKEN_ALPHA;
+  }
+  if (n_alphas == 0) {
+    return URL_TOKEN_DIGIT;
+  }
+  return URL_TOKEN_ALNUM;
+}
+
+static grn_bool
+url_is_word(grn_url_token_kind kind)
+{
+  return kind == URL_TOKEN_ALPHA ||
+    kind == URL_TOKEN_DIGIT ||
+    kind == URL_TOKEN_ALNUM;
+}
+
+static grn_bool
+url_words_contain(const char **words, const char *value,
+                  unsigned int value_length)
+{
+  int i;
+
+  for (i = 0; words[i]; i++) {
+    if (strlen(words[i]) == value_length &&
+        strncasecmp(words[i], value, value_length) == 0) {
+      return GRN_TRUE;
+    }
+  }
+  return GRN_FALSE;
+}
+
+static grn_bool
+url_symbol_contains_any(const char *value, unsigned int value_length,
+                        const char *chars)
+{
+  unsigned int i;
+
+  for (i = 0; i < value_length; i++) {
+    if (strchr(chars, value[i])) {
+      return GRN_TRUE;
+    }
+  }
+  return GRN_FALSE;
+}
+
+static void
+url_host_append(grn_url_token_filter *token_filter,
+                const char *value, unsigned int value_length)
+{
+  if (token_filter->host_size + value_length > URL_HOST_SIZE) {
+    return;
+  }
+  memcpy(token_filter->host + token_filter->host_size, value, value_length);
+  token_filter->host_size += value_length;
+}
+
+/* Matches the host read so far and each of its parent domains, so
+   docs.example.org is kept by example.org. */
+static grn_bool
+url_host_is_kept(grn_ctx *ctx, grn_url_token_filter *token_filter)
+{
+  unsigned int start = 0;
+
+  if (!token_filter->keep_domains || token_filter->host_size == 0) {
+    return GRN_FALSE;
+  }
+  while (start < token_filter->host_size) {
+    const char *dot;
+    if (grn_table_get(ctx, token_filter->keep_domains,
+                      token_filter->host + start,
+                      token_filter->host_size - start) != GRN_ID_NIL) {
+      return GRN_TRUE;
+    }
+    dot = memchr(token_filter->host + start, '.',
+                 token_filter->host_size - start);
+    if (!dot) {
+      break;
+    }
+    start = dot - token_filter->host + 1;
+  }
+  return GRN_FALSE;
+}
+
+static void
+url_reset(grn_url_token_filter *token_filter)
+{
+  token_filter->state = URL_STATE_NONE;
+  token_filter->n_span_tokens = 0;
+  token_filter->keep = GRN_FALSE;
+  token_filter->host_size = 0;
+  token_filter->n_dots = 0;
+}
+
+static void
+url_start_host(grn_url_token_filter *token_filter)
+{
+  token_filter->state = URL_STATE_HOST;
+  token_filter->n_span_tokens = 0;
+  token_filter->keep = GRN_FALSE;
+  token_filter->host_size = 0;
+}
+
+/* Returns GRN_TRUE when the token is a generic part of a URL or an
+   e-mail address. A span starts with a scheme, "://", "@", "www" or a
+   host name such as example.co.jp, and ends at a non-ASCII token, an
+   unexpected symbol, two words in a row or after max-span tokens. A
+   filter can't see the spaces between tokens, so "it. Or" looks like a
+   host name. Labels after a bare "." are kept until a third label made
+   of letters confirms the host name. */
+static grn_bool
+url_is_generic(grn_ctx *ctx, grn_url_token_filter *token_filter,
+               const char *value, unsigned int value_length)
+{
+  grn_url_token_kind kind = url_token_kind(value, value_length);
+  grn_url_token_kind previous_kind = token_filter->previous_kind;
+  grn_bool is_word = url_is_word(kind);
+
+  token_filter->previous_kind = kind;
+
+  if (token_filter->state != URL_STATE_NONE) {
+    if (kind == URL_TOKEN_OTHER ||
+        token_filter->n_span_tokens >= token_filter->max_span ||
+        (is_word && url_is_word(previous_kind) &&
+         !((kind == URL_TOKEN_ALPHA && previous_kind == URL_TOKEN_DIGIT) ||
+           (kind == URL_TOKEN_DIGIT && previous_kind == URL_TOKEN_ALPHA)))) {
+      url_reset(token_filter);
+    } else {
+      token_filter->n_span_tokens++;
+    }
+  }
+
+  switch (token_filter->state) {
+  case URL_STATE_SCHEME :
+    if (kind == URL_TOKEN_SYMBOL && value[0] == ':') {
+      url_start_host(token_filter);
+      return GRN_TRUE;
+    }
+    url_reset(token_filter);
+    break;
+  case URL_STATE_LABEL :
+    if (is_word) {
+      url_host_append(token_filter, value, value_length);
+      if (token_filter->n_dots < 2) {
+        return GRN_FALSE;
+      }
+      if (kind != URL_TOKEN_ALPHA) {
+        url_reset(token_filter);
+        return GRN_FALSE;
+      }
+      token_filter->state = URL_STATE_HOST;
+      token_filter->keep = url_host_is_kept(ctx, token_filter);
+      if (token_filter->keep) {
+        return GRN_FALSE;
+      }
+      return url_words_contain(url_generic_labels, value, value_length);
+    }
+    if (value_length == 1 && value[0] == '.' && url_is_word(previous_kind)) {
+      url_host_append(token_filter, value, value_length);
+      token_filter->n_dots++;
+      return GRN_FALSE;
+    }
+    url_reset(token_filter);
+    break;
+  case URL_STATE_HOST :
+    if (is_word) {
+      url_host_append(token_filter, value, value_length);
+      if (!token_filter->keep) {
+        token_filter->keep = url_host_is_kept(ctx, token_filter);
+      }
+      if (token_filter->keep) {
+        return GRN_FALSE;
+      }
+      return url_words_contain(url_generic_labels, value, value_length);
+    }
+    if (url_symbol_contains_any(value, value_length, "/?#")) {
+      token_filter->state = URL_STATE_PATH;
+      return GRN_TRUE;
+    }
+    if (value_length == 1 && value[0] == '@') {
+      token_filter->host_size = 0;
+      return GRN_TRUE;
+    }
+    if (!url_symbol_contains_any(value, value_length, ",;()<>\"'[]{}|\\^`!*")) {
+      url_host_append(token_filter, value, value_length);
+      return GRN_TRUE;
+    }
+    url_reset(token_filter);
+    return GRN_FALSE;
+  case URL_STATE_PATH :
+    if (is_word) {
+      if (token_filter->keep) {
+        return GRN_FALSE;
+      }
+      return url_words_contain(url_generic_path_words, value, value_length);
+    }
+    if (!url_symbol_contains_any(value, value_length, ",;()<>\"'[]{}|\\^`!*")) {
+      return GRN_TRUE;
+    }
+    url_reset(token_filter);
+    return GRN_FALSE;
+  default :
+    break;
+  }
+
+  if (is_word) {
+    if (url_words_contain(url_schemes, value, value_length)) {
+      token_filter->state = URL_STATE_SCHEME;
+      token_filter->n_span_tokens = 0;
+      return GRN_TRUE;
+    }
+    if (value_length == 3 && strncasecmp(value, "www", 3) == 0) {
+      url_start_host(token_filter);
+      return GRN_TRUE;
+    }
+    token_filter->host_size = 0;
+    url_host_append(token_filter, value, value_length);
+    return GRN_FALSE;
+  }
+  if (kind == URL_TOKEN_SYMBOL) {
+    if (value_length >= 3 && memcmp(value, "://", 3) == 0) {
+      url_start_host(token_filter);
+      return GRN_TRUE;
+    }
+    if (value_length == 1 && value[0] == '@') {
+      url_start_host(token_filter);
+      return GRN_TRUE;
+    }
+    if (value_length == 1 && value[0] == '.' && url_is_word(previous_kind)) {
+      /* The word before the dot still belongs to the host name, e.g.
+         docs in docs.example.org. */
+      token_filter->state = URL_STATE_LABEL;
+      token_filter->n_span_tokens = 0;
+      token_filter->n_dots = 1;
+      url_host_append(token_filter, value, value_length);
+      return GRN_FALSE;
+    }
+  }
+  return GRN_FALSE;
+}
+
+static void
+url_filter(grn_ctx *ctx,
+           grn_token *current_token,
+           grn_token *next_token,
+           void *user_data)
+{
+  grn_url_token_filter *token_filter = user_data;
+  grn_obj *data;
+  grn_tokenizer_status status;
+
+  if (!token_filter->enabled) {
+    return;
+  }
+  data = grn_token_get_data(ctx, current_token);
+  if (url_is_generic(ctx, token_filter,
+                     GRN_TEXT_VALUE(data), GRN_TEXT_LEN(data))) {
+    status = grn_token_get_status(ctx, current_token);
+    status |= GRN_TOKEN_SKIP_WITH_POSITION;
+    grn_token_set_status(ctx, next_token, status);
+  }
+}
+
+static void
+url_fin(grn_ctx *ctx, void *user_data)
+{
+  grn_url_token_filter *token_filter = user_data;
+  if (!token_filter) {
+    return;
+  }
+  if (token_filter->keep_domains) {
+    grn_obj_unlink(ctx, token_filter->keep_domains);
+  }
+  grn_tokenizer_token_fin(ctx, &(token_filter->token));
+  GRN_PLUGIN_FREE(ctx, token_filter);
+}
+
+#define BIGRAM_THIN_OPTION_PREFIX "tokenfilter-bigram-thin"
+
+/* A bigram inside a run is dropped when the top bit of its hash is set
+   and that of the previous bigram is not. The verdict only depends on the two
+   bigrams, so a query sees the same verdicts as the document except for
+   its first bigram, and two neighbouring bigrams are never both dropped.
+   A filter can't look ahead, so a bigram is only dropped once the run
+   already has min_run characters: runs shorter than that, such as most
+   words of two or three characters, are kept whole. */
+typedef struct {
+  grn_tokenizer_token token;
+  grn_bool enabled;
+  grn_token_mode mode;
+  uint32_t scripts;
+  uint64_t min_run;
+  grn_bool in_run;
+  uint64_t run_length;
+  grn_bool previous_droppable;
+  char previous_last[4];
+  int previous_last_length;
+} grn_bigram_thin_token_filter;
+
+static void *
+bigram_thin_init(grn_ctx *ctx, grn_obj *table, grn_token_mode mode)
+{
+#define DEFAULT_MIN_RUN 4
+  grn_bigram_thin_token_filter *token_filter;
+  const char *value;
+  uint32_t value_size;
+
+  token_filter = GRN_PLUGIN_MALLOC(ctx, sizeof(grn_bigram_thin_token_filter));
+  if (!token_filter) {
+    GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
+                     "[token-filter][bigram-thin] "
+                     "failed to allocate grn_bigram_thin_token_filter");
+    return NULL;
+  }
+  token_filter->enabled = yatof_mode_is_enabled(ctx, table, "bigram-thin",
+                                                mode);
+  token_filter->mode = mode;
+  token_filter->scripts =
+    (1U << YATOF_SCRIPT_HAN) | (1U << YATOF_SCRIPT_KATAKANA);
+  value = yatof_lexicon_option_get(ctx, table, BIGRAM_THIN_OPTION_PREFIX,
+                                   "scripts", "GRN_YATOF_BIGRAM_THIN_SCRIPTS",
+                                   &value_size);
+  if (value) {
+    token_filter->scripts = script_parse_names(value, value_size);
+  }
+  token_filter->min_run =
+    yatof_lexicon_option_get_uint64(ctx, table, BIGRAM_THIN_OPTION_PREFIX,
+                                    "min-run", "GRN_YATOF_BIGRAM_THIN_MIN_RUN",
+                                    DEFAULT_MIN_RUN);
+  token_filter->in_run = GRN_FALSE;
+  token_filter->run_length = 0;
+  token_filter->previous_droppable = GRN_FALSE;
+  token_filter->previous_last_length = 0;
+
+  grn_tokenizer_token_init(ctx, &(token_filter->token));
+
+  return token_filter;
+#undef DEFAULT_MIN_RUN
+}
+
+static grn_bool
+bigram_thin_is_droppable(const char *value, unsigned int value_length)
+{
+  uint64_t hash = 14695981039346656037ULL;
+  unsigned int i;
+
+  for (i = 0; i < value_length; i++) {
+    hash ^= (unsigned char)value[i];
+    hash *= 1099511628211ULL;
+  }
+  /* Not the low bit, which for FNV-1a follows the parity of the
+     bytes. */
+  return (hash >> 63) ? GRN_TRUE : GRN_FALSE;
+}
+
+static void
+bigram_thin_filter(grn_ctx *ctx,
+                   grn_token *current_token,
+                   grn_token *next_token,
+                   void *user_data)
+{
+  grn_bigram_thin_token_filter *token_filter = user_data;
+  grn_obj *data;
+  grn_tokenizer_status status;
+  const char *value;
+  int value_length;
+  int first_length;
+  int last_length;
+  grn_yatof_script first_script;
+  grn_yatof_script last_script;
+  grn_bool continued;
+  grn_bool droppable;
+
+  if (!token_filter->enabled) {
+    return;
+  }
+  if (GRN_CTX_GET_ENCODING(ctx) != GRN_ENC_UTF8) {
+    return;
+  }
+  data = grn_token_get_data(ctx, current_token);
+  value = GRN_TEXT_VALUE(data);
+  value_length = GRN_TEXT_LEN(data);
+
+  first_length = grn_plugin_charlen(ctx, value, value_length, GRN_ENC_UTF8);
+  if (first_length == 0 || first_length >= value_length) {
+    token_filter->in_run = GRN_FALSE;
+    return;
+  }
+  last_length = grn_plugin_charlen(ctx, value + first_length,
+                                   value_length - first_length, GRN_ENC_UTF8);
+  if (last_length == 0 || first_length + last_length != value_length) {
+    token_filter->in_run = GRN_FALSE;
+    return;
+  }
+  /* Common characters such as the prolonged sound mark join the run. */
+  first_script = script_lookup(script_code_point((const unsigned char *)value,
+                                                 first_length));
+  last_script =
+    script_lookup(script_code_point((const unsigned char *)value + first_length,
+                                    last_length));
+  if (first_script == YATOF_SCRIPT_COMMON) {
+    first_script = last_script;
+  } else if (last_script == YATOF_SCRIPT_COMMON) {
+    last_script = first_script;
+  }
+  if (first_script != last_script ||
+      first_script == YATOF_SCRIPT_COMMON ||
+      !(token_filter->scripts & (1U << first_script))) {
+    token_filter->in_run = GRN_FALSE;
+    return;
+  }
+
+  continued = token_filter->in_run &&
+    token_filter->previous_last_length == first_length &&
+    memcmp(token_filter->previous_last, value, first_length) == 0;
+  if (continued) {
+    token_filter->run_length++;
+  } else {
+    token_filter->run_length = 2;
+  }
+  droppable = bigram_thin_is_droppable(value, value_length);
+
+  status = grn_token_get_status(ctx, current_token);
+  if (continued) {
+    /* A query doesn't know how far into the run of the document it
+       starts, so it doesn't use any bigram that may be dropped there. */
+    if (droppable && !token_filter->previous_droppable &&
+        (token_filter->mode == GRN_TOKEN_GET ||
+         token_filter->run_length >= token_filter->min_run)) {
+      status |= GRN_TOKEN_SKIP;
+    } else if (token_filter->mode == GRN_TOKEN_GET) {
+      /* The bigram that n-gram search would use instead may be dropped. */
+      status &= ~GRN_TOKEN_OVERLAP;
+    }
+    grn_token_set_status(ctx, next_token, status);
+  } else if (token_filter->mode == GRN_TOKEN_GET &&
+             droppable && !(status & GRN_TOKEN_LAST)) {
+    /* The document may have a bigram before this one in the same run. */
+    status |= GRN_TOKEN_SKIP;
+    grn_token_set_status(ctx, next_token, status);
+  }
+
+  token_filter->in_run = GRN_TRUE;
+  token_filter->previous_droppable = droppable;
+  memcpy(token_filter->previous_last, value + first_length, last_length);
+  token_filter->previous_last_length = last_length;
+}
+
+static void
+bigram_thin_fin(grn_ctx *ctx, void *user_data)
+{
+  grn_bigram_thin_token_filter *token_filter = user_data;
+  if (!token_filter) {
+    return;
+  }
+  grn_tokenizer_token_fin(ctx, &(token_filter->token));
+  GRN_PLUGIN_FREE(ctx, token_filter);
+}
+
+/* Only the keys are kept, so a repeated token costs a single lookup in
+   the hash table instead of the get and set of a counter. */
+typedef struct {
+  grn_tokenizer_token token;
+  grn_obj *table;
+  grn_yatof_memory memory;
+  uint64_t n_skipped;
+  grn_bool enabled;
+} grn_unique_token_filter;
+
+static void *
+unique_init(grn_ctx *ctx, grn_obj *table, grn_token_mode mode)
+{
+  grn_unique_token_filter *token_filter;
+
+  token_filter = GRN_PLUGIN_MALLOC(ctx, sizeof(grn_unique_token_filter));
+  if (!token_filter) {
+    GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
+                     "[token-filter][unique] "
+                     "failed to allocate grn_unique_token_filter");
+    return NULL;
+  }
+  token_filter->enabled = yatof_mode_is_enabled(ctx, table, "unique", mode);
+  token_filter->table = NULL;
+  if (token_filter->enabled) {
+    token_filter->table = grn_table_create(ctx, NULL, 0, NULL,
+                                           GRN_OBJ_TABLE_HASH_KEY,
+                                           grn_ctx_at(ctx, GRN_DB_SHORT_TEXT),
+                                           NULL);
+    if (!token_filter->table) {
+      GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
+                       "[token-filter][unique] "
+                       "couldn't create a table");
+      GRN_PLUGIN_FREE(ctx, token_filter);
+      return NULL;
+    }
+  }
+  token_filter->n_skipped = 0;
+
+  yatof_memory_init(ctx, &(token_filter->memory), YATOF_MEMORY_UNIQUE);
+  grn_tokenizer_token_init(ctx, &(token_filter->token));
+
+  return token_filter;
+}
+
+static void
+unique_filter(grn_ctx *ctx,
+              grn_token *current_token,
+              grn_token *next_token,
+              void *user_data)
+{
+  grn_unique_token_filter *token_filter = user_data;
+  grn_obj *data;
+  grn_tokenizer_status status;
+  grn_id id;
+  int added = 0;
+
+  if (!token_filter->enabled) {
+    return;
+  }
+  data = grn_token_get_data(ctx, current_token);
+  if (GRN_TEXT_LEN(data) == 0 ||
+      GRN_TEXT_LEN(data) > GRN_TABLE_MAX_KEY_SIZE) {
+    return;
+  }
+
+  id = yatof_memory_table_add(ctx, &(token_filter->memory),
+                              token_filter->table,
+                              GRN_TEXT_VALUE(data), GRN_TEXT_LEN(data),
+                              &added);
+  if (id != GRN_ID_NIL && !added) {
+    status = grn_token_get_status(ctx, current_token);
+    status |= GRN_TOKEN_SKIP_WITH_POSITION;
+    grn_token_set_status(ctx, next_token, status);
+    token_filter->n_skipped++;
+  }
+}
+
+static void
+unique_fin(grn_ctx *ctx, void *user_data)
+{
+  grn_unique_token_filter *token_filter = user_data;
+  if (!token_filter) {
+    return;
+  }
+  if (token_filter->n_skipped > 0) {
+    GRN_PLUGIN_LOG(ctx, GRN_LOG_DEBUG,
+                   "[token-filter][unique] "
+                   "skipped %" PRIu64 " repeated tokens",
+                   token_filter->n_skipped);
+  }
+  if (token_filter->table) {
+    grn_obj_unlink(ctx, token_filter->table);
+  }
+  yatof_memory_fin(ctx, &(token_filter->memory));
+  grn_tokenizer_token_fin(ctx, &(token_filter->token));
+  GRN_PLUGIN_FREE(ctx, token_filter);
+}
+
+#define JUNK_OPTION_PREFIX "tokenfilter-junk"
+
+/* Looks at the first n_samples tokens of a document and skips the rest
+   when too many of them are symbols, non-English alphabet words or too
+   long. The verdict is taken as soon as the outcome is certain, so the
+   checks run on at most n_samples tokens per document. */
+typedef struct {
+  grn_tokenizer_token token;
+  grn_obj *lexicon;
+  grn_obj value;
+  uint64_t n_samples;
+  uint64_t n_junk_threshold;
+  uint64_t max_length;
+  uint64_t n_tokens;
+  uint64_t n_junk;
+  grn_bool decided;
+  grn_bool aborted;
+  grn_bool enabled;
+} grn_junk_token_filter;
+
+static void *
+junk_init(grn_ctx *ctx, grn_obj *table, grn_token_mode mode)
+{
+#define DEFAULT_N_SAMPLES 256
+#define DEFAULT_RATIO 0.5
+#define DEFAULT_MAX_LENGTH 32
+  grn_junk_token_filter *token_filter;
+  double ratio;
+
+  token_filter = GRN_PLUGIN_MALLOC(ctx, sizeof(grn_junk_token_filter));
+  if (!token_filter) {
+    GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
+                     "[token-filter][junk] "
+                     "failed to allocate grn_junk_token_filter");
+    return NULL;
+  }
+  token_filter->enabled =
+    mode != GRN_TOKEN_GET &&
+    yatof_mode_is_enabled(ctx, table, "junk", mode);
+  token_filter->lexicon = table;
+  token_filter->n_samples =
+    yatof_lexicon_option_get_uint64(ctx, table, JUNK_OPTION_PREFIX,
+                                    "samples", "GRN_YATOF_JUNK_SAMPLES",
+                                    DEFAULT_N_SAMPLES);
+  ratio =
+    yatof_lexicon_option_get_double(ctx, table, JUNK_OPTION_PREFIX,
+                                    "ratio", "GRN_YATOF_JUNK_RATIO",
+                                    DEFAULT_RATIO);
+  token_filter->max_length =
+    yatof_lexicon_option_get_uint64(ctx, table, JUNK_OPTION_PREFIX,
+                                    "max-length", "GRN_YATOF_JUNK_MAX_LENGTH",
+                                    DEFAULT_MAX_LENGTH);
+  if (token_filter->n_samples == 0 || ratio <= 0.0 || ratio > 1.0) {
+    token_filter->enabled = GRN_FALSE;
+    ratio = DEFAULT_RATIO;
+  }
+  token_filter->n_junk_threshold =
+    (uint64_t)ceil(ratio * token_filter->n_samples);
+  if (token_filter->n_junk_threshold == 0) {
+    token_filter->n_junk_threshold = 1;
+  }
+  token_filter->n_tokens = 0;
+  token_filter->n_junk = 0;
+  token_filter->decided = GRN_FALSE;
+  token_filter->aborted = GRN_FALSE;
+
+  GRN_TEXT_INIT(&(token_filter->value), 0);
+  grn_tokenizer_token_init(ctx, &(token_filter->token));
+
+  return token_filter;
+#undef DEFAULT_N_SAMPLES
+#undef DEFAULT_RATIO
+#undef DEFAULT_MAX_LENGTH
+}
+
+static grn_bool
+junk_is_junk(grn_ctx *ctx, grn_junk_token_filter *token_filter,
+             const char *value, unsigned int value_length)
+{
+  if (token_filter->max_length > 0 && value_length > token_filter->max_length) {
+    return GRN_TRUE;
+  }
+  if (is_symbol_only(ctx, value, value_length)) {
+    return GRN_TRUE;
+  }
+  GRN_BULK_REWIND(&(token_filter->value));
+  GRN_TEXT_PUT(ctx, &(token_filter->value), value, value_length);
+  GRN_TEXT_PUTC(ctx, &(token_filter->value), '\0');
+  return is_alpha_only(GRN_TEXT_VALUE(&(token_filter->value))) &&
+    is_non_english_word(GRN_TEXT_VALUE(&(token_filter->value)));
+}
+
+static void
+junk_filter(grn_ctx *ctx,
+            grn_token *current_token,
+            grn_token *next_token,
+            void *user_data)
+{
+  grn_junk_token_filter *token_filter = user_data;
+  grn_obj *data;
+  grn_tokenizer_status status;
+
+  if (!token_filter->enabled) {
+    return;
+  }
+
+  if (!token_filter->decided) {
+    data = grn_token_get_data(ctx, current_token);
+    token_filter->n_tokens++;
+    if (junk_is_junk(ctx, token_filter,
+                     GRN_TEXT_VALUE(data), GRN_TEXT_LEN(data))) {
+      token_filter->n_junk++;
+    }
+    if (token_filter->n_junk >= token_filter->n_junk_threshold) {
+      token_filter->decided = GRN_TRUE;
+      token_filter->aborted = GRN_TRUE;
+    } else if (token_filter->n_tokens - token_filter->n_junk >
+               token_filter->n_samples - token_filter->n_junk_threshold) {
+      token_filter->decided = GRN_TRUE;
+    }
+    return;
+  }
+  if (!token_filter->aborted) {
+    return;
+  }
+
+  /* The token cursor ends at this token, so the rest of the document
+     is never tokenized. */
+  status = grn_token_get_status(ctx, current_token);
+  status |= GRN_TOKEN_SKIP | GRN_TOKEN_LAST;
+  grn_token_set_status(ctx, next_token, status);
+}
+
+static void
+junk_fin(grn_ctx *ctx, void *user_data)
+{
+  grn_junk_token_filter *token_filter = user_data;
+  if (!token_filter) {
+    return;
+  }
+  if (token_filter->aborted) {
+    char name[GRN_TABLE_MAX_KEY_SIZE];
+    int name_size;
+    name_size = grn_obj_name(ctx, token_filter->lexicon,
+                             name, GRN_TABLE_MAX_KEY_SIZE);
+    GRN_PLUGIN_LOG(ctx, GRN_LOG_NOTICE,
+                   "[token-filter][junk] "
+                   "<%.*s> stopped a junk document after %" PRIu64 " tokens: "
+                   "%" PRIu64 " of them were junk",
+                   name_size, name,
+                   token_filter->n_tokens,
+                   token_filter->n_junk);
+  }
+  grn_obj_unlink(ctx, &(token_filter->value));
+  grn_tokenizer_token_fin(ctx, &(token_filter->token));
+  GRN_PLUGIN_FREE(ctx, token_filter);
+}
+
+typedef enum {
+  YATOF_TRACE_MAX_LENGTH,
+  YATOF_TRACE_MIN_LENGTH,
+  YATOF_TRACE_TF_LIMIT,
+  YATOF_TRACE_PHRASE_LIMIT,
+  YATOF_TRACE_PROLONG,
+  YATOF_TRACE_SYMBOL,
+  YATOF_TRACE_DIGIT,
+  YATOF_TRACE_IGNORE_WORD,
+  YATOF_TRACE_REMOVE_WORD,
+  YATOF_TRACE_THROUGH_WORD,
+  YATOF_TRACE_SYNONYM,
+  YATOF_TRACE_UNMATURED_ONE,
+  YATOF_TRACE_WHITE,
+  YATOF_TRACE_ATGC,
+  YATOF_TRACE_SKIP_NON_ENGLISH_ALPHA,
+  YATOF_TRACE_HIGH_ENTROPY,
+  YATOF_TRACE_NUMBER,
+  YATOF_TRACE_LEXICON_LIMIT,
+  YATOF_TRACE_DOCUMENT_LIMIT,
+  YATOF_TRACE_KATAKANA_FOLD,
+  YATOF_TRACE_REPEATED_SHINGLE,
+  YATOF_TRACE_BOILERPLATE,
+  YATOF_TRACE_SCRIPT,
+  YATOF_TRACE_URL,
+  YATOF_TRACE_BIGRAM_THIN,
+  YATOF_TRACE_UNIQUE,
+  YATOF_TRACE_JUNK,
+  YATOF_TRACE_N_FILTERS
+} grn_yatof_trace_filter;
+
+static const char *yatof_trace_filter_names[YATOF_TRACE_N_FILTERS] = {
+  "TokenFilterMaxLength",
+  "TokenFilterMinLength",
+  "TokenFilterTFLimit",
+  "TokenFilterPhraseLimit",
+  "TokenFilterProlong",
+  "TokenFilterSymbol",
+  "TokenFilterDigit",
+  "TokenFilterIgnoreWord",
+  "TokenFilterRemoveWord",
+  "TokenFilterThroughWord",
+  "TokenFilterSynonym",
+  "TokenFilterUnmaturedOne",
+  "TokenFilterWhite",
+  "TokenFilterATGC",
+  "TokenFilterSkipNonEnglishAlpha",
+  "TokenFilterHighEntropy",
+  "TokenFilterNumber",
+  "TokenFilterLexiconLimit",
+  "TokenFilterDocumentLimit",
+  "TokenFilterKatakanaFold",
+  "TokenFilterRepeatedShingle",
+  "TokenFilterBoilerplate",
+  "TokenFilterScript",
+  "TokenFilterURL",
+  "TokenFilterBigramThin",
+  "TokenFilterUnique",
+  "TokenFilterJunk"
+};
+
+#define YATOF_TRACE_TOKEN_SIZE 32
+#define YATOF_TRACE_US_SIZE 21
+
+typedef struct {
+  uint64_t elapsed_ns;
+  uint64_t n_tokens;
+  uint64_t slowest_ns;
+  char slowest_token[YATOF_TRACE_TOKEN_SIZE];
+  int slowest_token_size;
+  int slowest_token_length;
+} grn_yatof_trace_filter_stat;
+
+/* Per-document trace of the current thread. A document starts with the
+   first init of the filter chain and ends with the last fin. */
+typedef struct {
+  int depth;
+  grn_bool active;
+  grn_bool mask_time;
+  uint64_t threshold_ns;
+  grn_obj *lexicon;
+  uint64_t n_tokens;
+  uint64_t longest_token_length;
+  grn_yatof_trace_filter_stat filters[YATOF_TRACE_N_FILTERS];
+} grn_yatof_trace;
+
+static YATOF_THREAD_LOCAL grn_yatof_trace yatof_trace;
+
+static uint64_t
+yatof_trace_now(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static void
+yatof_trace_open(grn_ctx *ctx, grn_obj *lexicon)
+{
+  grn_yatof_trace *trace = &yatof_trace;
+  uint64_t threshold_us;
+
+  if (trace->depth++ > 0) {
+    return;
+  }
+  threshold_us = yatof_option_get_uint64(ctx,
+                                         "tokenfilter-yatof.trace-threshold",
+                                         "GRN_YATOF_TRACE_THRESHOLD",
+                                         0);
+  trace->active = threshold_us > 0;
+  if (!trace->active) {
+    return;
+  }
+  trace->threshold_ns = threshold_us * 1000;
+  trace->mask_time =
+    yatof_option_get_uint64(ctx, "tokenfilter-yatof.trace-mask-time",
+                            "GRN_YATOF_TRACE_MASK_TIME", 0) != 0;
+  trace->lexicon = lexicon;
+  trace->n_tokens = 0;
+  trace->longest_token_length = 0;
+  memset(trace->filters, 0, sizeof(trace->filters));
+}
+
+static void
+yatof_trace_record(grn_ctx *ctx, grn_yatof_trace_filter filter,
+                   grn_token *current_token, uint64_t start_ns)
+{
+  grn_yatof_trace *trace = &yatof_trace;
+  grn_yatof_trace_filter_stat *stat = &(trace->filters[filter]);
+  uint64_t elapsed_ns = yatof_trace_now() - start_ns;
+  grn_obj *data;
+
+  stat->elapsed_ns += elapsed_ns;
+  stat->n_tokens++;
+  if (stat->n_tokens > trace->n_tokens) {
+    trace->n_tokens = stat->n_tokens;
+  }
+  data = grn_token_get_data(ctx, current_token);
+  if (GRN_TEXT_LEN(data) > trace->longest_token_length) {
+    trace->longest_token_length = GRN_TEXT_LEN(data);
+  }
+  if (elapsed_ns > stat->slowest_ns) {
+    const char *value = GRN_TEXT_VALUE(data);
+    int length = GRN_TEXT_LEN(data);
+    int size = 0;
+    /* Cut on a character boundary so that the log stays valid UTF-8. */
+    while (size < length) {
+      int char_length = grn_plugin_charlen(ctx, value + size, length - size,
+                                           GRN_CTX_GET_ENCODING(ctx));
+      if (char_length == 0 || size + char_length > YATOF_TRACE_TOKEN_SIZE) {
+        break;
+      }
+      size += char_length;
+    }
+    stat->slowest_ns = elapsed_ns;
+    stat->slowest_token_length = length;
+    stat->slowest_token_size = size;
+    memcpy(stat->slowest_token, value, size);
+  }
+}
+
+/* tokenfilter-yatof.trace-mask-time prints "*" instead of the times
+   so that logs of the same documents can be compared. */
+static const char *
+yatof_trace_format_us(grn_yatof_trace *trace, uint64_t ns,
+                      char buffer[YATOF_TRACE_US_SIZE])
+{
+  if (trace->mask_time) {
+    return "*";
+  }
+  snprintf(buffer, YATOF_TRACE_US_SIZE, "%" PRIu64, ns / 1000);
+  return buffer;
+}
+
+static void
+yatof_trace_close(grn_ctx *ctx)
+{
+  grn_yatof_trace *trace = &yatof_trace;
+  uint64_t elapsed_ns = 0;
+  char elapsed[YATOF_TRACE_US_SIZE];
+  char slowest[YATOF_TRACE_US_SIZE];
+  char name[GRN_TABLE_MAX_KEY_SIZE];
+  int name_size = 0;
+  int i;
+
+  if (trace->depth == 0 || --trace->depth > 0 || !trace->active) {
+    return;
+  }
+  trace->active = GRN_FALSE;
+
+  for (i = 0; i < YATOF_TRACE_N_FILTERS; i++) {
+    elapsed_ns += trace->filters[i].elapsed_ns;
+  }
+  if (elapsed_ns < trace->threshold_ns) {
+    return;
+  }
+
+  if (trace->lexicon) {
+    name_size = grn_obj_name(ctx, trace->lexicon,
+                             name, GRN_TABLE_MAX_KEY_SIZE);
+  }
+  GRN_PLUGIN_LOG(ctx, GRN_LOG_NOTICE,
+                 "[token-filter][trace] "
+                 "<%.*s> slow document: %sus in filters, "
+                 "%" PRIu64 " tokens, longest token %" PRIu64 " bytes",
+                 name_size, name,
+                 yatof_trace_format_us(trace, elapsed_ns, elapsed),
+                 trace->n_tokens,
+                 trace->longest_token_length);
+  for (i = 0; i < YATOF_TRACE_N_FILTERS; i++) {
+    grn_yatof_trace_filter_stat *stat = &(trace->filters[i]);
+    if (stat->n_tokens == 0) {
+      continue;
+    }
+    GRN_PLUGIN_LOG(ctx, GRN_LOG_NOTICE,
+                   "[token-filter][trace] "
+                   "<%.*s> %s: %sus, %" PRIu64 " tokens, "
+                   "slowest <%.*s%s> (%d bytes) %sus",
+                   name_size, name,
+                   yatof_trace_filter_names[i],
+                   yatof_trace_format_us(trace, stat->elapsed_ns, elapsed),
+                   stat->n_tokens,
+                   stat->slowest_token_size, stat->slowest_token,
+                   stat->slowest_token_length > stat->slowest_token_size ?
+                   "..." : "",
+                   stat->slowest_token_length,
+                   yatof_trace_format_us(trace, stat->slowest_ns, slowest));
+  }
+}
+
+#define YATOF_VERDICT_KEY_SIZE 48
+#define YATOF_VERDICT_VALUE_SIZE 48
+#define YATOF_VERDICT_N_WAYS 4
+#define YATOF_VERDICT_MAX_N_ENTRIES (1 << 24)
+#define YATOF_VERDICT_MAX_N_LINKS 16
+#define YATOF_VERDICT_SKIP_FLAGS (GRN_TOKEN_SKIP | GRN_TOKEN_SKIP_WITH_POSITION)
+
+typedef void grn_yatof_filter_func(grn_ctx *ctx,
+                                   grn_token *current_token,
+                                   grn_token *next_token,
+                                   void *user_data);
+
+/* The result of a run of filters on one token: the status and the data
+   after the last filter that saw it. n_filters is shorter than the run
+   when a filter skipped the token. 128 bytes, so a probe touches two
+   cache lines. */
+typedef struct {
+  uint64_t hash;
+  uint64_t digest;
+  uint32_t status;
+  uint32_t next_status;
+  uint8_t mode;
+  uint8_t referenced;
+  uint8_t rewritten;
+  uint8_t n_filters;
+  uint8_t key_size;
+  uint8_t value_size;
+  char key[YATOF_VERDICT_KEY_SIZE];
+  char value[YATOF_VERDICT_VALUE_SIZE];
+} grn_yatof_verdict_entry;
+
+/* The entries of one thread. Blocks are linked so that GRN_PLUGIN_FIN
+   can free those of threads that are still running. */
+typedef struct _grn_yatof_verdict_block {
+  struct _grn_yatof_verdict_block *next;
+  uint64_t n_entries;
+  grn_yatof_verdict_entry entries[1];
+} grn_yatof_verdict_block;
+
+typedef enum {
+  YATOF_VERDICT_STATEFUL,
+  YATOF_VERDICT_CHEAP,
+  YATOF_VERDICT_COSTLY
+} grn_yatof_verdict_cost;
+
+/* A filter of the chain of the current token cursor, in init order.
+   run_length and digest are only set on the first filter of a run of
+   filters that is cached. */
+typedef struct {
+  void *user_data;
+  uint64_t options;
+  uint64_t digest;
+  uint8_t filter;
+  uint8_t cost;
+  uint8_t run_length;
+} grn_yatof_verdict_link;
+
+/* Verdict cache of the current thread, enabled by
+   tokenfilter-yatof.verdict-cache-size. Consecutive filters without
+   per-document state form a run, and a token is hashed once at the start
+   of the run: on a hit the result of the whole run is set and the other
+   filters of the run pass the token through. Entries are grouped in sets
+   of YATOF_VERDICT_N_WAYS and each set is replaced by CLOCK. Runs are
+   keyed on the digests of the options, tables and dictionaries their
+   filters read in init, so nothing has to be cleared when they change. */
+typedef struct {
+  int depth;
+  grn_bool active;
+  grn_bool sealed;
+  grn_token_mode mode;
+  uint32_t epoch;
+  uint64_t n_entries;
+  uint64_t set_mask;
+  grn_yatof_verdict_block *block;
+  grn_yatof_verdict_entry *entries;
+  unsigned int n_links;
+  unsigned int next_link;
+  grn_yatof_verdict_link links[YATOF_VERDICT_MAX_N_LINKS];
+  /* The run being replayed from an entry, or recorded into one. The
+     token each of its filters gets must be the one the previous filter
+     left, or the run is abandoned. */
+  int run_start;
+  unsigned int run_end;
+  grn_bool recording;
+  uint64_t hash;
+  uint32_t status;
+  unsigned int key_size;
+  char key[YATOF_VERDICT_KEY_SIZE];
+  uint32_t expected_status;
+  unsigned int expected_size;
+  char expected[YATOF_VERDICT_VALUE_SIZE];
+} grn_yatof_verdict_cache;
+
+static YATOF_THREAD_LOCAL grn_yatof_verdict_cache yatof_verdict;
+/* Frees the block of a thread when it exits. */
+static pthread_key_t yatof_verdict_key;
+static grn_bool yatof_verdict_key_created = GRN_FALSE;
+static pthread_mutex_t yatof_verdict_mutex = PTHREAD_MUTEX_INITIALIZER;
+static grn_yatof_verdict_block *yatof_verdict_blocks = NULL;
+/* Bumped by GRN_PLUGIN_FIN. Threads drop blocks of an older epoch
+   without touching them because they have been freed. */
+static uint32_t yatof_verdict_epoch = 0;
+
+static void
+yatof_verdict_block_free(void *data)
+{
+  grn_yatof_verdict_block *block = data;
+  grn_yatof_verdict_block **previous;
+
+  if (!block) {
+    return;
+  }
+  pthread_mutex_lock(&yatof_verdict_mutex);
+  for (previous = &yatof_verdict_blocks; *previous;
+       previous = &((*previous)->next)) {
+    if (*previous == block) {
+      *previous = block->next;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&yatof_verdict_mutex);
+  free(block);
+}
+
+static void
+yatof_verdict_free_all(void)
+{
+  grn_yatof_verdict_block *block, *next;
+
+  pthread_mutex_lock(&yatof_verdict_mutex);
+  for (block = yatof_verdict_blocks; block; block = next) {
+    next = block->next;
+    free(block);
+  }
+  yatof_verdict_blocks = NULL;
+  __sync_add_and_fetch(&yatof_verdict_epoch, 1);
+  pthread_mutex_unlock(&yatof_verdict_mutex);
+}
+
+static void
+yatof_verdict_open(grn_ctx *ctx, grn_token_mode mode)
+{
+  grn_yatof_verdict_cache *cache = &yatof_verdict;
+  uint64_t n_entries;
+
+  if (cache->depth++ > 0) {
+    /* Another token cursor opened while this one is tokenizing. Their
+       chains can't be told apart, so both are left uncached. */
+    if (cache->sealed) {
+      cache->active = GRN_FALSE;
+    }
+    return;
+  }
+  cache->active = GRN_FALSE;
+  cache->sealed = GRN_FALSE;
+  cache->n_links = 0;
+  cache->next_link = 0;
+  cache->run_start = -1;
+  if (!yatof_verdict_key_created) {
+    return;
+  }
+  n_entries = yatof_option_get_uint64(ctx,
+                                      "tokenfilter-yatof.verdict-cache-size",
+                                      "GRN_YATOF_VERDICT_CACHE_SIZE",
+                                      0);
+  if (n_entries == 0) {
+    return;
+  }
+  if (n_entries > YATOF_VERDICT_MAX_N_ENTRIES) {
+    n_entries = YATOF_VERDICT_MAX_N_ENTRIES;
+  }
+  {
+    uint64_t rounded = YATOF_VERDICT_N_WAYS;
+    while (rounded < n_entries) {
+      rounded <<= 1;
+    }
+    n_entries = rounded;
+  }
+  if (cache->epoch != yatof_verdict_epoch) {
+    cache->block = NULL;
+    cache->entries = NULL;
+    cache->n_entries = 0;
+    cache->epoch = yatof_verdict_epoch;
+  }
+  if (n_entries != cache->n_entries) {
+    grn_yatof_verdict_block *block;
+    yatof_verdict_block_free(cache->block);
+    cache->block = NULL;
+    cache->entries = NULL;
+    cache->n_entries = 0;
+    block = calloc(1, offsetof(grn_yatof_verdict_block, entries) +
+                      sizeof(grn_yatof_verdict_entry) * n_entries);
+    pthread_setspecific(yatof_verdict_key, block);
+    if (!block) {
+      GRN_PLUGIN_LOG(ctx, GRN_LOG_WARNING,
+                     "[token-filter][verdict-cache] "
+                     "failed to allocate %" PRIu64 " entries", n_entries);
+      return;
+    }
+    block->n_entries = n_entries;
+    pthread_mutex_lock(&yatof_verdict_mutex);
+    block->next = yatof_verdict_blocks;
+    yatof_verdict_blocks = block;
+    pthread_mutex_unlock(&yatof_verdict_mutex);
+    cache->block = block;
+    cache->entries = block->entries;
+    cache->n_entries = n_entries;
+    cache->set_mask = n_entries / YATOF_VERDICT_N_WAYS - 1;
+  }
+  cache->mode = mode;
+  cache->active = GRN_TRUE;
+}
+
+/* Filters with per-document state must see every token. Word tables and
+   flag columns are keyed on their last-modified time, but whether a token
+   is in the lexicon changes while a document is added, so flag columns
+   are only cached for queries. Cheap filters cost less than a probe and
+   only join a run that has a costly filter. */
+static grn_yatof_verdict_cost
+yatof_verdict_cost(grn_yatof_trace_filter filter, void *user_data,
+                   grn_token_mode mode)
+{
+  switch (filter) {
+  case YATOF_TRACE_MAX_LENGTH :
+  case YATOF_TRACE_MIN_LENGTH :
+  case YATOF_TRACE_PROLONG :
+  case YATOF_TRACE_SYMBOL :
+  case YATOF_TRACE_DIGIT :
+  case YATOF_TRACE_UNMATURED_ONE :
+    return YATOF_VERDICT_CHEAP;
+  case YATOF_TRACE_ATGC :
+  case YATOF_TRACE_SKIP_NON_ENGLISH_ALPHA :
+  case YATOF_TRACE_HIGH_ENTROPY :
+  case YATOF_TRACE_NUMBER :
+  case YATOF_TRACE_KATAKANA_FOLD :
+  case YATOF_TRACE_SCRIPT :
+  case YATOF_TRACE_THROUGH_WORD :
+  case YATOF_TRACE_SYNONYM :
+    return YATOF_VERDICT_COSTLY;
+  case YATOF_TRACE_IGNORE_WORD :
+    {
+      grn_ignore_word_token_filter *token_filter = user_data;
+      if (token_filter->flags.column && mode != GRN_TOKEN_GET) {
+        return YATOF_VERDICT_STATEFUL;
+      }
+      return YATOF_VERDICT_COSTLY;
+    }
+  case YATOF_TRACE_WHITE :
+    {
+      grn_white_token_filter *token_filter = user_data;
+      if (token_filter->flags.column && mode != GRN_TOKEN_GET) {
+        return YATOF_VERDICT_STATEFUL;
+      }
+      return YATOF_VERDICT_COSTLY;
+    }
+  case YATOF_TRACE_REMOVE_WORD :
+    {
+      grn_remove_word_token_filter *token_filter = user_data;
+      if (token_filter->remove_html_block ||
+          (token_filter->flags.column && mode != GRN_TOKEN_GET)) {
+        return YATOF_VERDICT_STATEFUL;
+      }
+      return YATOF_VERDICT_COSTLY;
+    }
+  default :
+    return YATOF_VERDICT_STATEFUL;
+  }
+}
+
+/* Called after the init of a filter with the digest of what it read.
+   Filters are initialized in chain order before the first token. */
+static void
+yatof_verdict_bind(grn_yatof_trace_filter filter, void *user_data,
+                   uint64_t options, grn_bool is_volatile)
+{
+  grn_yatof_verdict_cache *cache = &yatof_verdict;
+  grn_yatof_verdict_link *link;
+
+  if (!cache->active || !user_data) {
+    return;
+  }
+  if (cache->n_links == YATOF_VERDICT_MAX_N_LINKS) {
+    cache->active = GRN_FALSE;
+    return;
+  }
+  link = cache->links + cache->n_links++;
+  link->user_data = user_data;
+  link->options = options;
+  link->digest = 0;
+  link->filter = filter;
+  link->cost = is_volatile ?
+    YATOF_VERDICT_STATEFUL :
+    yatof_verdict_cost(filter, user_data, cache->mode);
+  link->run_length = 0;
+}
+
+static void
+yatof_verdict_close(GNUC_UNUSED grn_ctx *ctx)
+{
+  grn_yatof_verdict_cache *cache = &yatof_verdict;
+
+  if (cache->depth == 0 || --cache->depth > 0) {
+    return;
+  }
+  cache->active = GRN_FALSE;
+}
+
+/* Splits the chain into runs at the first token. */
+static void
+yatof_verdict_seal(grn_yatof_verdict_cache *cache)
+{
+  unsigned int i, j;
+
+  cache->sealed = GRN_TRUE;
+  for (i = 0; i < cache->n_links; i = j + 1) {
+    uint64_t digest = 14695981039346656037ULL;
+    grn_bool costly = GRN_FALSE;
+
+    for (j = i;
+         j < cache->n_links && cache->links[j].cost != YATOF_VERDICT_STATEFUL;
+         j++) {
+      if (cache->links[j].cost == YATOF_VERDICT_COSTLY) {
+        costly = GRN_TRUE;
+      }
+      digest ^= cache->links[j].filter;
+      digest *= 1099511628211ULL;
+      digest ^= cache->links[j].options;
+      digest *= 1099511628211ULL;
+    }
+    if (costly) {
+      cache->links[i].run_length = j - i;
+      cache->links[i].digest = digest;
+    }
+  }
+}
+
+static grn_bool
+yatof_verdict_is_expected(grn_ctx *ctx, grn_yatof_verdict_cache *cache,
+                          grn_token *current_token)
+{
+  grn_obj *data;
+
+  if ((uint32_t)grn_token_get_status(ctx, current_token) !=
+      cache->expected_status) {
+    return GRN_FALSE;
+  }
+  data = grn_token_get_data(ctx, current_token);
+  return GRN_TEXT_LEN(data) == cache->expected_size &&
+    memcmp(GRN_TEXT_VALUE(data), cache->expected, cache->expected_size) == 0;
+}
+
+/* Called after each filter of a run being recorded. The entry is stored
+   after the last filter of the run or the one that skipped the token. */
+static void
+yatof_verdict_record(grn_ctx *ctx, grn_yatof_verdict_cache *cache,
+                     unsigned int index, grn_token *next_token)
+{
+  grn_yatof_verdict_entry *set;
+  grn_yatof_verdict_entry *entry;
+  grn_obj *data;
+  uint32_t next_status;
+  unsigned int i;
+  unsigned int start;
+
+  next_status = grn_token_get_status(ctx, next_token);
+  data = grn_token_get_data(ctx, next_token);
+  if ((next_status & cache->status) != cache->status ||
+      GRN_TEXT_LEN(data) > YATOF_VERDICT_VALUE_SIZE) {
+    cache->run_start = -1;
+    return;
+  }
+  if (index < cache->run_end &&
+      !(next_status & ~cache->status & YATOF_VERDICT_SKIP_FLAGS)) {
+    cache->expected_status = next_status;
+    cache->expected_size = GRN_TEXT_LEN(data);
+    memcpy(cache->expected, GRN_TEXT_VALUE(data), cache->expected_size);
+    return;
+  }
+
+  /* Second chance within the set, starting at a slot picked by the hash
+     so that sets do not always evict their first way. */
+  set = cache->entries +
+    ((cache->hash >> 16) & cache->set_mask) * YATOF_VERDICT_N_WAYS;
+  start = (cache->hash >> 8) % YATOF_VERDICT_N_WAYS;
+  entry = set + start;
+  for (i = 0; i < YATOF_VERDICT_N_WAYS * 2; i++) {
+    entry = set + (start + i) % YATOF_VERDICT_N_WAYS;
+    if (!entry->referenced) {
+      break;
+    }
+    entry->referenced = 0;
+  }
+  entry->hash = cache->hash;
+  entry->digest = cache->links[cache->run_start].digest;
+  entry->status = cache->status;
+  entry->next_status = next_status;
+  entry->mode = cache->mode;
+  /* Empty ways are taken before a new entry is evicted. */
+  entry->referenced = 1;
+  entry->n_filters = index - cache->run_start + 1;
+  entry->key_size = cache->key_size;
+  memcpy(entry->key, cache->key, cache->key_size);
+  entry->rewritten =
+    GRN_TEXT_LEN(data) != cache->key_size ||
+    memcmp(GRN_TEXT_VALUE(data), cache->key, cache->key_size) != 0;
+  entry->value_size = 0;
+  if (entry->rewritten) {
+    entry->value_size = GRN_TEXT_LEN(data);
+    memcpy(entry->value, GRN_TEXT_VALUE(data), entry->value_size);
+  }
+  cache->run_start = -1;
+}
+
+static void
+yatof_verdict_filter(grn_ctx *ctx, grn_yatof_filter_func *filter,
+                     grn_token *current_token,
+                     grn_token *next_token,
+                     void *user_data)
+{
+  grn_yatof_verdict_cache *cache = &yatof_verdict;
+  grn_yatof_verdict_link *link;
+  grn_yatof_verdict_entry *set;
+  grn_yatof_verdict_entry *entry;
+  grn_obj *data;
+  grn_tokenizer_status status;
+  const char *key;
+  unsigned int key_size;
+  uint64_t hash = 14695981039346656037ULL;
+  unsigned int index;
+  unsigned int i;
+
+  if (!cache->active || !user_data) {
+    filter(ctx, current_token, next_token, user_data);
+    return;
+  }
+  if (!cache->sealed) {
+    yatof_verdict_seal(cache);
+  }
+  index = cache->next_link;
+  if (index >= cache->n_links || cache->links[index].user_data != user_data) {
+    for (index = 0; index < cache->n_links; index++) {
+      if (cache->links[index].user_data == user_data) {
+        break;
+      }
+    }
+    if (index == cache->n_links) {
+      filter(ctx, current_token, next_token, user_data);
+      return;
+    }
+  }
+  cache->next_link = index + 1;
+  link = cache->links + index;
+
+  if (cache->run_start >= 0) {
+    if (index > (unsigned int)cache->run_start && index <= cache->run_end &&
+        yatof_verdict_is_expected(ctx, cache, current_token)) {
+      if (!cache->recording) {
+        if (index == cache->run_end) {
+          cache->run_start = -1;
+        }
+        return;
+      }
+      filter(ctx, current_token, next_token, user_data);
+      yatof_verdict_record(ctx, cache, index, next_token);
+      return;
+    }
+    cache->run_start = -1;
+  }
+  if (link->run_length == 0) {
+    filter(ctx, current_token, next_token, user_data);
+    return;
+  }
+
+  data = grn_token_get_data(ctx, current_token);
+  key = GRN_TEXT_VALUE(data);
+  key_size = GRN_TEXT_LEN(data);
+  if (key_size > YATOF_VERDICT_KEY_SIZE) {
+    filter(ctx, current_token, next_token, user_data);
+    return;
+  }
+  status = grn_token_get_status(ctx, current_token);
+
+  for (i = 0; i < key_size; i++) {
+    hash ^= (unsigned char)key[i];
+    hash *= 1099511628211ULL;
+  }
+  hash ^= ((uint64_t)cache->mode << 48) ^ status;
+  hash *= 1099511628211ULL;
+  hash ^= link->digest;
+  hash *= 1099511628211ULL;
+
+  cache->run_start = index;
+  cache->run_end = index + link->run_length - 1;
+  set = cache->entries + ((hash >> 16) & cache->set_mask) * YATOF_VERDICT_N_WAYS;
+  for (i = 0; i < YATOF_VERDICT_N_WAYS; i++) {
+    entry = set + i;
+    if (entry->hash == hash &&
+        entry->digest == link->digest &&
+        entry->mode == cache->mode &&
+        entry->status == (uint32_t)status &&
+        entry->key_size == key_size &&
+        memcmp(entry->key, key, key_size) == 0) {
+      entry->referenced = 1;
+      if (entry->rewritten) {
+        grn_token_set_data(ctx, next_token, entry->value, entry->value_size);
+      }
+      if (entry->next_status != (uint32_t)status) {
+        grn_token_set_status(ctx, next_token, entry->next_status);
+      }
+      if (entry->n_filters == 1) {
+        cache->run_start = -1;
+        return;
+      }
+      cache->run_end = index + entry->n_filters - 1;
+      cache->recording = GRN_FALSE;
+      cache->expected_status = entry->next_status;
+      if (entry->rewritten) {
+        cache->expected_size = entry->value_size;
+        memcpy(cache->expected, entry->value, entry->value_size);
+      } else {
+        cache->expected_size = key_size;
+        memcpy(cache->expected, key, key_size);
+      }
+      return;
+    }
+  }
+
+  cache->recording = GRN_TRUE;
+  cache->hash = hash;
+  cache->status = status;
+  cache->key_size = key_size;
+  memcpy(cache->key, key, key_size);
+  filter(ctx, current_token, next_token, user_data);
+  yatof_verdict_record(ctx, cache, index, next_token);
+}
+
+/* filter_start and filter_done give the filter, the token length and,
+   when done, the status with the skip bits the filter set. */
+#define YATOF_PROBE_FILTER_ENABLED()                                    \
+  (YATOF_PROBE_ENABLED(filter_start) || YATOF_PROBE_ENABLED(filter_done))
+#define YATOF_PROBE_FILTER_START(ctx, id, current_token) do {           \
+    if (YATOF_PROBE_ENABLED(filter_start)) {                            \
+      YATOF_PROBE2(filter_start, id,                                    \
+                   GRN_TEXT_LEN(grn_token_get_data(ctx, current_token))); \
+    }                                                                   \
+  } while (0)
+#define YATOF_PROBE_FILTER_DONE(ctx, id, current_token, next_token) do { \
+    if (YATOF_PROBE_ENABLED(filter_done)) {                             \
+      YATOF_PROBE3(filter_done, id,                                     \
+                   GRN_TEXT_LEN(grn_token_get_data(ctx, current_token)), \
+                   grn_token_get_status(ctx, next_token));              \
+    }                                                                   \
+  } while (0)
+
+/* Defines PREFIX_traced_init/filter/fin that time a filter for
+   tokenfilter-yatof.trace-threshold and look its verdicts up in the
+   verdict cache. The checks are thread-local flags when both are off. */
+#define YATOF_TRACE_DEFINE(prefix, id, init, filter, fin)               \
+  static void *                                                         \
+  prefix ## _traced_init(grn_ctx *ctx, grn_obj *table,                  \
+                         grn_token_mode mode)                           \
+  {                                                                     \
+    void *user_data;                                                    \
+    yatof_trace_open(ctx, table);                                       \
+    yatof_verdict_open(ctx, mode);                                      \
+    yatof_option_digest = 14695981039346656037ULL;                      \
+    yatof_option_volatile = GRN_FALSE;                                  \
+    user_data = init(ctx, table, mode);                                 \
+    yatof_verdict_bind(id, user_data,                                   \
+                       yatof_option_digest, yatof_option_volatile);     \
+    YATOF_PROBE3(filter_init, id, mode, user_data != NULL);             \
+    if (!user_data) {                                                   \
+      yatof_verdict_close(ctx);                                         \
+      yatof_trace_close(ctx);                                           \
+    }                                                                   \
+    return user_data;                                                   \
+  }                                                                     \
+                                                                        \
+  static void                                                           \
+  prefix ## _traced_filter(grn_ctx *ctx,                                \
+                           grn_token *current_token,                    \
+                           grn_token *next_token,                       \
+                           void *user_data)                             \
+  {                                                                     \
+    uint64_t start_ns = 0;                                              \
+    if (!yatof_trace.active && !YATOF_PROBE_FILTER_ENABLED()) {         \
+      yatof_verdict_filter(ctx, filter,                             \
+                           current_token, next_token, user_data);       \
+      return;                                                           \
+    }                                                                   \
+    if (yatof_trace.active) {                                           \
+      start_ns = yatof_trace_now();                                     \
+    }                                                                   \
+    YATOF_PROBE_FILTER_START(ctx, id, current_token);                   \
+    yatof_verdict_filter(ctx, filter,                               \
+                         current_token, next_token, user_data);         \
+    YATOF_PROBE_FILTER_DONE(ctx, id, current_token, next_token);        \
+    if (yatof_trace.active) {                                           \
+      yatof_trace_record(ctx, id, current_token, start_ns);             \
+    }                                                                   \
+  }                                                                     \
+                                                                        \
+  static void                                                           \
+  prefix ## _traced_fin(grn_ctx *ctx, void *user_data)                  \
+  {                                                                     \
+    fin(ctx, user_data);                                                \
+    YATOF_PROBE1(filter_fin, id);                                       \
+    if (user_data) {                                                    \
+      yatof_verdict_close(ctx);                                         \
+      yatof_trace_close(ctx);                                           \
+    }                                                                   \
+  }
+
+YATOF_TRACE_DEFINE(max_length, YATOF_TRACE_MAX_LENGTH,
+                   max_length_init, max_length_filter, max_length_fin)
+YATOF_TRACE_DEFINE(min_length, YATOF_TRACE_MIN_LENGTH,
+                   min_length_init, min_length_filter, min_length_fin)
+YATOF_TRACE_DEFINE(tf_limit, YATOF_TRACE_TF_LIMIT,
+                   tf_limit_init, tf_limit_filter, tf_limit_fin)
+YATOF_TRACE_DEFINE(phrase_limit, YATOF_TRACE_PHRASE_LIMIT,
+                   phrase_limit_init, phrase_limit_filter, phrase_limit_fin)
+YATOF_TRACE_DEFINE(prolong, YATOF_TRACE_PROLONG,
+                   prolong_init, prolong_filter, yatof_fin)
+YATOF_TRACE_DEFINE(symbol, YATOF_TRACE_SYMBOL,
+                   symbol_init, symbol_filter, yatof_fin)
+YATOF_TRACE_DEFINE(digit, YATOF_TRACE_DIGIT,
+                   digit_init, digit_filter, yatof_fin)
+YATOF_TRACE_DEFINE(ignore_word, YATOF_TRACE_IGNORE_WORD,
+                   ignore_word_init, ignore_word_filter, ignore_word_fin)
+YATOF_TRACE_DEFINE(remove_word, YATOF_TRACE_REMOVE_WORD,
+                   remove_word_init, remove_word_filter, remove_word_fin)
+YATOF_TRACE_DEFINE(through_word, YATOF_TRACE_THROUGH_WORD,
+                   through_word_init, through_word_filter, through_word_fin)
+YATOF_TRACE_DEFINE(synonym, YATOF_TRACE_SYNONYM,
+                   synonym_init, synonym_filter, synonym_fin)
+YATOF_TRACE_DEFINE(unmatured_one, YATOF_TRACE_UNMATURED_ONE,
+                   unmatured_one_init, unmatured_one_filter, yatof_fin)
+YATOF_TRACE_DEFINE(white, YATOF_TRACE_WHITE,
+                   white_init, white_filter, white_fin)
+YATOF_TRACE_DEFINE(atgc, YATOF_TRACE_ATGC,
+                   atgc_init, atgc_filter, yatof_fin)
+YATOF_TRACE_DEFINE(remove_non_english, YATOF_TRACE_SKIP_NON_ENGLISH_ALPHA,
+                   remove_non_english_init, remove_non_english_filter,
+                   remove_non_english_fin)
+YATOF_TRACE_DEFINE(high_entropy, YATOF_TRACE_HIGH_ENTROPY,
+                   high_entropy_init, high_entropy_filter, high_entropy_fin)
+YATOF_TRACE_DEFINE(number, YATOF_TRACE_NUMBER,
+                   number_init, number_filter, number_fin)
+YATOF_TRACE_DEFINE(lexicon_limit, YATOF_TRACE_LEXICON_LIMIT,
+                   lexicon_limit_init, lexicon_limit_filter, lexicon_limit_fin)
+YATOF_TRACE_DEFINE(document_limit, YATOF_TRACE_DOCUMENT_LIMIT,
+                   document_limit_init, document_limit_filter,
+                   document_limit_fin)
+YATOF_TRACE_DEFINE(katakana_fold, YATOF_TRACE_KATAKANA_FOLD,
+                   katakana_fold_init, katakana_fold_filter, katakana_fold_fin)
+YATOF_TRACE_DEFINE(repeated_shingle, YATOF_TRACE_REPEATED_SHINGLE,
+                   repeated_shingle_init, repeated_shingle_filter,
+                   repeated_shingle_fin)
+YATOF_TRACE_DEFINE(boilerplate, YATOF_TRACE_BOILERPLATE,
+                   boilerplate_init, boilerplate_filter, boilerplate_fin)
+YATOF_TRACE_DEFINE(script, YATOF_TRACE_SCRIPT,
+                   script_init, script_filter, script_fin)
+YATOF_TRACE_DEFINE(url, YATOF_TRACE_URL,
+                   url_init, url_filter, url_fin)
+YATOF_TRACE_DEFINE(bigram_thin, YATOF_TRACE_BIGRAM_THIN,
+                   bigram_thin_init, bigram_thin_filter, bigram_thin_fin)
+YATOF_TRACE_DEFINE(unique, YATOF_TRACE_UNIQUE,
+                   unique_init, unique_filter, unique_fin)
+YATOF_TRACE_DEFINE(junk, YATOF_TRACE_JUNK,
+                   junk_init, junk_filter, junk_fin)
+
+#define ANALYZE_MAX_N_WORKERS 64
+#define ANALYZE_KEY_OVERHEAD 16
+#define ANALYZE_POSTING_SIZE 4
+#define ANALYZE_POSITION_SIZE 2
+
+/* Returns the first live record ID in [id, max_id]. Workers split a
+   table by record ID, but cursor bounds are keys on PAT and HASH tables,
+   so the range is walked directly. */
+static grn_id
+yatof_table_next_id(grn_ctx *ctx, grn_obj *table, grn_id id, grn_id max_id)
+{
+  for (; id != GRN_ID_NIL && id <= max_id; id++) {
+    if (grn_table_at(ctx, table, id) != GRN_ID_NIL) {
+      return id;
+    }
+  }
+  return GRN_ID_NIL;
+}
+
+typedef struct {
+  grn_ctx *ctx;
+  grn_obj *db;
+  grn_id column_id;
+  grn_id tokenizer_id;
+  grn_id normalizer_id;
+  grn_id *token_filter_ids;
+  int n_token_filters;
+  grn_id min_id;
+  grn_id max_id;
+  grn_obj **lexicons;
+  grn_bool started;
+  uint64_t n_records;
+  uint64_t *n_positions;
+  uint64_t *n_postings;
+  grn_rc rc;
+} grn_yatof_analyze_worker;
+
+static int
+analyze_compare_id(const void *a, const void *b)
+{
+  grn_id id_a = *((const grn_id *)a);
+  grn_id id_b = *((const grn_id *)b);
+  return (id_a > id_b) - (id_a < id_b);
+}
+
+static grn_obj *
+analyze_lexicon_create(grn_ctx *ctx,
+                       grn_id tokenizer_id,
+                       grn_id normalizer_id,
+                       grn_id *token_filter_ids,
+                       int n_token_filters)
+{
+  grn_obj *lexicon;
+
+  lexicon = grn_table_create(ctx, NULL, 0, NULL,
+                             GRN_OBJ_TABLE_HASH_KEY,
+                             grn_ctx_at(ctx, GRN_DB_SHORT_TEXT),
+                             NULL);
+  if (!lexicon) {
+    return NULL;
+  }
+  grn_obj_set_info(ctx, lexicon, GRN_INFO_DEFAULT_TOKENIZER,
+                   grn_ctx_at(ctx, tokenizer_id));
+  if (normalizer_id != GRN_ID_NIL) {
+    grn_obj_set_info(ctx, lexicon, GRN_INFO_NORMALIZER,
+                     grn_ctx_at(ctx, normalizer_id));
+  }
+  if (n_token_filters > 0) {
+    grn_obj token_filters;
+    int i;
+    GRN_PTR_INIT(&token_filters, GRN_OBJ_VECTOR, GRN_ID_NIL);
+    for (i = 0; i < n_token_filters; i++) {
+      GRN_PTR_PUT(ctx, &token_filters, grn_ctx_at(ctx, token_filter_ids[i]));
+    }
+    grn_obj_set_info(ctx, lexicon, GRN_INFO_TOKEN_FILTERS, &token_filters);
+    GRN_OBJ_FIN(ctx, &token_filters);
+  }
+  return lexicon;
+}
+
+static void *
+analyze_worker_run(void *arg)
+{
+  grn_yatof_analyze_worker *worker = arg;
+  grn_ctx *ctx = worker->ctx;
+  grn_obj *column;
+  grn_obj *table;
+  grn_obj value;
+  grn_obj ids;
+  grn_id id;
+  int i;
+
+  grn_ctx_use(ctx, worker->db);
+  column = grn_ctx_at(ctx, worker->column_id);
+  if (!column) {
+    worker->rc = GRN_INVALID_ARGUMENT;
+    return NULL;
+  }
+  for (i = 0; i <= worker->n_token_filters; i++) {
+    worker->lexicons[i] = analyze_lexicon_create(ctx,
+                                                 worker->tokenizer_id,
+                                                 worker->normalizer_id,
+                                                 worker->token_filter_ids,
+                                                 i);
+    if (!worker->lexicons[i]) {
+      worker->rc = ctx->rc != GRN_SUCCESS ? ctx->rc : GRN_NO_MEMORY_AVAILABLE;
+      return NULL;
+    }
+  }
 
-  for (int i = 0; i < formula_count; i++) {
-    if (strstr(str, specific_formulas[i]) != NULL) {
-      return 1;
+  table = grn_column_table(ctx, column);
+
+  GRN_TEXT_INIT(&value, 0);
+  GRN_RECORD_INIT(&ids, 0, GRN_ID_NIL);
+  for (id = yatof_table_next_id(ctx, table, worker->min_id, worker->max_id);
+       id != GRN_ID_NIL;
+       id = yatof_table_next_id(ctx, table, id + 1, worker->max_id)) {
+    GRN_BULK_REWIND(&value);
+    grn_obj_get_value(ctx, column, id, &value);
+    worker->n_records++;
+    if (GRN_TEXT_LEN(&value) == 0) {
+      continue;
+    }
+    for (i = 0; i <= worker->n_token_filters; i++) {
+      grn_id *tids;
+      size_t j, n_tids;
+      uint64_t n_postings = 0;
+
+      GRN_BULK_REWIND(&ids);
+      grn_table_tokenize(ctx, worker->lexicons[i],
+                         GRN_TEXT_VALUE(&value), GRN_TEXT_LEN(&value),
+                         &ids, GRN_TRUE);
+      if (ctx->rc != GRN_SUCCESS) {
+        worker->rc = ctx->rc;
+        break;
+      }
+      tids = (grn_id *)GRN_BULK_HEAD(&ids);
+      n_tids = GRN_BULK_VSIZE(&ids) / sizeof(grn_id);
+      qsort(tids, n_tids, sizeof(grn_id), analyze_compare_id);
+      for (j = 0; j < n_tids; j++) {
+        if (j == 0 || tids[j] != tids[j - 1]) {
+          n_postings++;
+        }
+      }
+      worker->n_positions[i] += n_tids;
+      worker->n_postings[i] += n_postings;
+    }
+    if (worker->rc != GRN_SUCCESS) {
+      break;
     }
   }
+  GRN_OBJ_FIN(ctx, &ids);
+  GRN_OBJ_FIN(ctx, &value);
 
-  // 3. 他の判定条件は使用しない
-  return 0;
+  return NULL;
 }
 
-// 英単語らしくないかどうかを判定する関数
-static int
-is_non_english_word(const char *word) {
-  if (word == NULL || strlen(word) == 0) {
-    return 0; // 空文字列は判定不能
+static grn_rc
+analyze_parse_token_filters(grn_ctx *ctx, grn_obj *names, grn_obj *ids)
+{
+  const char *current = GRN_TEXT_VALUE(names);
+  const char *end = current + GRN_TEXT_LEN(names);
+
+  while (current < end) {
+    const char *name_start, *name_end;
+    grn_obj *token_filter;
+
+    while (current < end && (*current == ' ' || *current == ',')) {
+      current++;
+    }
+    name_start = current;
+    while (current < end && *current != ',') {
+      current++;
+    }
+    name_end = current;
+    while (name_end > name_start && name_end[-1] == ' ') {
+      name_end--;
+    }
+    if (name_start == name_end) {
+      continue;
+    }
+    token_filter = grn_ctx_get(ctx, name_start, name_end - name_start);
+    if (!token_filter) {
+      GRN_PLUGIN_ERROR(ctx, GRN_INVALID_ARGUMENT,
+                       "[yatof][analyze] "
+                       "nonexistent token filter: <%.*s>",
+                       (int)(name_end - name_start), name_start);
+      return ctx->rc;
+    }
+    GRN_RECORD_PUT(ctx, ids, grn_obj_id(ctx, token_filter));
   }
+  return GRN_SUCCESS;
+}
 
-  // 化学式らしい場合は非英単語として検出しない
-  if (is_chemical_formula(word)) {
-    // printf("DEBUG: %s - 化学式と判定\n", word);
-    return 0;
+static grn_obj *
+command_yatof_analyze(grn_ctx *ctx, GNUC_UNUSED int nargs,
+                      GNUC_UNUSED grn_obj **args, grn_user_data *user_data)
+{
+  grn_obj *table_name, *column_name, *tokenizer_name, *normalizer_name;
+  grn_obj *token_filter_names, *n_workers_value;
+  grn_obj *table, *column, *tokenizer, *normalizer = NULL;
+  grn_obj token_filter_ids;
+  grn_id tokenizer_id, normalizer_id = GRN_ID_NIL;
+  grn_id max_id = GRN_ID_NIL;
+  int n_token_filters, n_stages, n_workers = 0;
+  grn_yatof_analyze_worker *workers = NULL;
+  pthread_t *threads = NULL;
+  grn_obj **merged = NULL;
+  uint64_t *key_sizes = NULL;
+  uint64_t n_records = 0;
+  uint64_t *n_positions = NULL, *n_postings = NULL;
+  int i, s;
+
+  table_name = grn_plugin_proc_get_var(ctx, user_data, "table", -1);
+  column_name = grn_plugin_proc_get_var(ctx, user_data, "column", -1);
+  tokenizer_name = grn_plugin_proc_get_var(ctx, user_data, "tokenizer", -1);
+  normalizer_name = grn_plugin_proc_get_var(ctx, user_data, "normalizer", -1);
+  token_filter_names = grn_plugin_proc_get_var(ctx, user_data,
+                                               "token_filters", -1);
+  n_workers_value = grn_plugin_proc_get_var(ctx, user_data, "n_workers", -1);
+
+  table = grn_ctx_get(ctx, GRN_TEXT_VALUE(table_name),
+                      GRN_TEXT_LEN(table_name));
+  if (!table) {
+    GRN_PLUGIN_ERROR(ctx, GRN_INVALID_ARGUMENT,
+                     "[yatof][analyze] "
+                     "nonexistent table: <%.*s>",
+                     (int)GRN_TEXT_LEN(table_name),
+                     GRN_TEXT_VALUE(table_name));
+    return NULL;
+  }
+  column = grn_obj_column(ctx, table, GRN_TEXT_VALUE(column_name),
+                          GRN_TEXT_LEN(column_name));
+  if (!column) {
+    GRN_PLUGIN_ERROR(ctx, GRN_INVALID_ARGUMENT,
+                     "[yatof][analyze] "
+                     "nonexistent column: <%.*s>",
+                     (int)GRN_TEXT_LEN(column_name),
+                     GRN_TEXT_VALUE(column_name));
+    return NULL;
+  }
+  tokenizer = grn_ctx_get(ctx, GRN_TEXT_VALUE(tokenizer_name),
+                          GRN_TEXT_LEN(tokenizer_name));
+  if (!tokenizer) {
+    GRN_PLUGIN_ERROR(ctx, GRN_INVALID_ARGUMENT,
+                     "[yatof][analyze] "
+                     "nonexistent tokenizer: <%.*s>",
+                     (int)GRN_TEXT_LEN(tokenizer_name),
+                     GRN_TEXT_VALUE(tokenizer_name));
+    return NULL;
+  }
+  tokenizer_id = grn_obj_id(ctx, tokenizer);
+  if (GRN_TEXT_LEN(normalizer_name) > 0) {
+    normalizer = grn_ctx_get(ctx, GRN_TEXT_VALUE(normalizer_name),
+                             GRN_TEXT_LEN(normalizer_name));
+    if (!normalizer) {
+      GRN_PLUGIN_ERROR(ctx, GRN_INVALID_ARGUMENT,
+                       "[yatof][analyze] "
+                       "nonexistent normalizer: <%.*s>",
+                       (int)GRN_TEXT_LEN(normalizer_name),
+                       GRN_TEXT_VALUE(normalizer_name));
+      return NULL;
+    }
+    normalizer_id = grn_obj_id(ctx, normalizer);
   }
 
-  // 英語文字の一般的な頻度（小文字）
-  const double eng_freq[26] = {
-    0.08167, 0.01492, 0.02802, 0.04271, 0.12702, // a-e
-    0.02228, 0.02015, 0.06094, 0.06966, 0.00153, // f-j
-    0.00772, 0.04025, 0.02406, 0.06749, 0.07507, // k-o
-    0.01929, 0.00095, 0.05987, 0.06327, 0.09056, // p-t
-    0.02758, 0.00978, 0.02360, 0.00150, 0.01974, // u-y
-    0.00074  // z
-  };
+  GRN_RECORD_INIT(&token_filter_ids, GRN_OBJ_VECTOR, GRN_ID_NIL);
+  if (analyze_parse_token_filters(ctx, token_filter_names,
+                                  &token_filter_ids) != GRN_SUCCESS) {
+    GRN_OBJ_FIN(ctx, &token_filter_ids);
+    return NULL;
+  }
+  n_token_filters = GRN_BULK_VSIZE(&token_filter_ids) / sizeof(grn_id);
+  n_stages = n_token_filters + 1;
 
-  int len = strlen(word);
-  if (len < 8) {
-    return 0; // 7文字以下は判定保留（より保守的に）
+  if (GRN_TEXT_LEN(n_workers_value) > 0) {
+    n_workers = grn_atoi(GRN_TEXT_VALUE(n_workers_value),
+                         GRN_BULK_CURR(n_workers_value), NULL);
+  }
+  if (n_workers <= 0) {
+    n_workers = sysconf(_SC_NPROCESSORS_ONLN);
+  }
+  if (n_workers <= 0) {
+    n_workers = 1;
+  } else if (n_workers > ANALYZE_MAX_N_WORKERS) {
+    n_workers = ANALYZE_MAX_N_WORKERS;
   }
 
-  // 文字数カウント
-  int char_count[26] = {0};
-  int valid_chars = 0;
-  int vowel_count = 0;
-  int consecutive_consonants = 0;
-  int max_consecutive_consonants = 0;
+  {
+    grn_table_cursor *cursor;
+    cursor = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0, 0, 1,
+                                   GRN_CURSOR_BY_ID | GRN_CURSOR_DESCENDING);
+    if (cursor) {
+      max_id = grn_table_cursor_next(ctx, cursor);
+      grn_table_cursor_close(ctx, cursor);
+    }
+  }
 
-  // 文字頻度と母音/子音の集計
-  for (int i = 0; i < len; i++) {
-    char c = tolower(word[i]);
-    if (c >= 'a' && c <= 'z') {
-      char_count[c - 'a']++;
-      valid_chars++;
+  workers = GRN_PLUGIN_CALLOC(ctx, sizeof(grn_yatof_analyze_worker) * n_workers);
+  threads = GRN_PLUGIN_CALLOC(ctx, sizeof(pthread_t) * n_workers);
+  merged = GRN_PLUGIN_CALLOC(ctx, sizeof(grn_obj *) * n_stages);
+  key_sizes = GRN_PLUGIN_CALLOC(ctx, sizeof(uint64_t) * n_stages);
+  n_positions = GRN_PLUGIN_CALLOC(ctx, sizeof(uint64_t) * n_stages);
+  n_postings = GRN_PLUGIN_CALLOC(ctx, sizeof(uint64_t) * n_stages);
+  if (!workers || !threads || !merged || !key_sizes ||
+      !n_positions || !n_postings) {
+    GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
+                     "[yatof][analyze] "
+                     "failed to allocate workers");
+    goto exit;
+  }
 
-      // 母音判定
-      if (c == 'a' || c == 'e' || c == 'i' || c == 'o' || c == 'u') {
-        vowel_count++;
-        consecutive_consonants = 0;
-      } else {
-        consecutive_consonants++;
-        if (consecutive_consonants > max_consecutive_consonants) {
-          max_consecutive_consonants = consecutive_consonants;
-        }
+  {
+    grn_id chunk_size = max_id / n_workers + 1;
+    for (i = 0; i < n_workers; i++) {
+      grn_yatof_analyze_worker *worker = &(workers[i]);
+      worker->db = grn_ctx_db(ctx);
+      worker->column_id = grn_obj_id(ctx, column);
+      worker->tokenizer_id = tokenizer_id;
+      worker->normalizer_id = normalizer_id;
+      worker->token_filter_ids = (grn_id *)GRN_BULK_HEAD(&token_filter_ids);
+      worker->n_token_filters = n_token_filters;
+      worker->min_id = chunk_size * i + 1;
+      worker->max_id = chunk_size * (i + 1);
+      worker->rc = GRN_SUCCESS;
+      worker->lexicons = GRN_PLUGIN_CALLOC(ctx, sizeof(grn_obj *) * n_stages);
+      worker->n_positions = GRN_PLUGIN_CALLOC(ctx, sizeof(uint64_t) * n_stages);
+      worker->n_postings = GRN_PLUGIN_CALLOC(ctx, sizeof(uint64_t) * n_stages);
+      worker->ctx = grn_ctx_open(0);
+      if (!worker->lexicons || !worker->n_positions ||
+          !worker->n_postings || !worker->ctx) {
+        GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
+                         "[yatof][analyze] "
+                         "failed to allocate a worker");
+        goto exit;
       }
     }
   }
 
-  // 有効な文字がなければ判定不能
-  if (valid_chars == 0) {
-    return 0;
+  for (i = 0; i < n_workers; i++) {
+    if (pthread_create(&(threads[i]), NULL,
+                       analyze_worker_run, &(workers[i])) == 0) {
+      workers[i].started = GRN_TRUE;
+    } else {
+      workers[i].rc = GRN_UNKNOWN_ERROR;
+    }
+  }
+  for (i = 0; i < n_workers; i++) {
+    if (workers[i].started) {
+      pthread_join(threads[i], NULL);
+    }
   }
 
-  // 判定条件を調整
-  double vowel_ratio = (double)vowel_count / valid_chars;
-  double freq_score = 0.0;
+  for (s = 0; s < n_stages; s++) {
+    merged[s] = grn_table_create(ctx, NULL, 0, NULL,
+                                 GRN_OBJ_TABLE_HASH_KEY,
+                                 grn_ctx_at(ctx, GRN_DB_SHORT_TEXT),
+                                 NULL);
+    if (!merged[s]) {
+      GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
+                       "[yatof][analyze] "
+                       "couldn't create a table");
+      goto exit;
+    }
+  }
+  for (i = 0; i < n_workers; i++) {
+    grn_yatof_analyze_worker *worker = &(workers[i]);
+    if (worker->rc != GRN_SUCCESS) {
+      GRN_PLUGIN_ERROR(ctx, worker->rc,
+                       "[yatof][analyze] "
+                       "worker %d failed: %s",
+                       i, worker->ctx->errbuf);
+      goto exit;
+    }
+    n_records += worker->n_records;
+    for (s = 0; s < n_stages; s++) {
+      grn_table_cursor *cursor;
+      n_positions[s] += worker->n_positions[s];
+      n_postings[s] += worker->n_postings[s];
+      cursor = grn_table_cursor_open(worker->ctx, worker->lexicons[s],
+                                     NULL, 0, NULL, 0, 0, -1, 0);
+      if (!cursor) {
+        continue;
+      }
+      while (grn_table_cursor_next(worker->ctx, cursor) != GRN_ID_NIL) {
+        void *key;
+        int key_size;
+        int added = 0;
+        key_size = grn_table_cursor_get_key(worker->ctx, cursor, &key);
+        grn_table_add(ctx, merged[s], key, key_size, &added);
+        if (added) {
+          key_sizes[s] += key_size;
+        }
+      }
+      grn_table_cursor_close(worker->ctx, cursor);
+    }
+  }
 
-  for (int i = 0; i < 26; i++) {
-    double observed_freq = (double)char_count[i] / valid_chars;
-    double expected_freq = eng_freq[i];
-    freq_score += (observed_freq - expected_freq) * (observed_freq - expected_freq);
+  {
+    int last = n_stages - 1;
+    uint64_t n_keys = grn_table_size(ctx, merged[last]);
+    uint64_t estimated_index_size =
+      key_sizes[last] +
+      n_keys * ANALYZE_KEY_OVERHEAD +
+      n_postings[last] * ANALYZE_POSTING_SIZE +
+      n_positions[last] * ANALYZE_POSITION_SIZE;
+
+    grn_ctx_output_map_open(ctx, "yatof_analyze", 8);
+    grn_ctx_output_cstr(ctx, "n_records");
+    grn_ctx_output_uint64(ctx, n_records);
+    grn_ctx_output_cstr(ctx, "n_tokens");
+    grn_ctx_output_uint64(ctx, n_positions[0]);
+    grn_ctx_output_cstr(ctx, "n_positions");
+    grn_ctx_output_uint64(ctx, n_positions[last]);
+    grn_ctx_output_cstr(ctx, "n_postings");
+    grn_ctx_output_uint64(ctx, n_postings[last]);
+    grn_ctx_output_cstr(ctx, "n_keys");
+    grn_ctx_output_uint64(ctx, n_keys);
+    grn_ctx_output_cstr(ctx, "key_size");
+    grn_ctx_output_uint64(ctx, key_sizes[last]);
+    grn_ctx_output_cstr(ctx, "estimated_index_size");
+    grn_ctx_output_uint64(ctx, estimated_index_size);
+    grn_ctx_output_cstr(ctx, "token_filters");
+    grn_ctx_output_array_open(ctx, "token_filters", n_token_filters);
+    for (s = 1; s < n_stages; s++) {
+      grn_obj *token_filter;
+      char name[GRN_TABLE_MAX_KEY_SIZE];
+      int name_size;
+      token_filter = grn_ctx_at(ctx,
+                                GRN_RECORD_VALUE_AT(&token_filter_ids, s - 1));
+      name_size = grn_obj_name(ctx, token_filter, name, GRN_TABLE_MAX_KEY_SIZE);
+      grn_ctx_output_map_open(ctx, "token_filter", 3);
+      grn_ctx_output_cstr(ctx, "name");
+      grn_ctx_output_str(ctx, name, name_size);
+      grn_ctx_output_cstr(ctx, "n_dropped");
+      grn_ctx_output_uint64(ctx, n_positions[s - 1] - n_positions[s]);
+      grn_ctx_output_cstr(ctx, "n_keys");
+      grn_ctx_output_uint64(ctx, grn_table_size(ctx, merged[s]));
+      grn_ctx_output_map_close(ctx);
+    }
+    grn_ctx_output_array_close(ctx);
+    grn_ctx_output_map_close(ctx);
   }
 
-  // デバッグ情報
-  // printf("DEBUG: %s - 母音比率: %.2f, 最大連続子音: %d, 頻度スコア: %.2f\n",
-          // word, vowel_ratio, max_consecutive_consonants, freq_score);
+exit :
+  if (workers) {
+    for (i = 0; i < n_workers; i++) {
+      grn_yatof_analyze_worker *worker = &(workers[i]);
+      if (worker->lexicons) {
+        for (s = 0; s < n_stages; s++) {
+          if (worker->lexicons[s]) {
+            grn_obj_close(worker->ctx, worker->lexicons[s]);
+          }
+        }
+        GRN_PLUGIN_FREE(ctx, worker->lexicons);
+      }
+      if (worker->ctx) {
+        grn_ctx_close(worker->ctx);
+      }
+      if (worker->n_positions) {
+        GRN_PLUGIN_FREE(ctx, worker->n_positions);
+      }
+      if (worker->n_postings) {
+        GRN_PLUGIN_FREE(ctx, worker->n_postings);
+      }
+    }
+    GRN_PLUGIN_FREE(ctx, workers);
+  }
+  if (merged) {
+    for (s = 0; s < n_stages; s++) {
+      if (merged[s]) {
+        grn_obj_close(ctx, merged[s]);
+      }
+    }
+    GRN_PLUGIN_FREE(ctx, merged);
+  }
+  if (threads) {
+    GRN_PLUGIN_FREE(ctx, threads);
+  }
+  if (key_sizes) {
+    GRN_PLUGIN_FREE(ctx, key_sizes);
+  }
+  if (n_positions) {
+    GRN_PLUGIN_FREE(ctx, n_positions);
+  }
+  if (n_postings) {
+    GRN_PLUGIN_FREE(ctx, n_postings);
+  }
+  GRN_OBJ_FIN(ctx, &token_filter_ids);
 
-  // スペースを含む場合は複数の英単語として扱い、非英単語とは判定しない
-  if (strchr(word, ' ') != NULL) {
-    return 0;
+  return NULL;
+}
+
+#define REINDEX_GENERATION_TABLE_PREFIX "yatof_generation_"
+#define REINDEX_BATCH_SIZE 1000
+
+typedef struct {
+  grn_ctx *ctx;
+  grn_obj *db;
+  grn_id *source_ids;
+  int n_sources;
+  grn_id tokenizer_id;
+  grn_id normalizer_id;
+  grn_obj *keys;
+  grn_obj *key_offsets;
+  grn_id min_id;
+  grn_id max_id;
+  grn_obj rids;
+  grn_bool started;
+  grn_rc rc;
+} grn_yatof_reindex_worker;
+
+static grn_bool
+reindex_is_mode_tag(const char *key, unsigned int key_size)
+{
+  return key_size >= 2 && key[0] == '<' && key[key_size - 1] == '>';
+}
+
+static void
+reindex_word_columns(grn_ctx *ctx, grn_obj *table, grn_obj *columns)
+{
+  grn_obj *column_ids;
+  grn_table_cursor *cursor;
+
+  column_ids = grn_table_create(ctx, NULL, 0, NULL,
+                                GRN_OBJ_TABLE_HASH_KEY,
+                                grn_ctx_at(ctx, GRN_DB_UINT32),
+                                NULL);
+  if (!column_ids) {
+    return;
+  }
+  grn_table_columns(ctx, table, "", 0, column_ids);
+  cursor = grn_table_cursor_open(ctx, column_ids, NULL, 0, NULL, 0, 0, -1, 0);
+  if (cursor) {
+    while (grn_table_cursor_next(ctx, cursor) != GRN_ID_NIL) {
+      void *key;
+      grn_obj *column;
+      grn_table_cursor_get_key(ctx, cursor, &key);
+      column = grn_ctx_at(ctx, *((grn_id *)key));
+      if (column && column->header.type != GRN_COLUMN_INDEX &&
+          (column->header.flags & GRN_OBJ_COLUMN_TYPE_MASK) ==
+          GRN_OBJ_COLUMN_SCALAR) {
+        GRN_PTR_PUT(ctx, columns, column);
+      }
+    }
+    grn_table_cursor_close(ctx, cursor);
   }
+  grn_obj_close(ctx, column_ids);
+}
 
-  // 判定条件（より保守的なOR条件）
-  // 1. 子音の連続が非常に多い（7以上）
-  if (max_consecutive_consonants >= 7) {
-    return 1;
+static grn_obj *
+reindex_generation_create(grn_ctx *ctx, grn_obj *word_table,
+                          const char *name, unsigned int name_size)
+{
+  grn_obj *generation;
+  grn_obj *normalizer;
+  grn_obj columns;
+  size_t i, n_columns;
+
+  generation = grn_table_create(ctx, name, name_size, NULL,
+                                GRN_OBJ_TABLE_HASH_KEY | GRN_OBJ_PERSISTENT,
+                                grn_ctx_at(ctx, word_table->header.domain),
+                                NULL);
+  if (!generation) {
+    return NULL;
+  }
+  normalizer = grn_obj_get_info(ctx, word_table, GRN_INFO_NORMALIZER, NULL);
+  if (normalizer) {
+    grn_obj_set_info(ctx, generation, GRN_INFO_NORMALIZER, normalizer);
   }
 
-  // 2. 母音比率が低く（15%未満）、子音の連続がやや多い（5以上）
-  if (vowel_ratio < 0.15 && max_consecutive_consonants >= 5) {
-    return 1;
+  GRN_PTR_INIT(&columns, GRN_OBJ_VECTOR, GRN_ID_NIL);
+  reindex_word_columns(ctx, word_table, &columns);
+  n_columns = GRN_BULK_VSIZE(&columns) / sizeof(grn_obj *);
+  for (i = 0; i < n_columns; i++) {
+    grn_obj *column = GRN_PTR_VALUE_AT(&columns, i);
+    char column_name[GRN_TABLE_MAX_KEY_SIZE];
+    int column_name_size;
+    column_name_size = grn_column_name(ctx, column, column_name,
+                                       GRN_TABLE_MAX_KEY_SIZE);
+    grn_column_create(ctx, generation, column_name, column_name_size, NULL,
+                      GRN_OBJ_COLUMN_SCALAR | GRN_OBJ_PERSISTENT,
+                      grn_ctx_at(ctx, grn_obj_get_range(ctx, column)));
   }
+  GRN_OBJ_FIN(ctx, &columns);
 
-  // 3. 母音比率が非常に低い（5%未満）
-  if (vowel_ratio < 0.05) {
-    return 1;
+  return generation;
+}
+
+/* Adds every key of table that is missing from other, or whose scalar
+   column values differ from other, to changed. */
+static void
+reindex_diff(grn_ctx *ctx, grn_obj *table, grn_obj *other,
+             grn_bool compare_values, grn_obj *changed)
+{
+  grn_obj columns;
+  grn_obj value, other_value;
+  grn_table_cursor *cursor;
+  size_t i, n_columns;
+
+  GRN_PTR_INIT(&columns, GRN_OBJ_VECTOR, GRN_ID_NIL);
+  if (compare_values) {
+    reindex_word_columns(ctx, table, &columns);
   }
+  n_columns = GRN_BULK_VSIZE(&columns) / sizeof(grn_obj *);
+  GRN_TEXT_INIT(&value, 0);
+  GRN_TEXT_INIT(&other_value, 0);
 
-  // 4. 文字頻度が英語と大きく異なる（0.4以上）
-  if (freq_score > 0.40) {
-    return 1;
+  cursor = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0, 0, -1, 0);
+  if (cursor) {
+    grn_id id;
+    while ((id = grn_table_cursor_next(ctx, cursor)) != GRN_ID_NIL) {
+      void *key;
+      int key_size;
+      grn_id other_id;
+      grn_bool is_changed = GRN_FALSE;
+
+      key_size = grn_table_cursor_get_key(ctx, cursor, &key);
+      other_id = grn_table_get(ctx, other, key, key_size);
+      if (other_id == GRN_ID_NIL) {
+        is_changed = GRN_TRUE;
+      }
+      for (i = 0; !is_changed && i < n_columns; i++) {
+        grn_obj *column = GRN_PTR_VALUE_AT(&columns, i);
+        grn_obj *other_column;
+        char column_name[GRN_TABLE_MAX_KEY_SIZE];
+        int column_name_size;
+
+        column_name_size = grn_column_name(ctx, column, column_name,
+                                           GRN_TABLE_MAX_KEY_SIZE);
+        other_column = grn_obj_column(ctx, other,
+                                      column_name, column_name_size);
+        if (!other_column) {
+          is_changed = GRN_TRUE;
+          break;
+        }
+        GRN_BULK_REWIND(&value);
+        GRN_BULK_REWIND(&other_value);
+        grn_obj_get_value(ctx, column, id, &value);
+        grn_obj_get_value(ctx, other_column, other_id, &other_value);
+        if (GRN_BULK_VSIZE(&value) != GRN_BULK_VSIZE(&other_value) ||
+            memcmp(GRN_BULK_HEAD(&value), GRN_BULK_HEAD(&other_value),
+                   GRN_BULK_VSIZE(&value))) {
+          is_changed = GRN_TRUE;
+        }
+        grn_obj_unlink(ctx, other_column);
+      }
+      if (is_changed) {
+        grn_table_add(ctx, changed, key, key_size, NULL);
+      }
+    }
+    grn_table_cursor_close(ctx, cursor);
   }
 
-  // いずれの条件も満たさない場合は英単語の可能性あり
-  return 0;
+  GRN_OBJ_FIN(ctx, &other_value);
+  GRN_OBJ_FIN(ctx, &value);
+  GRN_OBJ_FIN(ctx, &columns);
 }
 
-
-typedef struct {
-  grn_tokenizer_token token;
-  grn_obj *table;
+static void
+reindex_generation_record(grn_ctx *ctx, grn_obj *word_table,
+                          grn_obj *generation)
+{
+  grn_obj columns;
   grn_obj value;
-  grn_bool remove_html;
-  grn_bool remove_eos;
-  grn_bool remove_non_en;
-} grn_remove_word_token_filter;
+  grn_table_cursor *cursor;
+  size_t i, n_columns;
 
-static void *
-remove_word_init(grn_ctx *ctx, GNUC_UNUSED grn_obj *table, GNUC_UNUSED grn_token_mode mode)
-{
-  grn_remove_word_token_filter *token_filter;
-  const char *remove_word_table_name_env;
+  grn_table_truncate(ctx, generation);
 
-  token_filter = GRN_PLUGIN_MALLOC(ctx, sizeof(grn_remove_word_token_filter));
-  if (!token_filter) {
-    GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
-                     "[token-filter][remove-word] "
-                     "failed to allocate grn_remove_word_token_filter");
-    return NULL;
+  GRN_PTR_INIT(&columns, GRN_OBJ_VECTOR, GRN_ID_NIL);
+  reindex_word_columns(ctx, word_table, &columns);
+  n_columns = GRN_BULK_VSIZE(&columns) / sizeof(grn_obj *);
+
+  cursor = grn_table_cursor_open(ctx, word_table, NULL, 0, NULL, 0, 0, -1, 0);
+  if (cursor) {
+    grn_id id;
+    while ((id = grn_table_cursor_next(ctx, cursor)) != GRN_ID_NIL) {
+      void *key;
+      int key_size;
+      grn_id generation_id;
+
+      key_size = grn_table_cursor_get_key(ctx, cursor, &key);
+      generation_id = grn_table_add(ctx, generation, key, key_size, NULL);
+      if (generation_id == GRN_ID_NIL) {
+        continue;
+      }
+      for (i = 0; i < n_columns; i++) {
+        grn_obj *column = GRN_PTR_VALUE_AT(&columns, i);
+        grn_obj *generation_column;
+        char column_name[GRN_TABLE_MAX_KEY_SIZE];
+        int column_name_size;
+
+        column_name_size = grn_column_name(ctx, column, column_name,
+                                           GRN_TABLE_MAX_KEY_SIZE);
+        generation_column = grn_obj_column(ctx, generation,
+                                           column_name, column_name_size);
+        if (!generation_column) {
+          continue;
+        }
+        GRN_OBJ_INIT(&value, GRN_BULK, 0, grn_obj_get_range(ctx, column));
+        grn_obj_get_value(ctx, column, id, &value);
+        grn_obj_set_value(ctx, generation_column, generation_id,
+                          &value, GRN_OBJ_SET);
+        GRN_OBJ_FIN(ctx, &value);
+        grn_obj_unlink(ctx, generation_column);
+      }
+    }
+    grn_table_cursor_close(ctx, cursor);
   }
-  remove_word_table_name_env = getenv("GRN_YATOF_REMOVE_WORD_TABLE_NAME");
-  if (remove_word_table_name_env) {
-    token_filter->table = grn_ctx_get(ctx,
-                                      remove_word_table_name_env,
-                                      strlen(remove_word_table_name_env));
+  GRN_OBJ_FIN(ctx, &columns);
+}
+
+static grn_obj *
+reindex_source_open(grn_ctx *ctx, grn_id source_id)
+{
+  grn_obj *source = grn_ctx_at(ctx, source_id);
+  if (source && grn_obj_is_table(ctx, source)) {
+    return grn_obj_column(ctx, source, "_key", 4);
+  }
+  return source;
+}
+
+static void
+reindex_source_value_init(grn_obj *source, grn_obj *value)
+{
+  if (source->header.type == GRN_COLUMN_VAR_SIZE &&
+      (source->header.flags & GRN_OBJ_COLUMN_TYPE_MASK) ==
+      GRN_OBJ_COLUMN_VECTOR) {
+    GRN_OBJ_INIT(value, GRN_VECTOR, 0, GRN_DB_TEXT);
   } else {
-    token_filter->table = grn_ctx_get(ctx,
-                                      REMOVE_WORD_TABLE_NAME,
-                                      strlen(REMOVE_WORD_TABLE_NAME));
+    GRN_TEXT_INIT(value, 0);
   }
-  if (!token_filter->table) {
-    GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
-                     "[token-filter][remove-word] "
-                     "couldn't open a table");
-    GRN_PLUGIN_FREE(ctx, token_filter);
+}
+
+static grn_bool
+reindex_value_has_keys(grn_ctx *ctx, grn_obj *lexicon,
+                       grn_obj *value, grn_obj *ids)
+{
+  if (value->header.type == GRN_VECTOR) {
+    unsigned int i, n_elements;
+    n_elements = grn_vector_size(ctx, value);
+    for (i = 0; i < n_elements; i++) {
+      const char *element;
+      unsigned int element_size;
+      element_size = grn_vector_get_element(ctx, value, i, &element,
+                                            NULL, NULL);
+      GRN_BULK_REWIND(ids);
+      grn_table_tokenize(ctx, lexicon, element, element_size, ids, GRN_FALSE);
+      if (GRN_BULK_VSIZE(ids) > 0) {
+        return GRN_TRUE;
+      }
+    }
+    return GRN_FALSE;
+  }
+  GRN_BULK_REWIND(ids);
+  grn_table_tokenize(ctx, lexicon,
+                     GRN_TEXT_VALUE(value), GRN_TEXT_LEN(value),
+                     ids, GRN_FALSE);
+  return GRN_BULK_VSIZE(ids) > 0;
+}
+
+static void *
+reindex_worker_run(void *arg)
+{
+  grn_yatof_reindex_worker *worker = arg;
+  grn_ctx *ctx = worker->ctx;
+  grn_obj *lexicon;
+  grn_obj ids;
+  int i;
+  size_t k, n_keys;
+
+  grn_ctx_use(ctx, worker->db);
+  lexicon = analyze_lexicon_create(ctx,
+                                   worker->tokenizer_id,
+                                   worker->normalizer_id,
+                                   NULL, 0);
+  if (!lexicon) {
+    worker->rc = ctx->rc != GRN_SUCCESS ? ctx->rc : GRN_NO_MEMORY_AVAILABLE;
     return NULL;
   }
+  n_keys = GRN_BULK_VSIZE(worker->key_offsets) / sizeof(uint32_t) - 1;
+  for (k = 0; k < n_keys; k++) {
+    uint32_t *offsets = (uint32_t *)GRN_BULK_HEAD(worker->key_offsets);
+    grn_table_add(ctx, lexicon,
+                  GRN_TEXT_VALUE(worker->keys) + offsets[k],
+                  offsets[k + 1] - offsets[k],
+                  NULL);
+  }
+
+  GRN_RECORD_INIT(&ids, 0, GRN_ID_NIL);
+  for (i = 0; i < worker->n_sources; i++) {
+    grn_obj *source;
+    grn_obj *table;
+    grn_obj value;
+    grn_id id;
+
+    source = reindex_source_open(ctx, worker->source_ids[i]);
+    if (!source) {
+      continue;
+    }
+    table = grn_column_table(ctx, source);
+    reindex_source_value_init(source, &value);
+    for (id = yatof_table_next_id(ctx, table, worker->min_id, worker->max_id);
+         id != GRN_ID_NIL;
+         id = yatof_table_next_id(ctx, table, id + 1, worker->max_id)) {
+      GRN_BULK_REWIND(&value);
+      grn_obj_get_value(ctx, source, id, &value);
+      if (reindex_value_has_keys(ctx, lexicon, &value, &ids)) {
+        GRN_RECORD_PUT(ctx, &(worker->rids), id);
+      }
+    }
+    GRN_OBJ_FIN(ctx, &value);
+  }
+  GRN_OBJ_FIN(ctx, &ids);
+  grn_obj_close(ctx, lexicon);
+
+  return NULL;
+}
+
+static grn_rc
+reindex_scan(grn_ctx *ctx, grn_obj *index, grn_obj *source_ids,
+             grn_obj *keys, grn_obj *key_offsets,
+             int n_workers, grn_obj *affected)
+{
+  grn_obj *lexicon = grn_column_table(ctx, index);
+  grn_obj *source_table = grn_ctx_at(ctx, grn_obj_get_range(ctx, index));
+  grn_obj *tokenizer, *normalizer;
+  grn_yatof_reindex_worker *workers;
+  pthread_t *threads;
+  grn_id max_id = GRN_ID_NIL;
+  grn_id chunk_size;
+  grn_rc rc = GRN_SUCCESS;
+  int i;
+
+  tokenizer = grn_obj_get_info(ctx, lexicon, GRN_INFO_DEFAULT_TOKENIZER, NULL);
+  normalizer = grn_obj_get_info(ctx, lexicon, GRN_INFO_NORMALIZER, NULL);
+  if (!tokenizer) {
+    GRN_PLUGIN_ERROR(ctx, GRN_INVALID_ARGUMENT,
+                     "[yatof][reindex] "
+                     "lexicon has no tokenizer");
+    return ctx->rc;
+  }
 
-  token_filter->remove_html = GRN_FALSE;
   {
-    grn_id id;
-    id = grn_table_get(ctx, token_filter->table, REMOVE_WORD_HTML_TAG, strlen(REMOVE_WORD_HTML_TAG));
-    if (id) {
-      token_filter->remove_html = GRN_TRUE;
+    grn_table_cursor *cursor;
+    cursor = grn_table_cursor_open(ctx, source_table, NULL, 0, NULL, 0, 0, 1,
+                                   GRN_CURSOR_BY_ID | GRN_CURSOR_DESCENDING);
+    if (cursor) {
+      max_id = grn_table_cursor_next(ctx, cursor);
+      grn_table_cursor_close(ctx, cursor);
     }
   }
-  token_filter->remove_eos = GRN_FALSE;
-  {
-    grn_id id;
-    id = grn_table_get(ctx, token_filter->table, REMOVE_WORD_EOS_TAG, strlen(REMOVE_WORD_EOS_TAG));
-    if (id) {
-      token_filter->remove_eos = GRN_TRUE;
-    }
+  chunk_size = max_id / n_workers + 1;
+
+  workers = GRN_PLUGIN_CALLOC(ctx, sizeof(grn_yatof_reindex_worker) * n_workers);
+  threads = GRN_PLUGIN_CALLOC(ctx, sizeof(pthread_t) * n_workers);
+  if (!workers || !threads) {
+    GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
+                     "[yatof][reindex] "
+                     "failed to allocate workers");
+    rc = ctx->rc;
+    goto exit;
   }
-  token_filter->remove_non_en = GRN_FALSE;
-  {
-    grn_id id;
-    id = grn_table_get(ctx, token_filter->table, REMOVE_WORD_NON_ENGLISH_TAG, strlen(REMOVE_WORD_NON_ENGLISH_TAG));
-    if (id) {
-      token_filter->remove_non_en = GRN_TRUE;
+  for (i = 0; i < n_workers; i++) {
+    grn_yatof_reindex_worker *worker = &(workers[i]);
+    worker->db = grn_ctx_db(ctx);
+    worker->source_ids = (grn_id *)GRN_BULK_HEAD(source_ids);
+    worker->n_sources = GRN_BULK_VSIZE(source_ids) / sizeof(grn_id);
+    worker->tokenizer_id = grn_obj_id(ctx, tokenizer);
+    worker->normalizer_id = normalizer ? grn_obj_id(ctx, normalizer) : GRN_ID_NIL;
+    worker->keys = keys;
+    worker->key_offsets = key_offsets;
+    worker->min_id = chunk_size * i + 1;
+    worker->max_id = chunk_size * (i + 1);
+    worker->rc = GRN_SUCCESS;
+    worker->ctx = grn_ctx_open(0);
+    if (!worker->ctx) {
+      GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
+                       "[yatof][reindex] "
+                       "failed to allocate a worker");
+      rc = ctx->rc;
+      goto exit;
     }
+    GRN_RECORD_INIT(&(worker->rids), GRN_OBJ_VECTOR, GRN_ID_NIL);
   }
-  GRN_TEXT_INIT(&(token_filter->value), 0);
 
-  grn_tokenizer_token_init(ctx, &(token_filter->token));
+  for (i = 0; i < n_workers; i++) {
+    if (pthread_create(&(threads[i]), NULL,
+                       reindex_worker_run, &(workers[i])) == 0) {
+      workers[i].started = GRN_TRUE;
+    } else {
+      workers[i].rc = GRN_UNKNOWN_ERROR;
+    }
+  }
+  for (i = 0; i < n_workers; i++) {
+    grn_yatof_reindex_worker *worker = &(workers[i]);
+    size_t j, n_rids;
+    if (worker->started) {
+      pthread_join(threads[i], NULL);
+    }
+    if (worker->rc != GRN_SUCCESS) {
+      GRN_PLUGIN_ERROR(ctx, worker->rc,
+                       "[yatof][reindex] "
+                       "worker %d failed: %s",
+                       i, worker->ctx->errbuf);
+      rc = ctx->rc;
+      continue;
+    }
+    n_rids = GRN_BULK_VSIZE(&(worker->rids)) / sizeof(grn_id);
+    for (j = 0; j < n_rids; j++) {
+      grn_id rid = GRN_RECORD_VALUE_AT(&(worker->rids), j);
+      grn_table_add(ctx, affected, &rid, sizeof(grn_id), NULL);
+    }
+  }
 
-  return token_filter;
+exit :
+  if (workers) {
+    for (i = 0; i < n_workers; i++) {
+      if (workers[i].ctx) {
+        GRN_OBJ_FIN(workers[i].ctx, &(workers[i].rids));
+        grn_ctx_close(workers[i].ctx);
+      }
+    }
+    GRN_PLUGIN_FREE(ctx, workers);
+  }
+  if (threads) {
+    GRN_PLUGIN_FREE(ctx, threads);
+  }
+  return rc;
 }
 
 static void
-remove_word_filter(grn_ctx *ctx,
-                   grn_token *current_token,
-                   grn_token *next_token,
-                   void *user_data)
+reindex_record_update(grn_ctx *ctx, grn_obj *index, grn_id rid,
+                      grn_obj *source_ids, grn_yatof_table_override *override)
 {
-  grn_remove_word_token_filter *token_filter = user_data;
-  grn_obj *data;
-  grn_tokenizer_status status;
-  data = grn_token_get_data(ctx, current_token);
+  size_t i, n_sources;
 
-  status = grn_token_get_status(ctx, current_token);
+  n_sources = GRN_BULK_VSIZE(source_ids) / sizeof(grn_id);
+  for (i = 0; i < n_sources; i++) {
+    grn_obj *source;
+    grn_obj value;
 
-  if (token_filter->remove_html) {
+    source = reindex_source_open(ctx, GRN_RECORD_VALUE_AT(source_ids, i));
+    if (!source) {
+      continue;
+    }
+    reindex_source_value_init(source, &value);
+    grn_obj_get_value(ctx, source, rid, &value);
 
-    int char_length;
-    int rest_length = GRN_TEXT_LEN(data);
-    const char *rest = GRN_TEXT_VALUE(data);
+    yatof_table_override = override;
+    grn_ii_column_update(ctx, (grn_ii *)index, rid, i + 1, &value, NULL, NULL);
+    yatof_table_override = NULL;
+    grn_ii_column_update(ctx, (grn_ii *)index, rid, i + 1, NULL, &value, NULL);
 
-    GRN_BULK_REWIND(&(token_filter->value));
+    GRN_OBJ_FIN(ctx, &value);
+  }
+}
 
-    grn_bool in_tag = GRN_FALSE;
-    const char *tag_start = NULL;
-    int tag_length = 0;
-    grn_encoding encoding = GRN_CTX_GET_ENCODING(ctx);
+static grn_obj *
+command_yatof_reindex(grn_ctx *ctx, GNUC_UNUSED int nargs,
+                      GNUC_UNUSED grn_obj **args, grn_user_data *user_data)
+{
+  grn_obj *word_table_name, *index_name, *n_workers_value;
+  grn_obj *word_table, *index, *lexicon, *generation;
+  grn_obj *changed = NULL, *affected = NULL;
+  grn_obj source_ids, keys, key_offsets, rids;
+  grn_yatof_table_override override;
+  char name[GRN_TABLE_MAX_KEY_SIZE];
+  char generation_name[GRN_TABLE_MAX_KEY_SIZE];
+  int name_size, generation_name_size;
+  int n_workers = 0;
+  grn_bool is_mode_changed = GRN_FALSE;
+  unsigned int n_changed_keys = 0, n_scanned_keys = 0;
+  size_t i, n_affected = 0;
+
+  word_table_name = grn_plugin_proc_get_var(ctx, user_data, "word_table", -1);
+  index_name = grn_plugin_proc_get_var(ctx, user_data, "index", -1);
+  n_workers_value = grn_plugin_proc_get_var(ctx, user_data, "n_workers", -1);
+
+  word_table = grn_ctx_get(ctx, GRN_TEXT_VALUE(word_table_name),
+                           GRN_TEXT_LEN(word_table_name));
+  if (!word_table) {
+    GRN_PLUGIN_ERROR(ctx, GRN_INVALID_ARGUMENT,
+                     "[yatof][reindex] "
+                     "nonexistent word table: <%.*s>",
+                     (int)GRN_TEXT_LEN(word_table_name),
+                     GRN_TEXT_VALUE(word_table_name));
+    return NULL;
+  }
+  index = grn_ctx_get(ctx, GRN_TEXT_VALUE(index_name),
+                      GRN_TEXT_LEN(index_name));
+  if (!index || index->header.type != GRN_COLUMN_INDEX) {
+    GRN_PLUGIN_ERROR(ctx, GRN_INVALID_ARGUMENT,
+                     "[yatof][reindex] "
+                     "nonexistent index column: <%.*s>",
+                     (int)GRN_TEXT_LEN(index_name),
+                     GRN_TEXT_VALUE(index_name));
+    return NULL;
+  }
+  lexicon = grn_column_table(ctx, index);
 
-    while (rest_length > 0) {
-      grn_char_type type;
-      char_length = grn_plugin_charlen(ctx, rest, rest_length, encoding);
-      if (char_length == 0) {
+  if (GRN_TEXT_LEN(n_workers_value) > 0) {
+    n_workers = grn_atoi(GRN_TEXT_VALUE(n_workers_value),
+                         GRN_BULK_CURR(n_workers_value), NULL);
+  }
+  if (n_workers <= 0) {
+    n_workers = sysconf(_SC_NPROCESSORS_ONLN);
+  }
+  if (n_workers <= 0) {
+    n_workers = 1;
+  } else if (n_workers > ANALYZE_MAX_N_WORKERS) {
+    n_workers = ANALYZE_MAX_N_WORKERS;
+  }
+
+  name_size = grn_obj_name(ctx, word_table, name, GRN_TABLE_MAX_KEY_SIZE);
+  generation_name_size = snprintf(generation_name, GRN_TABLE_MAX_KEY_SIZE,
+                                  "%s%.*s",
+                                  REINDEX_GENERATION_TABLE_PREFIX,
+                                  name_size, name);
+  generation = grn_ctx_get(ctx, generation_name, generation_name_size);
+  if (!generation) {
+    generation = reindex_generation_create(ctx, word_table, generation_name,
+                                           generation_name_size);
+    if (!generation) {
+      GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
+                       "[yatof][reindex] "
+                       "couldn't create generation table: <%.*s>",
+                       generation_name_size, generation_name);
+      return NULL;
+    }
+    reindex_generation_record(ctx, word_table, generation);
+    GRN_PLUGIN_LOG(ctx, GRN_LOG_NOTICE,
+                   "[yatof][reindex] "
+                   "recorded the first generation of <%.*s>",
+                   name_size, name);
+    grn_ctx_output_map_open(ctx, "yatof_reindex", 3);
+    grn_ctx_output_cstr(ctx, "n_changed_keys");
+    grn_ctx_output_uint64(ctx, 0);
+    grn_ctx_output_cstr(ctx, "n_scanned_keys");
+    grn_ctx_output_uint64(ctx, 0);
+    grn_ctx_output_cstr(ctx, "n_affected_records");
+    grn_ctx_output_uint64(ctx, 0);
+    grn_ctx_output_map_close(ctx);
+    return NULL;
+  }
+
+  GRN_RECORD_INIT(&source_ids, GRN_OBJ_VECTOR, GRN_ID_NIL);
+  GRN_TEXT_INIT(&keys, 0);
+  GRN_UINT32_INIT(&key_offsets, GRN_OBJ_VECTOR);
+  GRN_RECORD_INIT(&rids, GRN_OBJ_VECTOR, GRN_ID_NIL);
+  grn_obj_get_info(ctx, index, GRN_INFO_SOURCE, &source_ids);
+
+  changed = grn_table_create(ctx, NULL, 0, NULL,
+                             GRN_OBJ_TABLE_HASH_KEY,
+                             grn_ctx_at(ctx, GRN_DB_SHORT_TEXT),
+                             NULL);
+  affected = grn_table_create(ctx, NULL, 0, NULL,
+                              GRN_OBJ_TABLE_HASH_KEY,
+                              grn_ctx_at(ctx, grn_obj_get_range(ctx, index)),
+                              NULL);
+  if (!changed || !affected) {
+    GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
+                     "[yatof][reindex] "
+                     "couldn't create a table");
+    goto exit;
+  }
+  reindex_diff(ctx, word_table, generation, GRN_TRUE, changed);
+  reindex_diff(ctx, generation, word_table, GRN_FALSE, changed);
+  n_changed_keys = grn_table_size(ctx, changed);
+
+  {
+    grn_table_cursor *cursor;
+    cursor = grn_table_cursor_open(ctx, changed, NULL, 0, NULL, 0, 0, -1, 0);
+    GRN_UINT32_SET(ctx, &key_offsets, 0);
+    while (cursor && grn_table_cursor_next(ctx, cursor) != GRN_ID_NIL) {
+      void *key;
+      int key_size;
+      grn_id tid;
+
+      key_size = grn_table_cursor_get_key(ctx, cursor, &key);
+      if (reindex_is_mode_tag(key, key_size)) {
+        GRN_PLUGIN_ERROR(ctx, GRN_OPERATION_NOT_PERMITTED,
+                         "[yatof][reindex] "
+                         "mode tag <%.*s> is changed: "
+                         "the whole index must be rebuilt",
+                         key_size, (const char *)key);
+        is_mode_changed = GRN_TRUE;
         break;
       }
-
-      if (!in_tag) {
-        if (*rest == '<') {
-          in_tag = GRN_TRUE;
-          tag_start = rest;
-          tag_length = 0;
-        } else {
-          GRN_TEXT_PUT(ctx, &(token_filter->value), rest, char_length);
+      tid = grn_table_get(ctx, lexicon, key, key_size);
+      if (tid != GRN_ID_NIL) {
+        grn_ii_cursor *ii_cursor;
+        grn_posting *posting;
+        ii_cursor = grn_ii_cursor_open(ctx, (grn_ii *)index, tid,
+                                       GRN_ID_NIL, GRN_ID_MAX, 0, 0);
+        if (ii_cursor) {
+          while ((posting = grn_ii_cursor_next(ctx, ii_cursor))) {
+            grn_table_add(ctx, affected, &(posting->rid), sizeof(grn_id),
+                          NULL);
+          }
+          grn_ii_cursor_close(ctx, ii_cursor);
         }
       } else {
-        if (*rest == '>') {
-          in_tag = GRN_FALSE;
-          tag_length = 0;
-        } else {
-          tag_length += char_length;
-        }
-      }
-
-      rest += char_length;
-      rest_length -= char_length;
-    }
-
-    // Handle case where document ends with an unclosed tag
-    if (in_tag) {
-      const char *p = tag_start;
-      rest_length = GRN_TEXT_LEN(data) - (p - GRN_TEXT_VALUE(data));
-      while (rest_length > 0) {
-        char_length = grn_plugin_charlen(ctx, p, rest_length, encoding);
-        GRN_TEXT_PUT(ctx, &(token_filter->value), p, char_length);
-        p += char_length;
-        rest_length -= char_length;
+        GRN_TEXT_PUT(ctx, &keys, key, key_size);
+        GRN_UINT32_PUT(ctx, &key_offsets, GRN_TEXT_LEN(&keys));
+        n_scanned_keys++;
       }
     }
-
-    grn_token_set_data(ctx, next_token,
-                       GRN_TEXT_VALUE(&(token_filter->value)),
-                       GRN_TEXT_LEN(&(token_filter->value)));
-
-    grn_id id;
-    id = grn_table_get(ctx, token_filter->table,
-                       GRN_TEXT_VALUE(&(token_filter->value)), GRN_TEXT_LEN(&(token_filter->value)));
-    if (id != GRN_ID_NIL) {
-      status |= GRN_TOKEN_SKIP;
+    if (cursor) {
+      grn_table_cursor_close(ctx, cursor);
     }
   }
-
-  if (token_filter->remove_eos) {
-    int char_length;
-    int rest_length = GRN_TEXT_LEN(data);
-    const char *rest = GRN_TEXT_VALUE(data);
-
-    if (rest_length >= 4 && (strncmp(rest, "EOS ", 4) == 0 || strncmp(rest, "eos ", 4) == 0)) {
-      status |= GRN_TOKEN_SKIP;
-    }
+  if (is_mode_changed) {
+    goto exit;
   }
 
-  if (token_filter->remove_non_en) {
-    int char_length;
-    int rest_length = GRN_TEXT_LEN(data);
-    const char *rest = GRN_TEXT_VALUE(data);
-    char buf[256];
-    int copy_len = rest_length < 255 ? rest_length : 255;
-    memcpy(buf, rest, copy_len);
-    buf[copy_len] = '\0';
-    if (is_alpha_only(buf) && is_non_english_word(buf)) {
-      status |= GRN_TOKEN_SKIP;
+  if (n_scanned_keys > 0) {
+    if (reindex_scan(ctx, index, &source_ids, &keys, &key_offsets,
+                     n_workers, affected) != GRN_SUCCESS) {
+      goto exit;
     }
   }
 
   {
-    grn_id id;
-    id = grn_table_get(ctx, token_filter->table,
-                       GRN_TEXT_VALUE(data), GRN_TEXT_LEN(data));
-    if (id != GRN_ID_NIL) {
-      status |= GRN_TOKEN_SKIP;
+    grn_table_cursor *cursor;
+    cursor = grn_table_cursor_open(ctx, affected, NULL, 0, NULL, 0, 0, -1, 0);
+    while (cursor && grn_table_cursor_next(ctx, cursor) != GRN_ID_NIL) {
+      void *key;
+      grn_table_cursor_get_key(ctx, cursor, &key);
+      GRN_RECORD_PUT(ctx, &rids, *((grn_id *)key));
+    }
+    if (cursor) {
+      grn_table_cursor_close(ctx, cursor);
     }
   }
-  grn_token_set_status(ctx, next_token, status);
-}
 
-static void
-remove_word_fin(grn_ctx *ctx, void *user_data)
-{
-  grn_remove_word_token_filter *token_filter = user_data;
-  if (!token_filter) {
-    return;
-  }
-  if (token_filter->table) {
-    grn_obj_unlink(ctx, token_filter->table);
+  override.name = name;
+  override.name_size = name_size;
+  override.alternative_name = generation_name;
+  override.alternative_name_size = generation_name_size;
+  n_affected = GRN_BULK_VSIZE(&rids) / sizeof(grn_id);
+  for (i = 0; i < n_affected; i++) {
+    reindex_record_update(ctx, index, GRN_RECORD_VALUE_AT(&rids, i),
+                          &source_ids, &override);
+    if ((i + 1) % REINDEX_BATCH_SIZE == 0 || i + 1 == n_affected) {
+      GRN_PLUGIN_LOG(ctx, GRN_LOG_INFO,
+                     "[yatof][reindex] "
+                     "updated %u/%u records",
+                     (unsigned int)(i + 1), (unsigned int)n_affected);
+    }
   }
-  grn_obj_close(ctx, &(token_filter->value));
-  grn_tokenizer_token_fin(ctx, &(token_filter->token));
-  GRN_PLUGIN_FREE(ctx, token_filter);
-}
 
-typedef struct {
-  grn_tokenizer_token token;
-  grn_obj value;
-} grn_remove_non_english_token_filter;
+  reindex_generation_record(ctx, word_table, generation);
 
-static void *
-remove_non_english_init(grn_ctx *ctx, GNUC_UNUSED grn_obj *table, GNUC_UNUSED grn_token_mode mode)
-{
-  grn_remove_non_english_token_filter *token_filter;
-  const char *remove_word_table_name_env;
+  grn_ctx_output_map_open(ctx, "yatof_reindex", 3);
+  grn_ctx_output_cstr(ctx, "n_changed_keys");
+  grn_ctx_output_uint64(ctx, n_changed_keys);
+  grn_ctx_output_cstr(ctx, "n_scanned_keys");
+  grn_ctx_output_uint64(ctx, n_scanned_keys);
+  grn_ctx_output_cstr(ctx, "n_affected_records");
+  grn_ctx_output_uint64(ctx, n_affected);
+  grn_ctx_output_map_close(ctx);
 
-  token_filter = GRN_PLUGIN_MALLOC(ctx, sizeof(grn_remove_non_english_token_filter));
-  if (!token_filter) {
-    GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
-                     "[token-filter][remove-non-english] "
-                     "failed to allocate grn_remove_non_english_token_filter");
-    return NULL;
+exit :
+  if (affected) {
+    grn_obj_close(ctx, affected);
   }
-  GRN_TEXT_INIT(&(token_filter->value), 0);
+  if (changed) {
+    grn_obj_close(ctx, changed);
+  }
+  GRN_OBJ_FIN(ctx, &rids);
+  GRN_OBJ_FIN(ctx, &key_offsets);
+  GRN_OBJ_FIN(ctx, &keys);
+  GRN_OBJ_FIN(ctx, &source_ids);
 
-  grn_tokenizer_token_init(ctx, &(token_filter->token));
+  return NULL;
+}
 
-  return token_filter;
+static grn_obj *
+command_yatof_memory(grn_ctx *ctx, GNUC_UNUSED int nargs,
+                     GNUC_UNUSED grn_obj **args,
+                     GNUC_UNUSED grn_user_data *user_data)
+{
+  grn_yatof_memory_filter_stat filter_stats[YATOF_MEMORY_N_FILTERS];
+  grn_yatof_memory_total_stat total_stat;
+  int i;
+
+  grn_plugin_mutex_lock(ctx, yatof_memory_mutex);
+  memcpy(filter_stats, yatof_memory_filter_stats, sizeof(filter_stats));
+  total_stat = yatof_memory_total_stat;
+  grn_plugin_mutex_unlock(ctx, yatof_memory_mutex);
+
+  grn_ctx_output_map_open(ctx, "yatof_memory", 2);
+  grn_ctx_output_cstr(ctx, "filters");
+  grn_ctx_output_array_open(ctx, "filters", YATOF_MEMORY_N_FILTERS);
+  for (i = 0; i < YATOF_MEMORY_N_FILTERS; i++) {
+    grn_ctx_output_map_open(ctx, "filter", 3);
+    grn_ctx_output_cstr(ctx, "name");
+    grn_ctx_output_cstr(ctx, yatof_memory_filter_names[i]);
+    grn_ctx_output_cstr(ctx, "peak_bytes");
+    grn_ctx_output_uint64(ctx, filter_stats[i].peak_bytes);
+    grn_ctx_output_cstr(ctx, "n_capped");
+    grn_ctx_output_uint64(ctx, filter_stats[i].n_capped);
+    grn_ctx_output_map_close(ctx);
+  }
+  grn_ctx_output_array_close(ctx);
+  grn_ctx_output_cstr(ctx, "total");
+  grn_ctx_output_map_open(ctx, "total", 2);
+  grn_ctx_output_cstr(ctx, "bytes");
+  grn_ctx_output_uint64(ctx, total_stat.bytes);
+  grn_ctx_output_cstr(ctx, "peak_bytes");
+  grn_ctx_output_uint64(ctx, total_stat.peak_bytes);
+  grn_ctx_output_map_close(ctx);
+  grn_ctx_output_map_close(ctx);
+
+  return NULL;
 }
 
 static void
-remove_non_english_filter(grn_ctx *ctx,
-                          grn_token *current_token,
-                          grn_token *next_token,
-                          void *user_data)
+dictionary_compile_align(grn_ctx *ctx, grn_obj *image)
 {
-  grn_remove_non_english_token_filter *token_filter = user_data;
-  grn_obj *data;
-  grn_tokenizer_status status;
-  data = grn_token_get_data(ctx, current_token);
-
-  status = grn_token_get_status(ctx, current_token);
-
-  {
-    GRN_BULK_REWIND(&(token_filter->value));
-    GRN_TEXT_SET(ctx, &(token_filter->value), GRN_TEXT_VALUE(data), GRN_TEXT_LEN(data));
-    GRN_TEXT_PUTC(ctx, &(token_filter->value), '\0');
-    if (is_alpha_only(GRN_TEXT_VALUE(&(token_filter->value))) && is_non_english_word(GRN_TEXT_VALUE(&(token_filter->value)))) {
-      status |= GRN_TOKEN_SKIP_WITH_POSITION;
-    }
+  while (GRN_TEXT_LEN(image) % YATOF_DICTIONARY_ALIGNMENT != 0) {
+    GRN_TEXT_PUTC(ctx, image, '\0');
   }
-
-  grn_token_set_status(ctx, next_token, status);
 }
 
-static void
-remove_non_english_fin(grn_ctx *ctx, void *user_data)
+static grn_rc
+dictionary_compile_write(grn_ctx *ctx, const char *path, grn_obj *image)
 {
-  grn_remove_non_english_token_filter *token_filter = user_data;
-  if (!token_filter) {
-    return;
+  char temporary_path[PATH_MAX];
+  FILE *file;
+  grn_bool written;
+
+  if (snprintf(temporary_path, PATH_MAX, "%s.%d.tmp",
+               path, (int)getpid()) >= PATH_MAX) {
+    GRN_PLUGIN_ERROR(ctx, GRN_INVALID_ARGUMENT,
+                     "[yatof][dictionary-compile] too long path: <%s>",
+                     path);
+    return ctx->rc;
   }
-  grn_obj_close(ctx, &(token_filter->value));
-  grn_tokenizer_token_fin(ctx, &(token_filter->token));
-  GRN_PLUGIN_FREE(ctx, token_filter);
+  file = fopen(temporary_path, "wb");
+  if (!file) {
+    GRN_PLUGIN_ERROR(ctx, GRN_NO_SUCH_FILE_OR_DIRECTORY,
+                     "[yatof][dictionary-compile] couldn't open: <%s>: %s",
+                     temporary_path, strerror(errno));
+    return ctx->rc;
+  }
+  written = fwrite(GRN_TEXT_VALUE(image), 1, GRN_TEXT_LEN(image), file) ==
+            GRN_TEXT_LEN(image);
+  written = written && fflush(file) == 0 && fsync(fileno(file)) == 0;
+  if (fclose(file) != 0) {
+    written = GRN_FALSE;
+  }
+  /* Readers see either the old file or the new one. */
+  if (!written || rename(temporary_path, path) != 0) {
+    GRN_PLUGIN_ERROR(ctx, GRN_INPUT_OUTPUT_ERROR,
+                     "[yatof][dictionary-compile] couldn't write: <%s>: %s",
+                     path, strerror(errno));
+    unlink(temporary_path);
+    return ctx->rc;
+  }
+  return GRN_SUCCESS;
 }
 
-#define THROUGH_WORD_TABLE_NAME "through_words"
+static grn_obj *
+command_yatof_dictionary_compile(grn_ctx *ctx, GNUC_UNUSED int nargs,
+                                 GNUC_UNUSED grn_obj **args,
+                                 grn_user_data *user_data)
+{
+  grn_obj *table_name, *path_value, *column_name;
+  grn_obj *table, *column = NULL;
+  grn_obj entries, pool, value, image;
+  grn_yatof_dictionary_header header;
+  uint32_t *buckets = NULL;
+  uint32_t n_keys, n_buckets, i;
+  char path[PATH_MAX];
+
+  table_name = grn_plugin_proc_get_var(ctx, user_data, "table", -1);
+  path_value = grn_plugin_proc_get_var(ctx, user_data, "path", -1);
+  column_name = grn_plugin_proc_get_var(ctx, user_data, "column", -1);
+
+  table = grn_ctx_get(ctx, GRN_TEXT_VALUE(table_name),
+                      GRN_TEXT_LEN(table_name));
+  if (!table || !grn_obj_is_table(ctx, table) ||
+      table->header.type == GRN_TABLE_NO_KEY) {
+    GRN_PLUGIN_ERROR(ctx, GRN_INVALID_ARGUMENT,
+                     "[yatof][dictionary-compile] "
+                     "nonexistent or no key table: <%.*s>",
+                     (int)GRN_TEXT_LEN(table_name),
+                     GRN_TEXT_VALUE(table_name));
+    return NULL;
+  }
+  if (!yatof_dictionary_path(ctx, "[yatof][dictionary-compile]",
+                             GRN_TEXT_VALUE(path_value),
+                             GRN_TEXT_LEN(path_value), path)) {
+    return NULL;
+  }
+  if (GRN_TEXT_LEN(column_name) > 0) {
+    column = grn_obj_column(ctx, table,
+                            GRN_TEXT_VALUE(column_name),
+                            GRN_TEXT_LEN(column_name));
+    if (!column) {
+      GRN_PLUGIN_ERROR(ctx, GRN_INVALID_ARGUMENT,
+                       "[yatof][dictionary-compile] "
+                       "nonexistent column: <%.*s>",
+                       (int)GRN_TEXT_LEN(column_name),
+                       GRN_TEXT_VALUE(column_name));
+      return NULL;
+    }
+  }
 
-typedef struct {
-  grn_tokenizer_token token;
-  grn_obj *table;
-  grn_obj value;
-} grn_through_word_token_filter;
+  GRN_TEXT_INIT(&entries, 0);
+  GRN_TEXT_INIT(&pool, 0);
+  GRN_TEXT_INIT(&value, 0);
+  GRN_TEXT_INIT(&image, 0);
 
-static void *
-through_word_init(grn_ctx *ctx, GNUC_UNUSED grn_obj *table, GNUC_UNUSED grn_token_mode mode)
-{
-  grn_through_word_token_filter *token_filter;
-  const char *through_word_table_name_env;
+  {
+    grn_table_cursor *cursor;
+    grn_id id;
+    cursor = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0, 0, -1, 0);
+    while (cursor && (id = grn_table_cursor_next(ctx, cursor)) != GRN_ID_NIL) {
+      grn_yatof_dictionary_entry entry;
+      void *key;
+      int key_size;
+
+      key_size = grn_table_cursor_get_key(ctx, cursor, &key);
+      entry.key_offset = GRN_TEXT_LEN(&pool);
+      entry.key_size = key_size;
+      GRN_TEXT_PUT(ctx, &pool, key, key_size);
+      entry.value_offset = GRN_TEXT_LEN(&pool);
+      entry.value_size = 0;
+      if (column) {
+        GRN_BULK_REWIND(&value);
+        grn_obj_get_value(ctx, column, id, &value);
+        entry.value_size = GRN_TEXT_LEN(&value);
+        GRN_TEXT_PUT(ctx, &pool, GRN_TEXT_VALUE(&value), GRN_TEXT_LEN(&value));
+      }
+      GRN_TEXT_PUT(ctx, &entries, &entry, sizeof(grn_yatof_dictionary_entry));
+    }
+    if (cursor) {
+      grn_table_cursor_close(ctx, cursor);
+    }
+  }
+  n_keys = GRN_TEXT_LEN(&entries) / sizeof(grn_yatof_dictionary_entry);
 
-  token_filter = GRN_PLUGIN_MALLOC(ctx, sizeof(grn_through_word_token_filter));
-  if (!token_filter) {
+  /* Keep the load factor at or under 50% so that probes stay short. */
+  n_buckets = 8;
+  while (n_buckets < n_keys * 2) {
+    n_buckets *= 2;
+  }
+  buckets = GRN_PLUGIN_CALLOC(ctx, sizeof(uint32_t) * n_buckets);
+  if (!buckets) {
     GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
-                     "[token-filter][through-word] "
-                     "failed to allocate grn_through_word_token_filter");
-    return NULL;
+                     "[yatof][dictionary-compile] "
+                     "failed to allocate buckets");
+    goto exit;
   }
-  through_word_table_name_env = getenv("GRN_YATOF_THROUGH_WORD_TABLE_NAME");
-  if (through_word_table_name_env) {
-    token_filter->table = grn_ctx_get(ctx,
-                                      through_word_table_name_env,
-                                      strlen(through_word_table_name_env));
-  } else {
-    token_filter->table = grn_ctx_get(ctx,
-                                      THROUGH_WORD_TABLE_NAME,
-                                      strlen(THROUGH_WORD_TABLE_NAME));
+  for (i = 0; i < n_keys; i++) {
+    const grn_yatof_dictionary_entry *entry;
+    uint32_t bucket;
+    entry = (const grn_yatof_dictionary_entry *)GRN_TEXT_VALUE(&entries) + i;
+    bucket = yatof_dictionary_hash(GRN_TEXT_VALUE(&pool) + entry->key_offset,
+                                   entry->key_size) & (n_buckets - 1);
+    while (buckets[bucket] != 0) {
+      bucket = (bucket + 1) & (n_buckets - 1);
+    }
+    buckets[bucket] = i + 1;
   }
-  if (!token_filter->table) {
-    GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
-                     "[token-filter][through-word] "
-                     "couldn't open a table");
-    GRN_PLUGIN_FREE(ctx, token_filter);
-    return NULL;
+
+  memset(&header, 0, sizeof(grn_yatof_dictionary_header));
+  memcpy(header.magic, YATOF_DICTIONARY_MAGIC, sizeof(header.magic));
+  header.version = YATOF_DICTIONARY_VERSION;
+  header.n_keys = n_keys;
+  header.n_buckets = n_buckets;
+  GRN_TEXT_PUT(ctx, &image, &header, sizeof(grn_yatof_dictionary_header));
+  header.buckets_offset = GRN_TEXT_LEN(&image);
+  GRN_TEXT_PUT(ctx, &image, buckets, sizeof(uint32_t) * n_buckets);
+  dictionary_compile_align(ctx, &image);
+  header.entries_offset = GRN_TEXT_LEN(&image);
+  GRN_TEXT_PUT(ctx, &image, GRN_TEXT_VALUE(&entries), GRN_TEXT_LEN(&entries));
+  dictionary_compile_align(ctx, &image);
+  header.pool_offset = GRN_TEXT_LEN(&image);
+  header.pool_size = GRN_TEXT_LEN(&pool);
+  GRN_TEXT_PUT(ctx, &image, GRN_TEXT_VALUE(&pool), GRN_TEXT_LEN(&pool));
+  header.checksum =
+    yatof_dictionary_checksum(GRN_TEXT_VALUE(&image) +
+                              sizeof(grn_yatof_dictionary_header),
+                              GRN_TEXT_LEN(&image) -
+                              sizeof(grn_yatof_dictionary_header));
+  memcpy(GRN_TEXT_VALUE(&image), &header, sizeof(grn_yatof_dictionary_header));
+
+  if (dictionary_compile_write(ctx, path, &image) != GRN_SUCCESS) {
+    goto exit;
+  }
+  GRN_PLUGIN_LOG(ctx, GRN_LOG_INFO,
+                 "[yatof][dictionary-compile] "
+                 "wrote <%s>: %u keys, %u bytes",
+                 path, n_keys, (unsigned int)GRN_TEXT_LEN(&image));
+
+  grn_ctx_output_map_open(ctx, "yatof_dictionary_compile", 3);
+  grn_ctx_output_cstr(ctx, "n_keys");
+  grn_ctx_output_uint64(ctx, n_keys);
+  grn_ctx_output_cstr(ctx, "n_buckets");
+  grn_ctx_output_uint64(ctx, n_buckets);
+  grn_ctx_output_cstr(ctx, "size");
+  grn_ctx_output_uint64(ctx, GRN_TEXT_LEN(&image));
+  grn_ctx_output_map_close(ctx);
+
+exit :
+  if (buckets) {
+    GRN_PLUGIN_FREE(ctx, buckets);
+  }
+  if (column) {
+    grn_obj_unlink(ctx, column);
   }
+  GRN_OBJ_FIN(ctx, &image);
+  GRN_OBJ_FIN(ctx, &value);
+  GRN_OBJ_FIN(ctx, &pool);
+  GRN_OBJ_FIN(ctx, &entries);
+
+  return NULL;
+}
+
+#define BOILERPLATE_LEARN_SKETCH_DEPTH 4
+#define BOILERPLATE_LEARN_DEFAULT_SKETCH_WIDTH (1 << 20)
+#define BOILERPLATE_LEARN_DEFAULT_THRESHOLD 100
+#define BOILERPLATE_LEARN_MAX_TEXT_SIZE 4095
+
+typedef struct {
+  uint64_t hash;
+  uint32_t end;
+} grn_yatof_boilerplate_shingle;
 
-  grn_tokenizer_token_init(ctx, &(token_filter->token));
+typedef struct {
+  grn_ctx *ctx;
+  grn_obj *db;
+  grn_id column_id;
+  grn_id tokenizer_id;
+  grn_id normalizer_id;
+  grn_id *token_filter_ids;
+  int n_token_filters;
+  grn_id min_id;
+  grn_id max_id;
+  unsigned int size;
+  uint32_t threshold;
+  uint32_t *sketch;
+  uint32_t sketch_width;
+  grn_obj *lexicon;
+  grn_obj *recorded;
+  grn_obj hashes;
+  grn_obj texts;
+  grn_obj text_offsets;
+  grn_bool started;
+  uint64_t n_records;
+  uint64_t n_shingles;
+  grn_rc rc;
+} grn_yatof_boilerplate_worker;
 
-  return token_filter;
+static int
+boilerplate_compare_shingle(const void *a, const void *b)
+{
+  uint64_t hash_a = ((const grn_yatof_boilerplate_shingle *)a)->hash;
+  uint64_t hash_b = ((const grn_yatof_boilerplate_shingle *)b)->hash;
+  return (hash_a > hash_b) - (hash_a < hash_b);
 }
 
-static void
-through_word_filter(grn_ctx *ctx,
-                   grn_token *current_token,
-                   grn_token *next_token,
-                   void *user_data)
+static uint32_t
+boilerplate_sketch_index(uint64_t hash, int row, uint32_t width)
 {
-  grn_through_word_token_filter *token_filter = user_data;
-  grn_obj *data;
-  grn_tokenizer_status status;
-  data = grn_token_get_data(ctx, current_token);
+  uint64_t x = hash + (uint64_t)(row + 1) * 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x % width;
+}
 
-  {
-    grn_id id;
-    id = grn_table_get(ctx, token_filter->table,
-                       GRN_TEXT_VALUE(data), GRN_TEXT_LEN(data));
-    if (id == GRN_ID_NIL) {
-      status = grn_token_get_status(ctx, current_token);
-      status |= GRN_TOKEN_SKIP_WITH_POSITION;
-      grn_token_set_status(ctx, next_token, status);
+/* Count-Min sketch shared by all workers. Counts are document
+   frequencies and may be overestimated by collisions. */
+static uint32_t
+boilerplate_sketch_add(uint32_t *sketch, uint32_t width, uint64_t hash)
+{
+  uint32_t estimate = UINT32_MAX;
+  int row;
+
+  for (row = 0; row < BOILERPLATE_LEARN_SKETCH_DEPTH; row++) {
+    uint32_t *counter;
+    uint32_t count;
+    counter = &(sketch[row * width + boilerplate_sketch_index(hash, row, width)]);
+    count = __sync_add_and_fetch(counter, 1);
+    if (count < estimate) {
+      estimate = count;
+    }
+  }
+  return estimate;
+}
+
+static uint32_t
+boilerplate_sketch_estimate(uint32_t *sketch, uint32_t width, uint64_t hash)
+{
+  uint32_t estimate = UINT32_MAX;
+  int row;
+
+  for (row = 0; row < BOILERPLATE_LEARN_SKETCH_DEPTH; row++) {
+    uint32_t count;
+    count = sketch[row * width + boilerplate_sketch_index(hash, row, width)];
+    if (count < estimate) {
+      estimate = count;
     }
   }
+  return estimate;
 }
 
 static void
-through_word_fin(grn_ctx *ctx, void *user_data)
+boilerplate_worker_record(grn_ctx *ctx, grn_yatof_boilerplate_worker *worker,
+                          grn_id *tids, uint32_t end, uint64_t hash)
 {
-  grn_through_word_token_filter *token_filter = user_data;
-  if (!token_filter) {
-    return;
+  uint32_t i;
+  size_t text_start;
+
+  GRN_UINT64_PUT(ctx, &(worker->hashes), hash);
+  text_start = GRN_TEXT_LEN(&(worker->texts));
+  for (i = end + 1 - worker->size; i <= end; i++) {
+    char key[GRN_TABLE_MAX_KEY_SIZE];
+    int key_size;
+    key_size = grn_table_get_key(ctx, worker->lexicon, tids[i],
+                                 key, GRN_TABLE_MAX_KEY_SIZE);
+    if (i > end + 1 - worker->size) {
+      GRN_TEXT_PUTC(ctx, &(worker->texts), ' ');
+    }
+    GRN_TEXT_PUT(ctx, &(worker->texts), key, key_size);
   }
-  if (token_filter->table) {
-    grn_obj_unlink(ctx, token_filter->table);
+  if (GRN_TEXT_LEN(&(worker->texts)) - text_start >
+      BOILERPLATE_LEARN_MAX_TEXT_SIZE) {
+    grn_bulk_truncate(ctx, &(worker->texts),
+                      text_start + BOILERPLATE_LEARN_MAX_TEXT_SIZE);
   }
-  grn_tokenizer_token_fin(ctx, &(token_filter->token));
-  GRN_PLUGIN_FREE(ctx, token_filter);
+  GRN_UINT32_PUT(ctx, &(worker->text_offsets), GRN_TEXT_LEN(&(worker->texts)));
 }
 
-#define SYNONYM_TABLE_NAME "synonyms"
-#define SYNONYM_COLUMN_NAME "synonym"
-
-typedef struct {
-  grn_tokenizer_token token;
-  grn_obj *table;
-  grn_obj *column;
-  grn_obj value;
-} grn_synonym_token_filter;
-
 static void *
-synonym_init(grn_ctx *ctx, GNUC_UNUSED grn_obj *table, GNUC_UNUSED grn_token_mode mode)
+boilerplate_worker_run(void *arg)
 {
-  grn_synonym_token_filter *token_filter;
-  const char *synonym_table_name_env;
-
-  token_filter = GRN_PLUGIN_MALLOC(ctx, sizeof(grn_synonym_token_filter));
-  if (!token_filter) {
-    GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
-                     "[token-filter][synonym] "
-                     "failed to allocate grn_synonym_token_filter");
+  grn_yatof_boilerplate_worker *worker = arg;
+  grn_ctx *ctx = worker->ctx;
+  grn_obj *column;
+  grn_obj *table;
+  grn_obj value, ids, shingles;
+  grn_yatof_shingle shingle;
+  grn_id id;
+
+  grn_ctx_use(ctx, worker->db);
+  column = grn_ctx_at(ctx, worker->column_id);
+  if (!column) {
+    worker->rc = GRN_INVALID_ARGUMENT;
     return NULL;
   }
-  synonym_table_name_env = getenv("GRN_YATOF_SYNONYM_TABLE_NAME");
-  if (synonym_table_name_env) {
-    token_filter->table = grn_ctx_get(ctx,
-                                      synonym_table_name_env,
-                                      strlen(synonym_table_name_env));
-  } else {
-    token_filter->table = grn_ctx_get(ctx,
-                                      SYNONYM_TABLE_NAME,
-                                      strlen(SYNONYM_TABLE_NAME));
-  }
-  if (!token_filter->table) {
-    GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
-                     "[token-filter][synonym] "
-                     "couldn't open a table");
-    GRN_PLUGIN_FREE(ctx, token_filter);
+  worker->lexicon = analyze_lexicon_create(ctx,
+                                           worker->tokenizer_id,
+                                           worker->normalizer_id,
+                                           worker->token_filter_ids,
+                                           worker->n_token_filters);
+  worker->recorded = grn_table_create(ctx, NULL, 0, NULL,
+                                      GRN_OBJ_TABLE_HASH_KEY,
+                                      grn_ctx_at(ctx, GRN_DB_UINT64),
+                                      NULL);
+  if (!worker->lexicon || !worker->recorded) {
+    worker->rc = ctx->rc != GRN_SUCCESS ? ctx->rc : GRN_NO_MEMORY_AVAILABLE;
     return NULL;
-  } else {
-    token_filter->column = grn_obj_column(ctx,
-                                          token_filter->table,
-                                          SYNONYM_COLUMN_NAME,
-                                          strlen(SYNONYM_COLUMN_NAME));
-    if (!token_filter->column) {
-      GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
-                       "[token-filter][synonym] "
-                       "couldn't open synonym column");
-      GRN_PLUGIN_FREE(ctx, token_filter);
-      return NULL;
-    }
   }
 
-  GRN_TEXT_INIT(&(token_filter->value), 0);
-  grn_tokenizer_token_init(ctx, &(token_filter->token));
+  table = grn_column_table(ctx, column);
+
+  GRN_TEXT_INIT(&value, 0);
+  GRN_RECORD_INIT(&ids, 0, GRN_ID_NIL);
+  GRN_TEXT_INIT(&shingles, 0);
+  for (id = yatof_table_next_id(ctx, table, worker->min_id, worker->max_id);
+       id != GRN_ID_NIL;
+       id = yatof_table_next_id(ctx, table, id + 1, worker->max_id)) {
+    grn_yatof_boilerplate_shingle *entries;
+    grn_id *tids;
+    size_t j, n_tids, n_entries;
+
+    GRN_BULK_REWIND(&value);
+    grn_obj_get_value(ctx, column, id, &value);
+    worker->n_records++;
+    if (GRN_TEXT_LEN(&value) == 0) {
+      continue;
+    }
+    GRN_BULK_REWIND(&ids);
+    grn_table_tokenize(ctx, worker->lexicon,
+                       GRN_TEXT_VALUE(&value), GRN_TEXT_LEN(&value),
+                       &ids, GRN_TRUE);
+    if (ctx->rc != GRN_SUCCESS) {
+      worker->rc = ctx->rc;
+      break;
+    }
+    tids = (grn_id *)GRN_BULK_HEAD(&ids);
+    n_tids = GRN_BULK_VSIZE(&ids) / sizeof(grn_id);
+
+    GRN_BULK_REWIND(&shingles);
+    yatof_shingle_init(&shingle, worker->size);
+    for (j = 0; j < n_tids; j++) {
+      char key[GRN_TABLE_MAX_KEY_SIZE];
+      int key_size;
+      key_size = grn_table_get_key(ctx, worker->lexicon, tids[j],
+                                   key, GRN_TABLE_MAX_KEY_SIZE);
+      if (yatof_shingle_push(&shingle, key, key_size)) {
+        grn_yatof_boilerplate_shingle entry;
+        entry.hash = shingle.hash;
+        entry.end = j;
+        GRN_TEXT_PUT(ctx, &shingles, &entry, sizeof(entry));
+      }
+    }
 
-  return token_filter;
+    /* Count each shingle once per document. */
+    entries = (grn_yatof_boilerplate_shingle *)GRN_BULK_HEAD(&shingles);
+    n_entries = GRN_BULK_VSIZE(&shingles) / sizeof(grn_yatof_boilerplate_shingle);
+    qsort(entries, n_entries, sizeof(grn_yatof_boilerplate_shingle),
+          boilerplate_compare_shingle);
+    for (j = 0; j < n_entries; j++) {
+      uint32_t estimate;
+      int added = 0;
+      if (j > 0 && entries[j].hash == entries[j - 1].hash) {
+        continue;
+      }
+      worker->n_shingles++;
+      estimate = boilerplate_sketch_add(worker->sketch, worker->sketch_width,
+                                        entries[j].hash);
+      if (estimate < worker->threshold) {
+        continue;
+      }
+      grn_table_add(ctx, worker->recorded, &(entries[j].hash),
+                    sizeof(uint64_t), &added);
+      if (added) {
+        boilerplate_worker_record(ctx, worker, tids, entries[j].end,
+                                  entries[j].hash);
+      }
+    }
+  }
+  GRN_OBJ_FIN(ctx, &shingles);
+  GRN_OBJ_FIN(ctx, &ids);
+  GRN_OBJ_FIN(ctx, &value);
+
+  return NULL;
 }
 
-static void
-synonym_filter(grn_ctx *ctx,
-               grn_token *current_token,
-               grn_token *next_token,
-               void *user_data)
+static grn_obj *
+boilerplate_table_open(grn_ctx *ctx, const char *name, int name_size,
+                       grn_obj **text_column, grn_obj **n_documents_column)
 {
-  grn_synonym_token_filter *token_filter = user_data;
-  grn_obj *data;
-  data = grn_token_get_data(ctx, current_token);
+  grn_obj *table;
 
-  {
-    grn_id id;
-    id = grn_table_get(ctx, token_filter->table,
-                       GRN_TEXT_VALUE(data), GRN_TEXT_LEN(data));
-    if (id != GRN_ID_NIL) {
-      GRN_BULK_REWIND(&(token_filter->value));
-      grn_obj_get_value(ctx, token_filter->column, id, &(token_filter->value));
-      grn_token_set_data(ctx, next_token,
-                         GRN_TEXT_VALUE(&(token_filter->value)),
-                         GRN_TEXT_LEN(&(token_filter->value)));
+  table = grn_ctx_get(ctx, name, name_size);
+  if (!table) {
+    table = grn_table_create(ctx, name, name_size, NULL,
+                             GRN_OBJ_TABLE_HASH_KEY | GRN_OBJ_PERSISTENT,
+                             grn_ctx_at(ctx, GRN_DB_UINT64),
+                             NULL);
+    if (!table) {
+      return NULL;
     }
+    grn_column_create(ctx, table,
+                      BOILERPLATE_TEXT_COLUMN_NAME,
+                      strlen(BOILERPLATE_TEXT_COLUMN_NAME),
+                      NULL,
+                      GRN_OBJ_COLUMN_SCALAR | GRN_OBJ_PERSISTENT,
+                      grn_ctx_at(ctx, GRN_DB_SHORT_TEXT));
+    grn_column_create(ctx, table,
+                      BOILERPLATE_N_DOCUMENTS_COLUMN_NAME,
+                      strlen(BOILERPLATE_N_DOCUMENTS_COLUMN_NAME),
+                      NULL,
+                      GRN_OBJ_COLUMN_SCALAR | GRN_OBJ_PERSISTENT,
+                      grn_ctx_at(ctx, GRN_DB_UINT32));
   }
+  *text_column = grn_obj_column(ctx, table,
+                                BOILERPLATE_TEXT_COLUMN_NAME,
+                                strlen(BOILERPLATE_TEXT_COLUMN_NAME));
+  *n_documents_column = grn_obj_column(ctx, table,
+                                       BOILERPLATE_N_DOCUMENTS_COLUMN_NAME,
+                                       strlen(BOILERPLATE_N_DOCUMENTS_COLUMN_NAME));
+  return table;
 }
 
-static void
-synonym_fin(grn_ctx *ctx, void *user_data)
+static grn_obj *
+command_yatof_boilerplate_learn(grn_ctx *ctx, GNUC_UNUSED int nargs,
+                                GNUC_UNUSED grn_obj **args,
+                                grn_user_data *user_data)
 {
-  grn_synonym_token_filter *token_filter = user_data;
-  if (!token_filter) {
-    return;
+  grn_obj *table_name, *column_name, *tokenizer_name, *normalizer_name;
+  grn_obj *token_filter_names, *n_workers_value, *boilerplate_table_name;
+  grn_obj *size_value, *threshold_value, *sketch_width_value;
+  grn_obj *table, *column, *tokenizer, *normalizer;
+  grn_obj *boilerplate_table = NULL;
+  grn_obj *text_column = NULL, *n_documents_column = NULL;
+  grn_obj token_filter_ids, text, n_documents;
+  grn_id tokenizer_id, normalizer_id = GRN_ID_NIL;
+  grn_id max_id = GRN_ID_NIL;
+  int n_workers = 0;
+  unsigned int size;
+  uint32_t threshold, sketch_width;
+  uint32_t *sketch = NULL;
+  grn_yatof_boilerplate_worker *workers = NULL;
+  pthread_t *threads = NULL;
+  uint64_t n_records = 0, n_shingles = 0, n_boilerplate_shingles = 0;
+  int i;
+
+  table_name = grn_plugin_proc_get_var(ctx, user_data, "table", -1);
+  column_name = grn_plugin_proc_get_var(ctx, user_data, "column", -1);
+  tokenizer_name = grn_plugin_proc_get_var(ctx, user_data, "tokenizer", -1);
+  normalizer_name = grn_plugin_proc_get_var(ctx, user_data, "normalizer", -1);
+  token_filter_names = grn_plugin_proc_get_var(ctx, user_data,
+                                               "token_filters", -1);
+  n_workers_value = grn_plugin_proc_get_var(ctx, user_data, "n_workers", -1);
+  boilerplate_table_name = grn_plugin_proc_get_var(ctx, user_data,
+                                                   "boilerplate_table", -1);
+  size_value = grn_plugin_proc_get_var(ctx, user_data, "size", -1);
+  threshold_value = grn_plugin_proc_get_var(ctx, user_data, "threshold", -1);
+  sketch_width_value = grn_plugin_proc_get_var(ctx, user_data,
+                                               "sketch_width", -1);
+
+  table = grn_ctx_get(ctx, GRN_TEXT_VALUE(table_name),
+                      GRN_TEXT_LEN(table_name));
+  if (!table) {
+    GRN_PLUGIN_ERROR(ctx, GRN_INVALID_ARGUMENT,
+                     "[yatof][boilerplate-learn] "
+                     "nonexistent table: <%.*s>",
+                     (int)GRN_TEXT_LEN(table_name),
+                     GRN_TEXT_VALUE(table_name));
+    return NULL;
   }
-  if (token_filter->table) {
-    grn_obj_unlink(ctx, token_filter->table);
+  column = grn_obj_column(ctx, table, GRN_TEXT_VALUE(column_name),
+                          GRN_TEXT_LEN(column_name));
+  if (!column) {
+    GRN_PLUGIN_ERROR(ctx, GRN_INVALID_ARGUMENT,
+                     "[yatof][boilerplate-learn] "
+                     "nonexistent column: <%.*s>",
+                     (int)GRN_TEXT_LEN(column_name),
+                     GRN_TEXT_VALUE(column_name));
+    return NULL;
   }
-  if (token_filter->column) {
-    grn_obj_unlink(ctx, token_filter->column);
+  tokenizer = grn_ctx_get(ctx, GRN_TEXT_VALUE(tokenizer_name),
+                          GRN_TEXT_LEN(tokenizer_name));
+  if (!tokenizer) {
+    GRN_PLUGIN_ERROR(ctx, GRN_INVALID_ARGUMENT,
+                     "[yatof][boilerplate-learn] "
+                     "nonexistent tokenizer: <%.*s>",
+                     (int)GRN_TEXT_LEN(tokenizer_name),
+                     GRN_TEXT_VALUE(tokenizer_name));
+    return NULL;
+  }
+  tokenizer_id = grn_obj_id(ctx, tokenizer);
+  if (GRN_TEXT_LEN(normalizer_name) > 0) {
+    normalizer = grn_ctx_get(ctx, GRN_TEXT_VALUE(normalizer_name),
+                             GRN_TEXT_LEN(normalizer_name));
+    if (!normalizer) {
+      GRN_PLUGIN_ERROR(ctx, GRN_INVALID_ARGUMENT,
+                       "[yatof][boilerplate-learn] "
+                       "nonexistent normalizer: <%.*s>",
+                       (int)GRN_TEXT_LEN(normalizer_name),
+                       GRN_TEXT_VALUE(normalizer_name));
+      return NULL;
+    }
+    normalizer_id = grn_obj_id(ctx, normalizer);
   }
-  grn_obj_unlink(ctx, &(token_filter->value));
-  grn_tokenizer_token_fin(ctx, &(token_filter->token));
-  GRN_PLUGIN_FREE(ctx, token_filter);
-}
-
-
-const char *white_table_name = "white_terms";
-uint32_t white_table_name_size = 11;
 
-typedef struct {
-  grn_tokenizer_token token;
-  grn_obj *table;
-  grn_token_mode mode;
-} grn_white_token_filter;
+  size = yatof_lexicon_option_get_uint64(ctx, NULL,
+                                         BOILERPLATE_OPTION_PREFIX, "size",
+                                         "GRN_YATOF_BOILERPLATE_SIZE",
+                                         BOILERPLATE_DEFAULT_SIZE);
+  if (GRN_TEXT_LEN(size_value) > 0) {
+    size = grn_atoi(GRN_TEXT_VALUE(size_value), GRN_BULK_CURR(size_value),
+                    NULL);
+  }
+  if (size == 0 || size > YATOF_SHINGLE_MAX_SIZE) {
+    GRN_PLUGIN_ERROR(ctx, GRN_INVALID_ARGUMENT,
+                     "[yatof][boilerplate-learn] "
+                     "size must be 1..%d: <%u>",
+                     YATOF_SHINGLE_MAX_SIZE, size);
+    return NULL;
+  }
+  threshold = BOILERPLATE_LEARN_DEFAULT_THRESHOLD;
+  if (GRN_TEXT_LEN(threshold_value) > 0) {
+    threshold = grn_atoi(GRN_TEXT_VALUE(threshold_value),
+                         GRN_BULK_CURR(threshold_value), NULL);
+  }
+  if (threshold == 0) {
+    threshold = 1;
+  }
+  sketch_width = BOILERPLATE_LEARN_DEFAULT_SKETCH_WIDTH;
+  if (GRN_TEXT_LEN(sketch_width_value) > 0) {
+    sketch_width = grn_atoi(GRN_TEXT_VALUE(sketch_width_value),
+                            GRN_BULK_CURR(sketch_width_value), NULL);
+  }
+  if (sketch_width == 0) {
+    sketch_width = BOILERPLATE_LEARN_DEFAULT_SKETCH_WIDTH;
+  }
 
-static void *
-white_init(grn_ctx *ctx, GNUC_UNUSED grn_obj *table, GNUC_UNUSED grn_token_mode mode)
-{
-  grn_white_token_filter *token_filter;
+  if (GRN_TEXT_LEN(n_workers_value) > 0) {
+    n_workers = grn_atoi(GRN_TEXT_VALUE(n_workers_value),
+                         GRN_BULK_CURR(n_workers_value), NULL);
+  }
+  if (n_workers <= 0) {
+    n_workers = sysconf(_SC_NPROCESSORS_ONLN);
+  }
+  if (n_workers <= 0) {
+    n_workers = 1;
+  } else if (n_workers > ANALYZE_MAX_N_WORKERS) {
+    n_workers = ANALYZE_MAX_N_WORKERS;
+  }
 
-  token_filter = GRN_PLUGIN_MALLOC(ctx, sizeof(grn_white_token_filter));
-  if (!token_filter) {
-    GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
-                     "[token-filter][white] "
-                     "failed to allocate grn_white_token_filter");
-    return NULL;
+  if (GRN_TEXT_LEN(boilerplate_table_name) > 0) {
+    boilerplate_table = boilerplate_table_open(ctx,
+                                               GRN_TEXT_VALUE(boilerplate_table_name),
+                                               GRN_TEXT_LEN(boilerplate_table_name),
+                                               &text_column,
+                                               &n_documents_column);
+  } else {
+    boilerplate_table = boilerplate_table_open(ctx,
+                                               BOILERPLATE_TABLE_NAME,
+                                               strlen(BOILERPLATE_TABLE_NAME),
+                                               &text_column,
+                                               &n_documents_column);
   }
-  token_filter->table = grn_ctx_get(ctx,
-                                    white_table_name,
-                                    white_table_name_size);
-  if (!token_filter->table) {
-    GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
-                     "[token-filter][white] "
-                     "couldn't open a table");
-    GRN_PLUGIN_FREE(ctx, token_filter);
+  if (!boilerplate_table || !text_column || !n_documents_column) {
+    GRN_PLUGIN_ERROR(ctx, GRN_INVALID_ARGUMENT,
+                     "[yatof][boilerplate-learn] "
+                     "couldn't open a boilerplate table with "
+                     BOILERPLATE_TEXT_COLUMN_NAME " and "
+                     BOILERPLATE_N_DOCUMENTS_COLUMN_NAME " columns");
     return NULL;
   }
-  token_filter->mode = mode;
 
-  grn_tokenizer_token_init(ctx, &(token_filter->token));
+  GRN_RECORD_INIT(&token_filter_ids, GRN_OBJ_VECTOR, GRN_ID_NIL);
+  GRN_TEXT_INIT(&text, 0);
+  GRN_UINT32_INIT(&n_documents, 0);
+  if (analyze_parse_token_filters(ctx, token_filter_names,
+                                  &token_filter_ids) != GRN_SUCCESS) {
+    goto exit;
+  }
 
-  return token_filter;
-}
+  {
+    grn_table_cursor *cursor;
+    cursor = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0, 0, 1,
+                                   GRN_CURSOR_BY_ID | GRN_CURSOR_DESCENDING);
+    if (cursor) {
+      max_id = grn_table_cursor_next(ctx, cursor);
+      grn_table_cursor_close(ctx, cursor);
+    }
+  }
 
-static void
-white_filter(grn_ctx *ctx,
-             grn_token *current_token,
-             grn_token *next_token,
-             void *user_data)
-{
-  grn_white_token_filter *token_filter = user_data;
-  grn_obj *data;
-  data = grn_token_get_data(ctx, current_token);
+  sketch = GRN_PLUGIN_CALLOC(ctx, sizeof(uint32_t) *
+                             BOILERPLATE_LEARN_SKETCH_DEPTH * sketch_width);
+  workers = GRN_PLUGIN_CALLOC(ctx,
+                              sizeof(grn_yatof_boilerplate_worker) * n_workers);
+  threads = GRN_PLUGIN_CALLOC(ctx, sizeof(pthread_t) * n_workers);
+  if (!sketch || !workers || !threads) {
+    GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
+                     "[yatof][boilerplate-learn] "
+                     "failed to allocate workers");
+    goto exit;
+  }
 
   {
-    grn_id id;
-    id = grn_table_get(ctx, token_filter->table,
-                       GRN_TEXT_VALUE(data), GRN_TEXT_LEN(data));
-    if (id == GRN_ID_NIL) {
-      grn_tokenizer_status status;
-      status = grn_token_get_status(ctx, current_token);
-      status |= GRN_TOKEN_SKIP;
-      grn_token_set_status(ctx, next_token, status);
+    grn_id chunk_size = max_id / n_workers + 1;
+    for (i = 0; i < n_workers; i++) {
+      grn_yatof_boilerplate_worker *worker = &(workers[i]);
+      worker->db = grn_ctx_db(ctx);
+      worker->column_id = grn_obj_id(ctx, column);
+      worker->tokenizer_id = tokenizer_id;
+      worker->normalizer_id = normalizer_id;
+      worker->token_filter_ids = (grn_id *)GRN_BULK_HEAD(&token_filter_ids);
+      worker->n_token_filters =
+        GRN_BULK_VSIZE(&token_filter_ids) / sizeof(grn_id);
+      worker->min_id = chunk_size * i + 1;
+      worker->max_id = chunk_size * (i + 1);
+      worker->size = size;
+      worker->threshold = threshold;
+      worker->sketch = sketch;
+      worker->sketch_width = sketch_width;
+      worker->rc = GRN_SUCCESS;
+      GRN_UINT64_INIT(&(worker->hashes), GRN_OBJ_VECTOR);
+      GRN_TEXT_INIT(&(worker->texts), 0);
+      GRN_UINT32_INIT(&(worker->text_offsets), GRN_OBJ_VECTOR);
+      worker->ctx = grn_ctx_open(0);
+      if (!worker->ctx) {
+        GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
+                         "[yatof][boilerplate-learn] "
+                         "failed to allocate a worker");
+        goto exit;
+      }
     }
   }
-}
 
-static void
-white_fin(grn_ctx *ctx, void *user_data)
-{
-  grn_white_token_filter *token_filter = user_data;
-  if (!token_filter) {
-    return;
+  for (i = 0; i < n_workers; i++) {
+    if (pthread_create(&(threads[i]), NULL,
+                       boilerplate_worker_run, &(workers[i])) == 0) {
+      workers[i].started = GRN_TRUE;
+    } else {
+      workers[i].rc = GRN_UNKNOWN_ERROR;
+    }
   }
-  if (token_filter->table) {
-    grn_obj_unlink(ctx, token_filter->table);
+  for (i = 0; i < n_workers; i++) {
+    if (workers[i].started) {
+      pthread_join(threads[i], NULL);
+    }
   }
-  grn_tokenizer_token_fin(ctx, &(token_filter->token));
-  GRN_PLUGIN_FREE(ctx, token_filter);
+
+  for (i = 0; i < n_workers; i++) {
+    grn_yatof_boilerplate_worker *worker = &(workers[i]);
+    size_t j, n_hashes;
+    uint32_t text_start = 0;
+
+    if (worker->rc != GRN_SUCCESS) {
+      GRN_PLUGIN_ERROR(ctx, worker->rc,
+                       "[yatof][boilerplate-learn] "
+                       "worker %d failed: %s",
+                       i, worker->ctx->errbuf);
+      goto exit;
+    }
+    n_records += worker->n_records;
+    n_shingles += worker->n_shingles;
+    n_hashes = GRN_BULK_VSIZE(&(worker->hashes)) / sizeof(uint64_t);
+    for (j = 0; j < n_hashes; j++) {
+      uint64_t hash = GRN_UINT64_VALUE_AT(&(worker->hashes), j);
+      uint32_t text_end = GRN_UINT32_VALUE_AT(&(worker->text_offsets), j);
+      grn_id id;
+      int added = 0;
+
+      id = grn_table_add(ctx, boilerplate_table, &hash, sizeof(uint64_t),
+                         &added);
+      if (id != GRN_ID_NIL) {
+        if (added) {
+          n_boilerplate_shingles++;
+        }
+        GRN_TEXT_SET(ctx, &text,
+                     GRN_TEXT_VALUE(&(worker->texts)) + text_start,
+                     text_end - text_start);
+        grn_obj_set_value(ctx, text_column, id, &text, GRN_OBJ_SET);
+        GRN_UINT32_SET(ctx, &n_documents,
+                       boilerplate_sketch_estimate(sketch, sketch_width, hash));
+        grn_obj_set_value(ctx, n_documents_column, id, &n_documents,
+                          GRN_OBJ_SET);
+      }
+      text_start = text_end;
+    }
+  }
+
+  GRN_PLUGIN_LOG(ctx, GRN_LOG_INFO,
+                 "[yatof][boilerplate-learn] "
+                 "recorded %" PRIu64 " shingles from %" PRIu64 " records",
+                 n_boilerplate_shingles, n_records);
+
+  grn_ctx_output_map_open(ctx, "yatof_boilerplate_learn", 3);
+  grn_ctx_output_cstr(ctx, "n_records");
+  grn_ctx_output_uint64(ctx, n_records);
+  grn_ctx_output_cstr(ctx, "n_shingles");
+  grn_ctx_output_uint64(ctx, n_shingles);
+  grn_ctx_output_cstr(ctx, "n_boilerplate_shingles");
+  grn_ctx_output_uint64(ctx, n_boilerplate_shingles);
+  grn_ctx_output_map_close(ctx);
+
+exit :
+  if (workers) {
+    for (i = 0; i < n_workers; i++) {
+      grn_yatof_boilerplate_worker *worker = &(workers[i]);
+      if (!worker->ctx) {
+        continue;
+      }
+      if (worker->recorded) {
+        grn_obj_close(worker->ctx, worker->recorded);
+      }
+      if (worker->lexicon) {
+        grn_obj_close(worker->ctx, worker->lexicon);
+      }
+      GRN_OBJ_FIN(worker->ctx, &(worker->text_offsets));
+      GRN_OBJ_FIN(worker->ctx, &(worker->texts));
+      GRN_OBJ_FIN(worker->ctx, &(worker->hashes));
+      grn_ctx_close(worker->ctx);
+    }
+    GRN_PLUGIN_FREE(ctx, workers);
+  }
+  if (threads) {
+    GRN_PLUGIN_FREE(ctx, threads);
+  }
+  if (sketch) {
+    GRN_PLUGIN_FREE(ctx, sketch);
+  }
+  GRN_OBJ_FIN(ctx, &n_documents);
+  GRN_OBJ_FIN(ctx, &text);
+  GRN_OBJ_FIN(ctx, &token_filter_ids);
+
+  return NULL;
 }
 
 grn_rc
@@ -1439,6 +8881,23 @@ GRN_PLUGIN_INIT(grn_ctx *ctx)
       white_table_name_size = config_table_name_size;
     }
   }
+  high_entropy_char_classes_init();
+  yatof_memory_mutex = grn_plugin_mutex_open(ctx);
+  if (!yatof_memory_mutex) {
+    GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
+                     "[yatof] "
+                     "failed to allocate a mutex");
+  }
+  yatof_dictionary_mutex = grn_plugin_mutex_open(ctx);
+  if (!yatof_dictionary_mutex) {
+    GRN_PLUGIN_ERROR(ctx, GRN_NO_MEMORY_AVAILABLE,
+                     "[yatof] "
+                     "failed to allocate a mutex");
+  }
+  if (!yatof_verdict_key_created &&
+      pthread_key_create(&yatof_verdict_key, yatof_verdict_block_free) == 0) {
+    yatof_verdict_key_created = GRN_TRUE;
+  }
   return ctx->rc;
 }
 
@@ -1449,100 +8908,230 @@ GRN_PLUGIN_REGISTER(grn_ctx *ctx)
 
   rc = grn_token_filter_register(ctx,
                                  "TokenFilterMaxLength", -1,
-                                 max_length_init,
-                                 max_length_filter,
-                                 max_length_fin);
+                                 max_length_traced_init,
+                                 max_length_traced_filter,
+                                 max_length_traced_fin);
 
   rc = grn_token_filter_register(ctx,
                                  "TokenFilterMinLength", -1,
-                                 min_length_init,
-                                 min_length_filter,
-                                 min_length_fin);
+                                 min_length_traced_init,
+                                 min_length_traced_filter,
+                                 min_length_traced_fin);
 
   rc = grn_token_filter_register(ctx,
                                  "TokenFilterTFLimit", -1,
-                                 tf_limit_init,
-                                 tf_limit_filter,
-                                 tf_limit_fin);
+                                 tf_limit_traced_init,
+                                 tf_limit_traced_filter,
+                                 tf_limit_traced_fin);
 
   rc = grn_token_filter_register(ctx,
                                  "TokenFilterPhraseLimit", -1,
-                                 phrase_limit_init,
-                                 phrase_limit_filter,
-                                 phrase_limit_fin);
+                                 phrase_limit_traced_init,
+                                 phrase_limit_traced_filter,
+                                 phrase_limit_traced_fin);
 
   rc = grn_token_filter_register(ctx,
                                  "TokenFilterProlong", -1,
-                                 yatof_init,
-                                 prolong_filter,
-                                 yatof_fin);
+                                 prolong_traced_init,
+                                 prolong_traced_filter,
+                                 prolong_traced_fin);
 
   rc = grn_token_filter_register(ctx,
                                  "TokenFilterSymbol", -1,
-                                 yatof_init,
-                                 symbol_filter,
-                                 yatof_fin);
+                                 symbol_traced_init,
+                                 symbol_traced_filter,
+                                 symbol_traced_fin);
 
   rc = grn_token_filter_register(ctx,
                                  "TokenFilterDigit", -1,
-                                 yatof_init,
-                                 digit_filter,
-                                 yatof_fin);
+                                 digit_traced_init,
+                                 digit_traced_filter,
+                                 digit_traced_fin);
 
   rc = grn_token_filter_register(ctx,
                                  "TokenFilterIgnoreWord", -1,
-                                 ignore_word_init,
-                                 ignore_word_filter,
-                                 ignore_word_fin);
+                                 ignore_word_traced_init,
+                                 ignore_word_traced_filter,
+                                 ignore_word_traced_fin);
 
   rc = grn_token_filter_register(ctx,
                                  "TokenFilterRemoveWord", -1,
-                                 remove_word_init,
-                                 remove_word_filter,
-                                 remove_word_fin);
+                                 remove_word_traced_init,
+                                 remove_word_traced_filter,
+                                 remove_word_traced_fin);
 
   rc = grn_token_filter_register(ctx,
                                  "TokenFilterThroughWord", -1,
-                                 through_word_init,
-                                 through_word_filter,
-                                 through_word_fin);
+                                 through_word_traced_init,
+                                 through_word_traced_filter,
+                                 through_word_traced_fin);
 
   rc = grn_token_filter_register(ctx,
                                  "TokenFilterSynonym", -1,
-                                 synonym_init,
-                                 synonym_filter,
-                                 synonym_fin);
+                                 synonym_traced_init,
+                                 synonym_traced_filter,
+                                 synonym_traced_fin);
 
   rc = grn_token_filter_register(ctx,
                                  "TokenFilterUnmaturedOne", -1,
-                                 yatof_init,
-                                 unmatured_one_filter,
-                                 yatof_fin);
+                                 unmatured_one_traced_init,
+                                 unmatured_one_traced_filter,
+                                 unmatured_one_traced_fin);
 
   rc = grn_token_filter_register(ctx,
                                  "TokenFilterWhite", -1,
-                                 white_init,
-                                 white_filter,
-                                 white_fin);
+                                 white_traced_init,
+                                 white_traced_filter,
+                                 white_traced_fin);
 
   rc = grn_token_filter_register(ctx,
                                  "TokenFilterATGC", -1,
-                                 yatof_init,
-                                 atgc_filter,
-                                 yatof_fin);
+                                 atgc_traced_init,
+                                 atgc_traced_filter,
+                                 atgc_traced_fin);
 
   rc = grn_token_filter_register(ctx,
                                  "TokenFilterSkipNonEnglishAlpha", -1,
-                                 remove_non_english_init,
-                                 remove_non_english_filter,
-                                 remove_non_english_fin);
+                                 remove_non_english_traced_init,
+                                 remove_non_english_traced_filter,
+                                 remove_non_english_traced_fin);
+
+  rc = grn_token_filter_register(ctx,
+                                 "TokenFilterHighEntropy", -1,
+                                 high_entropy_traced_init,
+                                 high_entropy_traced_filter,
+                                 high_entropy_traced_fin);
+
+  rc = grn_token_filter_register(ctx,
+                                 "TokenFilterNumber", -1,
+                                 number_traced_init,
+                                 number_traced_filter,
+                                 number_traced_fin);
+
+  rc = grn_token_filter_register(ctx,
+                                 "TokenFilterLexiconLimit", -1,
+                                 lexicon_limit_traced_init,
+                                 lexicon_limit_traced_filter,
+                                 lexicon_limit_traced_fin);
+
+  rc = grn_token_filter_register(ctx,
+                                 "TokenFilterDocumentLimit", -1,
+                                 document_limit_traced_init,
+                                 document_limit_traced_filter,
+                                 document_limit_traced_fin);
+
+  rc = grn_token_filter_register(ctx,
+                                 "TokenFilterKatakanaFold", -1,
+                                 katakana_fold_traced_init,
+                                 katakana_fold_traced_filter,
+                                 katakana_fold_traced_fin);
+
+  rc = grn_token_filter_register(ctx,
+                                 "TokenFilterRepeatedShingle", -1,
+                                 repeated_shingle_traced_init,
+                                 repeated_shingle_traced_filter,
+                                 repeated_shingle_traced_fin);
+
+  rc = grn_token_filter_register(ctx,
+                                 "TokenFilterBoilerplate", -1,
+                                 boilerplate_traced_init,
+                                 boilerplate_traced_filter,
+                                 boilerplate_traced_fin);
+
+  rc = grn_token_filter_register(ctx,
+                                 "TokenFilterScript", -1,
+                                 script_traced_init,
+                                 script_traced_filter,
+                                 script_traced_fin);
+
+  rc = grn_token_filter_register(ctx,
+                                 "TokenFilterURL", -1,
+                                 url_traced_init,
+                                 url_traced_filter,
+                                 url_traced_fin);
+
+  rc = grn_token_filter_register(ctx,
+                                 "TokenFilterBigramThin", -1,
+                                 bigram_thin_traced_init,
+                                 bigram_thin_traced_filter,
+                                 bigram_thin_traced_fin);
+
+  rc = grn_token_filter_register(ctx,
+                                 "TokenFilterUnique", -1,
+                                 unique_traced_init,
+                                 unique_traced_filter,
+                                 unique_traced_fin);
+
+  rc = grn_token_filter_register(ctx,
+                                 "TokenFilterJunk", -1,
+                                 junk_traced_init,
+                                 junk_traced_filter,
+                                 junk_traced_fin);
+
+  {
+    grn_expr_var vars[10];
+
+    grn_plugin_expr_var_init(ctx, &vars[0], "table", -1);
+    grn_plugin_expr_var_init(ctx, &vars[1], "column", -1);
+    grn_plugin_expr_var_init(ctx, &vars[2], "tokenizer", -1);
+    grn_plugin_expr_var_init(ctx, &vars[3], "normalizer", -1);
+    grn_plugin_expr_var_init(ctx, &vars[4], "token_filters", -1);
+    grn_plugin_expr_var_init(ctx, &vars[5], "n_workers", -1);
+    grn_plugin_command_create(ctx, "yatof_analyze", -1,
+                              command_yatof_analyze, 6, vars);
+
+    grn_plugin_expr_var_init(ctx, &vars[0], "word_table", -1);
+    grn_plugin_expr_var_init(ctx, &vars[1], "index", -1);
+    grn_plugin_expr_var_init(ctx, &vars[2], "n_workers", -1);
+    grn_plugin_command_create(ctx, "yatof_reindex", -1,
+                              command_yatof_reindex, 3, vars);
+
+    grn_plugin_command_create(ctx, "yatof_memory", -1,
+                              command_yatof_memory, 0, vars);
+
+    grn_plugin_expr_var_init(ctx, &vars[0], "table", -1);
+    grn_plugin_expr_var_init(ctx, &vars[1], "path", -1);
+    grn_plugin_expr_var_init(ctx, &vars[2], "column", -1);
+    grn_plugin_command_create(ctx, "yatof_dictionary_compile", -1,
+                              command_yatof_dictionary_compile, 3, vars);
+
+    grn_plugin_expr_var_init(ctx, &vars[0], "table", -1);
+    grn_plugin_expr_var_init(ctx, &vars[1], "column", -1);
+    grn_plugin_expr_var_init(ctx, &vars[2], "tokenizer", -1);
+    grn_plugin_expr_var_init(ctx, &vars[3], "normalizer", -1);
+    grn_plugin_expr_var_init(ctx, &vars[4], "token_filters", -1);
+    grn_plugin_expr_var_init(ctx, &vars[5], "n_workers", -1);
+    grn_plugin_expr_var_init(ctx, &vars[6], "boilerplate_table", -1);
+    grn_plugin_expr_var_init(ctx, &vars[7], "size", -1);
+    grn_plugin_expr_var_init(ctx, &vars[8], "threshold", -1);
+    grn_plugin_expr_var_init(ctx, &vars[9], "sketch_width", -1);
+    grn_plugin_command_create(ctx, "yatof_boilerplate_learn", -1,
+                              command_yatof_boilerplate_learn, 10, vars);
+  }
 
   return rc;
 }
 
 grn_rc
-GRN_PLUGIN_FIN(GNUC_UNUSED grn_ctx *ctx)
+GRN_PLUGIN_FIN(grn_ctx *ctx)
 {
+  if (yatof_memory_mutex) {
+    grn_plugin_mutex_close(ctx, yatof_memory_mutex);
+    yatof_memory_mutex = NULL;
+  }
+  if (yatof_dictionary_mutex) {
+    grn_plugin_mutex_lock(ctx, yatof_dictionary_mutex);
+    yatof_dictionary_close_all();
+    grn_plugin_mutex_unlock(ctx, yatof_dictionary_mutex);
+    grn_plugin_mutex_close(ctx, yatof_dictionary_mutex);
+    yatof_dictionary_mutex = NULL;
+  }
+  if (yatof_verdict_key_created) {
+    pthread_setspecific(yatof_verdict_key, NULL);
+    yatof_verdict_free_all();
+    pthread_key_delete(yatof_verdict_key);
+    yatof_verdict_key_created = GRN_FALSE;
+  }
 
   return GRN_SUCCESS;
 }